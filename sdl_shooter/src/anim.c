@@ -0,0 +1,272 @@
+#include "main.h"
+
+//Sprite sheet effects: explosions, hit sparkles, pickup flashes and engine
+//flicker. Each sheet is a row of equal frames, loaded once; how many frames
+//it has comes from its width. Instances are kept as parallel arrays and
+//advanced in one pass per tick, and each sheet is drawn with a single
+//geometry call however many of its effects are on screen.
+//
+//Purely cosmetic. Nothing here is in SimState, nothing is spawned while
+//netplay re-runs ticks, and headless games never open it, so anim_spawn()
+//and the rest do nothing when game->anims is NULL.
+
+typedef struct
+{
+    const char* path;
+    int frame_w;
+    int frame_h;
+} SheetInfo;
+
+#define ANIM_SHEETS 2
+
+static const SheetInfo SHEET_INFO[ANIM_SHEETS] =
+{
+    {"../img/Effects/Explosion (16 x 16).png",  16, 16},
+    {"../img/Effects/Sparkle (16 x 16).png",    16, 16}
+};
+
+typedef struct
+{
+    int sheet;
+    int ticks_per_frame;
+    float size;                 //Drawn this big when spawned with size 0
+    SDL_Color tint;
+    bool fade;                  //Alpha falls off over the animation
+} AnimType;
+
+static const AnimType ANIM_TYPES[ANIM_COUNT] =
+{
+    //sheet     ticks   size    tint                    fade
+    {0,         4,      48,     {255, 255, 255, 255},   false},    //ANIM_EXPLOSION
+    {1,         3,      16,     {255, 255, 255, 255},   false},    //ANIM_SPARKLE
+    {1,         2,      40,     {255, 215, 64, 255},    true},     //ANIM_PICKUP
+    {1,         1,      12,     {96, 180, 255, 255},    true}      //ANIM_ENGINE
+};
+
+typedef struct
+{
+    SDL_Texture* texture;
+    int frames;
+    float frame_u;              //Width of one frame in texture coordinates
+    int count;                  //Quads built this frame
+} AnimSheet;
+
+struct AnimSystem
+{
+    AnimSheet sheets[ANIM_SHEETS];
+
+    int count;
+    float x[MAX_ANIMS];         //Centre
+    float y[MAX_ANIMS];
+    float vx[MAX_ANIMS];        //Pixels per tick
+    float vy[MAX_ANIMS];
+    float size[MAX_ANIMS];
+    Uint16 age[MAX_ANIMS];      //Ticks
+    Uint16 life[MAX_ANIMS];
+    Uint8 kind[MAX_ANIMS];
+
+    //Four vertices (top left, top right, bottom right, bottom left) and six
+    //indices per quad, a MAX_ANIMS block per sheet. The indices never change.
+    SDL_Vertex vertices[ANIM_SHEETS * MAX_ANIMS * 4];
+    int indices[MAX_ANIMS * 6];
+
+    int peak;
+    Uint64 spawned;
+    Uint64 dropped;
+};
+
+//The effects that sheet would have played are skipped if it won't load.
+static void load_sheet(Game* game, AnimSheet* sheet, const SheetInfo* info)
+{
+    char buf[MSL];
+    SDL_Surface* surface = IMG_Load(info->path);
+
+    if (surface == NULL)
+    {
+        snprintf(buf, sizeof(buf), "Unable to load %s, its effects are off: %s\n", info->path, IMG_GetError());
+        LOG(buf);
+        return;
+    }
+
+    sheet->frames = SDL_max(1, surface->w / info->frame_w);
+    sheet->frame_u = (float)info->frame_w / surface->w;
+    sheet->texture = create_texture(game, surface);
+    SDL_FreeSurface(surface);
+}
+
+AnimSystem* anim_open(Game* game)
+{
+    char buf[MSL];
+    AnimSystem* anims = mem_calloc(MEM_PARTICLES, 1, sizeof(AnimSystem));
+
+    if (anims == NULL)
+        return NULL;
+
+    for (int i = 0; i < ANIM_SHEETS; i++)
+        load_sheet(game, &anims->sheets[i], &SHEET_INFO[i]);
+
+    for (int q = 0; q < MAX_ANIMS; q++)
+    {
+        int* index = &anims->indices[q * 6];
+        int v = q * 4;
+
+        index[0] = v;
+        index[1] = v + 1;
+        index[2] = v + 2;
+        index[3] = v;
+        index[4] = v + 2;
+        index[5] = v + 3;
+    }
+
+    snprintf(buf, sizeof(buf), "Effects: %d and %d frame sheets, room for %d animations\n",
+             anims->sheets[0].frames, anims->sheets[1].frames, MAX_ANIMS);
+    LOG(buf);
+    return anims;
+}
+
+void anim_close(Game* game, AnimSystem* anims)
+{
+    char buf[MSL];
+
+    if (anims == NULL)
+        return;
+
+    snprintf(buf, sizeof(buf), "Effects: %llu spawned, peak %d of %d live, %llu dropped\n",
+             (unsigned long long)anims->spawned, anims->peak, MAX_ANIMS, (unsigned long long)anims->dropped);
+    LOG(buf);
+
+    for (int i = 0; i < ANIM_SHEETS; i++)
+        destroy_texture(game, anims->sheets[i].texture);
+    mem_free(anims);
+}
+
+//Effects playing right now.
+int anim_count(Game* game)
+{
+    return game->anims ? game->anims->count : 0;
+}
+
+//Starts kind at x, y (centre) drifting vx, vy pixels per tick. A size of 0
+//uses the kind's own.
+void anim_spawn(Game* game, AnimKind kind, float x, float y, float vx, float vy, float size)
+{
+    AnimSystem* anims = game->anims;
+
+    if (anims == NULL || game->resimulating)
+        return;
+
+    const AnimSheet* sheet = &anims->sheets[ANIM_TYPES[kind].sheet];
+    if (sheet->texture == NULL)
+        return;
+
+    if (anims->count == MAX_ANIMS)
+    {
+        anims->dropped++;
+        return;
+    }
+
+    int i = anims->count++;
+    anims->x[i] = x;
+    anims->y[i] = y;
+    anims->vx[i] = vx;
+    anims->vy[i] = vy;
+    anims->size[i] = size > 0 ? size : ANIM_TYPES[kind].size;
+    anims->age[i] = 0;
+    anims->life[i] = (Uint16)(sheet->frames * ANIM_TYPES[kind].ticks_per_frame);
+    anims->kind[i] = (Uint8)kind;
+
+    anims->spawned++;
+    anims->peak = SDL_max(anims->peak, anims->count);
+}
+
+//Once per tick, from sim_step(). Moves and ages everything in one pass, then
+//drops what finished by moving the last one into its place.
+void anim_update(Game* game)
+{
+    AnimSystem* anims = game->anims;
+
+    if (anims == NULL || game->resimulating)
+        return;
+
+    int count = anims->count;
+    for (int i = 0; i < count; i++)
+    {
+        anims->x[i] += anims->vx[i];
+        anims->y[i] += anims->vy[i];
+        anims->age[i]++;
+    }
+
+    for (int i = 0; i < count; )
+    {
+        if (anims->age[i] < anims->life[i])
+        {
+            i++;
+            continue;
+        }
+
+        count--;
+        anims->x[i] = anims->x[count];
+        anims->y[i] = anims->y[count];
+        anims->vx[i] = anims->vx[count];
+        anims->vy[i] = anims->vy[count];
+        anims->size[i] = anims->size[count];
+        anims->age[i] = anims->age[count];
+        anims->life[i] = anims->life[count];
+        anims->kind[i] = anims->kind[count];
+    }
+    anims->count = count;
+
+    //Engine flicker under every live ship, brighter and longer on afterburner.
+    for (int p = 0; p < game->sim.num_players; p++)
+    {
+        const Player* player = &game->sim.players[p];
+        float x = player->position.x + player->position.w / 2.0f;
+        float y = (float)(player->position.y + player->position.h - 5);
+
+        if (player->hit_points <= 0)
+            continue;
+
+        if (player->is_afterburner_active)
+            anim_spawn(game, ANIM_ENGINE, x + (rand() % 7 - 3), y, 0, 4.0f, 20);
+        else if (game->sim.tick % 2 == 0)
+            anim_spawn(game, ANIM_ENGINE, x + (rand() % 3 - 1), y, 0, 2.0f, 0);
+    }
+}
+
+//Builds every live animation's quad into its sheet's block of vertices, then
+//draws each sheet in one call.
+void render_anims(Game* game)
+{
+    AnimSystem* anims = game->anims;
+
+    if (anims == NULL)
+        return;
+
+    for (int s = 0; s < ANIM_SHEETS; s++)
+        anims->sheets[s].count = 0;
+
+    for (int i = 0; i < anims->count; i++)
+    {
+        const AnimType* type = &ANIM_TYPES[anims->kind[i]];
+        AnimSheet* sheet = &anims->sheets[type->sheet];
+        SDL_Vertex* v = &anims->vertices[(type->sheet * MAX_ANIMS + sheet->count++) * 4];
+        int frame = SDL_min(anims->age[i] / type->ticks_per_frame, sheet->frames - 1);
+        float half = anims->size[i] / 2.0f;
+        float x0 = anims->x[i] - half, x1 = anims->x[i] + half;
+        float y0 = anims->y[i] - half, y1 = anims->y[i] + half;
+        float u0 = frame * sheet->frame_u, u1 = u0 + sheet->frame_u;
+        SDL_Color color = type->tint;
+
+        if (type->fade)
+            color.a = (Uint8)(color.a * (anims->life[i] - anims->age[i]) / anims->life[i]);
+
+        v[0] = (SDL_Vertex){{x0, y0}, color, {u0, 0}};
+        v[1] = (SDL_Vertex){{x1, y0}, color, {u1, 0}};
+        v[2] = (SDL_Vertex){{x1, y1}, color, {u1, 1}};
+        v[3] = (SDL_Vertex){{x0, y1}, color, {u0, 1}};
+    }
+
+    for (int s = 0; s < ANIM_SHEETS; s++)
+        if (anims->sheets[s].count)
+            draw_quads(game, anims->sheets[s].texture, &anims->vertices[s * MAX_ANIMS * 4], anims->indices, anims->sheets[s].count);
+}
@@ -0,0 +1,388 @@
+#include "main.h"
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+//Sound effects. The game thread never touches the audio device: audio_play()
+//drops a trigger into a single producer, single consumer ring and returns.
+//SDL's audio callback drains the ring, starts voices and mixes them straight
+//into the output buffer. Everything it needs is allocated up front, and it
+//takes no locks, so a slow frame can't make it glitch and it can't stall
+//the game.
+//
+//There are no sound files; every effect is synthesized once at startup into
+//a mono float buffer at the device rate. When all voices are busy a new
+//sound only replaces one of lower or equal priority, and no one sound plays
+//more than AUDIO_MAX_PER_SOUND times at once, so a wall of rapid fire can't
+//drown out an explosion.
+
+enum
+{
+    WAVE_SINE,
+    WAVE_SQUARE,
+    WAVE_SAW
+};
+
+typedef struct
+{
+    float seconds;
+    float freq_start, freq_end;     //Swept exponentially
+    int wave;
+    float noise;                    //0..1 mixed in, low passed
+    float decay;                    //Envelope falloff per second
+    int steps;                      //Quantize the sweep into notes, 0 for smooth
+    int priority;
+    float gain;
+} SoundDef;
+
+//Indexed by SoundId; shots are in WEAPON_TYPES order.
+static const SoundDef SOUND_DEFS[SND_COUNT] =
+{// seconds freq_start freq_end wave        noise  decay  steps  priority gain
+    {0.12f, 1800,      400,     WAVE_SQUARE, 0.0f,  25,    0,     1,       0.15f},     //Laser
+    {0.18f, 600,       150,     WAVE_SAW,    0.1f,  18,    0,     1,       0.20f},     //Plasma gun
+    {0.30f, 2400,      80,      WAVE_SAW,    0.4f,  10,    0,     2,       0.25f},     //Railgun
+    {0.05f, 1200,      900,     WAVE_SQUARE, 0.0f,  60,    0,     0,       0.10f},     //Rapid fire
+    {0.45f, 200,       90,      WAVE_SAW,    0.7f,  6,     0,     2,       0.25f},     //Missile
+    {0.10f, 500,       250,     WAVE_SQUARE, 0.0f,  30,    0,     1,       0.12f},     //Enemy shot
+    {0.80f, 120,       30,      WAVE_SINE,   0.9f,  5,     0,     3,       0.50f},     //Explosion
+    {0.24f, 660,       1320,    WAVE_SINE,   0.0f,  4,     3,     4,       0.30f}      //Powerup pickup
+};
+
+typedef struct
+{
+    float* samples;
+    int length;
+} Sound;
+
+typedef struct
+{
+    Uint8 sound;
+    float pan;                      //-1 left .. 1 right
+} AudioCommand;
+
+typedef struct
+{
+    bool active;
+    int sound;
+    int pos;
+    float left, right;
+    int priority;
+} Voice;
+
+struct AudioMixer
+{
+    SDL_AudioDeviceID device;
+    int rate;
+    Sound sounds[SND_COUNT];
+
+    //Written by audio_play() only
+    AudioCommand queue[AUDIO_QUEUE_SIZE];
+    SDL_atomic_t head;
+    int posted, dropped;
+
+    //Touched by the callback only
+    SDL_atomic_t tail;
+    Voice voices[AUDIO_MAX_VOICES];
+    int started, stolen, rejected;
+    Uint64 mix_time, max_mix_time, mixes;
+};
+
+static void synthesize(Sound* sound, const SoundDef* def, int rate)
+{
+    Uint32 noise_state = 0x1234567;
+    float phase = 0, noise = 0;
+
+    sound->length = (int)(def->seconds * rate);
+    sound->samples = mem_calloc(MEM_AUDIO, sound->length, sizeof(float));
+    if (sound->samples == NULL)
+    {
+        sound->length = 0;
+        return;
+    }
+
+    for (int i = 0; i < sound->length; i++)
+    {
+        float t = (float)i / rate;
+        float progress = (float)i / sound->length;
+
+        if (def->steps > 0)
+            progress = floorf(progress * def->steps) / (def->steps - 1 > 0 ? def->steps - 1 : 1);
+
+        float freq = def->freq_start * powf(def->freq_end / def->freq_start, fminf(progress, 1.0f));
+        phase += freq / rate;
+        phase -= floorf(phase);
+
+        float tone;
+        if (def->wave == WAVE_SQUARE)
+            tone = phase < 0.5f ? 1.0f : -1.0f;
+        else if (def->wave == WAVE_SAW)
+            tone = 2.0f * phase - 1.0f;
+        else
+            tone = sinf(2.0f * (float)M_PI * phase);
+
+        //Low passed white noise, darker as the sound dies away.
+        noise_state ^= noise_state << 13;
+        noise_state ^= noise_state >> 17;
+        noise_state ^= noise_state << 5;
+        float white = (noise_state >> 8) / 8388608.0f - 1.0f;
+        noise += (white - noise) * (0.5f - 0.45f * progress);
+
+        //2ms attack so nothing clicks.
+        float envelope = expf(-def->decay * t) * fminf(1.0f, t * 500.0f);
+        sound->samples[i] = def->gain * envelope * (tone * (1.0f - def->noise) + noise * def->noise);
+    }
+}
+
+//Adds a mono voice into interleaved stereo, four frames at a time where we can.
+static void mix_voice(float* out, const float* in, int frames, float left, float right)
+{
+    int i = 0;
+
+#if defined(__SSE__)
+    __m128 l = _mm_set1_ps(left), r = _mm_set1_ps(right);
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128 s = _mm_loadu_ps(in + i);
+        __m128 sl = _mm_mul_ps(s, l), sr = _mm_mul_ps(s, r);
+        _mm_storeu_ps(out + i * 2, _mm_add_ps(_mm_loadu_ps(out + i * 2), _mm_unpacklo_ps(sl, sr)));
+        _mm_storeu_ps(out + i * 2 + 4, _mm_add_ps(_mm_loadu_ps(out + i * 2 + 4), _mm_unpackhi_ps(sl, sr)));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= frames; i += 4)
+    {
+        float32x4_t s = vld1q_f32(in + i);
+        float32x4x2_t mix = vld2q_f32(out + i * 2);
+        mix.val[0] = vmlaq_n_f32(mix.val[0], s, left);
+        mix.val[1] = vmlaq_n_f32(mix.val[1], s, right);
+        vst2q_f32(out + i * 2, mix);
+    }
+#endif
+
+    for (; i < frames; i++)
+    {
+        out[i * 2] += in[i] * left;
+        out[i * 2 + 1] += in[i] * right;
+    }
+}
+
+static void clamp_output(float* out, int count)
+{
+    int i = 0;
+
+#if defined(__SSE__)
+    __m128 lo = _mm_set1_ps(-1.0f), hi = _mm_set1_ps(1.0f);
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_ps(out + i, _mm_min_ps(hi, _mm_max_ps(lo, _mm_loadu_ps(out + i))));
+#elif defined(__ARM_NEON)
+    float32x4_t lo = vdupq_n_f32(-1.0f), hi = vdupq_n_f32(1.0f);
+    for (; i + 4 <= count; i += 4)
+        vst1q_f32(out + i, vminq_f32(hi, vmaxq_f32(lo, vld1q_f32(out + i))));
+#endif
+
+    for (; i < count; i++)
+        out[i] = fminf(1.0f, fmaxf(-1.0f, out[i]));
+}
+
+static void start_voice(AudioMixer* mixer, const AudioCommand* command)
+{
+    const SoundDef* def = &SOUND_DEFS[command->sound];
+    Voice* slot = NULL;
+    Voice* oldest_same = NULL;
+    Voice* victim = NULL;
+    int same = 0;
+
+    if (mixer->sounds[command->sound].length == 0)
+        return;
+
+    for (int i = 0; i < AUDIO_MAX_VOICES; i++)
+    {
+        Voice* voice = &mixer->voices[i];
+
+        if (!voice->active)
+        {
+            if (slot == NULL)
+                slot = voice;
+            continue;
+        }
+
+        if (voice->sound == command->sound)
+        {
+            same++;
+            if (oldest_same == NULL || voice->pos > oldest_same->pos)
+                oldest_same = voice;
+        }
+
+        //Lowest priority, and of those the one nearest its end.
+        if (victim == NULL || voice->priority < victim->priority ||
+            (voice->priority == victim->priority && voice->pos > victim->pos))
+            victim = voice;
+    }
+
+    //More of the same just gets louder; restart the oldest one instead.
+    if (same >= AUDIO_MAX_PER_SOUND)
+        slot = oldest_same;
+    else if (slot == NULL)
+    {
+        if (victim->priority > def->priority)
+        {
+            mixer->rejected++;
+            return;
+        }
+        slot = victim;
+        mixer->stolen++;
+    }
+
+    //Constant power pan.
+    float pan = fminf(1.0f, fmaxf(-1.0f, command->pan));
+    *slot = (Voice){true, command->sound, 0, sqrtf(0.5f * (1.0f - pan)), sqrtf(0.5f * (1.0f + pan)), def->priority};
+    mixer->started++;
+}
+
+static void SDLCALL audio_callback(void* userdata, Uint8* stream, int len)
+{
+    AudioMixer* mixer = userdata;
+    float* out = (float*)stream;
+    int frames = len / (int)(sizeof(float) * 2);
+    Uint64 t0 = SDL_GetPerformanceCounter();
+
+    //Pair with the release in audio_play(): the commands are written before head moves.
+    Uint32 head = (Uint32)SDL_AtomicGet(&mixer->head);
+    Uint32 tail = (Uint32)SDL_AtomicGet(&mixer->tail);
+    SDL_MemoryBarrierAcquire();
+
+    for (; tail != head; tail++)
+        start_voice(mixer, &mixer->queue[tail % AUDIO_QUEUE_SIZE]);
+    SDL_AtomicSet(&mixer->tail, (int)tail);
+
+    memset(stream, 0, len);
+
+    for (int i = 0; i < AUDIO_MAX_VOICES; i++)
+    {
+        Voice* voice = &mixer->voices[i];
+        if (!voice->active)
+            continue;
+
+        const Sound* sound = &mixer->sounds[voice->sound];
+        int count = SDL_min(frames, sound->length - voice->pos);
+
+        mix_voice(out, sound->samples + voice->pos, count, voice->left, voice->right);
+        voice->pos += count;
+        if (voice->pos >= sound->length)
+            voice->active = false;
+    }
+
+    clamp_output(out, frames * 2);
+
+    Uint64 elapsed = SDL_GetPerformanceCounter() - t0;
+    mixer->mix_time += elapsed;
+    mixer->max_mix_time = SDL_max(mixer->max_mix_time, elapsed);
+    mixer->mixes++;
+}
+
+//Queues a sound for the audio thread. x is where it happens on screen, for panning.
+void audio_play(Game* game, SoundId sound, float x)
+{
+    AudioMixer* mixer = game->audio;
+
+    //Netplay re-running ticks after a rollback: these were heard the first time.
+    if (mixer == NULL || game->resimulating)
+        return;
+
+    Uint32 head = (Uint32)SDL_AtomicGet(&mixer->head);
+    Uint32 tail = (Uint32)SDL_AtomicGet(&mixer->tail);
+
+    if (head - tail >= AUDIO_QUEUE_SIZE)
+    {
+        mixer->dropped++;
+        return;
+    }
+
+    mixer->queue[head % AUDIO_QUEUE_SIZE] = (AudioCommand){(Uint8)sound, x / SCREEN_WIDTH * 2.0f - 1.0f};
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&mixer->head, (int)(head + 1));
+    mixer->posted++;
+}
+
+//No audio is no reason not to play: failures are logged and the game runs silent.
+AudioMixer* audio_open(Game* game)
+{
+    char buf[MSL];
+    SDL_AudioSpec want = {0}, have;
+
+    if (game->opts.mute)
+        return NULL;
+
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0)
+    {
+        snprintf(buf, sizeof(buf), "Unable to initialize audio, playing silent: %s\n", SDL_GetError());
+        LOG(buf);
+        return NULL;
+    }
+
+    AudioMixer* mixer = mem_calloc(MEM_AUDIO, 1, sizeof(AudioMixer));
+    if (mixer == NULL)
+        return NULL;
+
+    //Float stereo is what we mix in; SDL converts if the hardware wants something else.
+    want.freq = AUDIO_RATE;
+    want.format = AUDIO_F32SYS;
+    want.channels = 2;
+    want.samples = AUDIO_BUFFER_FRAMES;
+    want.callback = audio_callback;
+    want.userdata = mixer;
+
+    mixer->device = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (mixer->device == 0)
+    {
+        snprintf(buf, sizeof(buf), "Unable to open audio device, playing silent: %s\n", SDL_GetError());
+        LOG(buf);
+        mem_free(mixer);
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        return NULL;
+    }
+
+    mixer->rate = have.freq;
+    for (int i = 0; i < SND_COUNT; i++)
+        synthesize(&mixer->sounds[i], &SOUND_DEFS[i], mixer->rate);
+
+    snprintf(buf, sizeof(buf), "Audio: %s driver, %d Hz, %d frame buffer\n", SDL_GetCurrentAudioDriver(), have.freq, have.samples);
+    LOG(buf);
+
+    SDL_PauseAudioDevice(mixer->device, 0);
+    return mixer;
+}
+
+//Stops the callback while the game is idle, voices pick up where they were.
+void audio_pause(Game* game, bool pause)
+{
+    if (game->audio && game->audio->device)
+        SDL_PauseAudioDevice(game->audio->device, pause);
+}
+
+void audio_close(Game* game, AudioMixer* mixer)
+{
+    char buf[MSL];
+
+    if (mixer == NULL)
+        return;
+
+    //Closing waits for the callback, so its counters are safe to read after.
+    SDL_CloseAudioDevice(mixer->device);
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+
+    double us = 1e6 / (double)SDL_GetPerformanceFrequency();
+    snprintf(buf, sizeof(buf), "Audio: %d sounds queued, %d dropped (queue full), %d voices started, %d stolen, %d rejected. "
+             "Mix avg %.1f us, max %.1f us over %llu buffers\n",
+             mixer->posted, mixer->dropped, mixer->started, mixer->stolen, mixer->rejected,
+             mixer->mixes ? mixer->mix_time * us / mixer->mixes : 0.0, mixer->max_mix_time * us,
+             (unsigned long long)mixer->mixes);
+    LOG(buf);
+
+    for (int i = 0; i < SND_COUNT; i++)
+        mem_free(mixer->sounds[i].samples);
+    mem_free(mixer);
+    (void)game;
+}
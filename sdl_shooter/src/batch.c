@@ -0,0 +1,308 @@
+#include "main.h"
+
+//Headless batch runs (--batch N). Plays N single player games with fixed
+//steps and an autopilot in place of the player, spread over a pool of
+//threads, and logs aggregate throughput and gameplay numbers for balance
+//and soak testing.
+//
+//Each game is its own Game with no window, renderer, textures or audio.
+//Everything the sim touches is per instance (SimState, its generator, the
+//event bus, the spatial index), so instances never share anything mutable.
+//The hitboxes and compiled patterns are read only and built once up front;
+//a level is mapped once per game, since playing it releases pages. LOG()
+//from a game goes to that game's LogContext, either a file per game
+//(--batch-logs DIR) or nowhere.
+//
+//Game i is seeded with --seed + i, so any one of them can be played back on
+//its own with the same seed.
+
+#define AUTOPILOT_LOOKAHEAD     160     //How far above the ship enemy shots are dodged, in pixels
+#define AUTOPILOT_DEADZONE      8
+
+typedef struct
+{
+    Uint32 seed;
+    Uint32 ticks;               //Played, fewer than --ticks if the player died
+    bool survived;
+    int score;
+    int hit_points;
+    Uint64 kills;
+    Uint64 hits;
+    double ms;                  //Wall time the game took
+} BatchResult;
+
+typedef struct
+{
+    Game* proto;                //Options and the shared read only data
+    BatchResult* results;
+    int games;
+    SDL_atomic_t next;          //Next game to hand out
+    SDL_atomic_t failed;
+} BatchRun;
+
+//Scripted player: chase the nearest enemy's column and keep firing, but
+//sidestep (on afterburner) the closest enemy shot coming down on the ship,
+//and move on to the next weapon when the current one is empty. Only reads
+//the sim, so every game plays out the same for the same seed.
+static void autopilot_input(Game* game, int p, TickInput* input)
+{
+    const Player* player = &game->sim.players[p];
+    float px = player->position.x + player->position.w / 2.0f;
+    float py = (float)player->position.y;
+    float goal = px;
+    float threat = AUTOPILOT_LOOKAHEAD;
+    float threat_dx = 0;
+    int target;
+
+    memset(input, 0, sizeof(TickInput));
+    input->held = ACT_FIRE;
+
+    if (spatial_nearest(game, px, py, 1, 2 * SCREEN_HEIGHT, &target))
+        goal = game->enemy_index.x[target];
+
+    for (int t = 0; t < MAX_WEAPONS; t++)
+    {
+        for (int i = 0; i < game->sim.projectiles[t].count; i++)
+        {
+            const Projectile* proj = &game->sim.projectiles[t].items[i];
+            float dx = proj->x - px;
+            float dy = py - proj->y;
+
+            if (!proj->active || !proj->is_enemy_projectile || fabsf(dx) > player->position.w)
+                continue;
+            if (dy > -player->position.h && dy < threat)
+            {
+                threat = dy;
+                threat_dx = dx;
+            }
+        }
+    }
+
+    if (threat < AUTOPILOT_LOOKAHEAD)
+    {
+        float away = threat_dx > 0 ? -1.0f : 1.0f;
+
+        //Pinned against an edge, cross under the shot instead.
+        if ((away < 0 && px < player->position.w * 2) || (away > 0 && px > SCREEN_WIDTH - player->position.w * 2))
+            away = -away;
+        goal = px + away * player->position.w * 2;
+        input->held |= ACT_AFTERBURNER;
+    }
+
+    if (goal < px - AUTOPILOT_DEADZONE)
+        input->held |= ACT_LEFT;
+    else if (goal > px + AUTOPILOT_DEADZONE)
+        input->held |= ACT_RIGHT;
+
+    if (player->weapons[player->current_weapon].ammo <= 0)
+        input->held |= ACT_NEXT_WEAPON;
+}
+
+//Plays game index start to finish. False if it couldn't be set up.
+static bool batch_play(BatchRun* run, int index, BatchResult* result)
+{
+    const Options* opts = &run->proto->opts;
+    Game* game = mem_calloc(MEM_GAME, 1, sizeof(Game));
+    char path[MSL];
+
+    if (game == NULL)
+        return false;
+
+    game->opts = *opts;
+    game->headless = true;
+    game->patterns = run->proto->patterns;
+    memcpy(game->player_hitboxes, run->proto->player_hitboxes, sizeof(game->player_hitboxes));
+    game->enemy_hitbox = run->proto->enemy_hitbox;
+    for (int i = 0; i < MAX_PLANETS; i++)
+        game->planet_textures[i] = -1;
+
+    //A name too long for path gets no log, like a directory that can't be written.
+    if (opts->batch_logs[0] && snprintf(path, sizeof(path), "%s/game_%05d.log", opts->batch_logs, index) < (int)sizeof(path))
+        game->log.fp = fopen(path, "w");
+    log_set_context(&game->log);
+
+    game->events = events_open();
+    if (opts->level_file[0])
+        game->level = level_open(opts->level_file);
+
+    if (game->events == NULL || (opts->level_file[0] && game->level == NULL))
+    {
+        events_close(game->events);
+        log_set_context(NULL);
+        if (game->log.fp)
+            fclose(game->log.fp);
+        mem_free(game);
+        return false;
+    }
+
+    spatial_init(&game->enemy_index);
+    result->seed = (opts->seed ? opts->seed : 1) + (Uint32)index;
+    reset_sim(game, result->seed, 1);
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    TickInput inputs[MAX_PLAYERS] = {0};
+
+    while (game->sim.tick < (Uint32)opts->batch_ticks && game->sim.players[0].hit_points > 0)
+    {
+        autopilot_input(game, 0, &inputs[0]);
+        sim_step(game, inputs, 0);
+    }
+
+    result->ms = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+    result->ticks = game->sim.tick;
+    result->survived = game->sim.players[0].hit_points > 0;
+    result->score = game->sim.players[0].score;
+    result->hit_points = game->sim.players[0].hit_points;
+    result->kills = events_total(game, EV_KILL);
+    result->hits = events_total(game, EV_HIT);
+
+    events_close(game->events);
+    level_close(game->level);
+    log_set_context(NULL);
+    if (game->log.fp)
+        fclose(game->log.fp);
+    mem_free(game);
+    return true;
+}
+
+static int batch_worker(void* data)
+{
+    BatchRun* run = data;
+    int index;
+
+    while ((index = SDL_AtomicAdd(&run->next, 1)) < run->games)
+    {
+        if (!batch_play(run, index, &run->results[index]))
+            SDL_AtomicAdd(&run->failed, 1);
+    }
+    return 0;
+}
+
+static void batch_write_csv(const BatchRun* run, const char* file)
+{
+    char buf[MSL_LONG];
+    FILE* fp = fopen(file, "w");
+
+    if (fp == NULL)
+    {
+        snprintf(buf, sizeof(buf), "Unable to write %s\n", file);
+        LOG(buf);
+        return;
+    }
+
+    fprintf(fp, "game,seed,ticks,survived,score,hit_points,kills,hits,ms\n");
+    for (int i = 0; i < run->games; i++)
+    {
+        const BatchResult* r = &run->results[i];
+        fprintf(fp, "%d,%u,%u,%d,%d,%d,%llu,%llu,%.2f\n", i, r->seed, r->ticks, r->survived, r->score, r->hit_points,
+                (unsigned long long)r->kills, (unsigned long long)r->hits, r->ms);
+    }
+    fclose(fp);
+}
+
+static void batch_report(const BatchRun* run, int threads, double seconds)
+{
+    char buf[MSL];
+    Uint64 ticks = 0, kills = 0;
+    double score = 0, lost_ticks = 0;
+    int survived = 0, best = 0, worst = 0;
+
+    for (int i = 0; i < run->games; i++)
+    {
+        const BatchResult* r = &run->results[i];
+
+        ticks += r->ticks;
+        kills += r->kills;
+        score += r->score;
+        if (i == 0 || r->score > best)
+            best = r->score;
+        if (i == 0 || r->score < worst)
+            worst = r->score;
+        if (r->survived)
+            survived++;
+        else
+            lost_ticks += r->ticks;
+    }
+
+    snprintf(buf, sizeof(buf), "Batch: %d games on %d threads in %.2f s, %llu ticks, %.0f ticks/s, %.0f games/hour\n",
+             run->games, threads, seconds, (unsigned long long)ticks, seconds > 0 ? ticks / seconds : 0.0,
+             seconds > 0 ? run->games * 3600.0 / seconds : 0.0);
+    LOG(buf);
+
+    snprintf(buf, sizeof(buf), "Batch: score avg %.1f, min %d, max %d. %.1f kills per game. %d of %d survived",
+             score / run->games, worst, best, (double)kills / run->games, survived, run->games);
+    LOG(buf);
+
+    if (survived < run->games)
+        snprintf(buf, sizeof(buf), ", the rest lasted %.1f s on average\n", lost_ticks / (run->games - survived) / FPS);
+    else
+        snprintf(buf, sizeof(buf), "\n");
+    LOG(buf);
+}
+
+//--batch: returns the process exit code.
+int run_batch(Game* game)
+{
+    char buf[MSL];
+    BatchRun run = {0};
+    SDL_Thread* threads[BATCH_MAX_THREADS];
+    int num_threads = game->opts.batch_threads > 0 ? game->opts.batch_threads : SDL_GetCPUCount();
+    int helpers = 0;
+
+    num_threads = SDL_max(1, SDL_min(SDL_min(num_threads, BATCH_MAX_THREADS), game->opts.batch_games));
+    if (game->opts.batch_ticks <= 0)
+        game->opts.batch_ticks = BATCH_DEFAULT_TICKS;
+
+    if (!hitbox_load(game))
+        return 1;
+
+    game->patterns = patterns_load();
+    if (game->patterns == NULL)
+        return 1;
+
+    run.proto = game;
+    run.games = game->opts.batch_games;
+    run.results = mem_calloc(MEM_GAME, run.games, sizeof(BatchResult));
+    if (run.results == NULL)
+    {
+        LOG("Out of memory for batch results\n");
+        patterns_close(game->patterns);
+        return 1;
+    }
+
+    snprintf(buf, sizeof(buf), "Batch: %d games of %d ticks on %d threads\n", run.games, game->opts.batch_ticks, num_threads);
+    LOG(buf);
+
+    //The calling thread plays too, so only spawn helpers for the rest.
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < num_threads - 1; i++)
+    {
+        threads[helpers] = SDL_CreateThread(batch_worker, "batch", &run);
+        if (threads[helpers] == NULL)
+            break;
+        helpers++;
+    }
+
+    batch_worker(&run);
+
+    for (int i = 0; i < helpers; i++)
+        SDL_WaitThread(threads[i], NULL);
+    double seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+
+    int failed = SDL_AtomicGet(&run.failed);
+    if (failed)
+    {
+        snprintf(buf, sizeof(buf), "Batch: %d games could not be set up\n", failed);
+        LOG(buf);
+    }
+    else
+    {
+        batch_report(&run, helpers + 1, seconds);
+        if (game->opts.batch_csv[0])
+            batch_write_csv(&run, game->opts.batch_csv);
+    }
+
+    mem_free(run.results);
+    patterns_close(game->patterns);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,163 @@
+#include "main.h"
+
+//How enemies move: descend, sidestep, hover, dive, fire a burst, retreat.
+//Each behaviour is a stackless coroutine, a function that picks up where it
+//left off each time it is called and returns how many ticks to sleep before
+//the next call. Where it left off is the source line of its last CO_WAIT,
+//kept in the enemy's Behaviour with two loop counters and a target; anything
+//else it needs has to live in the enemy too, locals don't survive a wait.
+//
+//A sleeping enemy costs nothing: its velocity carries it and a timer
+//(timers.c) wakes it. Drifting enemies never run at all.
+
+#define CO_DONE                 0xFFFF
+
+#define CO_BEGIN(b)             switch ((b)->line) { case 0:
+#define CO_WAIT(b, ticks)       do { int co_ticks = (ticks); (b)->line = __LINE__; return SDL_max(1, co_ticks); case __LINE__:; } while (0)
+#define CO_END(b)               default: break; } (b)->line = CO_DONE; return 0
+
+//Speeds are given in pixels per tick.
+#define PX_PER_TICK(n)          ((float)(n) * FPS)
+
+typedef int (*BehaviourFunc)(Game* game, Enemy* enemy);
+
+static void enemy_move(Enemy* enemy, int dx, int dy)
+{
+    enemy->velocity_x = PX_PER_TICK(dx);
+    enemy->velocity_y = PX_PER_TICK(dy);
+}
+
+//Heads sideways for x at speed pixels per tick and returns roughly how many
+//ticks that takes, or stops and returns 0 once within a tick of it. Moves
+//are rounded to whole pixels, so callers wake up and steer again until it
+//says 0 rather than trusting the tick count.
+static int enemy_steer(Enemy* enemy, int x, int speed)
+{
+    int dx = x - enemy->position.x;
+
+    if (abs(dx) < speed)
+    {
+        enemy_move(enemy, 0, 0);
+        return 0;
+    }
+    enemy_move(enemy, dx < 0 ? -speed : speed, 0);
+    return abs(dx) / speed;
+}
+
+//Same as enemy_steer(), coming down to y. Already below it stops at once.
+static int enemy_descend(Enemy* enemy, int y, int speed)
+{
+    int dy = y - enemy->position.y;
+
+    if (dy < speed)
+    {
+        enemy_move(enemy, 0, 0);
+        return 0;
+    }
+    enemy_move(enemy, 0, speed);
+    return dy / speed;
+}
+
+//Comes down a third of the screen, sidesteps a few times, then leaves up.
+static int behave_strafe(Game* game, Enemy* enemy)
+{
+    Behaviour* b = &enemy->behaviour;
+    int ticks;
+
+    CO_BEGIN(b);
+    while ((ticks = enemy_descend(enemy, SCREEN_HEIGHT / 3, 2)) > 0)
+        CO_WAIT(b, ticks);
+
+    for (b->i = 0; b->i < 3; b->i++)
+    {
+        b->target = (Sint16)rnd_num(game, 0, SCREEN_WIDTH - enemy->position.w);
+        while ((ticks = enemy_steer(enemy, b->target, 3)) > 0)
+            CO_WAIT(b, ticks);
+        CO_WAIT(b, 20);
+    }
+
+    enemy_move(enemy, 0, -2);
+    CO_END(b);
+}
+
+//Comes down, hovers, then dives at the nearest player and keeps going.
+static int behave_dive(Game* game, Enemy* enemy)
+{
+    Behaviour* b = &enemy->behaviour;
+    int ticks;
+
+    CO_BEGIN(b);
+    while ((ticks = enemy_descend(enemy, SCREEN_HEIGHT / 4, 3)) > 0)
+        CO_WAIT(b, ticks);
+    CO_WAIT(b, 45);
+
+    float rad = enemy_aim(game, enemy) * (float)M_PI / 180.0f;
+    enemy_move(enemy, (int)roundf(sinf(rad) * 6), SDL_max(2, (int)roundf(-cosf(rad) * 6)));
+    CO_END(b);
+}
+
+//Holds near the top and fires aimed bursts in between sidesteps, instead of
+//running a bullet pattern.
+static int behave_gunner(Game* game, Enemy* enemy)
+{
+    Behaviour* b = &enemy->behaviour;
+    int ticks;
+
+    CO_BEGIN(b);
+    enemy->emitter.pattern = -1;
+    while ((ticks = enemy_descend(enemy, SCREEN_HEIGHT / 5, 2)) > 0)
+        CO_WAIT(b, ticks);
+
+    for (b->i = 0; b->i < 3; b->i++)
+    {
+        enemy_move(enemy, 0, 0);
+        for (b->j = 0; b->j < 4; b->j++)
+        {
+            float x = enemy->position.x + enemy->position.w / 2.0f;
+            if (projectile_spawn(game, enemy->current_weapon, x, (float)(enemy->position.y + enemy->position.h), enemy_aim(game, enemy), -1, (int)(enemy - game->sim.enemies)))
+                audio_play(game, SND_ENEMY_SHOT, x);
+            CO_WAIT(b, 8);
+        }
+        b->target = (Sint16)rnd_num(game, 0, SCREEN_WIDTH - enemy->position.w);
+        while ((ticks = enemy_steer(enemy, b->target, 2)) > 0)
+            CO_WAIT(b, ticks);
+    }
+
+    enemy_move(enemy, 0, -3);
+    CO_END(b);
+}
+
+static const BehaviourFunc BEHAVIOURS[BEHAVE_COUNT] =
+{
+    NULL,                       //BEHAVE_DRIFT
+    behave_strafe,
+    behave_dive,
+    behave_gunner
+};
+
+//Gives enemy index behaviour kind from the start, resuming on the next tick.
+void behaviour_start(Game* game, int index, BehaviourKind kind)
+{
+    Behaviour* b = &game->sim.enemies[index].behaviour;
+
+    memset(b, 0, sizeof(Behaviour));
+    b->kind = (Uint8)kind;
+    b->timer = BEHAVIOURS[kind] ? (Sint16)timer_add(game, TIMER_BEHAVIOUR, index, 1) : -1;
+}
+
+//Resumes the behaviours of the enemies whose timers fired this tick, each up
+//to its next wait.
+void behaviours_update(Game* game, const int* enemies, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        Enemy* enemy = &game->sim.enemies[enemies[i]];
+        Behaviour* b = &enemy->behaviour;
+
+        if (!enemy->active || b->kind >= BEHAVE_COUNT || BEHAVIOURS[b->kind] == NULL || b->line == CO_DONE)
+            continue;
+
+        int ticks = BEHAVIOURS[b->kind](game, enemy);
+        b->timer = ticks > 0 ? (Sint16)timer_add(game, TIMER_BEHAVIOUR, enemies[i], ticks) : -1;
+    }
+}
@@ -0,0 +1,243 @@
+#include "main.h"
+
+//Frame capture. Finished frames are read back from the offscreen target into
+//a small ring of preallocated slots, and a writer thread saves them to disk.
+//The frame loop never waits on the writer: if every slot is busy the frame
+//is dropped and counted instead.
+
+typedef struct
+{
+    Uint32* pixels;             //ARGB8888, alpha forced opaque
+    int frame;
+    char path[MSL];             //Empty means "use the sequence name"
+} CaptureSlot;
+
+struct FrameCapture
+{
+    char dir[MSL];
+    bool png;
+    int width;
+    int height;
+    int frame;
+    int dropped;
+
+    CaptureSlot slots[CAPTURE_SLOTS];
+    int head;                   //Next slot the game thread fills
+    int tail;                   //Next slot the writer saves
+    SDL_sem* filled;
+    SDL_sem* free_slots;
+    SDL_atomic_t pending;
+    SDL_Thread* thread;
+    bool quit;
+
+    SDL_Texture* target;        //Offscreen render target when not using --soft
+};
+
+static bool capture_write_slot(FrameCapture* capture, const CaptureSlot* slot)
+{
+    char path[MSL];
+    char buf[MSL_LONG];
+
+    if (slot->path[0])
+        snprintf(path, sizeof(path), "%s", slot->path);
+    else if (snprintf(path, sizeof(path), "%s/frame_%05d.%s", capture->dir, slot->frame, capture->png ? "png" : "raw") >= (int)sizeof(path))
+    {
+        LOG("Capture directory name is too long, frame not written\n");
+        return false;
+    }
+
+    if (capture->png || slot->path[0])
+    {
+        SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormatFrom(slot->pixels, capture->width, capture->height, 32,
+                                                                  capture->width * (int)sizeof(Uint32), SDL_PIXELFORMAT_ARGB8888);
+        int result = surface ? IMG_SavePNG(surface, path) : -1;
+        SDL_FreeSurface(surface);
+
+        if (result != 0)
+        {
+            snprintf(buf, sizeof(buf), "Unable to write %s: %s\n", path, IMG_GetError());
+            LOG(buf);
+            return false;
+        }
+        return true;
+    }
+
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL)
+    {
+        snprintf(buf, sizeof(buf), "Unable to write %s\n", path);
+        LOG(buf);
+        return false;
+    }
+
+    fwrite(slot->pixels, sizeof(Uint32), (size_t)capture->width * capture->height, fp);
+    fclose(fp);
+    return true;
+}
+
+static int capture_writer(void* data)
+{
+    FrameCapture* capture = data;
+
+    for (;;)
+    {
+        SDL_SemWait(capture->filled);
+
+        //The quit post comes after every frame post, so an empty queue here means we're done.
+        if (capture->quit && SDL_AtomicGet(&capture->pending) == 0)
+            break;
+
+        CaptureSlot* slot = &capture->slots[capture->tail];
+        capture_write_slot(capture, slot);
+        capture->tail = (capture->tail + 1) % CAPTURE_SLOTS;
+
+        SDL_AtomicAdd(&capture->pending, -1);
+        SDL_SemPost(capture->free_slots);
+    }
+    return 0;
+}
+
+FrameCapture* capture_open(Game* game, const char* dir, bool png)
+{
+    FrameCapture* capture = mem_calloc(MEM_RENDERER, 1, sizeof(FrameCapture));
+    if (capture == NULL)
+        return NULL;
+
+    snprintf(capture->dir, sizeof(capture->dir), "%s", dir);
+    capture->png = png;
+    capture->width = SCREEN_WIDTH;
+    capture->height = SCREEN_HEIGHT;
+
+    for (int i = 0; i < CAPTURE_SLOTS; i++)
+    {
+        capture->slots[i].pixels = mem_alloc(MEM_RENDERER, sizeof(Uint32) * capture->width * capture->height);
+        if (capture->slots[i].pixels == NULL)
+        {
+            capture_close(capture);
+            return NULL;
+        }
+    }
+
+    //The software rasterizer already draws offscreen, SDL_Renderer needs a target texture.
+    if (game->soft == NULL)
+    {
+        capture->target = SDL_CreateTexture(game->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, capture->width, capture->height);
+        if (capture->target == NULL)
+        {
+            SDL_Log("Unable to create capture target! SDL_Error: %s\n", SDL_GetError());
+            capture_close(capture);
+            return NULL;
+        }
+    }
+
+    capture->filled = SDL_CreateSemaphore(0);
+    capture->free_slots = SDL_CreateSemaphore(CAPTURE_SLOTS);
+    capture->thread = SDL_CreateThread(capture_writer, "capture_writer", capture);
+    if (capture->thread == NULL)
+    {
+        SDL_Log("Unable to start capture writer! SDL_Error: %s\n", SDL_GetError());
+        capture_close(capture);
+        return NULL;
+    }
+
+    return capture;
+}
+
+//Flushes every queued frame to disk and frees the capture.
+void capture_close(FrameCapture* capture)
+{
+    char buf[MSL];
+
+    if (capture == NULL)
+        return;
+
+    if (capture->thread)
+    {
+        capture->quit = true;
+        SDL_SemPost(capture->filled);
+        SDL_WaitThread(capture->thread, NULL);
+
+        snprintf(buf, sizeof(buf), "Captured %d frames (%d dropped)\n", capture->frame - capture->dropped, capture->dropped);
+        LOG(buf);
+    }
+
+    for (int i = 0; i < CAPTURE_SLOTS; i++)
+        mem_free(capture->slots[i].pixels);
+
+    if (capture->filled)
+        SDL_DestroySemaphore(capture->filled);
+    if (capture->free_slots)
+        SDL_DestroySemaphore(capture->free_slots);
+    if (capture->target)
+        SDL_DestroyTexture(capture->target);
+
+    mem_free(capture);
+}
+
+//Redirects SDL_Renderer drawing into the offscreen target for this frame.
+void capture_begin_frame(Game* game)
+{
+    if (game->capture && game->capture->target && game->opts.capture_sequence)
+        SDL_SetRenderTarget(game->renderer, game->capture->target);
+}
+
+//Copies the finished frame into out (width * height ARGB8888, opaque).
+void capture_read_pixels(Game* game, Uint32* out)
+{
+    int count = SCREEN_WIDTH * SCREEN_HEIGHT;
+
+    if (game->soft)
+        memcpy(out, soft_get_framebuffer(game->soft), sizeof(Uint32) * count);
+    else
+        SDL_RenderReadPixels(game->renderer, NULL, SDL_PIXELFORMAT_ARGB8888, out, SCREEN_WIDTH * (int)sizeof(Uint32));
+
+    for (int i = 0; i < count; i++)
+        out[i] |= 0xFF000000;
+}
+
+//Queues the current frame for the writer. path overrides the sequence name.
+//Unless block is set a busy writer means the frame is dropped (returns false).
+bool capture_frame(Game* game, const char* path, bool block)
+{
+    FrameCapture* capture = game->capture;
+
+    if (capture == NULL)
+        return false;
+
+    int frame = capture->frame++;
+
+    if (block)
+        SDL_SemWait(capture->free_slots);
+    else if (SDL_SemTryWait(capture->free_slots) != 0)
+    {
+        capture->dropped++;
+        return false;
+    }
+
+    CaptureSlot* slot = &capture->slots[capture->head];
+    capture_read_pixels(game, slot->pixels);
+    slot->frame = frame;
+    snprintf(slot->path, sizeof(slot->path), "%s", path ? path : "");
+    capture->head = (capture->head + 1) % CAPTURE_SLOTS;
+
+    SDL_AtomicAdd(&capture->pending, 1);
+    SDL_SemPost(capture->filled);
+    return true;
+}
+
+//Called from draw_present: grabs the frame and puts the offscreen target on screen.
+void capture_end_frame(Game* game)
+{
+    FrameCapture* capture = game->capture;
+
+    if (capture == NULL || !game->opts.capture_sequence)
+        return;
+
+    capture_frame(game, NULL, false);
+
+    if (capture->target)
+    {
+        SDL_SetRenderTarget(game->renderer, NULL);
+        SDL_RenderCopy(game->renderer, capture->target, NULL, NULL);
+    }
+}
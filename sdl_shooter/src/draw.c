@@ -0,0 +1,161 @@
+#include "main.h"
+
+//Every draw call the game makes goes through these, so the software
+//rasterizer (softrender.c) sees exactly what SDL_Renderer would have.
+
+SDL_Texture* create_texture(Game* game, SDL_Surface* surface)
+{
+    SDL_Texture* texture = SDL_CreateTextureFromSurface(game->renderer, surface);
+
+    if (texture && game->soft)
+        soft_register_texture(game->soft, texture, surface);
+
+    return texture;
+}
+
+void destroy_texture(Game* game, SDL_Texture* texture)
+{
+    if (texture == NULL)
+        return;
+
+    if (game->soft)
+        soft_unregister_texture(game->soft, texture);
+
+    SDL_DestroyTexture(texture);
+}
+
+//Rewrites part of a texture with ARGB8888 pixels (pitch in bytes).
+void update_texture(Game* game, SDL_Texture* texture, const SDL_Rect* rect, const Uint32* pixels, int pitch)
+{
+    if (game->soft)
+        soft_update_texture(game->soft, texture, rect, pixels, pitch);
+    else
+        SDL_UpdateTexture(texture, rect, pixels, pitch);
+}
+
+void set_texture_color_mod(Game* game, SDL_Texture* texture, Uint8 r, Uint8 g, Uint8 b)
+{
+    if (game->soft)
+        soft_set_texture_mod(game->soft, texture, r, g, b, 255);
+    else
+        SDL_SetTextureColorMod(texture, r, g, b);
+}
+
+void draw_begin_frame(Game* game)
+{
+    quality_begin_frame(game);
+    capture_begin_frame(game);
+}
+
+void draw_set_color(Game* game, Uint8 r, Uint8 g, Uint8 b, Uint8 a)
+{
+    if (game->soft)
+        soft_set_draw_color(game->soft, r, g, b, a);
+    else
+        SDL_SetRenderDrawColor(game->renderer, r, g, b, a);
+}
+
+void draw_clear(Game* game)
+{
+    if (game->soft)
+        soft_clear(game->soft);
+    else
+        SDL_RenderClear(game->renderer);
+}
+
+void draw_copy(Game* game, SDL_Texture* texture, const SDL_Rect* src, const SDL_Rect* dst)
+{
+    if (game->soft)
+        soft_copy(game->soft, texture, src, dst, 0.0, NULL);
+    else
+        SDL_RenderCopy(game->renderer, texture, src, dst);
+}
+
+void draw_copy_ex(Game* game, SDL_Texture* texture, const SDL_Rect* src, const SDL_Rect* dst, double angle, const SDL_Point* center)
+{
+    if (game->soft)
+        soft_copy(game->soft, texture, src, dst, angle, center);
+    else
+        SDL_RenderCopyEx(game->renderer, texture, src, dst, angle, center, SDL_FLIP_NONE);
+}
+
+//Draws num_quads axis aligned quads of texture in one go. Each quad is four
+//vertices (top left, top right, bottom right, bottom left) and six indices.
+void draw_quads(Game* game, SDL_Texture* texture, const SDL_Vertex* vertices, const int* indices, int num_quads)
+{
+    if (game->soft)
+        soft_draw_quads(game->soft, texture, vertices, num_quads);
+    else
+        SDL_RenderGeometry(game->renderer, texture, vertices, num_quads * 4, indices, num_quads * 6);
+}
+
+void draw_fill_rect(Game* game, const SDL_Rect* rect)
+{
+    if (game->soft)
+        soft_fill_rect(game->soft, rect);
+    else
+        SDL_RenderFillRect(game->renderer, rect);
+}
+
+void draw_rect(Game* game, const SDL_Rect* rect)
+{
+    if (game->soft)
+    {
+        soft_draw_line(game->soft, rect->x, rect->y, rect->x + rect->w - 1, rect->y);
+        soft_draw_line(game->soft, rect->x, rect->y + rect->h - 1, rect->x + rect->w - 1, rect->y + rect->h - 1);
+        soft_draw_line(game->soft, rect->x, rect->y + 1, rect->x, rect->y + rect->h - 2);
+        soft_draw_line(game->soft, rect->x + rect->w - 1, rect->y + 1, rect->x + rect->w - 1, rect->y + rect->h - 2);
+    }
+    else
+        SDL_RenderDrawRect(game->renderer, rect);
+}
+
+void draw_line(Game* game, int x1, int y1, int x2, int y2)
+{
+    if (game->soft)
+        soft_draw_line(game->soft, x1, y1, x2, y2);
+    else
+        SDL_RenderDrawLine(game->renderer, x1, y1, x2, y2);
+}
+
+void draw_point(Game* game, int x, int y)
+{
+    if (game->soft)
+        soft_draw_point(game->soft, x, y);
+    else
+        SDL_RenderDrawPoint(game->renderer, x, y);
+}
+
+void draw_aa_circle(Game* game, int x, int y, int radius, Uint8 r, Uint8 g, Uint8 b, Uint8 a)
+{
+    if (game->soft)
+        soft_draw_circle(game->soft, x, y, radius, r, g, b, a);
+    else
+        aacircleRGBA(game->renderer, x, y, radius, r, g, b, a);
+}
+
+//The cheap ring for low quality tiers. The rasterizer only has the one kind.
+void draw_circle(Game* game, int x, int y, int radius, Uint8 r, Uint8 g, Uint8 b, Uint8 a)
+{
+    if (game->soft)
+        soft_draw_circle(game->soft, x, y, radius, r, g, b, a);
+    else
+        circleRGBA(game->renderer, x, y, radius, r, g, b, a);
+}
+
+void draw_present(Game* game)
+{
+    //Capture needs the finished frame, so rasterize it before reading back.
+    if (game->soft)
+        soft_flush(game->soft);
+
+    capture_end_frame(game);
+    quality_resolve(game);
+
+    if (game->soft)
+        soft_present(game->soft);
+    else
+        SDL_RenderPresent(game->renderer);
+
+    input_mark_presented(game);
+}
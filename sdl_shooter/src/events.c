@@ -0,0 +1,285 @@
+#include "main.h"
+
+//Per-tick scratch memory and the gameplay event bus.
+//
+//The frame arena is a bump allocator that is emptied at the start of every
+//sim_step(), so anything a system only needs for one tick can come from
+//frame_alloc() without touching the heap.
+//
+//Systems that detect something (a hit, a kill, a pickup, a player taking
+//damage) change the state of what was hit on the spot and emit an event;
+//everything else that follows from it (score, explosions, sounds, logging)
+//happens once per tick in events_dispatch(), one event type at a time. The
+//queues live in the frame arena and grow by doubling into fresh arena space.
+//An event that doesn't fit is handled on the spot instead of being lost.
+
+#define FRAME_ARENA_KB 256
+#define EVENT_QUEUE_START 32        //First allocation of each queue, in events
+#define ARENA_ALIGN 16
+
+typedef struct
+{
+    void* items;
+    int count;
+    int capacity;
+} EventQueue;
+
+struct EventBus
+{
+    Uint8* arena;
+    size_t used;
+    size_t peak;                    //Most arena used by any one tick
+    Uint32 failed;                  //Allocations that didn't fit
+    Uint32 overflowed;              //Events handled on the spot for want of room
+
+    EventQueue queues[EV_COUNT];
+    Uint64 totals[EV_COUNT];        //Events seen since events_open()
+};
+
+static const size_t EVENT_SIZES[EV_COUNT] =
+{
+    sizeof(HitEvent),
+    sizeof(KillEvent),
+    sizeof(PickupEvent),
+    sizeof(PlayerDamagedEvent)
+};
+
+static const char* TARGET_NAMES[] = {"enemy", "planet", "player"};
+
+//Scratch memory that stays valid until the next sim_step(). NULL when the
+//arena is full, so callers need a fallback.
+void* frame_alloc(Game* game, size_t size)
+{
+    EventBus* bus = game->events;
+    size_t at = (bus->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    if (at + size > (size_t)FRAME_ARENA_KB * 1024)
+    {
+        bus->failed++;
+        return NULL;
+    }
+
+    bus->used = at + size;
+    if (bus->used > bus->peak)
+        bus->peak = bus->used;
+    return bus->arena + at;
+}
+
+//Empties the arena and every queue. Called at the start of each tick.
+void events_begin(Game* game)
+{
+    EventBus* bus = game->events;
+
+    bus->used = 0;
+    memset(bus->queues, 0, sizeof(bus->queues));
+}
+
+//Returns space for one more event of type, or NULL when the arena is out of
+//room; see event_overflow().
+static void* event_push(Game* game, GameEventType type)
+{
+    EventQueue* queue = &game->events->queues[type];
+    size_t size = EVENT_SIZES[type];
+
+    if (queue->count == queue->capacity)
+    {
+        int capacity = queue->capacity ? queue->capacity * 2 : EVENT_QUEUE_START;
+        void* items = frame_alloc(game, size * capacity);
+
+        if (items == NULL)
+            return NULL;
+        if (queue->count)
+            memcpy(items, queue->items, size * queue->count);
+        queue->items = items;
+        queue->capacity = capacity;
+    }
+
+    if (!game->resimulating)
+        game->events->totals[type]++;
+    return (Uint8*)queue->items + size * queue->count++;
+}
+
+static void consume_scoring(Game* game, const KillEvent* kills, int count)
+{
+    for (int i = 0; i < count; i++)
+        if (kills[i].owner >= 0)
+            game->sim.players[kills[i].owner].score += kills[i].score;
+}
+
+//Particles, sounds and sprite effects.
+static void consume_effects(Game* game, const HitEvent* hits, int num_hits, const KillEvent* kills, int num_kills,
+                            const PickupEvent* pickups, int num_pickups)
+{
+    for (int i = 0; i < num_hits; i++)
+        anim_spawn(game, ANIM_SPARKLE, hits[i].x, hits[i].y, 0, 0, 0);
+
+    //The sheets only dress it up, the debris particles are still the sim's.
+    for (int i = 0; i < num_kills; i++)
+    {
+        float size = kills[i].kind == TARGET_PLANET ? 96 : 0;
+
+        create_explosion(game, kills[i].x, kills[i].y);
+        anim_spawn(game, ANIM_EXPLOSION, kills[i].x, kills[i].y, 0, 0, size);
+        for (int j = 0; j < 4 && game->anims; j++)
+        {
+            float angle = (rand() % 360) * (float)M_PI / 180.0f;    //Cosmetic only, so not the sim's generator
+            anim_spawn(game, ANIM_SPARKLE, kills[i].x, kills[i].y, cosf(angle) * 2, sinf(angle) * 2, 0);
+        }
+    }
+
+    for (int i = 0; i < num_pickups; i++)
+    {
+        audio_play(game, SND_PICKUP, pickups[i].x);
+        anim_spawn(game, ANIM_PICKUP, pickups[i].x, pickups[i].y, 0, 0, 0);
+    }
+}
+
+//An event the arena had no room for. It still gets scored and dressed up,
+//straight away rather than with the rest of the tick's, which is just as
+//deterministic; only --log-events misses it. Logged the first time.
+static void event_overflow(Game* game, GameEventType type, const void* event)
+{
+    EventBus* bus = game->events;
+
+    if (bus->overflowed++ == 0)
+        LOG("Frame arena full, handling events as they are emitted\n");
+    if (!game->resimulating)
+        bus->totals[type]++;
+
+    if (type == EV_KILL)
+    {
+        consume_scoring(game, event, 1);
+        consume_effects(game, NULL, 0, event, 1, NULL, 0);
+    }
+    else if (type == EV_HIT)
+        consume_effects(game, event, 1, NULL, 0, NULL, 0);
+    else if (type == EV_PICKUP)
+        consume_effects(game, NULL, 0, NULL, 0, event, 1);
+}
+
+void emit_hit(Game* game, HitEvent event)
+{
+    HitEvent* slot = event_push(game, EV_HIT);
+    if (slot)
+        *slot = event;
+    else
+        event_overflow(game, EV_HIT, &event);
+}
+
+void emit_kill(Game* game, KillEvent event)
+{
+    KillEvent* slot = event_push(game, EV_KILL);
+    if (slot)
+        *slot = event;
+    else
+        event_overflow(game, EV_KILL, &event);
+}
+
+void emit_pickup(Game* game, PickupEvent event)
+{
+    PickupEvent* slot = event_push(game, EV_PICKUP);
+    if (slot)
+        *slot = event;
+    else
+        event_overflow(game, EV_PICKUP, &event);
+}
+
+void emit_player_damaged(Game* game, PlayerDamagedEvent event)
+{
+    PlayerDamagedEvent* slot = event_push(game, EV_PLAYER_DAMAGED);
+    if (slot)
+        *slot = event;
+    else
+        event_overflow(game, EV_PLAYER_DAMAGED, &event);
+}
+
+//--log-events, one line per event. Skipped while netplay re-runs ticks so
+//each tick is only logged once.
+static void consume_logging(Game* game)
+{
+    EventQueue* queues = game->events->queues;
+    char buf[MSL];
+
+    if (!game->opts.log_events || game->resimulating)
+        return;
+
+    for (int i = 0; i < queues[EV_HIT].count; i++)
+    {
+        const HitEvent* e = (const HitEvent*)queues[EV_HIT].items + i;
+        snprintf(buf, sizeof(buf), "Tick %u: %s %d hit for %d by %d at %.0f,%.0f\n",
+                 game->sim.tick, TARGET_NAMES[e->kind], e->index, e->damage, e->owner, e->x, e->y);
+        LOG(buf);
+    }
+    for (int i = 0; i < queues[EV_KILL].count; i++)
+    {
+        const KillEvent* e = (const KillEvent*)queues[EV_KILL].items + i;
+        snprintf(buf, sizeof(buf), "Tick %u: %s %d destroyed by %d for %d points\n",
+                 game->sim.tick, TARGET_NAMES[e->kind], e->index, e->owner, e->score);
+        LOG(buf);
+    }
+    for (int i = 0; i < queues[EV_PICKUP].count; i++)
+    {
+        const PickupEvent* e = (const PickupEvent*)queues[EV_PICKUP].items + i;
+        snprintf(buf, sizeof(buf), "Tick %u: player %d picked up powerup %d\n", game->sim.tick, e->player + 1, e->type);
+        LOG(buf);
+    }
+    for (int i = 0; i < queues[EV_PLAYER_DAMAGED].count; i++)
+    {
+        const PlayerDamagedEvent* e = (const PlayerDamagedEvent*)queues[EV_PLAYER_DAMAGED].items + i;
+        snprintf(buf, sizeof(buf), "Tick %u: player %d took %d damage from %s %d, %d left\n",
+                 game->sim.tick, e->player + 1, e->damage, TARGET_NAMES[e->source], e->source_index,
+                 game->sim.players[e->player].hit_points);
+        LOG(buf);
+    }
+}
+
+//Runs every consumer over what this tick emitted. Part of the simulation:
+//the consumers may change SimState, so this must stay deterministic.
+void events_dispatch(Game* game)
+{
+    EventQueue* queues = game->events->queues;
+
+    consume_scoring(game, queues[EV_KILL].items, queues[EV_KILL].count);
+    consume_effects(game, queues[EV_HIT].items, queues[EV_HIT].count, queues[EV_KILL].items, queues[EV_KILL].count,
+                    queues[EV_PICKUP].items, queues[EV_PICKUP].count);
+    consume_logging(game);
+}
+
+//How many events of type have been emitted since events_open().
+Uint64 events_total(Game* game, GameEventType type)
+{
+    return game->events->totals[type];
+}
+
+EventBus* events_open(void)
+{
+    EventBus* bus = mem_calloc(MEM_GAME, 1, sizeof(EventBus));
+
+    if (bus)
+        bus->arena = mem_alloc(MEM_GAME, (size_t)FRAME_ARENA_KB * 1024);
+
+    if (bus == NULL || bus->arena == NULL)
+    {
+        SDL_Log("Unable to allocate the %d KB frame arena\n", FRAME_ARENA_KB);
+        mem_free(bus);
+        return NULL;
+    }
+    return bus;
+}
+
+void events_close(EventBus* bus)
+{
+    char buf[MSL];
+
+    if (bus == NULL)
+        return;
+
+    snprintf(buf, sizeof(buf), "Events: %llu hits, %llu kills, %llu pickups, %llu player damaged. Frame arena peak %.1f of %d KB, %u allocations failed, %u events handled on overflow\n",
+             (unsigned long long)bus->totals[EV_HIT], (unsigned long long)bus->totals[EV_KILL],
+             (unsigned long long)bus->totals[EV_PICKUP], (unsigned long long)bus->totals[EV_PLAYER_DAMAGED],
+             bus->peak / 1024.0, FRAME_ARENA_KB, bus->failed, bus->overflowed);
+    LOG(buf);
+
+    mem_free(bus->arena);
+    mem_free(bus);
+}
@@ -1,22 +1,68 @@
 #include "main.h"
 
+//The simulation's own random numbers (xorshift32). The state lives in
+//game->sim, so a restored snapshot replays the exact same rolls; never use
+//rand() in anything update() reaches.
+Uint32 sim_rand(Game* game)
+{
+    Uint32 x = game->sim.rng;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    game->sim.rng = x;
+    return x;
+}
+
+//0 to 1 inclusive, like rand() / RAND_MAX.
+float sim_randf(Game* game)
+{
+    return (float)(sim_rand(game) >> 8) / (float)0xFFFFFF;
+}
+
+//Xorshift sticks at zero, so never seed it with that.
+void sim_seed(Game* game, Uint32 seed)
+{
+    game->sim.rng = seed ? seed : 0x9E3779B9;
+}
+
 ///Generates a random number within the given range.
-int rnd_num(int min, int max)
+int rnd_num(Game* game, int min, int max)
 { 
     int num = 0;
 
     if (min == 0 && max == 0)
         return 0;    
 
-    num = (min + rand() % (max+1 - min));
+    num = (min + (int)(sim_rand(game) % (Uint32)(max+1 - min)));
 
     return num;
     
 }
 
+//Not SDL's TLS, which allocates.
+static _Thread_local LogContext* log_context;
+
+//Sends LOG() on the calling thread to context instead of the console and
+//game.log, so games running side by side keep their logs apart. NULL goes
+//back to the default. context must outlive its use on this thread.
+void log_set_context(LogContext* context)
+{
+    log_context = context;
+}
+
 //Prints errors to the console and logs them into game.log
 void add_log(char * message)
 {
+    LogContext* context = log_context;
+
+    if (context)
+    {
+        if (context->fp)
+            fputs(message, context->fp);
+        return;
+    }
+
     printf("%s", message);
     FILE * fp;
 
@@ -40,33 +86,57 @@ bool check_collision(SDL_Rect a, SDL_Rect b)
             a.y + a.h > b.y);
 }
 
-void check_planet_collision(Game* game) 
+//Everything that hurts an enemy goes through here. Its defense comes off
+//the damage; returns true if this killed it.
+bool damage_enemy(Game* game, int index, int damage, int owner)
+{
+    Enemy* enemy = &game->sim.enemies[index];
+    float x = enemy->position.x + enemy->position.w / 2.0f;
+    float y = enemy->position.y + enemy->position.h / 2.0f;
+
+    damage -= enemy->defense;
+    if (damage <= 0)
+        return false;
+
+    enemy->hit_points -= damage;
+    emit_hit(game, (HitEvent){TARGET_ENEMY, index, damage, owner, x, y});
+
+    if (enemy->hit_points > 0)
+        return false;
+
+    enemy->active = false;
+    emit_kill(game, (KillEvent){TARGET_ENEMY, index, owner, enemy->max_hp, x, y});
+    return true;
+}
+
+//Everything that hurts a player goes through here.
+void damage_player(Game* game, int player, int damage, TargetKind source, int source_index)
 {
-    char buf[MSL];
+    Player* target = &game->sim.players[player];
 
+    target->hit_points -= damage;
+    if (target->hit_points < 0) {
+        target->hit_points = 0;
+        // Implement game over logic here
+    }
+
+    emit_player_damaged(game, (PlayerDamagedEvent){player, damage, source, source_index});
+}
+
+void check_planet_collision(Game* game) 
+{
+    for (int p = 0; p < game->sim.num_players; p++)
     for (int i = 0; i < MAX_PLANETS; i++) 
     {
-        Planet* planet = &game->planets[i];
+        Planet* planet = &game->sim.planets[i];
+        Player* player = &game->sim.players[p];
         
-        // Simple circle collision detection
-        float dx = game->player.position.x + game->player.position.w / 2 - planet->x;
-        float dy = game->player.position.y + game->player.position.h / 2 - planet->y;
-        float distance = sqrt(dx * dx + dy * dy);
-        
-        if (distance < (game->player.position.w / 2 + planet->radius)) {
-            // Collision detected, calculate damage
-            int damage = (int)(planet->radius * game->current_game_speed * 0.1f);
-            game->player.hit_points -= damage;
-            sprintf(buf, "Player took %d damage from planet collision!\n", damage);
-            LOG(buf);
-
-
-            if (game->player.hit_points < 0) {
-                game->player.hit_points = 0;
-                // Implement game over logic here
-            }
-            
-            // Implement visual feedback for collision (screen shake, particle effects)
-        }
+        // Bounding boxes first, then the planet's mask under the player
+        if (!planet->active || !check_collision(player->position, planet->position) ||
+            !planet_mask_hit(planet, &player->position, NULL, NULL))
+            continue;
+
+        // Bigger planets hurt more, every tick the player is in contact
+        damage_player(game, p, SDL_max(1, planet->position.w / 24), TARGET_PLANET, i);
     }
 }
\ No newline at end of file
@@ -0,0 +1,220 @@
+#include "main.h"
+
+//Sprite shaped hit tests. A Hitbox is built once at load from the alpha of
+//the image as it is drawn (size, source crop and rotation), and every test
+//goes through three levels, each only reached when the cheaper one hits:
+//
+//  1. the rects overlap (check_collision()),
+//  2. the other shape reaches the sprite's bounding circle,
+//  3. a solid bit of the sprite's 1bpp mask lies under the other shape.
+//
+//The mask holds one Uint64 per row with bit x for column x, so level 3 is a
+//shift and AND per overlapping row. Most pairs never get past level 1, so
+//the cost stays close to plain rect tests.
+
+//Bits 0..width-1.
+static inline Uint64 low_bits(int width)
+{
+    return width >= 64 ? ~(Uint64)0 : ((Uint64)1 << width) - 1;
+}
+
+//Every bit solid and the circle around the corners, so tests act like rects.
+static void hitbox_fill(Hitbox* box, int w, int h)
+{
+    memset(box, 0, sizeof(Hitbox));
+    box->w = w;
+    box->h = h;
+    box->cx = w / 2.0f;
+    box->cy = h / 2.0f;
+    box->radius = sqrtf(box->cx * box->cx + box->cy * box->cy);
+
+    for (int y = 0; y < h; y++)
+        box->rows[y] = low_bits(w);
+}
+
+//Builds the hitbox of src (all of surface if NULL) drawn w x h and turned
+//angle degrees clockwise about its centre, like SDL_RenderCopyEx(). A pixel
+//is solid when at least half opaque. Without a surface the box is solid.
+void hitbox_build(Hitbox* box, SDL_Surface* surface, const SDL_Rect* src, int w, int h, float angle)
+{
+    w = SDL_max(1, SDL_min(w, HITBOX_MAX_SIZE));
+    h = SDL_max(1, SDL_min(h, HITBOX_MAX_SIZE));
+    hitbox_fill(box, w, h);
+
+    SDL_Surface* argb = surface ? SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0) : NULL;
+    if (argb == NULL)
+        return;
+
+    SDL_Rect area = src ? *src : (SDL_Rect){0, 0, argb->w, argb->h};
+    float rad = -angle * (float)M_PI / 180.0f;
+    float c = cosf(rad), s = sinf(rad);
+    int min_x = w, min_y = h, max_x = -1, max_y = -1;
+
+    SDL_LockSurface(argb);
+    for (int y = 0; y < h; y++)
+    {
+        box->rows[y] = 0;
+        for (int x = 0; x < w; x++)
+        {
+            //Rotate the pixel centre back into the unrotated sprite, then into the source.
+            float dx = x + 0.5f - w / 2.0f, dy = y + 0.5f - h / 2.0f;
+            float u = dx * c - dy * s + w / 2.0f, v = dx * s + dy * c + h / 2.0f;
+            int sx = area.x + (int)floorf(u * area.w / w);
+            int sy = area.y + (int)floorf(v * area.h / h);
+
+            if (u < 0 || v < 0 || sx >= area.x + area.w || sy >= area.y + area.h || sx >= argb->w || sy >= argb->h)
+                continue;
+
+            Uint32 pixel = ((const Uint32*)((const Uint8*)argb->pixels + sy * argb->pitch))[sx];
+            if ((pixel >> 24) >= 128)
+            {
+                box->rows[y] |= (Uint64)1 << x;
+                min_x = SDL_min(min_x, x);
+                max_x = SDL_max(max_x, x);
+                min_y = SDL_min(min_y, y);
+                max_y = SDL_max(max_y, y);
+            }
+        }
+    }
+    SDL_UnlockSurface(argb);
+    SDL_FreeSurface(argb);
+
+    //Fully transparent art would never be hit, keep it a box instead.
+    if (max_x < 0)
+    {
+        hitbox_fill(box, w, h);
+        return;
+    }
+
+    box->cx = (min_x + max_x + 1) / 2.0f;
+    box->cy = (min_y + max_y + 1) / 2.0f;
+    box->radius = 0;
+
+    for (int y = min_y; y <= max_y; y++)
+    {
+        for (int x = min_x; x <= max_x; x++)
+        {
+            if (!((box->rows[y] >> x) & 1))
+                continue;
+
+            //Farthest corner of the pixel from the centre.
+            float fx = SDL_max(fabsf(x - box->cx), fabsf(x + 1 - box->cx));
+            float fy = SDL_max(fabsf(y - box->cy), fabsf(y + 1 - box->cy));
+            box->radius = SDL_max(box->radius, sqrtf(fx * fx + fy * fy));
+        }
+    }
+}
+
+//Circle centre and radius in screen space for the box drawn over at.
+static inline void hitbox_circle(const Hitbox* box, const SDL_Rect* at, float* x, float* y, float* r)
+{
+    float scale_x = (float)at->w / box->w, scale_y = (float)at->h / box->h;
+
+    *x = at->x + box->cx * scale_x;
+    *y = at->y + box->cy * scale_y;
+    *r = box->radius * SDL_max(scale_x, scale_y);
+}
+
+//Whether rect touches the sprite drawn at at.
+bool hitbox_hit_rect(const Hitbox* box, const SDL_Rect* at, const SDL_Rect* rect)
+{
+    if (!check_collision(*at, *rect))
+        return false;
+
+    float cx, cy, r;
+    hitbox_circle(box, at, &cx, &cy, &r);
+
+    float nx = SDL_max((float)rect->x, SDL_min(cx, (float)(rect->x + rect->w)));
+    float ny = SDL_max((float)rect->y, SDL_min(cy, (float)(rect->y + rect->h)));
+    if ((nx - cx) * (nx - cx) + (ny - cy) * (ny - cy) > r * r)
+        return false;
+
+    //Rect edges onto mask columns and rows, allowing for the box being drawn scaled.
+    int x0 = SDL_max(0, (rect->x - at->x) * box->w / at->w);
+    int x1 = SDL_min(box->w - 1, (rect->x + rect->w - 1 - at->x) * box->w / at->w);
+    int y0 = SDL_max(0, (rect->y - at->y) * box->h / at->h);
+    int y1 = SDL_min(box->h - 1, (rect->y + rect->h - 1 - at->y) * box->h / at->h);
+    Uint64 columns = low_bits(x1 + 1) & ~low_bits(x0);
+
+    for (int y = y0; y <= y1; y++)
+        if (box->rows[y] & columns)
+            return true;
+    return false;
+}
+
+//Whether two sprites touch. The masks are compared unscaled, so a box drawn
+//at another size than it was built for stops at the circle test.
+bool hitbox_hit(const Hitbox* a, const SDL_Rect* at_a, const Hitbox* b, const SDL_Rect* at_b)
+{
+    if (!check_collision(*at_a, *at_b))
+        return false;
+
+    float ax, ay, ar, bx, by, br;
+    hitbox_circle(a, at_a, &ax, &ay, &ar);
+    hitbox_circle(b, at_b, &bx, &by, &br);
+    if ((ax - bx) * (ax - bx) + (ay - by) * (ay - by) > (ar + br) * (ar + br))
+        return false;
+
+    if (at_a->w != a->w || at_a->h != a->h || at_b->w != b->w || at_b->h != b->h)
+        return true;
+
+    //Line both rows up on the left edge of the overlap, then AND.
+    int left = SDL_max(at_a->x, at_b->x);
+    int right = SDL_min(at_a->x + at_a->w, at_b->x + at_b->w);
+    int top = SDL_max(at_a->y, at_b->y);
+    int bottom = SDL_min(at_a->y + at_a->h, at_b->y + at_b->h);
+    Uint64 overlap = low_bits(right - left);
+
+    for (int y = top; y < bottom; y++)
+    {
+        Uint64 row_a = a->rows[y - at_a->y] >> (left - at_a->x);
+        Uint64 row_b = b->rows[y - at_b->y] >> (left - at_b->x);
+
+        if (row_a & row_b & overlap)
+            return true;
+    }
+    return false;
+}
+
+//The player's hitboxes across its roll, from its image drawn from the top
+//left PLAYER_WIDTH x PLAYER_HEIGHT (see render()).
+void hitbox_build_player(Game* game, SDL_Surface* surface)
+{
+    SDL_Rect src_rect = {0, 0, PLAYER_WIDTH, PLAYER_HEIGHT};
+
+    for (int i = 0; i < HITBOX_ROLL_STEPS; i++)
+    {
+        float roll = -PLAYER_MAX_ROLL + 2 * PLAYER_MAX_ROLL * i / (HITBOX_ROLL_STEPS - 1);
+        hitbox_build(&game->player_hitboxes[i], surface, &src_rect, PLAYER_WIDTH, PLAYER_HEIGHT, roll);
+    }
+}
+
+//Builds the player and enemy hitboxes straight from their images, for
+//headless games that never load textures. False if either is missing.
+bool hitbox_load(Game* game)
+{
+    SDL_Surface* player = IMG_Load(PLAYER_IMAGE);
+    SDL_Surface* enemy = IMG_Load(ENEMY_IMAGE);
+    bool loaded = player && enemy;
+
+    if (loaded)
+    {
+        hitbox_build_player(game, player);
+        hitbox_build(&game->enemy_hitbox, enemy, NULL, ENEMY_SIZE, ENEMY_SIZE, 0);
+    }
+    else
+        SDL_Log("Unable to load the hitbox images! SDL_Error: %s\n", SDL_GetError());
+
+    SDL_FreeSurface(player);
+    SDL_FreeSurface(enemy);
+    return loaded;
+}
+
+//The player's hitbox for its current roll.
+const Hitbox* player_hitbox(Game* game, const Player* player)
+{
+    float t = (player->roll_angle + PLAYER_MAX_ROLL) / (2 * PLAYER_MAX_ROLL);
+    int step = (int)(t * (HITBOX_ROLL_STEPS - 1) + 0.5f);
+
+    return &game->player_hitboxes[SDL_max(0, SDL_min(step, HITBOX_ROLL_STEPS - 1))];
+}
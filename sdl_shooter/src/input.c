@@ -0,0 +1,203 @@
+#include "main.h"
+
+//Input pipeline. handle_events() feeds every key, button and wheel event in
+//here with its timestamp; they are kept in order in the pending buffer until
+//input_sample() folds them into the TickInput for the next update, right
+//before the simulation runs. Presses are latched, so a tap that starts and
+//ends between two samples still fires. The oldest event behind a tick is
+//remembered until that tick is presented to measure input latency.
+
+typedef struct
+{
+    SDL_Scancode scancode;
+    Uint16 action;
+} KeyBinding;
+
+static const KeyBinding KEY_BINDINGS[] =
+{
+    {SDL_SCANCODE_LEFT,     ACT_LEFT},
+    {SDL_SCANCODE_A,        ACT_LEFT},
+    {SDL_SCANCODE_RIGHT,    ACT_RIGHT},
+    {SDL_SCANCODE_D,        ACT_RIGHT},
+    {SDL_SCANCODE_SPACE,    ACT_FIRE},
+    {SDL_SCANCODE_LCTRL,    ACT_AFTERBURNER},
+    {SDL_SCANCODE_RCTRL,    ACT_AFTERBURNER},
+    {SDL_SCANCODE_Q,        ACT_PREV_WEAPON},
+    {SDL_SCANCODE_E,        ACT_NEXT_WEAPON},
+    {SDL_SCANCODE_R,        ACT_REWIND},
+    {SDL_SCANCODE_BACKSPACE, ACT_REWIND}
+};
+
+static Uint16 key_action(SDL_Scancode scancode)
+{
+    for (size_t i = 0; i < SDL_arraysize(KEY_BINDINGS); i++)
+        if (KEY_BINDINGS[i].scancode == scancode)
+            return KEY_BINDINGS[i].action;
+    return 0;
+}
+
+static Uint16 button_action(Uint8 button)
+{
+    if (button == SDL_BUTTON_LEFT)
+        return ACT_FIRE;
+    if (button == SDL_BUTTON_RIGHT)
+        return ACT_AFTERBURNER;
+    return 0;
+}
+
+//SDL stamps events in milliseconds on the SDL_GetTicks() clock; move that
+//onto the performance counter so it can be compared with present times.
+static Uint64 event_counter_time(Uint32 timestamp)
+{
+    Uint64 now = SDL_GetPerformanceCounter();
+    Uint32 age_ms = SDL_GetTicks() - timestamp;
+    Uint64 age = (Uint64)age_ms * SDL_GetPerformanceFrequency() / 1000;
+
+    return age < now ? now - age : now;
+}
+
+//Applies one event to the held counts, and to the presses and wheel steps
+//the next sample hands out.
+static void input_fold(InputState* input, const InputEvent* ev)
+{
+    input->wheel += ev->wheel;
+
+    for (int bit = 0; bit < ACT_COUNT; bit++)
+    {
+        if (!(ev->action & (1 << bit)))
+            continue;
+
+        //Counted per action so releasing A doesn't cancel a held LEFT.
+        if (ev->down)
+        {
+            input->down_count[bit]++;
+            input->pressed |= 1 << bit;
+        }
+        else if (input->down_count[bit] > 0)
+            input->down_count[bit]--;
+    }
+}
+
+static void input_push(InputState* input, Uint32 timestamp, Uint16 action, bool down, int wheel)
+{
+    //A full buffer means we haven't sampled in a long time. The oldest event
+    //is folded in early rather than dropped: a lost release would leave its
+    //action held.
+    if (input->num_pending == INPUT_MAX_EVENTS)
+    {
+        if (input->folded_time == 0)
+            input->folded_time = input->pending[0].time;
+        input_fold(input, &input->pending[0]);
+        memmove(input->pending, input->pending + 1, sizeof(InputEvent) * (INPUT_MAX_EVENTS - 1));
+        input->num_pending--;
+    }
+
+    InputEvent* ev = &input->pending[input->num_pending++];
+    ev->time = event_counter_time(timestamp);
+    ev->action = action;
+    ev->down = down;
+    ev->wheel = (Sint8)SDL_max(-127, SDL_min(127, wheel));
+}
+
+//Returns true if the event was game input.
+bool input_handle_event(Game* game, const SDL_Event* event)
+{
+    InputState* input = &game->input;
+    Uint16 action;
+
+    switch (event->type)
+    {
+        case SDL_KEYDOWN:
+        case SDL_KEYUP:
+            if (event->key.repeat || (action = key_action(event->key.keysym.scancode)) == 0)
+                return false;
+            input_push(input, event->key.timestamp, action, event->type == SDL_KEYDOWN, 0);
+            return true;
+
+        case SDL_MOUSEBUTTONDOWN:
+        case SDL_MOUSEBUTTONUP:
+            if ((action = button_action(event->button.button)) == 0)
+                return false;
+            input_push(input, event->button.timestamp, action, event->type == SDL_MOUSEBUTTONDOWN, 0);
+            return true;
+
+        case SDL_MOUSEWHEEL:
+        {
+            int steps = event->wheel.direction == SDL_MOUSEWHEEL_FLIPPED ? -event->wheel.y : event->wheel.y;
+            if (steps == 0)
+                return false;
+            //Wheel up selects the previous weapon, like scrolling up a list.
+            input_push(input, event->wheel.timestamp, 0, false, -steps);
+            return true;
+        }
+    }
+    return false;
+}
+
+//Folds the pending events into game->tick_input for the coming update.
+void input_sample(Game* game)
+{
+    InputState* input = &game->input;
+    TickInput* tick = &game->tick_input;
+
+    tick->event_time = input->folded_time ? input->folded_time : input->num_pending ? input->pending[0].time : 0;
+
+    for (int i = 0; i < input->num_pending; i++)
+        input_fold(input, &input->pending[i]);
+    input->num_pending = 0;
+
+    tick->pressed = input->pressed;
+    tick->wheel = input->wheel;
+    input->pressed = 0;
+    input->wheel = 0;
+    input->folded_time = 0;
+
+    tick->held = 0;
+    for (int bit = 0; bit < ACT_COUNT; bit++)
+        if (input->down_count[bit] > 0)
+            tick->held |= 1 << bit;
+
+    //Keep the oldest event that hasn't reached the screen yet.
+    if (tick->event_time && input->latency_start == 0)
+        input->latency_start = tick->event_time;
+}
+
+//Hands the last sample's presses and wheel steps on to the next one, for
+//an update that ran no tick: between ticks they would be lost.
+void input_defer(Game* game)
+{
+    InputState* input = &game->input;
+    TickInput* tick = &game->tick_input;
+
+    input->pressed |= tick->pressed;
+    input->wheel += tick->wheel;
+    if (tick->event_time && (input->folded_time == 0 || tick->event_time < input->folded_time))
+        input->folded_time = tick->event_time;
+
+    //Not on screen with this frame either.
+    if (input->latency_start == tick->event_time)
+        input->latency_start = 0;
+}
+
+//Forgets everything pending and held, e.g. after the game has been idle:
+//keys released in another window never come back up here.
+void input_reset(Game* game)
+{
+    memset(&game->input, 0, sizeof(InputState));
+    memset(&game->tick_input, 0, sizeof(TickInput));
+}
+
+//Called right after a present: the input behind it is now visible.
+void input_mark_presented(Game* game)
+{
+    InputState* input = &game->input;
+
+    if (input->latency_start == 0)
+        return;
+
+    Uint64 now = SDL_GetPerformanceCounter();
+    float ms = (float)((now - input->latency_start) * 1000.0 / SDL_GetPerformanceFrequency());
+
+    stats_record_latency(game, ms);
+    input->latency_start = 0;
+}
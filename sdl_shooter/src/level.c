@@ -0,0 +1,453 @@
+#define _POSIX_C_SOURCE 200112L     //mmap() under -std=c11
+#define _DEFAULT_SOURCE             //madvise(); glibc's posix_madvise() ignores POSIX_MADV_DONTNEED
+
+#include "main.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//Levels (--level FILE). A level is a list of events sorted by how far the
+//background has scrolled when they happen: single enemies, waves, planets
+//and powerups. The file is mapped rather than read, and the sim only looks
+//at the next unplayed event each tick (its index lives in SimState, so
+//rewind, resume and rollback carry it along). Pages that have scrolled past
+//are handed back to the kernel, so a level of any length starts at once and
+//stays at a few pages of memory.
+//
+//Files are built from a text description with --build-level SRC OUT; see
+//levels/level1.txt for the syntax.
+//
+//Layout, all little endian:
+//  header  "SHLV", u16 version, u16 flags, u32 event count, u32 length (px)
+//  events  LEVEL_EVENT_SIZE bytes each, sorted by distance:
+//          u32 distance, u8 type, u8 variant, u8 count, u8 spacing / 4,
+//          u8 fields, 3 bytes reserved, s16 x, s16 a, s16 b, s16 hp
+//x, a and b only count when their FIELD_* bit is set in fields, anything
+//else is picked the way random spawning would. Any value is a valid one,
+//-1 included.
+
+#define LEVEL_MAGIC         "SHLV"
+#define LEVEL_VERSION       2
+#define LEVEL_HEADER_SIZE   16
+#define LEVEL_EVENT_SIZE    20
+#define LEVEL_FLAG_LOOP     1
+#define LEVEL_RANDOM        -1      //For spawn_planet(), any image
+
+//LevelEvent.fields
+#define FIELD_X             (1 << 0)
+#define FIELD_A             (1 << 1)
+#define FIELD_B             (1 << 2)
+#define LEVEL_RELEASE_BYTES (64 * 1024)     //Played bytes kept mapped before giving them back
+
+enum
+{
+    EVENT_ENEMY,            //variant = weapon, a/b = velocity, hp
+    EVENT_WAVE,             //count enemies in a row from x, spacing apart
+    EVENT_PLANET,           //variant = image, a = scale in percent
+    EVENT_POWERUP,          //variant = PowerUpType
+    EVENT_TYPES
+};
+
+static const char* EVENT_NAMES[EVENT_TYPES] = {"enemy", "wave", "planet", "powerup"};
+
+typedef struct
+{
+    Uint32 distance;
+    Uint8 type, variant, count, spacing;
+    Uint8 fields;           //FIELD_* bits of the values that were given
+    Sint16 x, a, b, hp;
+} LevelEvent;
+
+struct Level
+{
+    const Uint8* data;
+    size_t size;
+    int fd;
+    Uint32 num_events;
+    Uint32 length;
+    Uint16 flags;
+    size_t released;        //Bytes at the start already given back
+    long page_size;
+};
+
+static Uint16 read16(const Uint8* p) { Uint16 v; memcpy(&v, p, 2); return SDL_SwapLE16(v); }
+static Uint32 read32(const Uint8* p) { Uint32 v; memcpy(&v, p, 4); return SDL_SwapLE32(v); }
+static void write16(Uint8* p, Uint16 v) { v = SDL_SwapLE16(v); memcpy(p, &v, 2); }
+static void write32(Uint8* p, Uint32 v) { v = SDL_SwapLE32(v); memcpy(p, &v, 4); }
+
+static void read_event(const Level* level, Uint32 index, LevelEvent* event)
+{
+    const Uint8* p = level->data + LEVEL_HEADER_SIZE + (size_t)index * LEVEL_EVENT_SIZE;
+
+    event->distance = read32(p);
+    event->type = p[4];
+    event->variant = p[5];
+    event->count = p[6];
+    event->spacing = p[7];
+    event->fields = p[8];
+    event->x = (Sint16)read16(p + 12);
+    event->a = (Sint16)read16(p + 14);
+    event->b = (Sint16)read16(p + 16);
+    event->hp = (Sint16)read16(p + 18);
+}
+
+static void write_event(Uint8* p, const LevelEvent* event)
+{
+    write32(p, event->distance);
+    p[4] = event->type;
+    p[5] = event->variant;
+    p[6] = event->count;
+    p[7] = event->spacing;
+    p[8] = event->fields;
+    memset(p + 9, 0, 3);
+    write16(p + 12, (Uint16)event->x);
+    write16(p + 14, (Uint16)event->a);
+    write16(p + 16, (Uint16)event->b);
+    write16(p + 18, (Uint16)event->hp);
+}
+
+//x is only used when the event has FIELD_X.
+static void spawn_level_enemy(Game* game, const LevelEvent* event, int x)
+{
+    Enemy* enemy = spawn_enemy(game);
+    if (enemy == NULL)
+        return;
+
+    if (event->fields & FIELD_X)
+        enemy->position.x = SDL_max(0, SDL_min(x, SCREEN_WIDTH - enemy->position.w));
+    if (event->variant < MAX_WEAPONS)
+        enemy->current_weapon = event->variant;
+    if (event->fields & FIELD_A)
+        enemy->velocity_x = event->a;
+    if (event->fields & FIELD_B)
+        enemy->velocity_y = event->b;
+    //A scripted course is kept, not steered.
+    if (event->fields & (FIELD_A | FIELD_B))
+        behaviour_start(game, (int)(enemy - game->sim.enemies), BEHAVE_DRIFT);
+    if (event->hp > 0)
+        enemy->max_hp = enemy->hit_points = event->hp;
+}
+
+static void play_event(Game* game, const LevelEvent* event)
+{
+    switch (event->type)
+    {
+        case EVENT_ENEMY:
+            spawn_level_enemy(game, event, event->x);
+            break;
+
+        case EVENT_WAVE:
+            for (int i = 0; i < event->count; i++)
+                spawn_level_enemy(game, event, event->x + i * event->spacing * 4);
+            break;
+
+        case EVENT_PLANET:
+        {
+            Planet* planet = spawn_planet(game, event->variant < MAX_PLANETS ? event->variant : LEVEL_RANDOM);
+            if (planet == NULL)
+                break;
+            if ((event->fields & FIELD_A) && event->a > 0)
+            {
+                planet->scale = event->a / 100.0f;
+                planet->position.w = planet->position.h = (int)(96 * planet->scale);
+                planet->position.y = -planet->position.h;
+            }
+            if (event->fields & FIELD_X)
+                planet->position.x = SDL_max(0, SDL_min(event->x, SCREEN_WIDTH - planet->position.w));
+            break;
+        }
+
+        case EVENT_POWERUP:
+        {
+            PowerUp* powerup = spawn_powerup(game);
+            if (powerup == NULL)
+                break;
+            if (event->variant <= POWERUP_AMMO)
+                powerup->type = event->variant;
+            if (event->fields & FIELD_X)
+                powerup->position.x = SDL_max(0, SDL_min(event->x, SCREEN_WIDTH - POWERUP_SIZE));
+            break;
+        }
+    }
+}
+
+//Gives back the pages of events that have been played. They come back from
+//the page cache if a rewind needs them again.
+static void release_played(Level* level, Uint32 next_event)
+{
+    size_t played = LEVEL_HEADER_SIZE + (size_t)next_event * LEVEL_EVENT_SIZE;
+
+    if (played < level->released + LEVEL_RELEASE_BYTES + level->page_size)
+        return;
+
+    size_t upto = (played - LEVEL_RELEASE_BYTES) / level->page_size * level->page_size;
+    if (upto > level->released)
+    {
+        madvise((void*)(level->data + level->released), upto - level->released, MADV_DONTNEED);
+        level->released = upto;
+    }
+}
+
+//Plays every event the scroll has reached. Called once per sim step.
+void level_update(Game* game)
+{
+    Level* level = game->level;
+    SimState* sim = &game->sim;
+    LevelEvent event;
+
+    if (level == NULL)
+        return;
+
+    double distance = sim->distance - sim->level_origin;
+
+    while (sim->level_event < level->num_events)
+    {
+        read_event(level, sim->level_event, &event);
+        if (event.distance > distance)
+            break;
+
+        play_event(game, &event);
+        sim->level_event++;
+    }
+
+    //Looping levels start over once the scroll passes the end.
+    if ((level->flags & LEVEL_FLAG_LOOP) && distance >= level->length && sim->level_event >= level->num_events)
+    {
+        sim->level_origin += level->length;
+        sim->level_event = 0;
+        level->released = 0;
+    }
+
+    release_played(level, sim->level_event);
+}
+
+Level* level_open(const char* path)
+{
+    char buf[MSL];
+    struct stat st;
+    Level* level = mem_calloc(MEM_ASSETS, 1, sizeof(Level));
+
+    if (level == NULL)
+        return NULL;
+
+    level->fd = open(path, O_RDONLY);
+    if (level->fd < 0 || fstat(level->fd, &st) < 0 || st.st_size < LEVEL_HEADER_SIZE)
+    {
+        snprintf(buf, sizeof(buf), "Unable to open level %s\n", path);
+        LOG(buf);
+        level_close(level);
+        return NULL;
+    }
+
+    level->size = (size_t)st.st_size;
+    void* data = mmap(NULL, level->size, PROT_READ, MAP_PRIVATE, level->fd, 0);
+    if (data == MAP_FAILED)
+    {
+        snprintf(buf, sizeof(buf), "Unable to map level %s\n", path);
+        LOG(buf);
+        level_close(level);
+        return NULL;
+    }
+
+    level->data = data;
+    level->page_size = sysconf(_SC_PAGESIZE);
+    madvise(data, level->size, MADV_SEQUENTIAL);
+
+    //Only the header is read now; events are read as the scroll reaches them.
+    level->flags = read16(level->data + 6);
+    level->num_events = read32(level->data + 8);
+    level->length = read32(level->data + 12);
+
+    if (memcmp(level->data, LEVEL_MAGIC, 4) != 0 || read16(level->data + 4) != LEVEL_VERSION ||
+        (level->size - LEVEL_HEADER_SIZE) / LEVEL_EVENT_SIZE < level->num_events)
+    {
+        snprintf(buf, sizeof(buf), "%s is not a level file from this version\n", path);
+        LOG(buf);
+        level_close(level);
+        return NULL;
+    }
+
+    snprintf(buf, sizeof(buf), "Level %s: %u events over %u px%s\n", path, level->num_events, level->length,
+             (level->flags & LEVEL_FLAG_LOOP) ? ", looping" : "");
+    LOG(buf);
+    return level;
+}
+
+void level_close(Level* level)
+{
+    if (level == NULL)
+        return;
+
+    if (level->data)
+        munmap((void*)level->data, level->size);
+    if (level->fd >= 0)
+        close(level->fd);
+    mem_free(level);
+}
+
+static int compare_events(const void* a, const void* b)
+{
+    Uint32 da = ((const LevelEvent*)a)->distance, db = ((const LevelEvent*)b)->distance;
+    return (da > db) - (da < db);
+}
+
+//Reads "key=value" into *out if the word is that key.
+static bool parse_field(const char* word, const char* key, int* out)
+{
+    size_t len = strlen(key);
+
+    if (strncmp(word, key, len) != 0 || word[len] != '=')
+        return false;
+
+    *out = atoi(word + len + 1);
+    return true;
+}
+
+//Compiles a text level into the binary format. Lines are
+//    DISTANCE TYPE [key=value ...]
+//with TYPE one of enemy, wave, planet or powerup, plus "length PX" and
+//"loop". Returns false and logs the line on the first error.
+bool level_build(const char* src_path, const char* out_path)
+{
+    char buf[MSL], line[MSL];
+    LevelEvent* events = NULL;
+    int num_events = 0, capacity = 0, line_number = 0;
+    Uint32 length = 0;
+    Uint16 flags = 0;
+    bool ok = true;
+
+    FILE* src = fopen(src_path, "r");
+    if (src == NULL)
+    {
+        snprintf(buf, sizeof(buf), "Unable to read %s\n", src_path);
+        LOG(buf);
+        return false;
+    }
+
+    while (ok && fgets(line, sizeof(line), src))
+    {
+        char* words[16];
+        int num_words = 0;
+
+        line_number++;
+        for (char* word = strtok(line, " \t\r\n"); word && num_words < 16; word = strtok(NULL, " \t\r\n"))
+        {
+            if (word[0] == '#')
+                break;
+            words[num_words++] = word;
+        }
+
+        if (num_words == 0)
+            continue;
+        if (!strcmp(words[0], "loop"))
+        {
+            flags |= LEVEL_FLAG_LOOP;
+            continue;
+        }
+        if (!strcmp(words[0], "length") && num_words == 2)
+        {
+            length = (Uint32)strtoul(words[1], NULL, 10);
+            continue;
+        }
+
+        LevelEvent event = {(Uint32)strtoul(words[0], NULL, 10), EVENT_TYPES, 0xFF, 1, 0, 0, 0, 0, 0, 0};
+
+        for (int type = 0; num_words > 1 && type < EVENT_TYPES; type++)
+            if (!strcmp(words[1], EVENT_NAMES[type]))
+                event.type = type;
+
+        for (int i = 2; i < num_words && event.type < EVENT_TYPES; i++)
+        {
+            int value;
+
+            if (parse_field(words[i], "x", &value))
+            {
+                event.x = (Sint16)value;
+                event.fields |= FIELD_X;
+            }
+            else if (parse_field(words[i], "weapon", &value) || parse_field(words[i], "image", &value) ||
+                     parse_field(words[i], "type", &value))
+                event.variant = (Uint8)value;
+            else if (parse_field(words[i], "vx", &value) || parse_field(words[i], "scale", &value))
+            {
+                event.a = (Sint16)value;
+                event.fields |= FIELD_A;
+            }
+            else if (parse_field(words[i], "vy", &value))
+            {
+                event.b = (Sint16)value;
+                event.fields |= FIELD_B;
+            }
+            else if (parse_field(words[i], "hp", &value))
+                event.hp = (Sint16)value;
+            else if (parse_field(words[i], "count", &value))
+                event.count = (Uint8)SDL_max(1, SDL_min(value, 255));
+            else if (parse_field(words[i], "spacing", &value))
+                event.spacing = (Uint8)SDL_max(0, SDL_min(value / 4, 255));
+            else
+                event.type = EVENT_TYPES;
+        }
+
+        if (event.type == EVENT_TYPES)
+        {
+            snprintf(buf, sizeof(buf), "%s:%d: can't make sense of this line\n", src_path, line_number);
+            LOG(buf);
+            ok = false;
+            break;
+        }
+
+        if (num_events == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 256;
+            LevelEvent* grown = mem_realloc(MEM_ASSETS, events, sizeof(LevelEvent) * capacity);
+            if (grown == NULL)
+            {
+                ok = false;
+                break;
+            }
+            events = grown;
+        }
+        events[num_events++] = event;
+    }
+    fclose(src);
+
+    FILE* out = ok ? fopen(out_path, "wb") : NULL;
+    if (ok && out == NULL)
+    {
+        snprintf(buf, sizeof(buf), "Unable to write %s\n", out_path);
+        LOG(buf);
+        ok = false;
+    }
+
+    if (ok)
+    {
+        Uint8 header[LEVEL_HEADER_SIZE];
+        Uint8 record[LEVEL_EVENT_SIZE];
+
+        qsort(events, num_events, sizeof(LevelEvent), compare_events);
+        if (num_events && length < events[num_events - 1].distance)
+            length = events[num_events - 1].distance;
+
+        memcpy(header, LEVEL_MAGIC, 4);
+        write16(header + 4, LEVEL_VERSION);
+        write16(header + 6, flags);
+        write32(header + 8, (Uint32)num_events);
+        write32(header + 12, length);
+        ok = fwrite(header, sizeof(header), 1, out) == 1;
+
+        for (int i = 0; ok && i < num_events; i++)
+        {
+            write_event(record, &events[i]);
+            ok = fwrite(record, sizeof(record), 1, out) == 1;
+        }
+        ok = fclose(out) == 0 && ok;
+
+        snprintf(buf, sizeof(buf), "%s: %d events over %u px written to %s\n", src_path, num_events, length, out_path);
+        LOG(buf);
+    }
+
+    mem_free(events);
+    return ok;
+}
@@ -11,33 +11,23 @@ const SDL_Color CLR_LIME_GREEN =    {50, 205, 50, 255};
 const SDL_Color CLR_CYAN =          {0, 255, 255, 255};
 const SDL_Color CLR_MAGENTA =       {255, 0, 255, 255};
 
-const WeaponType WEAPON_TYPES[] = 
-{//max_ammo,damage, fire_rate,  bullet_speed,   cooldown,name,              offx,   offy,   width,  height
-    {100,   10,     0.5,        6,            250,     "Laser",           1,      4,      2,      12},
-    {40,    20,     1.0,        5,            500,     "Plasma Gun",      2,      4,      4,      8},
-    {250,   25,     300,        4,            400,     "Railgun",         8,      8,      16,     16},
-    {500,   2,      600,        2.5,          150,     "Rapid Fire",      1,      1,      2,      2},
-    {20,    50,     200,        15,           2000,    "Missile",         8,      8,      16,     16}
-};
-
 //function prototypes
-void change_weapon(Game * game, int direction);
+void change_weapon(Game * game, Player * player, int direction);
 
 void check_planet_collision(Game * game);
 
 void cleanup(Game* game);
 
-void create_explosion(float x, float y);
+void create_explosion(Game* game, float x, float y);
 
 void draw_shield(Game* game, int x, int y, int radius, Uint32 remaining_time, Uint32 total_time);
 
 void handle_events(Game* game);
-void handle_input(Game* game);
+bool idle_wait(Game* game);
+void handle_input(Game* game, Player* player, const TickInput* input);
 
 void init_enemies(Game* game);
 bool init_game(Game* game);
-void init_particles();
-void init_planets(Game* game);
 void init_powerups(Game* game);
 
 bool load_background(Game* game);
@@ -45,66 +35,236 @@ bool load_planet_textures(Game* game);
 bool load_player(Game* game);
 bool load_weapon_textures(Game * game);
 
-int rnd_num(int min, int max);
+void parse_args(Game* game, int argc, char* argv[]);
+
+int rnd_num(Game* game, int min, int max);
 
-void render(Game* game);
 void render_afterburner_meter(Game* game);
 void render_afterburner_particles(Game* game);
-void render_gradient_bar(SDL_Renderer* renderer, int x, int y, int width, int height, float percentage, SDL_Color start_color, SDL_Color end_color);
+void render_gradient_bar(Game* game, int x, int y, int width, int height, float percentage, SDL_Color start_color, SDL_Color end_color);
 void render_score(Game* game);
-void render_text(SDL_Renderer* renderer, TTF_Font* font, const char* text, int x, int y, SDL_Color color);
 void render_enemies(Game* game);
-void render_particles(SDL_Renderer *renderer);
-
-void shoot_projectile(Game* game, Enemy * enemy, Player * player);
+void render_particles(Game* game);
 
-void spawn_enemy(Game* game);
 
-void update(Game* game);
 void update_afterburner_particles(Game* game, float delta_time);
 void update_enemies(Game* game, float delta_time);
-void update_particles();
+void update_particles(Game* game);
 void update_planets(Game* game, float delta_time);
-void update_player(Game* game, float delta_time);
-void update_projectiles(Game* game, float delta_time);
+void update_player(Player* player, float delta_time);
 
-//Main game loop.
+//Main game loop. Left out of libspace (make lib), which embeds the game instead.
+#ifndef SPACE_NO_MAIN
 int main(int argc, char* argv[]) 
 {
-    Game game;
-    
-    if (argc > 0)
-    {
-        if (argv[1])
-            LOG(argv[1]);
-    }
+    Game game = {0};
+
+    mem_install();
+    parse_args(&game, argc, argv);
+
+    if (game.opts.level_source[0])
+        return level_build(game.opts.level_source, game.opts.level_output) ? 0 : 1;
+
+    if (game.opts.batch_games > 0)
+        return run_batch(&game);
 
     if (!init_game(&game)) 
         return 1;    
 
-    game.last_frame_time = SDL_GetTicks();
+    if (game.opts.test_dir[0] || game.opts.bench_frames > 0)
+    {
+        int result = game.opts.test_dir[0] ? run_replay_test(&game) : run_render_bench(&game);
+        mem_disarm();
+        cleanup(&game);
+        return mem_report() ? result : 1;
+    }
+
+    game.last_update_counter = SDL_GetPerformanceCounter();
+    pacer_init(&game.pacer, &game.opts);
 
     while (game.is_running)     
     {
-        Uint32 frame_start = SDL_GetTicks();
-
         handle_events(&game);
-        update(&game);
+        if (idle_wait(&game))
+            continue;
+        input_sample(&game);        //As late as possible, right before the sim uses it
+        if (game.net)
+            net_update(&game);
+        else if (game.watch)
+            watch_update(&game);
+        else
+            update(&game);
+        spectate_publish(&game);
         render(&game);
-
-        Uint32 frame_time = SDL_GetTicks() - frame_start;
-        if (frame_time < FRAME_TARGET_TIME) 
-            SDL_Delay(FRAME_TARGET_TIME - frame_time);        
+        pacer_end_frame(&game);
+        mem_frame_end(&game);
     }
 
+    mem_disarm();
     cleanup(&game);
-    return 0;
+    return mem_report() ? 0 : 1;
+}
+#endif
+
+//Reads command line switches into the game before anything is initialized.
+void parse_args(Game* game, int argc, char* argv[])
+{
+    char buf[MSL];
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--soft"))
+            game->opts.soft_renderer = true;
+        else if (!strcmp(argv[i], "--fps") && i + 1 < argc)
+            game->opts.target_fps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--vsync"))
+            game->opts.vsync = true;
+        else if (!strcmp(argv[i], "--uncapped"))
+            game->opts.uncapped = true;
+        else if (!strcmp(argv[i], "--stats") && i + 1 < argc)
+            snprintf(game->opts.stats_file, sizeof(game->opts.stats_file), "%s", argv[++i]);
+        else if (!strcmp(argv[i], "--quality") && i + 1 < argc)
+        {
+            //"auto" (the default) leaves it to the governor.
+            game->opts.quality_fixed = strcmp(argv[++i], "auto") != 0;
+            game->opts.quality = atoi(argv[i]);
+        }
+        else if (!strcmp(argv[i], "--tex-budget") && i + 1 < argc)
+            game->opts.texture_budget_kb = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--stream-budget") && i + 1 < argc)
+            game->opts.stream_budget_kb = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+            game->opts.seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+        else if ((!strcmp(argv[i], "--capture") || !strcmp(argv[i], "--capture-raw")) && i + 1 < argc)
+        {
+            game->opts.capture_png = !strcmp(argv[i], "--capture");
+            game->opts.capture_sequence = true;
+            snprintf(game->opts.capture_dir, sizeof(game->opts.capture_dir), "%s", argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--test") && i + 1 < argc)
+            snprintf(game->opts.test_dir, sizeof(game->opts.test_dir), "%s", argv[++i]);
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+            game->opts.test_frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--tolerance") && i + 1 < argc)
+            game->opts.golden_tolerance = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--bless"))
+            game->opts.bless = true;
+        else if (!strcmp(argv[i], "--bench") && i + 1 < argc)
+            game->opts.bench_frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--host"))
+        {
+            game->opts.net_mode = NET_HOST;
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                game->opts.net_port = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--join") && i + 1 < argc)
+        {
+            char* port;
+
+            game->opts.net_mode = NET_JOIN;
+            snprintf(game->opts.net_address, sizeof(game->opts.net_address), "%s", argv[++i]);
+            if ((port = strrchr(game->opts.net_address, ':')) != NULL)
+            {
+                *port = '\0';
+                game->opts.net_port = atoi(port + 1);
+            }
+        }
+        else if (!strcmp(argv[i], "--level") && i + 1 < argc)
+            snprintf(game->opts.level_file, sizeof(game->opts.level_file), "%s", argv[++i]);
+        else if (!strcmp(argv[i], "--build-level") && i + 2 < argc)
+        {
+            snprintf(game->opts.level_source, sizeof(game->opts.level_source), "%s", argv[++i]);
+            snprintf(game->opts.level_output, sizeof(game->opts.level_output), "%s", argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--mute"))
+            game->opts.mute = true;
+        else if (!strcmp(argv[i], "--log-events"))
+            game->opts.log_events = true;
+        else if (!strcmp(argv[i], "--no-alloc"))
+            game->opts.mem_assert = true;
+        else if (!strcmp(argv[i], "--batch") && i + 1 < argc)
+            game->opts.batch_games = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            game->opts.batch_threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--ticks") && i + 1 < argc)
+            game->opts.batch_ticks = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--batch-logs") && i + 1 < argc)
+            snprintf(game->opts.batch_logs, sizeof(game->opts.batch_logs), "%s", argv[++i]);
+        else if (!strcmp(argv[i], "--batch-csv") && i + 1 < argc)
+            snprintf(game->opts.batch_csv, sizeof(game->opts.batch_csv), "%s", argv[++i]);
+        else if (!strcmp(argv[i], "--resume") && i + 1 < argc)
+            snprintf(game->opts.resume_file, sizeof(game->opts.resume_file), "%s", argv[++i]);
+        else if (!strcmp(argv[i], "--net-sim") && i + 1 < argc)
+            sscanf(argv[++i], "%d,%d", &game->opts.net_latency_ms, &game->opts.net_loss_percent);
+        else if (!strcmp(argv[i], "--spectate") && i + 1 < argc)
+            snprintf(game->opts.spectate_address, sizeof(game->opts.spectate_address), "%s", argv[++i]);
+        else if (!strcmp(argv[i], "--watch") && i + 1 < argc)
+            snprintf(game->opts.watch_address, sizeof(game->opts.watch_address), "%s", argv[++i]);
+        else
+        {
+            snprintf(buf, sizeof(buf), "Unknown option: %s\n", argv[i]);
+            LOG(buf);
+        }
+    }
+
+    if (game->opts.texture_budget_kb <= 0)
+        game->opts.texture_budget_kb = TEX_DEFAULT_BUDGET_KB;
+    if (game->opts.stream_budget_kb <= 0)
+        game->opts.stream_budget_kb = STREAM_DEFAULT_BUDGET_KB;
+
+    //The replay test is always headless, deterministic and software rendered.
+    if (game->opts.test_dir[0])
+    {
+        game->opts.soft_renderer = true;
+        game->opts.fixed_step = true;
+        game->opts.capture_sequence = false;
+        game->opts.resume_file[0] = '\0';
+        if (game->opts.seed == 0)
+            game->opts.seed = 1;
+        if (game->opts.test_frames <= 0)
+            game->opts.test_frames = GOLDEN_DEFAULT_FRAMES;
+        if (game->opts.golden_tolerance <= 0)
+            game->opts.golden_tolerance = GOLDEN_DEFAULT_TOLERANCE;
+        game->opts.golden_every = GOLDEN_DEFAULT_EVERY;
+    }
+
+    //The benchmark plays the same seeded session under either renderer, at
+    //full quality so the governor doesn't lighten the load it measures.
+    if (game->opts.bench_frames > 0)
+    {
+        game->opts.fixed_step = true;
+        game->opts.quality_fixed = true;
+        game->opts.quality = 0;
+        game->opts.capture_sequence = false;
+        game->opts.resume_file[0] = '\0';
+        game->opts.mute = true;
+        if (game->opts.seed == 0)
+            game->opts.seed = 1;
+    }
+
+    //Both sides of a co-op game must run the exact same ticks.
+    if (game->opts.net_mode)
+    {
+        game->opts.fixed_step = true;
+        if (game->opts.net_port <= 0)
+            game->opts.net_port = NET_DEFAULT_PORT;
+    }
 }
 
 //Initializes everything for the game.
 bool init_game(Game* game) 
 {
-    srand(time(NULL));
+    srand(game->opts.seed ? game->opts.seed : (unsigned int)time(NULL));
+
+    if (game->opts.test_dir[0] || game->opts.bench_frames > 0)
+    {
+        SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+        SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+    }
+
+    //What SDL and its libraries allocate from here on is tagged by what it
+    //is for, see memory.c.
+    MemTag tag = mem_set_tag(MEM_RENDERER);
 
     if (SDL_Init(SDL_INIT_VIDEO) < 0) 
     {
@@ -119,13 +279,44 @@ bool init_game(Game* game)
         return false;
     }
 
-    game->renderer = SDL_CreateRenderer(game->window, -1, SDL_RENDERER_ACCELERATED);
+    //The software rasterizer only presents through SDL, so it takes any
+    //renderer, including SDL's own software one under the dummy video driver
+    //the replay test uses, which doesn't advertise SDL_RENDERER_ACCELERATED.
+    //Otherwise capture and reduced resolution frames both draw offscreen first.
+    //The benchmark compares the rasterizer with SDL's software renderer.
+    Uint32 renderer_flags = 0;
+    if (game->opts.bench_frames > 0)
+        renderer_flags |= SDL_RENDERER_SOFTWARE | (game->opts.soft_renderer ? 0 : SDL_RENDERER_TARGETTEXTURE);
+    else if (!game->opts.soft_renderer)
+        renderer_flags |= SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE;
+    if (game->opts.vsync && !game->opts.uncapped)
+        renderer_flags |= SDL_RENDERER_PRESENTVSYNC;
+
+    game->renderer = SDL_CreateRenderer(game->window, -1, renderer_flags);
     if (game->renderer == NULL) 
     {
         SDL_Log("Renderer could not be created! SDL_Error: %s\n", SDL_GetError());
         return false;
     }
 
+    if (game->opts.soft_renderer)
+    {
+        game->soft = soft_create(game->renderer, SCREEN_WIDTH, SCREEN_HEIGHT);
+        if (game->soft == NULL)
+            return false;
+    }
+
+    quality_init(game);
+
+    if (game->opts.capture_sequence || game->opts.test_dir[0])
+    {
+        const char* dir = game->opts.test_dir[0] ? game->opts.test_dir : game->opts.capture_dir;
+        game->capture = capture_open(game, dir, game->opts.test_dir[0] || game->opts.capture_png);
+        if (game->capture == NULL)
+            return false;
+    }
+
+    mem_set_tag(MEM_TEXT);
     if (TTF_Init() == -1) 
     {
         fprintf(stderr, "SDL_ttf could not initialize! SDL_ttf Error: %s\n", TTF_GetError());
@@ -139,31 +330,26 @@ bool init_game(Game* game)
         return false;
     }
 
-    game->background.scroll_y = 0;
+    if (!text_open(game))
+        return false;
+
+    mem_set_tag(MEM_GAME);
+    game->events = events_open();
+    if (game->events == NULL)
+        return false;
+
+    spatial_init(&game->enemy_index);
+
+    game->patterns = patterns_load();
+    if (game->patterns == NULL)
+        return false;
+
     game->is_running = true;
-    
-    //Player init
-    game->player.last_shot_time = 0;
-    game->player.afterburner = AFTERBURNER_MAX;
-    game->player.is_afterburner_active = false;    
-    game->player.max_hp = 1000;
-    game->player.hit_points = game->player.max_hp;
-    game->player.score = 0;
-    game->player.bonus_velocity = 0;
-    game->player.velocity_x = 0;
-    game->player.velocity_y = 0;
-    
-    for (int i = 0; i < MAX_AFTERBURNER_PARTICLES; i++)     
-        game->afterburner_particles[i].lifetime = 0;
-    
-    for (int i = 0; i < MAX_WEAPONS; i++) 
-    {
-        game->player.weapons[i].type = WEAPON_TYPES[i];
-        game->player.weapons[i].ammo = WEAPON_TYPES[i].max_ammo;
-    }
 
-    game->player.current_weapon = WPN_LASER;
+    //A session joined over the network is reset again with the host's seed.
+    reset_sim(game, game->opts.seed ? game->opts.seed : (Uint32)time(NULL), game->opts.net_mode ? 2 : 1);
 
+    mem_set_tag(MEM_ASSETS);
     if (!load_background(game)) 
         return false;
 
@@ -171,28 +357,94 @@ bool init_game(Game* game)
     if (!load_player(game)) 
         return false;
 
-    //Initialize projectiles and their textures
+    //Initialize projectile textures
     if (!load_weapon_textures(game))
         return false;
-
-    for (int i = 0; i < MAX_PROJECTILES; i++)     
-        game->projectiles[i].active = false;        
     
     if (!load_planet_textures(game)) 
         return false;
 
-    init_planets(game);    
     init_enemies(game);
     init_powerups(game);
-    init_particles();
+    game->anims = anim_open(game);
+
+    mem_set_tag(MEM_AUDIO);
+    game->audio = audio_open(game);
+
+    mem_set_tag(MEM_ASSETS);
+    if (game->opts.level_file[0])
+    {
+        game->level = level_open(game->opts.level_file);
+        if (game->level == NULL)
+            return false;
+    }
+
+    texture_budget_commit(game);
+
+    mem_set_tag(MEM_NET);
+    //A viewer only draws what the stream says, so it plays no game of its own.
+    if (game->opts.watch_address[0])
+    {
+        game->watch = watch_open(game);
+        if (game->watch == NULL)
+            return false;
+    }
+    else if (game->opts.net_mode)
+    {
+        game->net = net_open(game);
+        if (game->net == NULL)
+            return false;
+    }
+    else
+    {
+        //Rewinding one side of a co-op game would only desync it.
+        game->snapshots = snapshot_open(game);
+        if (snapshot_load_resume(game))
+            game->sim_counter = (Uint64)game->sim.tick * SDL_GetPerformanceFrequency() / FPS;
+        snapshot_capture(game);
+    }
 
+    if (game->opts.spectate_address[0])
+    {
+        game->spectate = spectate_open(game);
+        if (game->spectate == NULL)
+            return false;
+    }
+
+    mem_set_tag(tag);
     return true;
 }
 
-void init_planets(Game* game) 
+//Puts the simulation back to its first tick. Everything inactive is just
+//zeroed, so only the players need setting up.
+void reset_sim(Game* game, Uint32 seed, int num_players)
 {
-    for (int i = 0; i < MAX_PLANETS; i++) 
-        game->planets[i].active = false;    
+    memset(&game->sim, 0, sizeof(SimState));
+    sim_seed(game, seed);
+    game->sim.num_players = num_players;
+    timers_reset(game);
+
+    for (int i = 0; i < num_players; i++)
+    {
+        Player* player = &game->sim.players[i];
+
+        player->afterburner = AFTERBURNER_MAX;
+        player->max_hp = 1000;
+        player->hit_points = player->max_hp;
+
+        for (int w = 0; w < MAX_WEAPONS; w++) 
+        {
+            player->weapons[w].type = WEAPON_TYPES[w];
+            player->weapons[w].ammo = WEAPON_TYPES[w].max_ammo;
+        }
+        player->current_weapon = WPN_LASER;
+
+        //Spread out evenly along the bottom of the screen.
+        player->position.w = PLAYER_WIDTH;
+        player->position.h = PLAYER_HEIGHT;
+        player->position.x = SCREEN_WIDTH * (i + 1) / (num_players + 1) - PLAYER_WIDTH / 2;
+        player->position.y = SCREEN_HEIGHT - PLAYER_HEIGHT - 50; // 50 pixels from the bottom
+    }
 }
 
 //Load background images.
@@ -208,7 +460,7 @@ bool load_background(Game* game)
             SDL_Log("Unable to load background image %s! SDL_Error: %s\n", bg_files[i], SDL_GetError());
             return false;
         }
-        game->background.textures[i] = SDL_CreateTextureFromSurface(game->renderer, surface);
+        game->background.textures[i] = create_texture(game, surface);
         SDL_FreeSurface(surface);
 
         if (game->background.textures[i] == NULL) 
@@ -218,36 +470,29 @@ bool load_background(Game* game)
         }
     }
 
-    game->background.scroll_y = 0;
+    game->sim.scroll_y = 0;
     return true;
 }
 
 bool load_player(Game* game) 
 {
-    SDL_Surface* surface = IMG_Load("../img/Player/ship_1.png");
+    SDL_Surface* surface = IMG_Load(PLAYER_IMAGE);
     if (surface == NULL) 
     {
         SDL_Log("Unable to load player image! SDL_Error: %s\n", SDL_GetError());
         return false;
     }
-    game->player.texture = SDL_CreateTextureFromSurface(game->renderer, surface);
+    game->player_texture = create_texture(game, surface);
+
+    hitbox_build_player(game, surface);
     SDL_FreeSurface(surface);
 
-    if (game->player.texture == NULL) 
+    if (game->player_texture == NULL) 
     {
         SDL_Log("Unable to create texture from player image! SDL_Error: %s\n", SDL_GetError());
         return false;
     }
 
-    // Set initial position for the player
-    game->player.position.w = PLAYER_WIDTH;
-    game->player.position.h = PLAYER_HEIGHT;
-    game->player.position.x = (SCREEN_WIDTH - PLAYER_WIDTH) / 2;
-    game->player.position.y = SCREEN_HEIGHT - PLAYER_HEIGHT - 50; // 50 pixels from the bottom
-
-    game->player.velocity_x = 0;
-    game->player.roll_angle = 0;
-
     return true;
 }
 
@@ -257,20 +502,13 @@ bool load_weapon_textures(Game * game)
     {
         char filename[64];
         snprintf(filename, sizeof(filename), "../img/Projectiles/%s.png", WEAPON_TYPES[i].name);
-        SDL_Surface* surface = IMG_Load(filename);
-        if (surface) 
-        {
-            game->weapon_textures[i] = SDL_CreateTextureFromSurface(game->renderer, surface);            
-            SDL_FreeSurface(surface);
-            if (!game->weapon_textures[i]) 
-            {
-                printf("Failed to create texture for %s: %s\n", WEAPON_TYPES[i].name, SDL_GetError());
-                return false;                
-            }
-        } 
-        else         
+
+        //In flight (see projectile_spawn()) and as the HUD icon.
+        SDL_Point sizes[] = {{WEAPON_TYPES[i].width * 2, WEAPON_TYPES[i].height * 2}, {32, 32}};
+
+        if (!texture_set_load(game, &game->weapon_textures[i], filename, sizes, SDL_arraysize(sizes)))
         {
-            fprintf(stderr, "Failed to load texture for %s: %s\n", WEAPON_TYPES[i].name, IMG_GetError());        
+            fprintf(stderr, "Failed to load texture for %s\n", WEAPON_TYPES[i].name);        
             return false;
         }
     }
@@ -309,25 +547,16 @@ bool load_planet_textures(Game* game)
         "../img/Planets/supernova.png"
     };
 
-    for (int i = 0; i < MAX_PLANETS; i++) 
-    {
-        SDL_Surface* surface = IMG_Load(planet_files[i]);
-        if (surface == NULL) 
-        {
-            SDL_Log("Unable to load planet image %s! SDL_Error: %s\n", planet_files[i], SDL_GetError());
-            return false;
-        }
-        game->planet_textures[i] = SDL_CreateTextureFromSurface(game->renderer, surface);
-        SDL_FreeSurface(surface);
+    //Planets are drawn 24-72px across (see update_planets()), a step of 1.5x between sizes.
+    const SDL_Point sizes[] = {{24, 24}, {36, 36}, {48, 48}, {72, 72}};
 
-        if (game->planet_textures[i] == NULL) 
-        {
-            SDL_Log("Unable to create texture from planet image %s! SDL_Error: %s\n", planet_files[i], SDL_GetError());
-            return false;
-        }
+    //Only registered here, the files are read when a planet first spawns.
+    game->streamer = stream_open(game, !game->opts.fixed_step);
+    if (game->streamer == NULL)
+        return false;
 
-        printf("Loaded planet texture #%d\n", i);
-    }
+    for (int i = 0; i < MAX_PLANETS; i++) 
+        game->planet_textures[i] = stream_add(game->streamer, planet_files[i], sizes, SDL_arraysize(sizes));
 
     return true;
 }
@@ -337,46 +566,120 @@ void handle_events(Game* game)
     SDL_Event event;
     while (SDL_PollEvent(&event)) 
     {
+        //Game actions are buffered with their timestamps and applied by the next update.
+        if (input_handle_event(game, &event))
+            continue;
+
         if (event.type == SDL_QUIT)         
             game->is_running = false;        
+        else if (event.type == SDL_KEYDOWN && !event.key.repeat)
+        {
+            if (event.key.keysym.scancode == SDL_SCANCODE_F3)
+                game->show_stats = !game->show_stats;
+            else if (event.key.keysym.scancode == SDL_SCANCODE_ESCAPE)
+                game->is_running = false;
+            //Co-op and watched games go on regardless, so only single player pauses.
+            else if ((event.key.keysym.scancode == SDL_SCANCODE_P || event.key.keysym.scancode == SDL_SCANCODE_PAUSE) &&
+                     !game->net && !game->watch)
+                game->paused = !game->paused;
+        }
+        else if (event.type == SDL_WINDOWEVENT)
+        {
+            switch (event.window.event)
+            {
+                case SDL_WINDOWEVENT_FOCUS_LOST:    game->unfocused = true; break;
+                case SDL_WINDOWEVENT_FOCUS_GAINED:  game->unfocused = false; break;
+                case SDL_WINDOWEVENT_MINIMIZED:
+                case SDL_WINDOWEVENT_HIDDEN:        game->minimized = true; break;
+                case SDL_WINDOWEVENT_RESTORED:
+                case SDL_WINDOWEVENT_SHOWN:         game->minimized = false; break;
+                case SDL_WINDOWEVENT_EXPOSED:       game->redraw = true; break;
+            }
+        }
     }
-    
-    handle_input(game);
 }
 
-void handle_input(Game* game) 
+//Paused, minimized or in the background: no simulation and no frames, the
+//loop blocks in SDL_WaitEventTimeout() until something happens, so an idle
+//instance costs next to nothing. Co-op and watched games can't stop, the
+//other side goes on, so they keep ticking at about FPS and only stop
+//drawing. Returns false when the game should run a frame; the first one
+//after idling starts on a clean clock.
+bool idle_wait(Game* game)
 {
-    const Uint8* keyboard_state = SDL_GetKeyboardState(NULL);
-    
-    if (keyboard_state[SDL_SCANCODE_LEFT] || keyboard_state[SDL_SCANCODE_A])     
-        game->player.velocity_x = - 1 - game->player.bonus_velocity;
-    else if (keyboard_state[SDL_SCANCODE_RIGHT] || keyboard_state[SDL_SCANCODE_D])     
-        game->player.velocity_x = 1 + game->player.bonus_velocity;     
-    /*else if (keyboard_state[SDL_SCANCODE_UP] || keyboard_state[SDL_SCANCODE_W])     
-        game->player.velocity_y = - 1 - game->player.bonus_velocity;
-    else if (keyboard_state[SDL_SCANCODE_DOWN] || keyboard_state[SDL_SCANCODE_S])     
-        game->player.velocity_y = 1 + game->player.bonus_velocity;     */
+    if (!game->paused && !game->minimized && !game->unfocused)
+    {
+        if (game->idle)
+        {
+            game->idle = false;
+            input_reset(game);
+            audio_pause(game, false);
+            game->last_update_counter = SDL_GetPerformanceCounter();
+            pacer_reset(&game->pacer);
+        }
+        return false;
+    }
+
+    if (!game->idle)
+    {
+        game->idle = true;
+        game->redraw = game->paused;    //Once more, with the banner
+        audio_pause(game, true);
+    }
+
+    if (game->net || game->watch)
+    {
+        input_sample(game);
+        if (game->net)
+            net_update(game);
+        else
+            watch_update(game);
+        spectate_publish(game);
+        SDL_WaitEventTimeout(NULL, 1000 / FPS);
+        return true;
+    }
+
+    if (game->redraw && !game->minimized)
+        render(game);
+    game->redraw = false;
+
+    SDL_WaitEventTimeout(NULL, IDLE_WAIT_MS);
+    return true;
+}
+
+//Applies one tick of a player's input, called from sim_step() so it runs on the sim clock.
+void handle_input(Game* game, Player* player, const TickInput* input) 
+{
+    if (input->held & ACT_LEFT)     
+        player->velocity_x = - 1 - player->bonus_velocity;
+    else if (input->held & ACT_RIGHT)     
+        player->velocity_x = 1 + player->bonus_velocity;     
     else     
     {
-        game->player.velocity_x = 0;
-        game->player.velocity_y = 0;
+        player->velocity_x = 0;
+        player->velocity_y = 0;
     }
     
-    game->player.is_afterburner_active = (keyboard_state[SDL_SCANCODE_LCTRL] || keyboard_state[SDL_SCANCODE_RCTRL]) && game->player.afterburner > 0;
+    player->is_afterburner_active = (input->held & ACT_AFTERBURNER) && player->afterburner > 0;
 
-    if (keyboard_state[SDL_SCANCODE_SPACE]) 
-        shoot_projectile(game, NULL, &game->player);
+    //A tap released before the sample still counts as a shot.
+    if ((input->held | input->pressed) & ACT_FIRE) 
+        shoot_projectile(game, NULL, player);
 
-    if (keyboard_state[SDL_SCANCODE_Q])
-        change_weapon(game, -1);
-    if (keyboard_state[SDL_SCANCODE_E])
-        change_weapon(game, 1);
+    if ((input->held | input->pressed) & ACT_PREV_WEAPON)
+        change_weapon(game, player, -1);
+    if ((input->held | input->pressed) & ACT_NEXT_WEAPON)
+        change_weapon(game, player, 1);
 
-    if (keyboard_state[SDL_SCANCODE_ESCAPE])    
-        game->is_running = false;            
+    //Every wheel notch is a deliberate step, so it skips the held-key cooldown.
+    if (input->wheel)
+    {
+        player->current_weapon = ((player->current_weapon + input->wheel) % MAX_WEAPONS + MAX_WEAPONS) % MAX_WEAPONS;
+        player->last_weapon_switch_time = game->sim.time;
+    }
 }
 
-void change_weapon(Game* game, int direction) 
+void change_weapon(Game* game, Player* player, int direction) 
 {
 
     if (!game)
@@ -385,23 +688,23 @@ void change_weapon(Game* game, int direction)
         return;
     }
 
-    Uint32 current_time = SDL_GetTicks();
+    Uint32 current_time = game->sim.time;
 
-    if (current_time - game->player.last_weapon_switch_time < WEAPON_SWITCH_COOLDOWN)
+    if (current_time - player->last_weapon_switch_time < WEAPON_SWITCH_COOLDOWN)
         // Cooldown hasn't elapsed, don't switch weapon
         return;    
 
     int num_weapons = MAX_WEAPONS;
-    game->player.current_weapon = (game->player.current_weapon + direction + num_weapons) % num_weapons;
-    game->player.last_weapon_switch_time = current_time;
+    player->current_weapon = (player->current_weapon + direction + num_weapons) % num_weapons;
+    player->last_weapon_switch_time = current_time;
 }
 
 void shoot_projectile(Game * game, Enemy * enemy, Player * player)
 {
-    Uint32 current_time = SDL_GetTicks();
+    Uint32 current_time = game->sim.time;
     Uint32 last_shot_time = 0;
     int cur_weapon = 0;
-    float cooldown_multiplier = (current_time < game->powerup_end_times[POWERUP_FIRE_RATE]) ? 0.5f : 1.0f;
+    float cooldown_multiplier = (player && current_time < player->powerup_end_times[POWERUP_FIRE_RATE]) ? 0.5f : 1.0f;
 
     if (!enemy && !player)
     {
@@ -440,250 +743,219 @@ void shoot_projectile(Game * game, Enemy * enemy, Player * player)
         return; // Don't shoot if cooldown hasn't elapsed
     
 
-    for (int i = 0; i < MAX_PROJECTILES; i++) 
+    Projectile* shot;
+    if (enemy)
+        shot = projectile_spawn(game, cur_weapon, enemy->position.x + enemy->position.w / 2,
+                                enemy->position.y + enemy->position.h, 180, -1, (int)(enemy - game->sim.enemies)); // Shooting down toward player
+    else
+        shot = projectile_spawn(game, cur_weapon, player->position.x + player->position.w / 2,
+                                player->position.y, player->roll_angle, (int)(player - game->sim.players), -1);
+
+    if (shot == NULL)
+        return;
+
+    audio_play(game, enemy ? SND_ENEMY_SHOT : SND_SHOT + cur_weapon, shot->x);
+
+    if (enemy)
     {
-        if (!game->projectiles[i].active) 
-        {            
-            if (enemy)
-            {
-                game->projectiles[i].x = enemy->position.x + enemy->position.w / 2;
-                game->projectiles[i].y = enemy->position.y + enemy->position.h;
-                game->projectiles[i].is_enemy_projectile = true;
-                game->projectiles[i].angle = 180; // Shooting down toward player
-            }
-            else
-            {
-                game->projectiles[i].x = player->position.x + player->position.w / 2;
-                game->projectiles[i].y = player->position.y;
-                game->projectiles[i].is_enemy_projectile = false;
-                game->projectiles[i].angle = game->player.roll_angle;
-            }
-            
-            game->projectiles[i].speed = WEAPON_TYPES[cur_weapon].bullet_speed;
-            game->projectiles[i].damage = WEAPON_TYPES[cur_weapon].damage;
-            game->projectiles[i].active = true;
-            game->projectiles[i].type = cur_weapon;
-            game->projectiles[i].texture = game->weapon_textures[cur_weapon];
-            
-            // Calculate velocity components based on angle
-            float rad_angle = game->projectiles[i].angle * M_PI / 180.0f;
-            game->projectiles[i].vx = sinf(rad_angle) * game->projectiles[i].speed;
-            game->projectiles[i].vy = -cosf(rad_angle) * game->projectiles[i].speed;
-
-             // Increase the size of the projectile for visibility
-            int projectile_width = WEAPON_TYPES[cur_weapon].width * 2;  // Double the width
-            int projectile_height = WEAPON_TYPES[cur_weapon].height * 2;  // Double the height
-
-            game->projectiles[i].dest_rect = (SDL_Rect)
-            {                
-                (int)game->projectiles[i].x - WEAPON_TYPES[cur_weapon].width / 2,
-                (int)game->projectiles[i].y - WEAPON_TYPES[cur_weapon].height / 2,
-                projectile_width,
-                projectile_height                
-            };
-
-            game->projectiles[i].center = (SDL_Point)
-            {
-                WEAPON_TYPES[cur_weapon].width / 2,
-                WEAPON_TYPES[cur_weapon].height / 2
-            };            
+        enemy->last_shot_time = current_time;
+        //enemy->weapons[cur_weapon].ammo --;
+    }
+    else
+    {
+        player->last_shot_time = current_time;
+        player->weapons[cur_weapon].ammo --;
+    }
+}
 
-            /*printf("Projectile created: x=%f, y=%f, angle=%f, speed=%f\n", 
-            game->projectiles[i].x, game->projectiles[i].y, 
-            game->projectiles[i].angle, game->projectiles[i].speed);*/
 
+//Single player: as many 1/FPS ticks as the clock has moved on, with the
+//input just sampled. Timers, patterns and shots count ticks, so the sim
+//has to run at the same rate whatever the frame rate.
+void update(Game* game) 
+{    
+    TickInput inputs[MAX_PLAYERS] = {game->tick_input};
+    Uint64 now = SDL_GetPerformanceCounter();
+    Uint64 freq = SDL_GetPerformanceFrequency();
 
-            if (enemy)
-            {
-                enemy->last_shot_time = current_time;
-                //enemy->weapons[cur_weapon].ammo --;
-            }
-            else
-            {
-                player->last_shot_time = current_time;
-                player->weapons[cur_weapon].ammo --;
-            }
+    //Rewinding replaces the step: one tick back per frame, with the clock following.
+    if ((game->tick_input.held & ACT_REWIND) && snapshot_rewind(game))
+    {
+        game->sim_counter = (Uint64)game->sim.tick * freq / FPS;
+        game->last_update_counter = now;
+        return;
+    }
+
+    //Fixed steps make a seeded session play out identically every run.
+    if (game->opts.fixed_step)
+    {
+        sim_step(game, inputs, 0);
+        snapshot_capture(game);
+        return;
+    }
+
+    game->sim_counter += now - game->last_update_counter;
+    game->last_update_counter = now;
+
+    int ticks = 0;
+    while ((Uint64)(game->sim.tick + 1) * freq / FPS <= game->sim_counter)
+    {
+        //After a stall, drop the time rather than stall again catching up.
+        if (ticks == MAX_TICKS_PER_FRAME)
+        {
+            game->sim_counter = (Uint64)game->sim.tick * freq / FPS;
             break;
         }
+
+        sim_step(game, inputs, 0);
+        snapshot_capture(game);
+        inputs[0].pressed = 0;      //One-offs go to the first tick only
+        inputs[0].wheel = 0;
+        ticks++;
     }
 
-} 
+    if (ticks == 0)
+        input_defer(game);
+}
 
+//Advances the simulation by one tick. Everything it reads or writes lives in
+//game->sim, so netplay.c can rewind and run it again; a delta_time of 0 means
+//a fixed 1/FPS step.
+void sim_step(Game* game, const TickInput inputs[MAX_PLAYERS], float delta_time)
+{
+    game->sim.tick++;
+    events_begin(game);
 
-void update(Game* game) 
-{    
-    Uint32 current_time = SDL_GetTicks();
-    float delta_time = (current_time - game->last_frame_time) / 1000.0f;
-    game->last_frame_time = current_time;
+    if (delta_time <= 0)
+    {
+        delta_time = 1.0f / FPS;
+        game->sim.time = (Uint32)((Uint64)game->sim.tick * 1000 / FPS);
+    }
+
+    for (int i = 0; i < game->sim.num_players; i++)
+        handle_input(game, &game->sim.players[i], &inputs[i]);
 
     // Scroll background
-    game->background.scroll_y += SCROLL_SPEED * delta_time;
-    if (game->background.scroll_y >= BG_HEIGHT)     
-        game->background.scroll_y -= BG_HEIGHT;
+    game->sim.scroll_y += SCROLL_SPEED * delta_time;
+    if (game->sim.scroll_y >= BG_HEIGHT)     
+        game->sim.scroll_y -= BG_HEIGHT;
+    game->sim.distance += (double)SCROLL_SPEED * delta_time;
+    level_update(game);
     
     update_enemies(game, delta_time);
+    timers_update(game);
     update_afterburner_particles(game, delta_time);
     update_planets(game, delta_time);
-    update_player(game, delta_time);    
-    update_projectiles(game, delta_time);
-    update_particles();
+    for (int i = 0; i < game->sim.num_players; i++)
+        update_player(&game->sim.players[i], delta_time);    
+    update_projectiles(game);
+    update_particles(game);
     update_powerups(game, delta_time);
-    //update_powerup_effects(); 
     check_planet_collision(game);
+
+    events_dispatch(game);
+    anim_update(game);
 }
 
-void update_player(Game* game, float delta_time) 
+void update_player(Player* player, float delta_time) 
 {
     float current_speed = PLAYER_SPEED;
 
-    if (game->player.is_afterburner_active) 
+    if (player->is_afterburner_active) 
     {
         current_speed *= AFTERBURNER_SPEED_MULTIPLIER;
-        game->player.afterburner -= AFTERBURNER_DEPLETION_RATE * delta_time;
-        if (game->player.afterburner < 0) game->player.afterburner = 0;
+        player->afterburner -= AFTERBURNER_DEPLETION_RATE * delta_time;
+        if (player->afterburner < 0) player->afterburner = 0;
     } 
     else 
     {
-        game->player.afterburner += AFTERBURNER_RECHARGE_RATE * delta_time;
-        if (game->player.afterburner > AFTERBURNER_MAX) 
-            game->player.afterburner = AFTERBURNER_MAX;
+        player->afterburner += AFTERBURNER_RECHARGE_RATE * delta_time;
+        if (player->afterburner > AFTERBURNER_MAX) 
+            player->afterburner = AFTERBURNER_MAX;
     }
 
     // Update player position
-     game->player.position.x += (int)(game->player.velocity_x * current_speed * delta_time);
-     game->player.position.y += (int)(game->player.velocity_y * current_speed * delta_time);
+     player->position.x += (int)(player->velocity_x * current_speed * delta_time);
+     player->position.y += (int)(player->velocity_y * current_speed * delta_time);
 
     // Clamp player position to screen bounds
-    if (game->player.position.x < 0)     
-        game->player.position.x = 0;
-    else if (game->player.position.x > SCREEN_WIDTH - game->player.position.w) 
-        game->player.position.x = SCREEN_WIDTH - game->player.position.w;    
-    /*else if (game->player.position.y < 0)     
-        game->player.position.y = 0;
-    else if (game->player.position.y > SCREEN_HEIGHT - game->player.position.y) 
-        game->player.position.y = SCREEN_HEIGHT - game->player.position.y;    */
+    if (player->position.x < 0)     
+        player->position.x = 0;
+    else if (player->position.x > SCREEN_WIDTH - player->position.w) 
+        player->position.x = SCREEN_WIDTH - player->position.w;    
+    /*else if (player->position.y < 0)     
+        player->position.y = 0;
+    else if (player->position.y > SCREEN_HEIGHT - player->position.y) 
+        player->position.y = SCREEN_HEIGHT - player->position.y;    */
 
     // Update roll angle
     float target_roll = 0;
-    if (game->player.velocity_x < 0) 
+    if (player->velocity_x < 0) 
         target_roll = -PLAYER_MAX_ROLL;
-    else if (game->player.velocity_x > 0) 
+    else if (player->velocity_x > 0) 
         target_roll = PLAYER_MAX_ROLL;
     
     float roll_change = PLAYER_ROLL_SPEED * delta_time;
-    if (game->player.roll_angle < target_roll)     
-        game->player.roll_angle = fmin(game->player.roll_angle + roll_change, target_roll);     
-    else if (game->player.roll_angle > target_roll)     
-        game->player.roll_angle = fmax(game->player.roll_angle - roll_change, target_roll);
+    if (player->roll_angle < target_roll)     
+        player->roll_angle = fmin(player->roll_angle + roll_change, target_roll);     
+    else if (player->roll_angle > target_roll)     
+        player->roll_angle = fmax(player->roll_angle - roll_change, target_roll);
 }
 
-void update_projectiles(Game* game, float delta_time) 
+//Brings in a planet at a random size and place. index picks the image, or
+//-1 for the first one not on screen. Returns NULL if it can't be shown.
+Planet* spawn_planet(Game* game, int index)
 {
-    for (int i = 0; i < MAX_PROJECTILES; i++) 
+    for (int i = 0; i < MAX_PLANETS; i++) 
     {
-        if (game->projectiles[i].active) 
-        {            
-            game->projectiles[i].x += game->projectiles[i].vx;
-            game->projectiles[i].y += game->projectiles[i].vy;
-            
-            game->projectiles[i].dest_rect.x = (int)game->projectiles[i].x - game->projectiles[i].dest_rect.w / 2;
-            game->projectiles[i].dest_rect.y = (int)game->projectiles[i].y - game->projectiles[i].dest_rect.h / 2;
-            
-            // Deactivate projectile if it goes off screen
-            if (game->projectiles[i].y  < 0 ||
-                game->projectiles[i].y > SCREEN_HEIGHT ||
-                game->projectiles[i].x  < 0 ||
-                game->projectiles[i].x > SCREEN_WIDTH) 
-            {
-                game->projectiles[i].active = false;
-                //printf("Projectile deactivated: x=%f, y=%f\n", game->projectiles[i].x, game->projectiles[i].y);
-            }        
-            
-            // Check collision with enemies
-            SDL_Rect projectile_rect = 
-            {
-                (int)game->projectiles[i].x - 2,
-                (int)game->projectiles[i].y - 2,
-                4,
-                4
-            };
-            
-            for (int j = 0; j < MAX_ENEMIES; j++) 
-            {
-                if (game->enemies[j].active && check_collision(projectile_rect, game->enemies[j].position)) 
-                {
-                    int damage = game->projectiles[i].damage - game->enemies[j].defense;
-                    if (damage > 0) 
-                    {
-                        game->enemies[j].hit_points -= damage;
-                        if (game->enemies[j].hit_points <= 0) 
-                        {
-                            game->enemies[j].active = false;
-                            game->player.score += game->enemies[j].max_hp;                            
-                            create_explosion(game->enemies[j].position.x, game->enemies[j].position.y);
-                        }
-                    }
-                    game->projectiles[i].active = false;
-                    break;
-                }
-                
-                // Check collision with player (for enemy projectiles)
-                if (game->projectiles[i].angle == 180 && check_collision(projectile_rect, game->player.position)) {
-                    game->player.hit_points -= game->projectiles[i].damage;
-                    game->projectiles[i].active = false;
-                    // Add player hit effect here
-                }
-            }
+        if (index >= 0 && i != index)
+            continue;
+
+        //A planet whose image was missing at startup just never shows up;
+        //that is settled once, so every run spawns the same planets. Its
+        //texture is only requested when it is first drawn. One that is there
+        //but fails to decode stays an outline with a round mask.
+        //Headless games have no images at all, so every planet gets a round mask.
+        if (!game->sim.planets[i].active && (game->headless || stream_present(game, game->planet_textures[i]))) 
+        {
+            game->sim.planets[i].active = true;
+            game->sim.planets[i].scale = (float)(sim_rand(game) % 50 + 25) / 100.0f; // Random scale between 0.25 and .75
+            game->sim.planets[i].position.w = (int)(96 * game->sim.planets[i].scale); // Assuming original size is 48x48
+            game->sim.planets[i].position.h = (int)(96 * game->sim.planets[i].scale);
+            game->sim.planets[i].position.x = sim_rand(game) % (SCREEN_WIDTH - game->sim.planets[i].position.w);
+            game->sim.planets[i].position.y = -game->sim.planets[i].position.h;
+
+            float speed_factor = 1.0f - (game->sim.planets[i].scale - 0.25f) / 0.5f; // 0 for largest, 1 for smallest
+            game->sim.planets[i].speed = MIN_PLANET_SPEED + speed_factor * (MAX_PLANET_SPEED - MIN_PLANET_SPEED);
+            planet_init_mask(game, i);
+            return &game->sim.planets[i];
         }
     }
+    return NULL;
 }
 
-
 void update_planets(Game* game, float delta_time) 
 {
-    // Spawn new planets
-    if ((float)rand() / RAND_MAX < PLANET_SPAWN_CHANCE) 
-    {
-        for (int i = 0; i < MAX_PLANETS; i++) 
-        {
-            if (!game->planets[i].active) 
-            {
-                game->planets[i].active = true;
-                game->planets[i].scale = (float)(rand() % 50 + 25) / 100.0f; // Random scale between 0.25 and .75
-                game->planets[i].position.w = (int)(96 * game->planets[i].scale); // Assuming original size is 48x48
-                game->planets[i].position.h = (int)(96 * game->planets[i].scale);
-                game->planets[i].position.x = rand() % (SCREEN_WIDTH - game->planets[i].position.w);
-                game->planets[i].position.y = -game->planets[i].position.h;
-
-                float speed_factor = 1.0f - (game->planets[i].scale - 0.25f) / 0.5f; // 0 for largest, 1 for smallest
-                game->planets[i].speed = MIN_PLANET_SPEED + speed_factor * (MAX_PLANET_SPEED - MIN_PLANET_SPEED);
-
-                //printf("Planet spawned [%d] @ x: %d, y: %d [speed: %.2f, scale: %.2f, delta_time: %.4f\n", 
-                    //i, game->planets[i].position.x, game->planets[i].position.y, game->planets[i].speed, game->planets[i].scale, delta_time);
-                break;
-            }
-        }
-    }
-
     // Move planets
     for (int i = 0; i < MAX_PLANETS; i++) 
     {
-        if (game->planets[i].active) 
+        if (game->sim.planets[i].active) 
         {
-            float movement = (int)(game->planets[i].speed * delta_time);
+            float movement = (int)(game->sim.planets[i].speed * delta_time);
             
-            game->planets[i].position.y += movement;
+            game->sim.planets[i].position.y += movement;
             /*printf("Planet [%d] movement: %.2f, speed: %.2f, delta_time: %.4f\n", 
-                   i, movement, game->planets[i].speed, delta_time);            */
-            if (game->planets[i].position.y > SCREEN_HEIGHT)            
-                game->planets[i].active = false;
+                   i, movement, game->sim.planets[i].speed, delta_time);            */
+            if (game->sim.planets[i].position.y > SCREEN_HEIGHT)            
+                game->sim.planets[i].active = false;
         }       
     }
 }
 
-void render_current_weapon(SDL_Renderer* renderer, Game* game) 
+void render_current_weapon(Game* game) 
 {
-    int wtype = game->player.current_weapon;
+    Player* player = &game->sim.players[game->local_player];
+    int wtype = player->current_weapon;
     
     // Position for weapon display (bottom right)
     int display_width =  32;  // Adjust as needed
@@ -692,7 +964,7 @@ void render_current_weapon(SDL_Renderer* renderer, Game* game)
     int start_x = SCREEN_WIDTH - (MAX_WEAPONS * (display_width + spacing));
     int y = SCREEN_HEIGHT - display_height - 32;  // 32 pixels from bottom edge
 
-    if (renderer == NULL || game == NULL) 
+    if (game == NULL || game->renderer == NULL) 
     {
         LOG("Error: Renderer or game is NULL in render_current_weapon");
         return;
@@ -715,42 +987,27 @@ void render_current_weapon(SDL_Renderer* renderer, Game* game)
         };
     
         // Draw weapon icon
-        if (game->weapon_textures[wtype])        
-            SDL_RenderCopy(renderer, game->weapon_textures[wtype], NULL, &dest_rect);        
+        SDL_Texture* icon = texture_pick(&game->weapon_textures[wtype], display_width, display_height);
+        if (icon)        
+            draw_copy(game, icon, NULL, &dest_rect);        
     
         // Highlight current weapon
-        if (i == game->player.current_weapon) 
+        if (i == player->current_weapon) 
         {
-            SDL_SetRenderDrawColor(renderer, 9, 255, 255, 255);  // Yellow highlight
-            SDL_RenderDrawRect(renderer, &dest_rect);
+            draw_set_color(game, 9, 255, 255, 255);  // Yellow highlight
+            draw_rect(game, &dest_rect);
         }
 
         // Draw ammo count
         char ammo_count[8];
-        snprintf(ammo_count, sizeof(ammo_count), "%d", game->player.weapons[i].ammo);
-        render_text(renderer, game->font, ammo_count, dest_rect.x, dest_rect.y + dest_rect.h, CLR_LIME_GREEN);
+        snprintf(ammo_count, sizeof(ammo_count), "%d", player->weapons[i].ammo);
+        render_text(game, ammo_count, dest_rect.x, dest_rect.y + dest_rect.h, CLR_LIME_GREEN);
 
     }
     // Draw current weapon name
     char weapon_name[64];
-    snprintf(weapon_name, sizeof(weapon_name), "%s", WEAPON_TYPES[game->player.current_weapon].name);
-    render_text(renderer, game->font, weapon_name, start_x, y - 20, CLR_LIME_GREEN);
-}
-
-void render_text(SDL_Renderer* renderer, TTF_Font* font, const char* text, int x, int y, SDL_Color color) 
-{
-    SDL_Surface* surface = TTF_RenderText_Solid(font, text, color);
-    if (surface) 
-    {
-        SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-        if (texture) 
-        {
-            SDL_Rect dest = {x, y, surface->w, surface->h};
-            SDL_RenderCopy(renderer, texture, NULL, &dest);
-            SDL_DestroyTexture(texture);
-        }
-        SDL_FreeSurface(surface);
-    }
+    snprintf(weapon_name, sizeof(weapon_name), "%s", WEAPON_TYPES[player->current_weapon].name);
+    render_text(game, weapon_name, start_x, y - 20, CLR_LIME_GREEN);
 }
 
 void render_health_bar(Game* game) 
@@ -762,60 +1019,43 @@ void render_health_bar(Game* game)
 
     SDL_Color start_color = {255, 0, 0, 255};
     SDL_Color end_color = {0, 255, 0, 255};
-    float percentage = (float)game->player.hit_points / game->player.max_hp;
+    Player* player = &game->sim.players[game->local_player];
+    float percentage = (float)player->hit_points / player->max_hp;
 
-    render_gradient_bar(game->renderer, x, y, meter_width, meter_height, percentage, start_color, end_color);
-}
-
-void render_projectiles(Game* game) 
-{
-    for (int i = 0; i < MAX_PROJECTILES; i++) 
-    {
-        // Debug: Draw a colored rectangle around the projectile
-        //SDL_SetRenderDrawColor(game->renderer, 255, 0, 0, 255);  // Red color
-        //SDL_RenderDrawRect(game->renderer, &game->projectiles[i].dest_rect);
-
-        if (game->projectiles[i].active) 
-        {
-            SDL_RenderCopyEx(
-                game->renderer,
-                game->projectiles[i].texture,
-                NULL,
-                &game->projectiles[i].dest_rect,
-                game->projectiles[i].angle,
-                &game->projectiles[i].center,
-                SDL_FLIP_NONE
-            );         
-
-            // Debug output
-            /*printf("Rendering projectile: x=%d, y=%d, w=%d, h=%d, angle=%f\n", 
-                   game->projectiles[i].dest_rect.x, game->projectiles[i].dest_rect.y,
-                   game->projectiles[i].dest_rect.w, game->projectiles[i].dest_rect.h,
-                   game->projectiles[i].angle);*/
-        }
-    }
+    render_gradient_bar(game, x, y, meter_width, meter_height, percentage, start_color, end_color);
 }
 
 void render_planets(Game* game) 
 {
     for (int i = 0; i < MAX_PLANETS; i++) 
     {
-        if (game->planets[i].active) 
+        if (game->sim.planets[i].active) 
         {
-            SDL_RenderCopy(game->renderer, game->planet_textures[i], NULL, &game->planets[i].position);
+            SDL_Rect* pos = &game->sim.planets[i].position;
+            SDL_Texture* texture = game->sim.planets[i].damaged ? planet_view(game, i) : stream_pick(game, game->planet_textures[i], pos->w, pos->h);
+
+            //Still streaming in: a faint outline until the texture is resident.
+            //A rewind or resume can bring back a planet whose texture was evicted.
+            if (texture)
+                draw_copy(game, texture, NULL, pos);
+            else
+            {
+                stream_request(game, game->planet_textures[i]);
+                draw_aa_circle(game, pos->x + pos->w / 2, pos->y + pos->h / 2, pos->w / 2, 90, 90, 110, 96);
+            }
 
             /*printf("Rendered planet [%d] @ x: %d, y: %d, w: %d, h: %d\n", 
-                   i, game->planets[i].position.x, game->planets[i].position.y, 
-                   game->planets[i].position.w, game->planets[i].position.h);*/
+                   i, game->sim.planets[i].position.x, game->sim.planets[i].position.y, 
+                   game->sim.planets[i].position.w, game->sim.planets[i].position.h);*/
         }
     }
 }
 
-void render_gradient_bar(SDL_Renderer* renderer, int x, int y, int width, int height, float percentage, SDL_Color start_color, SDL_Color end_color) 
+void render_gradient_bar(Game* game, int x, int y, int width, int height, float percentage, SDL_Color start_color, SDL_Color end_color) 
 {
     SDL_Rect bg_rect = {x, y, width, height};
-    SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255);
-    SDL_RenderFillRect(renderer, &bg_rect);
+    draw_set_color(game, 50, 50, 50, 255);
+    draw_fill_rect(game, &bg_rect);
 
     int fill_width = (int)(percentage * width);
     for (int i = 0; i < fill_width; i++) 
@@ -828,12 +1068,12 @@ void render_gradient_bar(SDL_Renderer* renderer, int x, int y, int width, int he
             start_color.b + (end_color.b - start_color.b) * t,
             255
         };
-        SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
-        SDL_RenderDrawLine(renderer, x + i, y, x + i, y + height - 1);
+        draw_set_color(game, color.r, color.g, color.b, color.a);
+        draw_line(game, x + i, y, x + i, y + height - 1);
     }
 
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    SDL_RenderDrawRect(renderer, &bg_rect);
+    draw_set_color(game, 0, 0, 0, 255);
+    draw_rect(game, &bg_rect);
 }
 
 void render_enemies(Game* game) 
@@ -842,10 +1082,11 @@ void render_enemies(Game* game)
 
     for (int i = 0; i < MAX_ENEMIES; i++) 
     {
-        if (game->enemies[i].active) 
+        if (game->sim.enemies[i].active) 
         {
-            SDL_RenderCopy(game->renderer, game->enemy_texture, NULL, &game->enemies[i].position);        
-            //sprintf(buf, "Enemy %d: x=%d, y=%d\n", i, game->enemies[i].position.x, game->enemies[i].position.y);
+            draw_copy(game, texture_pick(&game->enemy_texture, game->sim.enemies[i].position.w, game->sim.enemies[i].position.h),
+                      NULL, &game->sim.enemies[i].position);        
+            //sprintf(buf, "Enemy %d: x=%d, y=%d\n", i, game->sim.enemies[i].position.x, game->sim.enemies[i].position.y);
             //LOG(buf);
         }
     }
@@ -854,7 +1095,7 @@ void render_enemies(Game* game)
 void render_score(Game* game) 
 {
     char score_text[32];
-    snprintf(score_text, sizeof(score_text), "Score: %d", game->player.score);    
+    snprintf(score_text, sizeof(score_text), "Score: %d", game->sim.players[game->local_player].score);    
 
     SDL_Rect dest_rect = 
     {
@@ -864,30 +1105,39 @@ void render_score(Game* game)
         10
     };
 
-    render_text(game->renderer, game->font, score_text, dest_rect.x, dest_rect.y + dest_rect.h, CLR_LIME_GREEN);
+    render_text(game, score_text, dest_rect.x, dest_rect.y + dest_rect.h, CLR_LIME_GREEN);
 }
 
 void render(Game* game) 
 {
-    SDL_SetRenderDrawColor(game->renderer, 0, 0, 0, 255);
-    SDL_RenderClear(game->renderer);
+    MemTag tag = mem_set_tag(MEM_RENDERER);
+
+    stream_update(game);
+    draw_begin_frame(game);
+    draw_set_color(game, 0, 0, 0, 255);
+    draw_clear(game);
 
     // Render scrolling background
-    for (int y = -BG_HEIGHT + game->background.scroll_y; y < SCREEN_HEIGHT; y += BG_HEIGHT) 
+    for (int y = -BG_HEIGHT + game->sim.scroll_y; y < SCREEN_HEIGHT; y += BG_HEIGHT) 
     {
         for (int x = 0; x < SCREEN_WIDTH; x += BG_WIDTH) 
         {
             SDL_Rect dest_rect = {x, y, BG_WIDTH, BG_HEIGHT};
 
-            int texture_index = rand() % 2;
-            SDL_RenderCopy(game->renderer, game->background.textures[texture_index], NULL, &dest_rect);
+            int texture_index = rand() % 2;     //Cosmetic only, so not the sim's generator
+            draw_copy(game, game->background.textures[texture_index], NULL, &dest_rect);
         }
     }
 
-    // Render player with rotation
-    SDL_Rect src_rect = {0, 0, game->player.position.w, game->player.position.h};
-    SDL_RenderCopyEx(game->renderer, game->player.texture, &src_rect, &game->player.position, 
-                     game->player.roll_angle, NULL, SDL_FLIP_NONE);
+    // Render players with rotation
+    for (int i = 0; i < game->sim.num_players; i++)
+    {
+        Player* player = &game->sim.players[i];
+        SDL_Rect src_rect = {0, 0, player->position.w, player->position.h};
+
+        draw_copy_ex(game, game->player_texture, &src_rect, &player->position, 
+                     player->roll_angle, NULL);
+    }
 
 
     render_planets(game);
@@ -897,145 +1147,192 @@ void render(Game* game)
     render_score(game);
     render_health_bar(game);
     render_projectiles(game);
-    render_current_weapon(game->renderer, game);
-    render_particles(game->renderer);
+    render_current_weapon(game);
+    render_particles(game);
+    render_anims(game);
     render_powerups(game);
 
     // Check if shield power-up is active
-    if (game->powerup_end_times[POWERUP_SHIELD] > SDL_GetTicks()) 
+    for (int i = 0; i < game->sim.num_players; i++)
     {
-        Uint32 remaining_time = game->powerup_end_times[POWERUP_SHIELD] - SDL_GetTicks();
+        Player* player = &game->sim.players[i];
+
+        if (player->powerup_end_times[POWERUP_SHIELD] <= game->sim.time) 
+            continue;
+
+        Uint32 remaining_time = player->powerup_end_times[POWERUP_SHIELD] - game->sim.time;
         Uint32 total_time = 10000; // Assuming shield lasts for 10 seconds        
-        int shield_radius = game->player.position.w / 2 + 10; // Adjust as needed
+        int shield_radius = player->position.w / 2 + 10; // Adjust as needed
         //int max_thickness = 10; // Maximum thickness of the shield
         //int current_thickness = (int)(max_thickness * remaining_time / (float)total_time);
         
         draw_shield(game, 
-                    game->player.position.x + game->player.position.w / 2, 
-                    game->player.position.y + game->player.position.h / 2, 
+                    player->position.x + player->position.w / 2, 
+                    player->position.y + player->position.h / 2, 
                     shield_radius, 
                     //current_thickness, 
                     remaining_time, 
                     total_time);
     }
     
-    SDL_RenderPresent(game->renderer);
+    render_stats_overlay(game);
+
+    if (game->paused)
+    {
+        int w = 0, h = 0;
+
+        text_size(game, "PAUSED", &w, &h);
+        render_text(game, "PAUSED", (SCREEN_WIDTH - w) / 2, (SCREEN_HEIGHT - h) / 2, CLR_LIME_GREEN);
+    }
+
+    draw_present(game);
+    mem_set_tag(tag);
 }
 
 void init_enemies(Game* game) 
 {
     for (int i = 0; i < MAX_ENEMIES; i++) 
-        game->enemies[i].active = false;    
+        game->sim.enemies[i].active = false;    
     
-    // Load enemy texture
-    SDL_Surface* surface = IMG_Load("../img/Enemies/enemy-green-01.png");
-    if (surface == NULL)
-    {
-        SDL_Log("Unable to load enemy image! SDL_Error: %s\n", SDL_GetError());
-        return;
-    }
-    game->enemy_texture = SDL_CreateTextureFromSurface(game->renderer, surface);
-    SDL_FreeSurface(surface);
+    // Load enemy texture, drawn at ENEMY_SIZE by spawn_enemy()
+    const SDL_Point sizes[] = {{ENEMY_SIZE, ENEMY_SIZE}};
+    texture_set_load(game, &game->enemy_texture, ENEMY_IMAGE, sizes, SDL_arraysize(sizes));
+
+    //From the staging surface, before texture_budget_commit() frees it. Solid if it failed to load.
+    hitbox_build(&game->enemy_hitbox, game->enemy_texture.num_variants ? game->enemy_texture.variants[0].surface : NULL,
+                 NULL, sizes[0].x, sizes[0].y, 0);
 }
 
 void update_enemies(Game* game, float delta_time) 
 {
-    Uint32 current_time = SDL_GetTicks();
     for (int i = 0; i < MAX_ENEMIES; i++) 
     {
-        Enemy* enemy = &game->enemies[i];
+        Enemy* enemy = &game->sim.enemies[i];
         if (enemy->active) 
         {
             // Move enemy
             enemy->position.x += enemy->velocity_x * delta_time;
             enemy->position.y += enemy->velocity_y * delta_time;
             
-            // Check if enemy is off-screen
-            if (enemy->position.y > SCREEN_HEIGHT) 
+            // Check if enemy is off-screen, below or retreating above
+            if (enemy->position.y > SCREEN_HEIGHT || (enemy->velocity_y < 0 && enemy->position.y + enemy->position.h < 0)) 
                 enemy->active = false;
             
             
-            // Enemy shooting
-            if (current_time - enemy->last_shot_time >= WEAPON_TYPES[enemy->current_weapon].cooldown)            
-                shoot_projectile(game, enemy, NULL);
-            
-            // Check collision with projectiles
-            for (int j = 0; j < MAX_PROJECTILES; j++) 
+            // Check collision with projectiles, one hit per tick
+            bool hit = false;
+            for (int t = 0; t < MAX_WEAPONS && !hit; t++) 
             {
-                if (game->projectiles[j].active && !game->projectiles[j].is_enemy_projectile &&
-                    check_collision(game->projectiles[j].dest_rect, enemy->position)) 
+                ProjectileBucket* bucket = &game->sim.projectiles[t];
+
+                for (int j = 0; j < bucket->count; j++) 
                 {
-                    enemy->hit_points -= game->projectiles[j].damage;
-                    game->projectiles[j].active = false;
+                    Projectile* shot = &bucket->items[j];
 
-                    if (enemy->hit_points <= 0) 
+                    if (shot->active && !shot->is_enemy_projectile &&
+                        hitbox_hit_rect(&game->enemy_hitbox, &enemy->position, &shot->dest_rect)) 
                     {
-                        game->player.score += enemy->max_hp;                        
-                        enemy->active = false;
-                        // Add explosion effect here
+                        damage_enemy(game, i, WEAPON_TYPES[t].damage, shot->owner);
+                        if (WEAPON_TYPES[t].splash > 0)
+                        {
+                            spatial_update(game);   //Enemies are mid-move here, catch the index up first
+                            projectile_splash(game, shot, WEAPON_TYPES[t].damage, WEAPON_TYPES[t].splash, i);
+                        }
+                        shot->active = false;
+                        hit = true;
+                        break;
                     }
-                    break;
                 }
             }
 
-            // Check collision with player
-            if (check_collision(enemy->position, game->player.position)) 
+            // Check collision with players
+            for (int p = 0; p < game->sim.num_players && enemy->active; p++)
             {
-                game->player.hit_points -= enemy->damage;
-                enemy->active = false;
-                // Add explosion effect here
+                if (hitbox_hit(&game->enemy_hitbox, &enemy->position, player_hitbox(game, &game->sim.players[p]), &game->sim.players[p].position)) 
+                {
+                    damage_player(game, p, enemy->damage, TARGET_ENEMY, i);
+                    enemy->active = false;
+                    emit_kill(game, (KillEvent){TARGET_ENEMY, i, -1, 0,
+                              enemy->position.x + enemy->position.w / 2.0f, enemy->position.y + enemy->position.h / 2.0f});
+                }
             }
         }
     }
-    
-    // Spawn new enemies
-    if (rnd_num(0, 200) < 2)     
-        spawn_enemy(game);    
 }
 
-void spawn_enemy(Game* game) 
+//Returns the new enemy, set up at random, or NULL if all slots are taken.
+Enemy* spawn_enemy(Game* game) 
 {
     for (int i = 0; i < MAX_ENEMIES; i++) 
     {
-        if (!game->enemies[i].active) 
+        if (!game->sim.enemies[i].active) 
         {
-            Enemy* enemy = &game->enemies[i];
+            Enemy* enemy = &game->sim.enemies[i];
             enemy->active = true;
-            enemy->position.w = 48; // Adjust based on your enemy sprite size
-            enemy->position.h = 48;
-            enemy->position.x = rnd_num(0, SCREEN_WIDTH - enemy->position.w);
+            enemy->position.w = ENEMY_SIZE;
+            enemy->position.h = ENEMY_SIZE;
+            enemy->position.x = rnd_num(game, 0, SCREEN_WIDTH - enemy->position.w);
             enemy->position.y = -enemy->position.h;
-            enemy->velocity_x = rnd_num(-50, 50);
-            enemy->velocity_y = rnd_num(50, 100);
-            enemy->max_hp = rnd_num(10,40);
+            enemy->velocity_x = rnd_num(game, -50, 50);
+            enemy->velocity_y = rnd_num(game, 50, 100);
+            enemy->max_hp = rnd_num(game, 10,40);
             enemy->hit_points = enemy->max_hp;
-            enemy->defense = rnd_num(0, 5);
-            enemy->damage = rnd_num(10, 20);
-            enemy->current_weapon = rnd_num(0, MAX_WEAPONS - 1);
-            enemy->last_shot_time = SDL_GetTicks();
+            enemy->defense = rnd_num(game, 0, 5);
+            enemy->damage = rnd_num(game, 10, 20);
+            enemy->current_weapon = rnd_num(game, 0, MAX_WEAPONS - 1);
+            enemy->last_shot_time = game->sim.time;
 
-            Uint32 current_time = SDL_GetTicks();
+            Uint32 current_time = game->sim.time;
             
             for (int j = 0; j < MAX_WEAPONS; j++) 
                 enemy->last_shot_time = current_time;            
 
-            break;
+            emitter_start(game, i);
+
+            //Two in five just drift, the rest share the other behaviours.
+            int roll = rnd_num(game, 0, 9);
+            behaviour_start(game, i, roll < 4 ? BEHAVE_DRIFT : (BehaviourKind)(BEHAVE_DRIFT + 1 + (roll - 4) % (BEHAVE_COUNT - 1)));
+
+            return enemy;
         }
     }
+    return NULL;
 }
 
 void cleanup(Game* game) 
 {
-    SDL_DestroyTexture(game->background.textures[0]);
-    SDL_DestroyTexture(game->background.textures[1]);
-
-    for (int i = 0; i < MAX_PLANETS; i++)    
-        SDL_DestroyTexture(game->planet_textures[i]);
+    stats_report(game);
+    audio_close(game, game->audio);
+    anim_close(game, game->anims);
+    net_close(game, game->net);
+    spectate_close(game, game->spectate);
+    watch_close(game, game->watch);
+    level_close(game->level);
+    events_close(game->events);
+    patterns_close(game->patterns);
+    snapshot_save_resume(game);
+    snapshot_close(game, game->snapshots);
+
+    destroy_texture(game, game->background.textures[0]);
+    destroy_texture(game, game->background.textures[1]);
+
+    planet_close_views(game);
+    stream_close(game, game->streamer);
     
     for (int i = 0; i < MAX_WEAPONS; i++)
-        SDL_DestroyTexture(game->weapon_textures[i]);
+        texture_set_destroy(game, &game->weapon_textures[i]);
+
+    texture_set_destroy(game, &game->enemy_texture);
     
-    SDL_DestroyTexture(game->powerup_texture);
+    destroy_texture(game, game->powerup_texture);
+    text_close(game);
+    capture_close(game->capture);
+    quality_close(game);
+    soft_destroy(game->soft);
+
+    if (game->font)
+        TTF_CloseFont(game->font);
+    TTF_Quit();
 
     SDL_DestroyRenderer(game->renderer);
     SDL_DestroyWindow(game->window);
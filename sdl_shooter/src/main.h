@@ -18,6 +18,7 @@
 
 //Max string length, for char buffers.
 #define MSL                         512
+#define MSL_LONG                    (MSL + 64)  //An MSL string and some text around it, e.g. a log line quoting a path
 
 //In pixels.
 #define SCREEN_WIDTH                800
@@ -31,6 +32,7 @@
 #define BG_HEIGHT                   256
 
 //ship_1.png
+#define PLAYER_IMAGE                "../img/Player/ship_1.png"
 #define PLAYER_WIDTH                48
 #define PLAYER_HEIGHT               48
 
@@ -38,6 +40,7 @@
 #define PLAYER_SPEED                300.0f
 #define PLAYER_MAX_ROLL             90.0f
 #define PLAYER_ROLL_SPEED           180.0f
+#define HITBOX_ROLL_STEPS           13      //Player hitboxes prebuilt across -PLAYER_MAX_ROLL..PLAYER_MAX_ROLL
 
 #define AFTERBURNER_MAX 100.0f
 #define AFTERBURNER_DEPLETION_RATE 30.0f // Units per second
@@ -50,18 +53,33 @@
 
 //Enemies
 #define MAX_ENEMIES 10
+#define ENEMY_SPAWN_GAP             100     //Average ticks between random spawns
+#define ENEMY_IMAGE                 "../img/Enemies/enemy-green-01.png"
+#define ENEMY_SIZE                  48      //Drawn this big, whatever the image is
 
+//Players, the second one only joins over the network (netplay.c)
+#define MAX_PLAYERS 2
 
-//Player weapons
-#define MAX_WEAPONS                 5
 
-#define WPN_LASER           0
-#define WPN_PLASMA_GUN      1
-#define WPN_RAILGUN         2
-#define WPN_RAPID_FIRE      3
-#define WPN_MISSILE         4
+//Player weapons, the one place they are defined. Expands into the WPN_ ids,
+//WEAPON_TYPES (projectiles.c) and a projectile kernel per weapon with its
+//stats as constants. homing is degrees turned per tick toward the nearest
+//enemy, splash the radius damaged around an impact; 0 for neither.
+//
+//    id              name            ammo  damage  fire_rate  speed  cooldown  offx  offy  width  height  homing  splash
+#define WEAPON_LIST(X) \
+    X(WPN_LASER,      "Laser",        100,  10,     0.5,       6,     250,      1,    4,    2,     12,     0,      0)  \
+    X(WPN_PLASMA_GUN, "Plasma Gun",   40,   20,     1.0,       5,     500,      2,    4,    4,     8,      0,      0)  \
+    X(WPN_RAILGUN,    "Railgun",      250,  25,     300,       4,     400,      8,    8,    16,    16,     0,      0)  \
+    X(WPN_RAPID_FIRE, "Rapid Fire",   500,  2,      600,       2.5,   150,      1,    1,    2,     2,      0,      0)  \
+    X(WPN_MISSILE,    "Missile",      20,   50,     200,       15,    2000,     8,    8,    16,    16,     6,      64)
 
-#define MAX_PROJECTILES     120
+#define WEAPON_ID(id, ...)  id,
+enum { WEAPON_LIST(WEAPON_ID) MAX_WEAPONS };
+
+//Shots in flight are kept per weapon, see projectiles.c
+#define PROJECTILES_PER_WEAPON      64
+#define MAX_PROJECTILES             (MAX_WEAPONS * PROJECTILES_PER_WEAPON)
 
 #define WEAPON_SWITCH_COOLDOWN 150 
 
@@ -69,26 +87,274 @@
 #define MAX_POWERUPS 10
 #define POWERUP_SIZE 32
 //#define POWERUP_SPEED 10
-#define POWERUP_SPAWN_CHANCE 0.005f
+#define POWERUP_SPAWN_GAP 200     //Average ticks between random spawns
 #define POWERUP_DURATION 10000  // 10 seconds
-//#define POWERUP_COUNT 4
+#define POWERUP_COUNT 4
 
 //Game specific
-#define FPS 60
-#define FRAME_TARGET_TIME (1000 / FPS)
+#define FPS 60                      //Simulation rate, and the default frame rate
+#define MAX_TICKS_PER_FRAME 5       //Catching up after a stall, the rest is dropped
 #define SCROLL_SPEED (PLAYER_SPEED)
 
 #define MAX_PLANETS 24 //Needs to match how many planet .png files we have
-#define PLANET_SPAWN_CHANCE 0.005 // Adjust this value to control how often planets appear
+#define PLANET_SPAWN_GAP 200      //Average ticks between random spawns
+#define PLANET_MASK_SIZE 64         //Collision mask is this many bits square, one Uint64 per row
 
 
 //Scroll speed of planets.
 #define MIN_PLANET_SPEED 50.0f
 #define MAX_PLANET_SPEED 200.0f
 
+//Software rasterizer (softrender.c), used with --soft on machines without a GPU
+#define SOFT_TILE_SIZE      64
+#define SOFT_MAX_THREADS    16
+
+//Frame pacing and frame time statistics
+#define PACER_SPIN_US               2000    //Spin instead of sleeping for the last 2ms before a deadline
+#define HIST_BUCKETS                1000
+#define HIST_BUCKET_MS              0.1f    //So the histograms cover 0-100ms
+#define STATS_WINDOW_FRAMES         300     //Frames per overlay refresh
+#define IDLE_WAIT_MS                500     //Longest block in SDL_WaitEventTimeout() while paused or in the background
+
+//Adaptive quality (quality.c)
+#define QUALITY_TIERS               4
+#define QUALITY_DOWN_LOAD           0.9f    //Share of the frame budget that, sustained, drops a tier
+#define QUALITY_DOWN_FRAMES         20
+#define QUALITY_UP_LOAD             0.6f    //Below this share for long enough raises one
+#define QUALITY_UP_FRAMES           180
+#define QUALITY_SETTLE_FRAMES       60      //Load is ignored this long after a change
+
+//Frame capture and the headless replay test
+#define CAPTURE_SLOTS               8       //Frames that can wait for the writer thread
+#define GOLDEN_DEFAULT_FRAMES       600
+#define GOLDEN_DEFAULT_EVERY        60
+#define GOLDEN_DEFAULT_TOLERANCE    8       //Per channel
+#define GOLDEN_MAX_BAD_FRACTION     0.001f  //Of all pixels
+#define BENCH_SPAWNS_PER_FRAME      64      //Effects started each --bench frame, up to MAX_ANIMS
+
+//Downscaled texture variants (textures.c)
+#define TEX_MAX_VARIANTS            6
+#define TEX_MAX_SETS                64
+#define TEX_DEFAULT_BUDGET_KB       2048
+
+//On-demand texture streaming (streaming.c)
+#define STREAM_MAX_ASSETS           64
+#define STREAM_DEFAULT_BUDGET_KB    256
+#define STREAM_UPLOADS_PER_FRAME    2
+
+//Rollback netplay (netplay.c)
+#define NET_DEFAULT_PORT            7777
+#define NET_INPUT_DELAY             2       //Ticks between sampling local input and simulating it
+#define NET_ROLLBACK_WINDOW         8       //Furthest back a correction can reach; we stall beyond it
+#define NET_INPUT_HISTORY           64      //Ring of inputs per player, must exceed the window
+#define NET_CONNECT_TIMEOUT_MS      30000
+#define NET_SHIM_QUEUE              256     //Packets the latency/loss shim can hold back
+
+//Spectator broadcast (spectate.c)
+#define SPECTATE_DEFAULT_PORT       7778
+#define SPECTATE_KEY_FRAMES         120     //Frames between keyframes, where new viewers join
+#define SPECTATE_RING_KB            1024    //Stream a viewer may fall behind before it is dropped
+#define SPECTATE_MAX_VIEWERS        32
+
+//Headless batch runs (batch.c)
+#define BATCH_DEFAULT_TICKS         (FPS * 180)
+#define BATCH_MAX_THREADS           64
+
+//Rewind and quick resume (snapshot.c)
+#define SNAP_KEYFRAME_EVERY         60      //Ticks
+#define SNAP_KEYFRAMES              16      //Rewind reaches back at most this many keyframes
+#define SNAP_ARENA_KB               1024    //For the deltas in between
+#define SNAP_RESUME_EVERY           300     //Ticks between --resume saves
+
+//Sound effects (audio.c)
+#define AUDIO_RATE                  48000
+#define AUDIO_BUFFER_FRAMES         512     //~10ms
+#define AUDIO_QUEUE_SIZE            256     //Triggers waiting for the callback
+#define AUDIO_MAX_VOICES            24
+#define AUDIO_MAX_PER_SOUND         4
+
+//Timer wheel on sim ticks (timers.c)
+#define TIMER_BITS                  6
+#define TIMER_SLOTS                 (1 << TIMER_BITS)   //Per level
+#define TIMER_LEVELS                3                   //Reaches TIMER_SLOTS^3 ticks, ~73 minutes
+#define TIMER_SPAWNS                3                   //Random spawn chains
+#define MAX_TIMERS                  (TIMER_SPAWNS + MAX_PLAYERS * POWERUP_COUNT + 2 * MAX_ENEMIES)  //One per owner
+
+//Sprite sheet effects (anim.c)
+#define MAX_ANIMS                   1024
+
+//HUD text (text.c)
+#define TEXT_FIRST_GLYPH            ' '
+#define TEXT_GLYPHS                 ('~' - ' ' + 1)     //Printable ASCII
+#define TEXT_ATLAS_WIDTH            512
+
+//Memory accounting (memory.c)
+#define MEM_ASSERT_WARMUP           300     //Frames before --no-alloc starts checking
+#define MEM_ASSERT_REPORTS          16      //Offending allocations logged, the rest only counted
+
+//Input actions, one bit each in TickInput (input.c)
+#define ACT_LEFT            (1 << 0)
+#define ACT_RIGHT           (1 << 1)
+#define ACT_FIRE            (1 << 2)
+#define ACT_AFTERBURNER     (1 << 3)
+#define ACT_PREV_WEAPON     (1 << 4)
+#define ACT_NEXT_WEAPON     (1 << 5)
+#define ACT_REWIND          (1 << 6)    //Not a sim action, update() handles it
+#define ACT_COUNT           7
+
+#define INPUT_MAX_EVENTS    64      //Buffered between two samples
+
 
 //Data structs used in game
 
+//Opaque, live in softrender.c and capture.c
+typedef struct SoftRenderer SoftRenderer;
+typedef struct FrameCapture FrameCapture;
+typedef struct TextureStreamer TextureStreamer;
+typedef struct NetSession NetSession;
+typedef struct Spectate Spectate;
+typedef struct Watch Watch;
+typedef struct SnapshotRing SnapshotRing;
+typedef struct AudioMixer AudioMixer;
+typedef struct Level Level;
+typedef struct EventBus EventBus;
+typedef struct PatternSet PatternSet;
+typedef struct AnimSystem AnimSystem;
+
+//What an allocation is for, see memory.c. MEM_SDL is SDL allocating outside
+//any mem_set_tag().
+typedef enum
+{
+    MEM_SDL,
+    MEM_GAME,
+    MEM_ASSETS,
+    MEM_TEXT,
+    MEM_PARTICLES,
+    MEM_RENDERER,
+    MEM_AUDIO,
+    MEM_NET,
+    MEM_STREAM,                 //Assets streamed in on demand, allowed under --no-alloc
+    MEM_TAGS
+} MemTag;
+
+//Every printable glyph of the font in one texture, see text.c.
+typedef struct
+{
+    SDL_Texture* texture;
+    SDL_Rect glyphs[TEXT_GLYPHS];       //In the texture, empty for blank ones
+    Sint16 advance[TEXT_GLYPHS];
+    int height;
+} TextAtlas;
+
+//Of the last finished frame, for the stats overlay.
+typedef struct
+{
+    Uint32 frame_allocs;
+    size_t frame_bytes;
+    size_t live;
+    size_t peak;
+} MemTotals;
+
+//Sound effects, shots first in WEAPON_TYPES order
+typedef enum
+{
+    SND_SHOT,
+    SND_ENEMY_SHOT = SND_SHOT + MAX_WEAPONS,
+    SND_EXPLOSION,
+    SND_PICKUP,
+    SND_COUNT
+} SoundId;
+
+//Sprite sheet effects, see anim.c
+typedef enum
+{
+    ANIM_EXPLOSION,
+    ANIM_SPARKLE,
+    ANIM_PICKUP,
+    ANIM_ENGINE,
+    ANIM_COUNT
+} AnimKind;
+
+typedef enum
+{
+    NET_NONE,
+    NET_HOST,
+    NET_JOIN
+} NetMode;
+
+//Command line options, filled in by parse_args()
+typedef struct
+{
+    bool soft_renderer;
+    bool fixed_step;            //Advance the sim by exactly 1/FPS per update
+    unsigned int seed;          //0 seeds from the clock
+
+    int target_fps;             //--fps, 0 means FPS
+    bool vsync;
+    bool uncapped;
+    char stats_file[MSL];       //Histogram dump written on exit
+    bool quality_fixed;         //--quality N pins a tier, otherwise the governor picks
+    int quality;
+
+    int texture_budget_kb;      //--tex-budget, for downscaled variants
+    int stream_budget_kb;       //--stream-budget, for streamed planets
+
+    char capture_dir[MSL];      //--capture / --capture-raw
+    bool capture_png;
+    bool capture_sequence;
+
+    NetMode net_mode;           //--host / --join
+    char net_address[MSL];      //Host to join
+    int net_port;
+    int net_latency_ms;         //--net-sim, delay added to every packet sent
+    int net_loss_percent;       //--net-sim, packets dropped on send
+    char spectate_address[MSL]; //--spectate ADDR, broadcast to viewers
+    char watch_address[MSL];    //--watch ADDR, be a viewer instead of playing
+    char resume_file[MSL];      //--resume, state saved and restored across runs
+    bool mute;                  //--mute, don't open the audio device
+    bool log_events;            //--log-events, every gameplay event to the log
+    bool mem_assert;            //--no-alloc, fail if the frame loop allocates after warmup
+    char level_file[MSL];       //--level, scripted spawns instead of random ones
+    char level_source[MSL];     //--build-level SRC OUT, compile and exit
+    char level_output[MSL];
+
+    int batch_games;            //--batch N, headless games on a thread pool, then exit
+    int batch_threads;          //--threads, 0 is one per core
+    int batch_ticks;            //--ticks, length of each game
+    char batch_logs[MSL];       //--batch-logs DIR, one log file per game
+    char batch_csv[MSL];        //--batch-csv FILE, one line of results per game
+
+    char test_dir[MSL];         //--test, golden images and timings live here
+    int test_frames;
+    int golden_every;
+    int golden_tolerance;
+    bool bless;
+
+    int bench_frames;           //--bench N, time rendering N frames of effects, then exit
+} Options;
+
+//One size of a sprite, see textures.c
+typedef struct
+{
+    SDL_Surface* surface;       //Staging copy until texture_budget_commit()
+    SDL_Texture* texture;       //NULL when it didn't fit the budget
+    int w, h;
+} TextureVariant;
+
+typedef struct
+{
+    TextureVariant variants[TEX_MAX_VARIANTS];  //Smallest first
+    int num_variants;
+    int source_w, source_h;
+} TextureSet;
+
+typedef struct
+{
+    TextureSet* sets[TEX_MAX_SETS];
+    int num_sets;
+    size_t resident_bytes;
+} TexturePool;
+
 //Particles
 typedef struct 
 {
@@ -100,16 +366,32 @@ typedef struct
 
 typedef struct 
 {
-    SDL_Texture* texture;
     SDL_Rect position;
     float scale;
     float speed;
     bool active;
-    float radius;
-    float x;
-    float y;    
+    Uint64 mask[PLANET_MASK_SIZE];  //Bit x of mask[y] is solid, scaled over position
+    int solid;                      //Bits set when it spawned
+    bool damaged;                   //Cratered, so drawn from the mask instead of the shared texture
 } Planet;
 
+//Collision shape of a sprite as drawn, see hitbox.c.
+#define HITBOX_MAX_SIZE 64
+
+typedef struct
+{
+    int w, h;                       //Drawn size it was built for
+    float cx, cy, radius;           //Bounding circle, from the top left of the drawn rect
+    Uint64 rows[HITBOX_MAX_SIZE];   //Bit x of rows[y] is solid
+} Hitbox;
+
+//Render side copy of a damaged planet, kept per slot and reused.
+typedef struct
+{
+    SDL_Texture* texture;
+    Uint64 shown[PLANET_MASK_SIZE]; //Mask the texture currently matches
+} PlanetView;
+
 // Power-up types
 typedef enum {
     POWERUP_SPEED,
@@ -121,47 +403,200 @@ typedef enum {
 // Power-up structure
 typedef struct {
     PowerUpType type;
-    SDL_Texture* texture;
     SDL_Rect position;
     float velocity_y;
     bool active;
 } PowerUp;
 
+//Gameplay events, emitted during a tick and handled together at its end (events.c)
+typedef enum
+{
+    EV_HIT,
+    EV_KILL,
+    EV_PICKUP,
+    EV_PLAYER_DAMAGED,
+    EV_COUNT
+} GameEventType;
+
+typedef enum
+{
+    TARGET_ENEMY,
+    TARGET_PLANET,
+    TARGET_PLAYER
+} TargetKind;
+
+typedef struct
+{
+    TargetKind kind;
+    int index;                  //Into the sim array for kind
+    int damage;
+    int owner;                  //Player that fired, -1 for enemies
+    float x, y;
+} HitEvent;
+
+typedef struct
+{
+    TargetKind kind;
+    int index;
+    int owner;                  //Player credited, -1 for none
+    int score;
+    float x, y;                 //Centre, where the explosion goes
+} KillEvent;
+
+typedef struct
+{
+    int player;
+    PowerUpType type;
+    float x, y;                 //Centre of the powerup
+} PickupEvent;
+
+typedef struct
+{
+    int player;
+    int damage;
+    TargetKind source;
+    int source_index;           //-1 when not known (enemy shots)
+} PlayerDamagedEvent;
+
+//What the player asked for during one tick, built by input_sample()
+typedef struct
+{
+    Uint16 held;                //ACT_* bits down at sample time
+    Uint16 pressed;             //ACT_* bits pressed since the last sample, even if already released
+    int wheel;                  //Weapon steps scrolled, negative is previous
+    Uint64 event_time;          //Performance counter time of the oldest event, 0 if none
+} TickInput;
+
+typedef struct
+{
+    Uint64 time;                //Performance counter
+    Uint16 action;              //ACT_* bits, 0 for wheel-only events
+    bool down;
+    Sint8 wheel;
+} InputEvent;
+
+typedef struct
+{
+    InputEvent pending[INPUT_MAX_EVENTS];
+    int num_pending;
+    Uint8 down_count[ACT_COUNT];    //Keys/buttons holding each action
+    Uint16 pressed;                 //Folded in ahead of the next sample, see input_fold()
+    int wheel;
+    Uint64 folded_time;             //Oldest event folded in early, 0 if none
+    Uint64 latency_start;           //Oldest sampled event not yet presented
+} InputState;
+
+typedef struct
+{
+    Uint64 freq;
+    Uint64 period;              //Counter ticks per frame, 0 when vsync or uncapped
+    Uint64 spin_threshold;
+    Uint64 frame_start;
+    Uint64 next_deadline;
+    bool vsync;
+} FramePacer;
+
+typedef struct
+{
+    Uint32 counts[HIST_BUCKETS];
+    Uint32 total;
+    double sum_ms;
+    float max_ms;
+} FrameHistogram;
+
+typedef struct
+{
+    FrameHistogram frame;       //Whole session
+    FrameHistogram work;
+    FrameHistogram window_frame;    //Filling up
+    FrameHistogram window_work;
+    FrameHistogram shown_frame;     //Last full window, drawn by the overlay
+    FrameHistogram shown_work;
+    FrameHistogram latency;         //Input event to present
+    FrameHistogram window_latency;
+    FrameHistogram shown_latency;
+} FrameStats;
+
+typedef struct
+{
+    const char* name;
+    float render_scale;         //Share of the window drawn, then stretched over all of it
+    int particle_step;          //Only every Nth particle is drawn
+    bool aa;                    //Antialiased shield rings
+} QualityTier;
+
+typedef struct
+{
+    int tier;                   //Into QUALITY_TABLE, 0 is full quality
+    bool locked;                //--quality N, capture and the replay test
+    float load_ms;              //Smoothed time from frame start to present
+    int over;                   //Consecutive frames past either threshold
+    int under;
+    int settle;
+    Uint64 drawn;               //Counter when the frame was handed to present
+    Uint32 frames[QUALITY_TIERS];
+    Uint32 changes;
+    SDL_Texture* target;        //SDL_Renderer path: reduced frames are drawn in here first
+    bool scaled;                //This frame is going into target
+} QualityGovernor;
+
 typedef struct 
 {
     SDL_Texture* textures[2];
-    int scroll_y;
 } Background;
 
+//A shot in flight. Everything its weapon decides (speed, damage, size,
+//texture) comes from which bucket it is in.
 typedef struct 
 {
     float x, y;
-    float vx, vy;
+    float vx, vy;               //Pixels per tick
     float angle;
-    float speed;
-    int damage;
-    bool active;
-    int type;
-    SDL_Texture* texture;
     SDL_Rect dest_rect;
-    SDL_Point center;
+    Sint8 owner;                //Player index, -1 for enemy fire
+    Sint8 shooter;              //Enemy index for enemy fire, which it can't hit, -1 for players
     bool is_enemy_projectile;
+    bool active;                //Cleared on a hit; the bucket drops it at its next update
 } Projectile;
 
+typedef struct
+{
+    int count;                  //Packed from 0
+    Projectile items[PROJECTILES_PER_WEAPON];
+} ProjectileBucket;
+
 typedef struct 
 {
     int max_ammo;
     int damage;
     float fire_rate;
-    int bullet_speed;
+    float bullet_speed;
     Uint32 cooldown;
-    char* name;    
+    char name[16];
     int offset_x;     //for positioning with shooter
     int offset_y;
     int width;
     int height;
+    float homing;     //Degrees per tick a player's shot turns toward the nearest enemy, 0 flies straight
+    int splash;       //Radius damaged around an impact, 0 hits one target
 } WeaponType;
 
+//Uniform grid over the screen holding enemy centres, see spatial.c.
+#define SPATIAL_CELL 64
+#define SPATIAL_COLS ((SCREEN_WIDTH + SPATIAL_CELL - 1) / SPATIAL_CELL)
+#define SPATIAL_ROWS ((SCREEN_HEIGHT + SPATIAL_CELL - 1) / SPATIAL_CELL)
+#define SPATIAL_MAX_K 16
+
+typedef struct
+{
+    Sint16 head[SPATIAL_ROWS * SPATIAL_COLS];   //First enemy in each cell, -1 for none
+    Sint16 next[MAX_ENEMIES];
+    Sint16 prev[MAX_ENEMIES];
+    Sint16 cell[MAX_ENEMIES];                   //Cell each enemy is linked into, -1 if not
+    float x[MAX_ENEMIES];                       //Centres as of the last spatial_update()
+    float y[MAX_ENEMIES];
+} SpatialIndex;
+
 typedef struct 
 {
     WeaponType type;
@@ -170,7 +605,6 @@ typedef struct
 
 typedef struct 
 {
-    SDL_Texture* texture;
     SDL_Rect position;
 
     float velocity_x;
@@ -187,10 +621,44 @@ typedef struct
     Weapon weapons[MAX_WEAPONS];
     int current_weapon;
     int score;
+    Uint32 powerup_end_times[POWERUP_COUNT];
 } Player;
 
+//Where an enemy is in its bullet pattern, see patterns.c.
+#define PATTERN_LOOP_DEPTH 4
+
+typedef struct
+{
+    Sint16 pattern;             //-1 doesn't fire
+    Uint16 pc;                  //Byte offset into the pattern's code
+    Sint16 timer;               //Wakes it up after a wait, -1 while running
+    Uint16 depth;               //Loops open
+    Uint16 loop_start[PATTERN_LOOP_DEPTH];
+    Uint16 loop_left[PATTERN_LOOP_DEPTH];
+    float aim;                  //Degrees, 0 is up, clockwise
+} Emitter;
+
+//What an enemy does besides fire, see behaviours.c.
+typedef enum
+{
+    BEHAVE_DRIFT,               //Keeps the velocity it spawned with
+    BEHAVE_STRAFE,
+    BEHAVE_DIVE,
+    BEHAVE_GUNNER,
+    BEHAVE_COUNT
+} BehaviourKind;
+
+//A behaviour's whole coroutine state.
+typedef struct
+{
+    Uint16 line;                //Where it resumes, 0 to start
+    Sint16 timer;               //Wakes it up, -1 while running or when done
+    Uint8 kind;
+    Uint8 i, j;                 //Loop counters kept across waits
+    Sint16 target;              //Where it is steering to
+} Behaviour;
+
 typedef struct {
-    SDL_Texture* texture;
     SDL_Rect position;
     float velocity_x;
     float velocity_y;
@@ -201,51 +669,384 @@ typedef struct {
     int current_weapon;
     Uint32 last_shot_time;
     bool active;
+    Emitter emitter;
+    Behaviour behaviour;
 } Enemy;
 
+//What a timer does when it fires, see timers.c.
+typedef enum
+{
+    TIMER_EMITTER,              //Resume enemy target's bullet pattern
+    TIMER_BEHAVIOUR,            //Resume enemy target's behaviour
+    TIMER_POWERUP_END,          //target is player * POWERUP_COUNT + PowerUpType
+    TIMER_SPAWN_ENEMY,
+    TIMER_SPAWN_PLANET,
+    TIMER_SPAWN_POWERUP
+} TimerKind;
+
+typedef struct
+{
+    Uint32 due;                 //Tick it fires on
+    Sint16 next;                //In its slot
+    Sint16 slot;                //Flat index of the head it hangs off, -1 if not pending
+    Sint16 target;
+    Uint8 kind;
+} Timer;
+
+typedef struct
+{
+    Uint32 now;                                 //Next tick to run
+    Sint16 head[TIMER_LEVELS][TIMER_SLOTS];     //First timer in each slot, -1 for none
+    Timer timers[MAX_TIMERS];
+} TimerWheel;
+
+//Everything update() changes. Netplay rolls back by copying this whole
+//block and snapshot.c stores it as raw bytes, so it must stay plain data: no
+//pointers, textures are looked up by index when drawing. Game logic uses
+//time instead of SDL_GetTicks() and sim_rand() instead of rand().
+typedef struct
+{
+    Uint32 tick;                    //Updates run so far
+    Uint32 time;                    //Milliseconds of simulated time
+    Uint32 rng;                     //sim_rand() state
+    int scroll_y;                   //Background
+    double distance;                //Scrolled in total, what level events are timed by; a float stops counting past 2^24 px
+    double level_origin;            //distance when the level (re)started
+    Uint32 level_event;             //Next level event to play
+
+    Player players[MAX_PLAYERS];
+    int num_players;
+    Enemy enemies[MAX_ENEMIES];
+    ProjectileBucket projectiles[MAX_WEAPONS];
+    Planet planets[MAX_PLANETS];
+    PowerUp powerups[MAX_POWERUPS];
+    Particle particles[MAX_PARTICLES];
+    Particle afterburner_particles[MAX_AFTERBURNER_PARTICLES];
+    TimerWheel timers;
+} SimState;
+
+//Where LOG() goes on the calling thread, see log_set_context()
+typedef struct
+{
+    FILE* fp;                   //NULL drops everything
+} LogContext;
+
 typedef struct 
 {
     SDL_Renderer* renderer;
     SDL_Window* window;
+    SoftRenderer* soft;             //NULL unless the software rasterizer is active
+    FrameCapture* capture;
+    Options opts;
     Background background;
     bool is_running;
-    Player player;
-    SDL_Texture * weapon_textures[MAX_WEAPONS];
-    
-    Planet planets[MAX_PLANETS];
-    SDL_Texture* planet_textures[MAX_PLANETS];
-    Uint32 last_frame_time;
+    bool paused;                    //P / Pause, single player only
+    bool minimized;                 //Minimized or hidden
+    bool unfocused;
+    bool idle;                      //Paused or in the background, see idle_wait()
+    bool redraw;                    //Idle, but the window needs painting again
+
+    SimState sim;
+    int local_player;               //Index in sim.players this machine controls
+    NetSession* net;                //NULL unless playing co-op
+    Spectate* spectate;             //NULL unless broadcasting to viewers
+    Watch* watch;                   //NULL unless watching someone else's game
+    SnapshotRing* snapshots;        //Rewind history, NULL in co-op
+    AudioMixer* audio;              //NULL when muted or there is no audio device
+    AnimSystem* anims;              //Sprite sheet effects, NULL when headless
+    Level* level;                   //NULL for random spawning
+    EventBus* events;               //Frame arena and this tick's gameplay events
+    PatternSet* patterns;           //Compiled enemy bullet patterns
+    bool resimulating;              //Netplay re-running ticks after a rollback
+    bool headless;                  //Batch instance: no window, renderer, textures or audio
+    LogContext log;                 //Batch instance's log, installed on its worker thread
+
+    SDL_Texture* player_texture;
+    Hitbox player_hitboxes[HITBOX_ROLL_STEPS];
+    Hitbox enemy_hitbox;
+    SpatialIndex enemy_index;
+    TextureSet weapon_textures[MAX_WEAPONS];
+    int planet_textures[MAX_PLANETS];   //Streamed asset ids, planet i always uses planet_textures[i]
+    PlanetView planet_views[MAX_PLANETS];
+    Uint64 last_update_counter;
+    Uint64 sim_counter;             //Play time on the performance counter, update() runs ticks up to it
 
     float current_game_speed;
-    Projectile projectiles[MAX_PROJECTILES];
     TTF_Font* font;
+    TextAtlas text;
 
-    Particle afterburner_particles[MAX_AFTERBURNER_PARTICLES];
-
+    TextureSet enemy_texture;
+    SDL_Texture* powerup_texture;
 
+    TexturePool textures;
+    TextureStreamer* streamer;
 
-    Enemy enemies[MAX_ENEMIES];
-    SDL_Texture* enemy_texture;
+    InputState input;
+    TickInput tick_input;           //Applied by the next update()
 
-    PowerUp powerups[MAX_POWERUPS];
-    SDL_Texture* powerup_texture;
-    Uint32 powerup_end_times[4];
+    FramePacer pacer;
+    FrameStats stats;
+    bool show_stats;
+    QualityGovernor quality;
 } Game;
 
 
 
 
+//Colors, main.c
+extern const SDL_Color CLR_LIME_GREEN;
+
+//Weapon stats, projectiles.c
+extern const WeaponType WEAPON_TYPES[];
+
 //Function declarations shared program wide.
 void add_log(char * message);
-void apply_powerup(Game* game, PowerUpType type);
+void log_set_context(LogContext* context);
+void apply_powerup(Game* game, Player* player, PowerUpType type);
 bool check_collision(SDL_Rect a, SDL_Rect b);
+void create_explosion(Game* game, float x, float y);
 void render_powerups(Game* game);
-void spawn_powerup(Game* game);
-void update_powerup_effects(Game* game);
+PowerUp* spawn_powerup(Game* game);
+void powerup_expire(Game* game, int player, int type);
 void update_powerups(Game* game, float delta_time);
 
-//Globals
-extern Particle particles[MAX_PARTICLES];
+//events.c
+void emit_hit(Game* game, HitEvent event);
+void emit_kill(Game* game, KillEvent event);
+void emit_pickup(Game* game, PickupEvent event);
+void emit_player_damaged(Game* game, PlayerDamagedEvent event);
+void events_begin(Game* game);
+void events_close(EventBus* bus);
+void events_dispatch(Game* game);
+EventBus* events_open(void);
+Uint64 events_total(Game* game, GameEventType type);
+void* frame_alloc(Game* game, size_t size);
+
+//batch.c
+int run_batch(Game* game);
+
+//hitbox.c
+void hitbox_build(Hitbox* box, SDL_Surface* surface, const SDL_Rect* src, int w, int h, float angle);
+bool hitbox_hit(const Hitbox* a, const SDL_Rect* at_a, const Hitbox* b, const SDL_Rect* at_b);
+bool hitbox_hit_rect(const Hitbox* box, const SDL_Rect* at, const SDL_Rect* rect);
+bool hitbox_load(Game* game);
+void hitbox_build_player(Game* game, SDL_Surface* surface);
+const Hitbox* player_hitbox(Game* game, const Player* player);
+
+//patterns.c
+float enemy_aim(Game* game, const Enemy* enemy);
+void emitter_start(Game* game, int index);
+void patterns_close(PatternSet* set);
+PatternSet* patterns_load(void);
+void patterns_update(Game* game, const int* enemies, int count);
+
+//behaviours.c
+void behaviour_start(Game* game, int index, BehaviourKind kind);
+void behaviours_update(Game* game, const int* enemies, int count);
+
+//projectiles.c
+void render_projectiles(Game* game);
+Projectile* projectile_spawn(Game* game, int type, float x, float y, float angle, int owner, int shooter);
+void update_projectiles(Game* game);
+
+//timers.c
+int timer_add(Game* game, TimerKind kind, int target, Uint32 delay);
+void timers_reset(Game* game);
+void timers_update(Game* game);
+
+//spatial.c
+void projectile_home(Game* game, Projectile* projectile, float rate, float speed);
+void projectile_splash(Game* game, const Projectile* projectile, int damage, int radius, int direct);
+void spatial_init(SpatialIndex* index);
+int spatial_nearest(Game* game, float x, float y, int k, float max_dist, int* out);
+int spatial_radius(Game* game, float x, float y, float radius, int* out, int max);
+void spatial_update(Game* game);
+
+//planets.c
+void planet_close_views(Game* game);
+bool planet_hit(Game* game, int index, const SDL_Rect* rect, int damage, int owner);
+void planet_init_mask(Game* game, int index);
+bool planet_mask_hit(const Planet* planet, const SDL_Rect* rect, int* gx, int* gy);
+SDL_Texture* planet_view(Game* game, int index);
+
+//functions.c
+bool damage_enemy(Game* game, int index, int damage, int owner);
+void damage_player(Game* game, int player, int damage, TargetKind source, int source_index);
+int rnd_num(Game* game, int min, int max);
+Uint32 sim_rand(Game* game);
+float sim_randf(Game* game);
+void sim_seed(Game* game, Uint32 seed);
+
+//main.c
+void render(Game* game);
+void reset_sim(Game* game, Uint32 seed, int num_players);
+void shoot_projectile(Game* game, Enemy * enemy, Player * player);
+Enemy* spawn_enemy(Game* game);
+Planet* spawn_planet(Game* game, int index);
+void sim_step(Game* game, const TickInput inputs[MAX_PLAYERS], float delta_time);
+void update(Game* game);
+
+//input.c
+bool input_handle_event(Game* game, const SDL_Event* event);
+void input_mark_presented(Game* game);
+void input_reset(Game* game);
+void input_sample(Game* game);
+void input_defer(Game* game);
+
+//netplay.c
+void net_close(Game* game, NetSession* net);
+NetSession* net_open(Game* game);
+void net_update(Game* game);
+
+//spectate.c
+Spectate* spectate_open(Game* game);
+void spectate_close(Game* game, Spectate* spectate);
+void spectate_publish(Game* game);
+Watch* watch_open(Game* game);
+void watch_close(Game* game, Watch* watch);
+void watch_update(Game* game);
+
+//anim.c
+void anim_close(Game* game, AnimSystem* anims);
+int anim_count(Game* game);
+AnimSystem* anim_open(Game* game);
+void anim_spawn(Game* game, AnimKind kind, float x, float y, float vx, float vy, float size);
+void anim_update(Game* game);
+void render_anims(Game* game);
+
+//audio.c
+void audio_close(Game* game, AudioMixer* mixer);
+AudioMixer* audio_open(Game* game);
+void audio_pause(Game* game, bool pause);
+void audio_play(Game* game, SoundId sound, float x);
+
+//level.c
+bool level_build(const char* src_path, const char* out_path);
+void level_close(Level* level);
+Level* level_open(const char* path);
+void level_update(Game* game);
+
+//snapshot.c
+void snapshot_capture(Game* game);
+void snapshot_close(Game* game, SnapshotRing* ring);
+bool snapshot_load_resume(Game* game);
+SnapshotRing* snapshot_open(Game* game);
+bool snapshot_rewind(Game* game);
+bool snapshot_save_resume(Game* game);
+
+//memory.c
+void* mem_alloc(MemTag tag, size_t size);
+void* mem_calloc(MemTag tag, size_t count, size_t size);
+void mem_frame_end(Game* game);
+void mem_free(void* ptr);
+void mem_disarm(void);
+void mem_install(void);
+void* mem_realloc(MemTag tag, void* ptr, size_t size);
+bool mem_report(void);
+MemTag mem_set_tag(MemTag tag);
+void mem_totals(MemTotals* totals);
+
+//pacing.c
+void pacer_end_frame(Game* game);
+void pacer_init(FramePacer* pacer, const Options* opts);
+void pacer_reset(FramePacer* pacer);
+
+//quality.c
+void quality_begin_frame(Game* game);
+void quality_close(Game* game);
+void quality_end_frame(Game* game, Uint64 frame_start);
+void quality_init(Game* game);
+void quality_resolve(Game* game);
+const QualityTier* quality_tier(Game* game);
+
+//stats.c
+void histogram_add(FrameHistogram* hist, float ms);
+float histogram_mean(const FrameHistogram* hist);
+float histogram_percentile(const FrameHistogram* hist, float percentile);
+void histogram_reset(FrameHistogram* hist);
+void render_stats_overlay(Game* game);
+void stats_record_frame(Game* game, float frame_ms, float work_ms);
+void stats_record_latency(Game* game, float ms);
+void stats_report(Game* game);
+
+//replay_test.c
+int run_render_bench(Game* game);
+int run_replay_test(Game* game);
+
+//capture.c
+void capture_begin_frame(Game* game);
+void capture_close(FrameCapture* capture);
+void capture_end_frame(Game* game);
+bool capture_frame(Game* game, const char* path, bool block);
+FrameCapture* capture_open(Game* game, const char* dir, bool png);
+void capture_read_pixels(Game* game, Uint32* out);
+
+//draw.c
+SDL_Texture* create_texture(Game* game, SDL_Surface* surface);
+void destroy_texture(Game* game, SDL_Texture* texture);
+void draw_begin_frame(Game* game);
+void draw_aa_circle(Game* game, int x, int y, int radius, Uint8 r, Uint8 g, Uint8 b, Uint8 a);
+void draw_circle(Game* game, int x, int y, int radius, Uint8 r, Uint8 g, Uint8 b, Uint8 a);
+void draw_clear(Game* game);
+void draw_copy(Game* game, SDL_Texture* texture, const SDL_Rect* src, const SDL_Rect* dst);
+void draw_copy_ex(Game* game, SDL_Texture* texture, const SDL_Rect* src, const SDL_Rect* dst, double angle, const SDL_Point* center);
+void draw_fill_rect(Game* game, const SDL_Rect* rect);
+void draw_line(Game* game, int x1, int y1, int x2, int y2);
+void draw_point(Game* game, int x, int y);
+void draw_present(Game* game);
+void draw_quads(Game* game, SDL_Texture* texture, const SDL_Vertex* vertices, const int* indices, int num_quads);
+void draw_rect(Game* game, const SDL_Rect* rect);
+void draw_set_color(Game* game, Uint8 r, Uint8 g, Uint8 b, Uint8 a);
+void set_texture_color_mod(Game* game, SDL_Texture* texture, Uint8 r, Uint8 g, Uint8 b);
+void update_texture(Game* game, SDL_Texture* texture, const SDL_Rect* rect, const Uint32* pixels, int pitch);
+
+//text.c
+void render_text(Game* game, const char* text, int x, int y, SDL_Color color);
+void text_close(Game* game);
+bool text_open(Game* game);
+void text_size(Game* game, const char* text, int* w, int* h);
+
+//textures.c
+void texture_budget_commit(Game* game);
+SDL_Texture* texture_pick(const TextureSet* set, int w, int h);
+bool texture_set_build(TextureSet* set, const char* path, const SDL_Point* sizes, int num_sizes);
+void texture_set_destroy(Game* game, TextureSet* set);
+bool texture_set_mask(const TextureSet* set, int size, Uint64* mask, Uint32* pixels);
+bool texture_set_load(Game* game, TextureSet* set, const char* path, const SDL_Point* sizes, int num_sizes);
+size_t texture_set_upload(Game* game, TextureSet* set);
+
+//streaming.c
+int stream_add(TextureStreamer* stream, const char* path, const SDL_Point* sizes, int num_sizes);
+void stream_close(Game* game, TextureStreamer* stream);
+TextureStreamer* stream_open(Game* game, bool async);
+SDL_Texture* stream_pick(Game* game, int id, int w, int h);
+bool stream_mask(Game* game, int id, Uint64* mask);
+const Uint32* stream_mask_pixels(Game* game, int id);
+bool stream_present(Game* game, int id);
+bool stream_request(Game* game, int id);
+void stream_update(Game* game);
+
+//softrender.c
+void soft_clear(SoftRenderer* soft);
+void soft_copy(SoftRenderer* soft, SDL_Texture* texture, const SDL_Rect* src, const SDL_Rect* dst, double angle, const SDL_Point* center);
+SoftRenderer* soft_create(SDL_Renderer* renderer, int width, int height);
+void soft_destroy(SoftRenderer* soft);
+void soft_draw_circle(SoftRenderer* soft, int x, int y, int radius, Uint8 r, Uint8 g, Uint8 b, Uint8 a);
+void soft_draw_line(SoftRenderer* soft, int x1, int y1, int x2, int y2);
+void soft_draw_point(SoftRenderer* soft, int x, int y);
+void soft_draw_quads(SoftRenderer* soft, SDL_Texture* texture, const SDL_Vertex* vertices, int num_quads);
+void soft_fill_rect(SoftRenderer* soft, const SDL_Rect* rect);
+void soft_flush(SoftRenderer* soft);
+const Uint32* soft_get_framebuffer(SoftRenderer* soft);
+void soft_present(SoftRenderer* soft);
+void soft_register_texture(SoftRenderer* soft, SDL_Texture* texture, SDL_Surface* surface);
+void soft_set_draw_blend_mode(SoftRenderer* soft, SDL_BlendMode mode);
+void soft_set_draw_color(SoftRenderer* soft, Uint8 r, Uint8 g, Uint8 b, Uint8 a);
+void soft_set_scale(SoftRenderer* soft, float scale);
+void soft_set_texture_mod(SoftRenderer* soft, SDL_Texture* texture, Uint8 r, Uint8 g, Uint8 b, Uint8 a);
+void soft_unregister_texture(SoftRenderer* soft, SDL_Texture* texture);
+void soft_update_texture(SoftRenderer* soft, SDL_Texture* texture, const SDL_Rect* rect, const Uint32* pixels, int pitch);
+
 
 
 
@@ -0,0 +1,298 @@
+#include "main.h"
+
+#include <stddef.h>
+
+//Memory accounting. SDL and the libraries on top of it (surfaces, textures,
+//fonts, image decoding) allocate through hooks installed with
+//SDL_SetMemoryFunctions(), and the game's own allocations go through
+//mem_alloc() and friends, so both land in one table by tag: what is live,
+//the peak, and how much each frame allocated.
+//
+//SDL's allocations get the tag the calling thread last set with
+//mem_set_tag(), MEM_SDL if none. Every block carries a small header with
+//its size and tag, so a free is credited back to the tag that allocated it.
+//mem_install() runs before SDL allocates anything, so every block SDL hands
+//back to hook_free() came from the hooks and has a header.
+//
+//With --no-alloc, every allocation made once MEM_ASSERT_WARMUP frames have
+//gone by is a failure: the first MEM_ASSERT_REPORTS are logged with tag and
+//size, and the game exits non-zero. Two things are left out: whatever is
+//allocated while the thread's tag is MEM_STREAM (assets loaded on demand,
+//and the renderer's copies of them), which is what streaming is for, and
+//everything from mem_disarm() on, i.e. shutdown.
+
+typedef union
+{
+    struct
+    {
+        size_t size;
+        Uint32 tag;
+    } h;
+    max_align_t align;                  //Keeps the block behind it aligned
+} MemHeader;
+
+typedef struct
+{
+    size_t live;                        //Bytes
+    size_t peak;
+    Uint64 blocks;                      //Live
+    Uint64 allocs;                      //Ever
+    Uint64 bytes;
+} MemTagStats;
+
+typedef struct
+{
+    MemTag tag;
+    size_t size;
+    Uint32 frame;
+} MemViolation;
+
+static const char* const MEM_TAG_NAMES[MEM_TAGS] = {"sdl", "game", "assets", "text", "particles", "renderer", "audio", "net", "stream"};
+
+static struct
+{
+    SDL_SpinLock lock;
+    MemTagStats tags[MEM_TAGS];
+    size_t live;
+    size_t peak;
+
+    Uint32 frames;                      //Finished, see mem_frame_end()
+    Uint32 frame_allocs;                //In the frame under way
+    size_t frame_bytes;
+    MemTotals last;                     //Of the last finished frame
+    Uint32 max_frame_allocs;
+    Uint64 steady_allocs;               //Since warmup
+
+    bool armed;                         //--no-alloc is checking
+    bool checked;                       //It was at some point, see mem_report()
+    Uint64 violations;
+    MemViolation reports[MEM_ASSERT_REPORTS];
+    int reported;                       //Of reports already logged
+} mem;
+
+//Not SDL's TLS, which allocates.
+static _Thread_local MemTag current_tag;
+
+static void account(MemTag tag, size_t size, bool allocated)
+{
+    MemTagStats* stats = &mem.tags[tag];
+
+    SDL_AtomicLock(&mem.lock);
+    if (allocated)
+    {
+        stats->live += size;
+        stats->blocks++;
+        stats->allocs++;
+        stats->bytes += size;
+        stats->peak = SDL_max(stats->peak, stats->live);
+        mem.live += size;
+        mem.peak = SDL_max(mem.peak, mem.live);
+        mem.frame_allocs++;
+        mem.frame_bytes += size;
+
+        if (mem.armed && current_tag != MEM_STREAM && mem.violations++ < MEM_ASSERT_REPORTS)
+            mem.reports[mem.violations - 1] = (MemViolation){tag, size, mem.frames};
+    }
+    else
+    {
+        stats->live -= size;
+        stats->blocks--;
+        mem.live -= size;
+    }
+    SDL_AtomicUnlock(&mem.lock);
+}
+
+static void* tagged_alloc(MemTag tag, size_t size, bool zero)
+{
+    if (size > SIZE_MAX - sizeof(MemHeader))
+        return NULL;
+
+    MemHeader* header = zero ? calloc(1, sizeof(MemHeader) + size) : malloc(sizeof(MemHeader) + size);
+
+    if (header == NULL)
+        return NULL;
+
+    header->h.size = size;
+    header->h.tag = tag;
+    account(tag, size, true);
+    return header + 1;
+}
+
+void* mem_alloc(MemTag tag, size_t size)
+{
+    return tagged_alloc(tag, size, false);
+}
+
+void* mem_calloc(MemTag tag, size_t count, size_t size)
+{
+    if (size && count > (SIZE_MAX - sizeof(MemHeader)) / size)
+        return NULL;
+    return tagged_alloc(tag, count * size, true);
+}
+
+//A block keeps the tag it was first allocated with.
+void* mem_realloc(MemTag tag, void* ptr, size_t size)
+{
+    if (ptr == NULL)
+        return tagged_alloc(tag, size, false);
+    if (size > SIZE_MAX - sizeof(MemHeader))
+        return NULL;
+
+    MemHeader* header = (MemHeader*)ptr - 1;
+    MemTag owner = header->h.tag;
+    size_t old = header->h.size;
+
+    //Credited before the move, the header may be gone after it.
+    MemHeader* grown = realloc(header, sizeof(MemHeader) + size);
+    if (grown == NULL)
+        return NULL;
+
+    account(owner, old, false);
+    grown->h.size = size;
+    account(owner, size, true);
+    return grown + 1;
+}
+
+void mem_free(void* ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    MemHeader* header = (MemHeader*)ptr - 1;
+
+    account(header->h.tag, header->h.size, false);
+    free(header);
+}
+
+static void* hook_malloc(size_t size) { return mem_alloc(current_tag, size); }
+static void* hook_calloc(size_t count, size_t size) { return mem_calloc(current_tag, count, size); }
+static void* hook_realloc(void* ptr, size_t size) { return mem_realloc(current_tag, ptr, size); }
+static void hook_free(void* ptr) { mem_free(ptr); }
+
+//Routes SDL's allocations through the accounting. First thing in main(),
+//SDL must not have allocated anything yet.
+void mem_install(void)
+{
+    if (SDL_SetMemoryFunctions(hook_malloc, hook_calloc, hook_realloc, hook_free) < 0)
+        SDL_Log("Unable to install the memory hooks, only the game's own allocations are counted: %s\n", SDL_GetError());
+}
+
+//Tags what SDL allocates on this thread from now on; returns the tag it
+//replaces, to put back afterwards.
+MemTag mem_set_tag(MemTag tag)
+{
+    MemTag previous = current_tag;
+
+    current_tag = tag;
+    return previous;
+}
+
+void mem_totals(MemTotals* totals)
+{
+    SDL_AtomicLock(&mem.lock);
+    *totals = mem.last;
+    SDL_AtomicUnlock(&mem.lock);
+}
+
+//Once a frame, from the main loop: closes the frame's counts, and after the
+//warmup arms --no-alloc.
+void mem_frame_end(Game* game)
+{
+    char buf[MSL];
+    MemViolation reports[MEM_ASSERT_REPORTS];
+    int first, last;
+
+    SDL_AtomicLock(&mem.lock);
+    mem.last = (MemTotals){mem.frame_allocs, mem.frame_bytes, mem.live, mem.peak};
+    mem.max_frame_allocs = SDL_max(mem.max_frame_allocs, mem.frame_allocs);
+    if (mem.frames >= MEM_ASSERT_WARMUP)
+        mem.steady_allocs += mem.frame_allocs;
+    mem.frame_allocs = 0;
+    mem.frame_bytes = 0;
+    mem.frames++;
+
+    bool arm = game->opts.mem_assert && !mem.checked && mem.frames == MEM_ASSERT_WARMUP;
+    mem.armed |= arm;
+    mem.checked |= arm;
+
+    first = mem.reported;
+    last = (int)SDL_min(mem.violations, (Uint64)MEM_ASSERT_REPORTS);
+    memcpy(reports, mem.reports, sizeof(reports));
+    mem.reported = last;
+    SDL_AtomicUnlock(&mem.lock);
+
+    //Never logged from inside the allocator, only out here.
+    if (arm)
+    {
+        snprintf(buf, sizeof(buf), "No-alloc check: from frame %d on, any allocation fails the run\n", MEM_ASSERT_WARMUP);
+        LOG(buf);
+    }
+
+    for (int i = first; i < last; i++)
+    {
+        snprintf(buf, sizeof(buf), "No-alloc check: frame %u allocated %zu bytes (%s)\n",
+                 reports[i].frame, reports[i].size, MEM_TAG_NAMES[reports[i].tag]);
+        LOG(buf);
+    }
+}
+
+//Ends the --no-alloc check, before cleanup(): it covers the frame loop,
+//and shutdown frees and allocates as it likes.
+void mem_disarm(void)
+{
+    SDL_AtomicLock(&mem.lock);
+    mem.armed = false;
+    SDL_AtomicUnlock(&mem.lock);
+}
+
+static void format_bytes(char* out, size_t len, double bytes)
+{
+    if (bytes >= 1024 * 1024)
+        snprintf(out, len, "%.1f MB", bytes / (1024 * 1024));
+    else if (bytes >= 1024)
+        snprintf(out, len, "%.1f KB", bytes / 1024);
+    else
+        snprintf(out, len, "%.0f B", bytes);
+}
+
+//Logs peak use, allocations per frame, and whatever is still allocated by
+//tag, after cleanup() has freed all it is going to. False if --no-alloc
+//caught anything.
+bool mem_report(void)
+{
+    char buf[MSL];
+    char peak[32], live[32], leaked[64];
+    Uint64 allocs = 0;
+
+    for (int i = 0; i < MEM_TAGS; i++)
+        allocs += mem.tags[i].allocs;
+
+    format_bytes(peak, sizeof(peak), (double)mem.peak);
+    snprintf(buf, sizeof(buf), "Memory: peak %s, %llu allocations, %.1f a frame (max %u), %.1f after the first %d frames\n",
+             peak, (unsigned long long)allocs, mem.frames ? (double)allocs / mem.frames : 0.0, mem.max_frame_allocs,
+             mem.frames > MEM_ASSERT_WARMUP ? (double)mem.steady_allocs / (mem.frames - MEM_ASSERT_WARMUP) : 0.0, MEM_ASSERT_WARMUP);
+    LOG(buf);
+
+    for (int i = 0; i < MEM_TAGS; i++)
+    {
+        const MemTagStats* stats = &mem.tags[i];
+
+        if (stats->allocs == 0)
+            continue;
+
+        format_bytes(peak, sizeof(peak), (double)stats->peak);
+        format_bytes(live, sizeof(live), (double)stats->live);
+        snprintf(leaked, sizeof(leaked), ", leaked %s in %llu blocks", live, (unsigned long long)stats->blocks);
+        snprintf(buf, sizeof(buf), "  %-10s peak %10s, %8llu allocations%s\n",
+                 MEM_TAG_NAMES[i], peak, (unsigned long long)stats->allocs, stats->blocks ? leaked : "");
+        LOG(buf);
+    }
+
+    if (mem.checked)
+    {
+        snprintf(buf, sizeof(buf), "No-alloc check: %s, %llu allocations after warmup\n",
+                 mem.violations ? "FAILED" : "passed", (unsigned long long)mem.violations);
+        LOG(buf);
+    }
+    return mem.violations == 0;
+}
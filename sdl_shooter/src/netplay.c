@@ -0,0 +1,538 @@
+#define _POSIX_C_SOURCE 200112L     //getaddrinfo() under -std=c11
+
+#include "main.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+//Two player co-op over UDP with rollback. Each side simulates both players
+//every tick; the remote player's input is predicted (same keys held as last
+//time, no new presses) until the real one arrives. When it turns out to be
+//different, the sim is restored to the snapshot taken before that tick and
+//re-run up to the present with the corrected input, all within one frame.
+//
+//Local input is scheduled NET_INPUT_DELAY ticks ahead, which hides that much
+//latency without any rollback at all. Neither side may get more than
+//NET_ROLLBACK_WINDOW ticks past the last input it has from the other one;
+//beyond that it stalls until the other side catches up. Every packet repeats
+//all the inputs the peer hasn't acknowledged, so a lost packet costs nothing
+//but a possible rollback.
+//
+//For testing on one machine, --net-sim MS,PERCENT holds every outgoing packet
+//back by MS and drops PERCENT of them.
+
+#define NET_MAGIC           0x53484D50      //"SHMP"
+#define NET_PACKET_MAX      1024
+#define NET_HELLO_EVERY_MS  200
+#define NET_SAVE_SLOTS      (NET_ROLLBACK_WINDOW + 1)
+
+enum
+{
+    PACKET_HELLO,           //Guest -> host until welcomed
+    PACKET_WELCOME,         //Host -> guest, carries the seed
+    PACKET_INPUT
+};
+
+typedef struct
+{
+    Uint8 data[NET_PACKET_MAX];
+    int len;
+    Uint64 send_at;         //Performance counter
+} ShimPacket;
+
+struct NetSession
+{
+    int sock;
+    struct sockaddr_in peer;
+    bool peer_known;
+    bool host;
+    int local, remote;      //Player indices
+    Uint32 seed;
+
+    TickInput inputs[MAX_PLAYERS][NET_INPUT_HISTORY];  //By tick, remote ones are predictions past remote_known
+    TickInput pending;      //Local input gathered over stalled frames
+    Uint32 current;         //Next tick to simulate, always game->sim.tick
+    Uint32 remote_known;    //Remote inputs are real for every tick below this
+    Uint32 peer_acked;      //Peer has our inputs for every tick below this
+    Uint32 peer_tick;       //Peer's current tick when it last sent
+    Uint64 peer_heard;      //When that was
+
+    SimState saved[NET_SAVE_SLOTS];     //State before each tick, by tick
+
+    //Latency/loss shim
+    ShimPacket shim[NET_SHIM_QUEUE];
+    int shim_count;
+    Uint32 shim_rng;
+    Uint64 latency;         //Counter ticks
+
+    //Reported when the session ends
+    Uint32 rollbacks, resimulated, max_resimulated, stalls, lost_packets;
+    Uint64 save_time, restore_time, saves, restores;
+};
+
+static TickInput* input_at(NetSession* net, int player, Uint32 tick)
+{
+    return &net->inputs[player][tick % NET_INPUT_HISTORY];
+}
+
+static bool same_input(const TickInput* a, const TickInput* b)
+{
+    return a->held == b->held && a->pressed == b->pressed && a->wheel == b->wheel;
+}
+
+//Byte order helpers, everything goes out big endian.
+static Uint8* put16(Uint8* p, Uint16 v) { v = SDL_SwapBE16(v); memcpy(p, &v, 2); return p + 2; }
+static Uint8* put32(Uint8* p, Uint32 v) { v = SDL_SwapBE32(v); memcpy(p, &v, 4); return p + 4; }
+static const Uint8* get16(const Uint8* p, Uint16* v) { memcpy(v, p, 2); *v = SDL_SwapBE16(*v); return p + 2; }
+static const Uint8* get32(const Uint8* p, Uint32* v) { memcpy(v, p, 4); *v = SDL_SwapBE32(*v); return p + 4; }
+
+static void raw_send(NetSession* net, const Uint8* data, int len)
+{
+    sendto(net->sock, data, len, 0, (const struct sockaddr*)&net->peer, sizeof(net->peer));
+}
+
+//Sends now, or hands the packet to the shim when --net-sim is on.
+static void net_send(Game* game, NetSession* net, const Uint8* data, int len)
+{
+    if (!net->peer_known)
+        return;
+
+    if (game->opts.net_latency_ms <= 0 && game->opts.net_loss_percent <= 0)
+    {
+        raw_send(net, data, len);
+        return;
+    }
+
+    //Own generator: the sim's must see the same calls on both machines.
+    net->shim_rng ^= net->shim_rng << 13;
+    net->shim_rng ^= net->shim_rng >> 17;
+    net->shim_rng ^= net->shim_rng << 5;
+    if ((int)(net->shim_rng % 100) < game->opts.net_loss_percent)
+    {
+        net->lost_packets++;
+        return;
+    }
+
+    if (net->shim_count == NET_SHIM_QUEUE)
+    {
+        net->lost_packets++;
+        return;
+    }
+
+    ShimPacket* packet = &net->shim[net->shim_count++];
+    memcpy(packet->data, data, len);
+    packet->len = len;
+    packet->send_at = SDL_GetPerformanceCounter() + net->latency;
+}
+
+//Releases held back packets whose time has come. They all have the same
+//delay, so the queue is already in order.
+static void shim_flush(NetSession* net)
+{
+    Uint64 now = SDL_GetPerformanceCounter();
+    int sent = 0;
+
+    while (sent < net->shim_count && net->shim[sent].send_at <= now)
+    {
+        raw_send(net, net->shim[sent].data, net->shim[sent].len);
+        sent++;
+    }
+
+    if (sent)
+    {
+        net->shim_count -= sent;
+        memmove(net->shim, net->shim + sent, sizeof(ShimPacket) * net->shim_count);
+    }
+}
+
+static void send_simple(Game* game, NetSession* net, Uint8 type, Uint32 value)
+{
+    Uint8 data[16];
+    Uint8* p = put32(data, NET_MAGIC);
+
+    *p++ = type;
+    p = put32(p, value);
+    net_send(game, net, data, (int)(p - data));
+}
+
+//Every local input the peer hasn't confirmed yet, up to the newest scheduled one.
+static void send_inputs(Game* game, NetSession* net)
+{
+    Uint8 data[NET_PACKET_MAX];
+    Uint32 end = net->current + NET_INPUT_DELAY;
+    Uint32 start = net->peer_acked;
+
+    if (end - start > NET_INPUT_HISTORY)
+        start = end - NET_INPUT_HISTORY;
+
+    Uint8* p = put32(data, NET_MAGIC);
+    *p++ = PACKET_INPUT;
+    p = put32(p, net->remote_known);
+    p = put32(p, net->current);
+    p = put32(p, start);
+    *p++ = (Uint8)(end - start);
+
+    for (Uint32 t = start; t < end; t++)
+    {
+        const TickInput* input = input_at(net, net->local, t);
+        p = put16(p, input->held);
+        p = put16(p, input->pressed);
+        *p++ = (Uint8)(Sint8)input->wheel;
+    }
+
+    net_send(game, net, data, (int)(p - data));
+}
+
+//Takes in the remote inputs from a packet. Returns the first tick that was
+//already simulated with a wrong prediction, or net->current if none was.
+static Uint32 receive_inputs(NetSession* net, const Uint8* p, const Uint8* end)
+{
+    Uint32 ack, peer_tick, start;
+    Uint32 mismatch = net->current;
+
+    if (end - p < 13)
+        return mismatch;
+
+    p = get32(p, &ack);
+    p = get32(p, &peer_tick);
+    p = get32(p, &start);
+    int count = *p++;
+
+    if (end - p < count * 5)
+        return mismatch;
+
+    //Packets can arrive out of order; only ever move forward.
+    if ((Sint32)(ack - net->peer_acked) > 0)
+        net->peer_acked = ack;
+    if ((Sint32)(peer_tick - net->peer_tick) >= 0)
+    {
+        net->peer_tick = peer_tick;
+        net->peer_heard = SDL_GetPerformanceCounter();
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        Uint32 t = start + i;
+        TickInput real = {0};
+        Uint16 wheel;
+
+        p = get16(p, &real.held);
+        p = get16(p, &real.pressed);
+        wheel = *p++;
+        real.wheel = (Sint8)wheel;
+
+        //Only the next unknown tick is useful, anything else is old or leaves a gap.
+        if (t != net->remote_known)
+            continue;
+
+        TickInput* slot = input_at(net, net->remote, t);
+        if (t < net->current && !same_input(slot, &real) && t < mismatch)
+            mismatch = t;
+
+        *slot = real;
+        net->remote_known++;
+    }
+    return mismatch;
+}
+
+//The remote player keeps holding whatever they held last; presses and the
+//wheel are one-offs, so never predict those.
+static void predict_remote(NetSession* net, Uint32 tick)
+{
+    if (tick < net->remote_known)
+        return;
+
+    TickInput prediction = {0};
+    if (net->remote_known > 0)
+        prediction.held = input_at(net, net->remote, net->remote_known - 1)->held;
+
+    *input_at(net, net->remote, tick) = prediction;
+}
+
+static void save_state(Game* game, NetSession* net)
+{
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    net->saved[game->sim.tick % NET_SAVE_SLOTS] = game->sim;
+    net->save_time += SDL_GetPerformanceCounter() - t0;
+    net->saves++;
+}
+
+static void restore_state(Game* game, NetSession* net, Uint32 tick)
+{
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    game->sim = net->saved[tick % NET_SAVE_SLOTS];
+    net->restore_time += SDL_GetPerformanceCounter() - t0;
+    net->restores++;
+}
+
+static void step_tick(Game* game, NetSession* net)
+{
+    Uint32 tick = game->sim.tick;
+    TickInput inputs[MAX_PLAYERS];
+
+    predict_remote(net, tick);
+    for (int i = 0; i < MAX_PLAYERS; i++)
+        inputs[i] = *input_at(net, i, tick);
+
+    save_state(game, net);
+    sim_step(game, inputs, 0);
+}
+
+//Rewinds to the given tick and runs forward again to where we were.
+static void rollback(Game* game, NetSession* net, Uint32 from)
+{
+    Uint32 target = net->current;
+
+    restore_state(game, net, from);
+    game->resimulating = true;
+    while (game->sim.tick < target)
+        step_tick(game, net);
+    game->resimulating = false;
+
+    net->rollbacks++;
+    net->resimulated += target - from;
+    if (target - from > net->max_resimulated)
+        net->max_resimulated = target - from;
+}
+
+static void receive_all(Game* game, NetSession* net)
+{
+    Uint8 data[NET_PACKET_MAX];
+    struct sockaddr_in from;
+    socklen_t from_len;
+    Uint32 mismatch = net->current;
+    int len;
+
+    for (;;)
+    {
+        from_len = sizeof(from);
+        len = (int)recvfrom(net->sock, data, sizeof(data), 0, (struct sockaddr*)&from, &from_len);
+        if (len < 5)
+        {
+            if (len < 0)
+                break;
+            continue;
+        }
+
+        Uint32 magic;
+        const Uint8* p = get32(data, &magic);
+        Uint8 type = *p++;
+
+        if (magic != NET_MAGIC)
+            continue;
+
+        //The host learns where the guest is from its first hello, and
+        //answers every hello in case the welcome got lost.
+        if (type == PACKET_HELLO && net->host)
+        {
+            net->peer = from;
+            net->peer_known = true;
+            send_simple(game, net, PACKET_WELCOME, net->seed);
+        }
+        else if (type == PACKET_WELCOME && !net->host && len >= 9)
+            get32(p, &net->seed);
+        else if (type == PACKET_INPUT)
+        {
+            Uint32 first = receive_inputs(net, p, data + len);
+            if (first < mismatch)
+                mismatch = first;
+        }
+    }
+
+    if (mismatch < net->current)
+        rollback(game, net, mismatch);
+}
+
+static bool open_socket(Game* game, NetSession* net)
+{
+    char buf[MSL_LONG];
+    struct sockaddr_in local = {0};
+
+    net->sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (net->sock < 0)
+    {
+        snprintf(buf, sizeof(buf), "Unable to create UDP socket: %s\n", strerror(errno));
+        LOG(buf);
+        return false;
+    }
+
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(net->host ? (Uint16)game->opts.net_port : 0);
+
+    if (bind(net->sock, (struct sockaddr*)&local, sizeof(local)) < 0)
+    {
+        snprintf(buf, sizeof(buf), "Unable to bind UDP port %d: %s\n", game->opts.net_port, strerror(errno));
+        LOG(buf);
+        return false;
+    }
+
+    fcntl(net->sock, F_SETFL, fcntl(net->sock, F_GETFL, 0) | O_NONBLOCK);
+
+    if (net->host)
+        return true;
+
+    struct addrinfo hints = {0};
+    struct addrinfo* result = NULL;
+    char port[16];
+
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    snprintf(port, sizeof(port), "%d", game->opts.net_port);
+
+    if (getaddrinfo(game->opts.net_address, port, &hints, &result) != 0 || result == NULL)
+    {
+        snprintf(buf, sizeof(buf), "Unable to resolve %s\n", game->opts.net_address);
+        LOG(buf);
+        return false;
+    }
+
+    memcpy(&net->peer, result->ai_addr, sizeof(net->peer));
+    net->peer_known = true;
+    freeaddrinfo(result);
+    return true;
+}
+
+void net_close(Game* game, NetSession* net)
+{
+    char buf[MSL];
+
+    if (net == NULL)
+        return;
+
+    double freq = (double)SDL_GetPerformanceFrequency();
+
+    snprintf(buf, sizeof(buf), "Netplay: %u ticks, %u rollbacks (%u ticks re-run, at most %u at once), %u stalls, %u packets lost in the shim. "
+             "Save avg %.2f us, restore avg %.2f us (%zu byte state)\n",
+             net->current, net->rollbacks, net->resimulated, net->max_resimulated, net->stalls, net->lost_packets,
+             net->saves ? net->save_time * 1e6 / freq / net->saves : 0.0,
+             net->restores ? net->restore_time * 1e6 / freq / net->restores : 0.0,
+             sizeof(SimState));
+    LOG(buf);
+
+    if (net->sock >= 0)
+        close(net->sock);
+    mem_free(net);
+    (void)game;
+}
+
+//Connects to the other player (or waits for them) and starts both sides
+//from the same seed. Blocks, but keeps the window responsive.
+NetSession* net_open(Game* game)
+{
+    char buf[MSL_LONG];
+    NetSession* net = mem_calloc(MEM_NET, 1, sizeof(NetSession));
+
+    if (net == NULL)
+        return NULL;
+
+    net->sock = -1;
+    net->host = game->opts.net_mode == NET_HOST;
+    net->local = net->host ? 0 : 1;
+    net->remote = 1 - net->local;
+    net->seed = game->sim.rng;
+    net->shim_rng = (Uint32)SDL_GetPerformanceCounter() | 1;
+    net->latency = SDL_GetPerformanceFrequency() * (Uint64)SDL_max(0, game->opts.net_latency_ms) / 1000;
+
+    if (!open_socket(game, net))
+    {
+        net_close(game, net);
+        return NULL;
+    }
+
+    if (net->host)
+        snprintf(buf, sizeof(buf), "Waiting for a player to join on UDP port %d...\n", game->opts.net_port);
+    else
+        snprintf(buf, sizeof(buf), "Joining %s:%d...\n", game->opts.net_address, game->opts.net_port);
+    LOG(buf);
+
+    Uint32 started = SDL_GetTicks();
+    Uint32 last_hello = 0;
+
+    //The host is connected once it has heard a hello, the guest once it has a seed.
+    net->seed = net->host ? net->seed : 0;
+    while (net->host ? !net->peer_known : net->seed == 0)
+    {
+        SDL_Event event;
+        while (SDL_PollEvent(&event))
+            if (event.type == SDL_QUIT || (event.type == SDL_KEYDOWN && event.key.keysym.scancode == SDL_SCANCODE_ESCAPE))
+            {
+                net_close(game, net);
+                return NULL;
+            }
+
+        if (SDL_GetTicks() - started > NET_CONNECT_TIMEOUT_MS)
+        {
+            LOG("Timed out waiting for the other player\n");
+            net_close(game, net);
+            return NULL;
+        }
+
+        if (!net->host && SDL_GetTicks() - last_hello > NET_HELLO_EVERY_MS)
+        {
+            send_simple(game, net, PACKET_HELLO, 0);
+            last_hello = SDL_GetTicks();
+        }
+
+        shim_flush(net);
+        receive_all(game, net);
+        SDL_Delay(5);
+    }
+
+    snprintf(buf, sizeof(buf), "Connected as player %d, seed %u\n", net->local + 1, net->seed);
+    LOG(buf);
+
+    reset_sim(game, net->seed, MAX_PLAYERS);
+    game->local_player = net->local;
+
+    //Nobody has input for the first ticks of delay, so both sides already agree on them.
+    net->remote_known = NET_INPUT_DELAY;
+    net->peer_acked = NET_INPUT_DELAY;
+    net->peer_heard = SDL_GetPerformanceCounter();
+    return net;
+}
+
+//Replaces update() when playing co-op: folds in the remote inputs that have
+//arrived (rolling back if they contradict a prediction), then runs at most
+//one new tick.
+void net_update(Game* game)
+{
+    NetSession* net = game->net;
+    Uint64 freq = SDL_GetPerformanceFrequency();
+
+    shim_flush(net);
+    receive_all(game, net);
+
+    //Presses made while stalled still have to go out with the next tick.
+    net->pending.held = game->tick_input.held;
+    net->pending.pressed |= game->tick_input.pressed;
+    net->pending.wheel += game->tick_input.wheel;
+
+    bool stall = net->current - net->remote_known >= NET_ROLLBACK_WINDOW;
+
+    //If we are well ahead of the peer, give it a frame to catch up now
+    //rather than running into the window later.
+    Uint32 peer_now = net->peer_tick + (Uint32)((SDL_GetPerformanceCounter() - net->peer_heard) * FPS / freq);
+    if (!stall && (Sint32)(net->current - peer_now) > 2 && net->current % 8 == 0)
+        stall = true;
+
+    if (stall)
+        net->stalls++;
+    else
+    {
+        *input_at(net, net->local, net->current + NET_INPUT_DELAY) = net->pending;
+        net->pending.pressed = 0;
+        net->pending.wheel = 0;
+
+        step_tick(game, net);
+        net->current++;
+    }
+
+    send_inputs(game, net);
+    shim_flush(net);
+}
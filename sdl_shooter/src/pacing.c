@@ -0,0 +1,71 @@
+#include "main.h"
+
+//Frame pacing on the high resolution counter. Deadlines advance by a fixed
+//period instead of "now + period", so rounding never accumulates into drift.
+//The wait sleeps in SDL_Delay() until it is close to the deadline and spins
+//for the last stretch, which the scheduler can't hit reliably on its own.
+
+void pacer_init(FramePacer* pacer, const Options* opts)
+{
+    pacer->freq = SDL_GetPerformanceFrequency();
+    pacer->vsync = opts->vsync;
+    pacer->period = 0;
+
+    if (!opts->uncapped && !opts->vsync)
+        pacer->period = pacer->freq / (Uint64)(opts->target_fps > 0 ? opts->target_fps : FPS);
+
+    pacer->spin_threshold = pacer->freq * PACER_SPIN_US / 1000000;
+    pacer->frame_start = SDL_GetPerformanceCounter();
+    pacer->next_deadline = pacer->frame_start;
+}
+
+//Starts the clock over, e.g. after the game has been suspended.
+void pacer_reset(FramePacer* pacer)
+{
+    pacer->frame_start = SDL_GetPerformanceCounter();
+    pacer->next_deadline = pacer->frame_start;
+}
+
+static void pacer_wait(FramePacer* pacer)
+{
+    pacer->next_deadline += pacer->period;
+
+    Uint64 now = SDL_GetPerformanceCounter();
+
+    //More than a whole frame late: start again from now rather than
+    //rushing out a burst of short frames to catch up.
+    if (now > pacer->next_deadline + pacer->period)
+    {
+        pacer->next_deadline = now;
+        return;
+    }
+
+    if (now + pacer->spin_threshold < pacer->next_deadline)
+    {
+        Uint64 sleep = pacer->next_deadline - pacer->spin_threshold - now;
+        SDL_Delay((Uint32)(sleep * 1000 / pacer->freq));
+    }
+
+    while (SDL_GetPerformanceCounter() < pacer->next_deadline)
+        ;
+}
+
+//Closes the frame: records how long the work took, waits out the rest of
+//the period and records the full frame time.
+void pacer_end_frame(Game* game)
+{
+    FramePacer* pacer = &game->pacer;
+    Uint64 work_end = SDL_GetPerformanceCounter();
+
+    if (pacer->period)
+        pacer_wait(pacer);
+
+    Uint64 frame_end = SDL_GetPerformanceCounter();
+
+    stats_record_frame(game,
+                       (float)((frame_end - pacer->frame_start) * 1000.0 / pacer->freq),
+                       (float)((work_end - pacer->frame_start) * 1000.0 / pacer->freq));
+    quality_end_frame(game, pacer->frame_start);
+
+    pacer->frame_start = frame_end;
+}
@@ -1,57 +1,51 @@
 #include "main.h"
 
-void render_gradient_bar(SDL_Renderer* renderer, int x, int y, int width, int height, float percentage, SDL_Color start_color, SDL_Color end_color);
+void render_gradient_bar(Game* game, int x, int y, int width, int height, float percentage, SDL_Color start_color, SDL_Color end_color);
 
-
-Particle particles[MAX_PARTICLES];
-
-void init_particles() 
+void create_explosion(Game* game, float x, float y) 
 {
-    for (int i = 0; i < MAX_PARTICLES; i++)     
-        particles[i].lifetime = 0;
-    
-}
+    audio_play(game, SND_EXPLOSION, x);
 
-void create_explosion(float x, float y) 
-{
     for (int i = 0; i < MAX_PARTICLES; i++) 
     {
-        if (particles[i].lifetime <= 0) 
+        if (game->sim.particles[i].lifetime <= 0) 
         {
-            particles[i].x = x;
-            particles[i].y = y;
-            float angle = (float)rand() / RAND_MAX * 2 * M_PI;
-            float speed = (float)rand() / RAND_MAX * 2 + 1;
-            particles[i].vx = cosf(angle) * speed;
-            particles[i].vy = sinf(angle) * speed;
-            particles[i].lifetime = PARTICLE_LIFETIME;
-            particles[i].color = (SDL_Color){255, 100 + rand() % 155, 0, 255};
+            game->sim.particles[i].x = x;
+            game->sim.particles[i].y = y;
+            float angle = sim_randf(game) * 2 * M_PI;
+            float speed = sim_randf(game) * 2 + 1;
+            game->sim.particles[i].vx = cosf(angle) * speed;
+            game->sim.particles[i].vy = sinf(angle) * speed;
+            game->sim.particles[i].lifetime = PARTICLE_LIFETIME;
+            game->sim.particles[i].color = (SDL_Color){255, 100 + sim_rand(game) % 155, 0, 255};
         }
     }
 }
 
-void update_particles() 
+void update_particles(Game* game) 
 {
     for (int i = 0; i < MAX_PARTICLES; i++) 
     {
-        if (particles[i].lifetime > 0) 
+        if (game->sim.particles[i].lifetime > 0) 
         {
-            particles[i].x += particles[i].vx;
-            particles[i].y += particles[i].vy;
-            particles[i].lifetime--;
-            particles[i].color.a = 255 * particles[i].lifetime / PARTICLE_LIFETIME;
+            game->sim.particles[i].x += game->sim.particles[i].vx;
+            game->sim.particles[i].y += game->sim.particles[i].vy;
+            game->sim.particles[i].lifetime--;
+            game->sim.particles[i].color.a = 255 * game->sim.particles[i].lifetime / PARTICLE_LIFETIME;
         }
     }
 }
 
-void render_particles(SDL_Renderer *renderer) 
+void render_particles(Game* game) 
 {
-    for (int i = 0; i < MAX_PARTICLES; i++) 
+    int step = quality_tier(game)->particle_step;
+
+    for (int i = 0; i < MAX_PARTICLES; i += step) 
     {
-        if (particles[i].lifetime > 0) 
+        if (game->sim.particles[i].lifetime > 0) 
         {
-            SDL_SetRenderDrawColor(renderer, particles[i].color.r, particles[i].color.g, particles[i].color.b, particles[i].color.a);
-            SDL_RenderDrawPoint(renderer, (int)particles[i].x, (int)particles[i].y);
+            draw_set_color(game, game->sim.particles[i].color.r, game->sim.particles[i].color.g, game->sim.particles[i].color.b, game->sim.particles[i].color.a);
+            draw_point(game, (int)game->sim.particles[i].x, (int)game->sim.particles[i].y);
         }
     }
 }
@@ -61,7 +55,7 @@ void update_afterburner_particles(Game* game, float delta_time)
 {
     for (int i = 0; i < MAX_AFTERBURNER_PARTICLES; i++) 
     {        
-        Particle* p = &game->afterburner_particles[i];
+        Particle* p = &game->sim.afterburner_particles[i];
         
         if (p->lifetime > 0) {
             p->x += p->vx * delta_time;
@@ -71,23 +65,28 @@ void update_afterburner_particles(Game* game, float delta_time)
         }
     }
 
-    if (game->player.is_afterburner_active) {
+    for (int n = 0; n < game->sim.num_players; n++) {
+        Player* player = &game->sim.players[n];
+
+        if (!player->is_afterburner_active)
+            continue;
+
         for (int i = 0; i < 2; i++) {
             int index = -1;
             for (int j = 0; j < MAX_AFTERBURNER_PARTICLES; j++) {
-                if (game->afterburner_particles[j].lifetime <= 0) {
+                if (game->sim.afterburner_particles[j].lifetime <= 0) {
                     index = j;
                     break;
                 }
             }
             if (index != -1) {
-                Particle* p = &game->afterburner_particles[index];
-                p->x = game->player.position.x + game->player.position.w / 2;
-                p->y = game->player.position.y + game->player.position.h - 5;
-                p->vx = (float)(rand() % 20 - 10) * 5;
-                p->vy = (float)(rand() % 10 + 20) * 5;
+                Particle* p = &game->sim.afterburner_particles[index];
+                p->x = player->position.x + player->position.w / 2;
+                p->y = player->position.y + player->position.h - 5;
+                p->vx = (float)((int)(sim_rand(game) % 20) - 10) * 5;
+                p->vy = (float)(sim_rand(game) % 10 + 20) * 5;
                 p->lifetime = 30;
-                p->color = (SDL_Color){0, 100 + rand() % 155, 200 + rand() % 55, 255};
+                p->color = (SDL_Color){0, 100 + sim_rand(game) % 155, 200 + sim_rand(game) % 55, 255};
             }
         }
     }
@@ -95,13 +94,15 @@ void update_afterburner_particles(Game* game, float delta_time)
 
 void render_afterburner_particles(Game* game) 
 {
-    for (int i = 0; i < MAX_AFTERBURNER_PARTICLES; i++) 
+    int step = quality_tier(game)->particle_step;
+
+    for (int i = 0; i < MAX_AFTERBURNER_PARTICLES; i += step) 
     {
-        Particle* p = &game->afterburner_particles[i];
+        Particle* p = &game->sim.afterburner_particles[i];
         if (p->lifetime > 0) {
-            SDL_SetRenderDrawColor(game->renderer, p->color.r, p->color.g, p->color.b, p->color.a);
+            draw_set_color(game, p->color.r, p->color.g, p->color.b, p->color.a);
             SDL_Rect rect = {(int)p->x - 1, (int)p->y - 1, 3, 3};
-            SDL_RenderFillRect(game->renderer, &rect);
+            draw_fill_rect(game, &rect);
         }
     }
 }
@@ -116,7 +117,7 @@ void render_afterburner_meter(Game* game)
 
     SDL_Color start_color = {0, 100, 255, 255};
     SDL_Color end_color = {0, 200, 255, 255};
-    float percentage = game->player.afterburner / AFTERBURNER_MAX;
+    float percentage = game->sim.players[game->local_player].afterburner / AFTERBURNER_MAX;
 
-    render_gradient_bar(game->renderer, x, y, meter_width, meter_height, percentage, start_color, end_color);
+    render_gradient_bar(game, x, y, meter_width, meter_height, percentage, start_color, end_color);
 }
\ No newline at end of file
@@ -0,0 +1,370 @@
+#include "main.h"
+
+//Bullet patterns. Enemy fire is described by small programs in a text file
+//(../patterns/enemies.txt), compiled at startup into a bytecode of one
+//opcode byte followed by its 16-bit little endian operands. Every enemy
+//carries an Emitter (program counter, loop stack and aim) in SimState, so
+//patterns rewind, replay and roll back with everything else.
+//
+//An emitter that waits sets a timer (timers.c) and costs nothing until it
+//fires. patterns_update() runs the emitters woken this tick in one pass.
+//Bullets are appended straight onto their weapon's projectile bucket.
+
+#define PATTERN_MAX 32
+#define PATTERN_CODE_MAX 4096
+#define PATTERN_NAME_SIZE 32
+#define PATTERN_MAX_STEPS 256           //Ops one emitter may run per tick
+
+#define PATTERN_FILE "../patterns/enemies.txt"
+
+//Used when the file can't be read or compiled: what enemies did before patterns.
+static const char* FALLBACK_PATTERNS = "pattern down\nangle 180\nfire\ncooldown\n";
+
+typedef enum
+{
+    OP_END,                     //Back to the start
+    OP_WEAPON,                  //weapon
+    OP_ANGLE,                   //degrees
+    OP_AIM,
+    OP_TURN,                    //degrees
+    OP_FIRE,
+    OP_SPREAD,                  //count, arc
+    OP_RING,                    //count
+    OP_SPIRAL,                  //degrees
+    OP_WAIT,                    //ticks
+    OP_COOLDOWN,
+    OP_LOOP,                    //count
+    OP_NEXT,
+    OP_COUNT
+} PatternOp;
+
+static const struct
+{
+    const char* name;
+    int operands;
+} OPS[OP_COUNT] =
+{
+    {"end", 0}, {"weapon", 1}, {"angle", 1}, {"aim", 0}, {"turn", 1}, {"fire", 0},
+    {"spread", 2}, {"ring", 1}, {"spiral", 1}, {"wait", 1}, {"cooldown", 0},
+    {"loop", 1}, {"next", 0}
+};
+
+struct PatternSet
+{
+    Uint8 code[PATTERN_CODE_MAX];
+    int code_len;
+    int start[PATTERN_MAX];     //Offset of each pattern's first op
+    char names[PATTERN_MAX][PATTERN_NAME_SIZE];
+    int count;
+};
+
+static inline int operand(const Uint8* code, int index)
+{
+    return (Sint16)(code[index * 2] | (code[index * 2 + 1] << 8));
+}
+
+//Closes the pattern being compiled. Fails if it never pauses, since it would
+//then burn through its step budget every tick.
+static bool finish_pattern(PatternSet* set, bool waits, const char* path, int line_number)
+{
+    char buf[MSL];
+
+    if (set->count == 0)
+        return true;
+
+    if (!waits)
+    {
+        snprintf(buf, sizeof(buf), "%s:%d: pattern %s never waits\n", path, line_number, set->names[set->count - 1]);
+        LOG(buf);
+        return false;
+    }
+    set->code[set->code_len++] = OP_END;
+    return true;
+}
+
+//Compiles pattern source text into set. Logs the first error and returns false.
+static bool compile_patterns(PatternSet* set, const char* text, const char* path)
+{
+    char buf[MSL], line[MSL];
+    int line_number = 0, depth = 0;
+    bool waits = false;
+
+    memset(set, 0, sizeof(PatternSet));
+
+    while (*text)
+    {
+        size_t len = strcspn(text, "\n");
+        snprintf(line, sizeof(line), "%.*s", (int)SDL_min(len, sizeof(line) - 1), text);
+        text += len + (text[len] == '\n');
+        line_number++;
+
+        char* words[4];
+        int num_words = 0;
+        for (char* word = strtok(line, " \t\r"); word && num_words < 4; word = strtok(NULL, " \t\r"))
+        {
+            if (word[0] == '#')
+                break;
+            words[num_words++] = word;
+        }
+
+        if (num_words == 0)
+            continue;
+
+        const char* error = NULL;
+
+        if (!strcmp(words[0], "pattern"))
+        {
+            if (depth)
+                error = "loop without next";
+            else if (!finish_pattern(set, waits, path, line_number))
+                return false;
+            else if (num_words != 2 || set->count == PATTERN_MAX)
+                error = "pattern needs a name, and there can be at most 32";
+            else
+            {
+                snprintf(set->names[set->count], PATTERN_NAME_SIZE, "%s", words[1]);
+                set->start[set->count++] = set->code_len;
+                waits = false;
+            }
+        }
+        else
+        {
+            int op = 0;
+            while (op < OP_COUNT && strcmp(words[0], OPS[op].name))
+                op++;
+
+            if (op == OP_END || op == OP_COUNT)
+                error = "unknown op";
+            else if (set->count == 0)
+                error = "op before the first pattern";
+            else if (num_words != 1 + OPS[op].operands)
+                error = "wrong number of operands";
+            else if (set->code_len + 1 + OPS[op].operands * 2 >= PATTERN_CODE_MAX)
+                error = "too much code";
+            else if (op == OP_LOOP && ++depth > PATTERN_LOOP_DEPTH)
+                error = "loops nested too deep";
+            else if (op == OP_NEXT && --depth < 0)
+                error = "next without loop";
+            else
+            {
+                set->code[set->code_len++] = (Uint8)op;
+                for (int i = 0; i < OPS[op].operands; i++)
+                {
+                    int value = atoi(words[1 + i]);
+                    set->code[set->code_len++] = (Uint8)(value & 0xFF);
+                    set->code[set->code_len++] = (Uint8)((value >> 8) & 0xFF);
+                }
+                waits |= (op == OP_WAIT || op == OP_COOLDOWN);
+            }
+        }
+
+        if (error)
+        {
+            snprintf(buf, sizeof(buf), "%s:%d: %s\n", path, line_number, error);
+            LOG(buf);
+            return false;
+        }
+    }
+
+    if (depth)
+    {
+        snprintf(buf, sizeof(buf), "%s: loop without next at the end\n", path);
+        LOG(buf);
+        return false;
+    }
+    return finish_pattern(set, waits, path, line_number) && set->count > 0;
+}
+
+//Compiles the pattern file, falling back to the built in pattern if it is
+//missing or broken. NULL only when out of memory.
+PatternSet* patterns_load(void)
+{
+    char buf[MSL];
+    PatternSet* set = mem_alloc(MEM_ASSETS, sizeof(PatternSet));
+    if (set == NULL)
+        return NULL;
+
+    size_t size = 0;
+    char* text = SDL_LoadFile(PATTERN_FILE, &size);
+
+    if (text == NULL || !compile_patterns(set, text, PATTERN_FILE))
+    {
+        snprintf(buf, sizeof(buf), "Using the built in bullet pattern, %s is missing or has errors\n", PATTERN_FILE);
+        LOG(buf);
+        compile_patterns(set, FALLBACK_PATTERNS, "built in");
+    }
+    SDL_free(text);
+
+    snprintf(buf, sizeof(buf), "Bullet patterns: %d compiled to %d bytes\n", set->count, set->code_len);
+    LOG(buf);
+    return set;
+}
+
+void patterns_close(PatternSet* set)
+{
+    mem_free(set);
+}
+
+//Gives enemy index a pattern at random, starting after a short random delay
+//so enemies spawned together don't fire in lockstep.
+void emitter_start(Game* game, int index)
+{
+    Emitter* emitter = &game->sim.enemies[index].emitter;
+
+    memset(emitter, 0, sizeof(Emitter));
+    emitter->pattern = (Sint16)(sim_rand(game) % game->patterns->count);
+    emitter->aim = 180;
+    emitter->timer = (Sint16)timer_add(game, TIMER_EMITTER, index, sim_rand(game) % 30);
+}
+
+//What a pass has fired so far.
+typedef struct
+{
+    int fired;                  //By the emitter running now
+} BulletWriter;
+
+static inline void emit_bullet(Game* game, BulletWriter* writer, const Enemy* enemy, float angle)
+{
+    if (projectile_spawn(game, enemy->current_weapon, enemy->position.x + enemy->position.w / 2,
+                         enemy->position.y + enemy->position.h, angle, -1, (int)(enemy - game->sim.enemies)))
+        writer->fired++;
+}
+
+//Degrees from the enemy's muzzle to the nearest player, 180 if there is none.
+float enemy_aim(Game* game, const Enemy* enemy)
+{
+    float x = enemy->position.x + enemy->position.w / 2.0f;
+    float y = enemy->position.y + enemy->position.h;
+    float best = -1, angle = 180;
+
+    for (int p = 0; p < game->sim.num_players; p++)
+    {
+        const SDL_Rect* pos = &game->sim.players[p].position;
+        float dx = pos->x + pos->w / 2.0f - x, dy = pos->y + pos->h / 2.0f - y;
+
+        if (best < 0 || dx * dx + dy * dy < best)
+        {
+            best = dx * dx + dy * dy;
+            angle = atan2f(dx, -dy) * 180.0f / (float)M_PI;
+        }
+    }
+    return angle;
+}
+
+//Runs one emitter until it waits or runs out of steps for this tick, then
+//sets a timer for when it goes on.
+static void emitter_run(Game* game, int index, BulletWriter* writer)
+{
+    Enemy* enemy = &game->sim.enemies[index];
+    Emitter* em = &enemy->emitter;
+    const Uint8* code = game->patterns->code + game->patterns->start[em->pattern];
+
+    for (int step = 0; step < PATTERN_MAX_STEPS; step++)
+    {
+        PatternOp op = code[em->pc];
+        const Uint8* args = code + em->pc + 1;
+
+        em->pc += 1 + OPS[op].operands * 2;
+
+        switch (op)
+        {
+            case OP_END:
+                em->pc = 0;
+                em->depth = 0;
+                break;
+
+            case OP_WEAPON:
+                enemy->current_weapon = SDL_max(0, SDL_min(operand(args, 0), MAX_WEAPONS - 1));
+                break;
+
+            case OP_ANGLE:
+                em->aim = operand(args, 0);
+                break;
+
+            case OP_AIM:
+                em->aim = enemy_aim(game, enemy);
+                break;
+
+            case OP_TURN:
+                em->aim += operand(args, 0);
+                break;
+
+            case OP_FIRE:
+                emit_bullet(game, writer, enemy, em->aim);
+                break;
+
+            case OP_SPREAD:
+            {
+                int count = operand(args, 0);
+                float arc = operand(args, 1);
+                for (int i = 0; i < count; i++)
+                    emit_bullet(game, writer, enemy, count > 1 ? em->aim - arc / 2 + arc * i / (count - 1) : em->aim);
+                break;
+            }
+
+            case OP_RING:
+            {
+                int count = operand(args, 0);
+                for (int i = 0; i < count; i++)
+                    emit_bullet(game, writer, enemy, em->aim + 360.0f * i / count);
+                break;
+            }
+
+            case OP_SPIRAL:
+                emit_bullet(game, writer, enemy, em->aim);
+                em->aim += operand(args, 0);
+                break;
+
+            case OP_WAIT:
+            case OP_COOLDOWN:
+            {
+                int ticks = op == OP_WAIT ? operand(args, 0) : (int)(WEAPON_TYPES[enemy->current_weapon].cooldown * FPS / 1000);
+                if (ticks > 0)
+                {
+                    em->timer = (Sint16)timer_add(game, TIMER_EMITTER, index, ticks);
+                    return;
+                }
+                break;
+            }
+
+            case OP_LOOP:
+                em->loop_start[em->depth] = em->pc;
+                em->loop_left[em->depth++] = (Uint16)SDL_max(1, operand(args, 0));
+                break;
+
+            case OP_NEXT:
+                if (em->depth > 0 && --em->loop_left[em->depth - 1] > 0)
+                    em->pc = em->loop_start[em->depth - 1];
+                else if (em->depth > 0)
+                    em->depth--;
+                break;
+
+            default:
+                em->pattern = -1;
+                return;
+        }
+    }
+
+    em->timer = (Sint16)timer_add(game, TIMER_EMITTER, index, 1);
+}
+
+//Runs the bullet patterns of the enemies whose timers fired this tick.
+void patterns_update(Game* game, const int* enemies, int count)
+{
+    BulletWriter writer = {0};
+
+    for (int i = 0; i < count; i++)
+    {
+        Enemy* enemy = &game->sim.enemies[enemies[i]];
+
+        if (!enemy->active || enemy->emitter.pattern < 0 || enemy->emitter.pattern >= game->patterns->count)
+            continue;
+
+        writer.fired = 0;
+        emitter_run(game, enemies[i], &writer);
+
+        //One sound per volley, not per bullet.
+        if (writer.fired)
+            audio_play(game, SND_ENEMY_SHOT, enemy->position.x + enemy->position.w / 2);
+    }
+}
@@ -0,0 +1,245 @@
+#include "main.h"
+
+//Destructible planets. Each one carries a PLANET_MASK_SIZE square, 1 bit per
+//pixel copy of its image's alpha (built once per image by the streamer), laid
+//over position however big the planet is drawn. Hits are tested a row at a
+//time by ANDing the rows under a rect with a span of column bits, and craters
+//clear one span per row, so nothing here walks pixels.
+//
+//Undamaged planets still draw the shared streamed texture. Once cratered a
+//planet switches to a small per-slot texture that planet_view() brings up to
+//date by re-uploading only the rows and columns that changed since it was
+//last drawn.
+
+#define PLANET_BREAK_FRACTION 4     //Blows up with less than 1/4 of its bits left
+
+//Bits lo..hi inclusive, both within 0..63.
+static inline Uint64 span_bits(int lo, int hi)
+{
+    return (~(Uint64)0 >> (63 - hi)) & (~(Uint64)0 << lo);
+}
+
+static inline int popcount64(Uint64 bits)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(bits);
+#else
+    bits = bits - ((bits >> 1) & 0x5555555555555555ULL);
+    bits = (bits & 0x3333333333333333ULL) + ((bits >> 2) & 0x3333333333333333ULL);
+    bits = (bits + (bits >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((bits * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+static inline int lowest_bit(Uint64 bits)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(bits);
+#else
+    int n = 0;
+    while (!(bits & 1))
+    {
+        bits >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+static inline int highest_bit(Uint64 bits)
+{
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(bits);
+#else
+    int n = 63;
+    while (!(bits >> 63))
+    {
+        bits <<= 1;
+        n--;
+    }
+    return n;
+#endif
+}
+
+static int planet_solid(const Planet* planet)
+{
+    int solid = 0;
+
+    for (int y = 0; y < PLANET_MASK_SIZE; y++)
+        solid += popcount64(planet->mask[y]);
+    return solid;
+}
+
+//Screen x or y to a mask row or column, clamped onto the mask.
+static inline int to_grid(int value, int origin, int size)
+{
+    int cell = size > 0 ? (value - origin) * PLANET_MASK_SIZE / size : 0;
+    return SDL_max(0, SDL_min(cell, PLANET_MASK_SIZE - 1));
+}
+
+//Clears a disc of the mask centred on grid cell cx, cy.
+static void planet_carve(Planet* planet, int cx, int cy, int radius)
+{
+    for (int dy = -radius; dy <= radius; dy++)
+    {
+        int y = cy + dy;
+        if (y < 0 || y >= PLANET_MASK_SIZE)
+            continue;
+
+        int dx = (int)sqrtf((float)(radius * radius - dy * dy));
+        int lo = SDL_max(0, cx - dx);
+        int hi = SDL_min(PLANET_MASK_SIZE - 1, cx + dx);
+
+        if (lo <= hi)
+            planet->mask[y] &= ~span_bits(lo, hi);
+    }
+    planet->damaged = true;
+}
+
+//Gives a freshly spawned planet its image's mask, or a disc if the image
+//won't decode (or there are no images, headless).
+void planet_init_mask(Game* game, int index)
+{
+    Planet* planet = &game->sim.planets[index];
+
+    if (!stream_mask(game, game->planet_textures[index], planet->mask))
+    {
+        const float r = PLANET_MASK_SIZE / 2.0f;
+
+        for (int y = 0; y < PLANET_MASK_SIZE; y++)
+        {
+            float dy = y + 0.5f - r;
+            int half = (int)sqrtf(SDL_max(0.0f, r * r - dy * dy));
+
+            planet->mask[y] = half > 0 ? span_bits(PLANET_MASK_SIZE / 2 - half, PLANET_MASK_SIZE / 2 + half - 1) : 0;
+        }
+    }
+
+    planet->solid = planet_solid(planet);
+    planet->damaged = false;
+}
+
+//Whether any solid bit lies under rect, which is assumed to overlap the
+//planet's position. The first one found is returned in gx, gy.
+bool planet_mask_hit(const Planet* planet, const SDL_Rect* rect, int* gx, int* gy)
+{
+    const SDL_Rect* pos = &planet->position;
+    Uint64 columns = span_bits(to_grid(rect->x, pos->x, pos->w), to_grid(rect->x + rect->w - 1, pos->x, pos->w));
+    int y0 = to_grid(rect->y, pos->y, pos->h);
+    int y1 = to_grid(rect->y + rect->h - 1, pos->y, pos->h);
+
+    for (int y = y0; y <= y1; y++)
+    {
+        Uint64 hit = planet->mask[y] & columns;
+        if (hit)
+        {
+            if (gx)
+                *gx = lowest_bit(hit);
+            if (gy)
+                *gy = y;
+            return true;
+        }
+    }
+    return false;
+}
+
+//A projectile-sized rect hitting planet index. Craters where it lands and
+//blows the planet up once most of it is gone, credited to owner.
+//False if rect only passed over empty space.
+bool planet_hit(Game* game, int index, const SDL_Rect* rect, int damage, int owner)
+{
+    Planet* planet = &game->sim.planets[index];
+    int gx, gy;
+
+    if (!planet->active || !check_collision(*rect, planet->position) || !planet_mask_hit(planet, rect, &gx, &gy))
+        return false;
+
+    //Crater size is in screen pixels, so small planets lose more of their mask.
+    float pixels = 2.0f + damage / 10.0f;
+    int radius = SDL_max(1, (int)(pixels * PLANET_MASK_SIZE / SDL_max(1, planet->position.w)));
+
+    float x = planet->position.x + planet->position.w / 2.0f;
+    float y = planet->position.y + planet->position.h / 2.0f;
+
+    planet_carve(planet, gx, gy, radius);
+    emit_hit(game, (HitEvent){TARGET_PLANET, index, damage, owner, x, y});
+
+    if (planet_solid(planet) < planet->solid / PLANET_BREAK_FRACTION)
+    {
+        planet->active = false;
+        emit_kill(game, (KillEvent){TARGET_PLANET, index, owner, planet->position.w, x, y});
+    }
+    return true;
+}
+
+//The texture to draw a damaged planet with, NULL until its image has been
+//decoded.
+SDL_Texture* planet_view(Game* game, int index)
+{
+    static Uint32 pixels[PLANET_MASK_SIZE * PLANET_MASK_SIZE];
+    const Uint32* source = stream_mask_pixels(game, game->planet_textures[index]);
+    const Planet* planet = &game->sim.planets[index];
+    PlanetView* view = &game->planet_views[index];
+
+    if (source == NULL)
+        return NULL;
+
+    if (view->texture == NULL)
+    {
+        SDL_Surface* blank = SDL_CreateRGBSurfaceWithFormat(0, PLANET_MASK_SIZE, PLANET_MASK_SIZE, 32, SDL_PIXELFORMAT_ARGB8888);
+        if (blank == NULL)
+            return NULL;
+
+        //Starts fully transparent, the diff below fills in what is solid.
+        view->texture = create_texture(game, blank);
+        SDL_FreeSurface(blank);
+        if (view->texture == NULL)
+            return NULL;
+        memset(view->shown, 0, sizeof(view->shown));
+    }
+
+    int y0 = -1, y1 = -1;
+    Uint64 changed = 0;
+
+    for (int y = 0; y < PLANET_MASK_SIZE; y++)
+    {
+        Uint64 diff = view->shown[y] ^ planet->mask[y];
+        if (diff)
+        {
+            if (y0 < 0)
+                y0 = y;
+            y1 = y;
+            changed |= diff;
+        }
+    }
+
+    if (y0 < 0)
+        return view->texture;
+
+    int x0 = lowest_bit(changed);
+    int x1 = highest_bit(changed);
+
+    for (int y = y0; y <= y1; y++)
+    {
+        for (int x = x0; x <= x1; x++)
+        {
+            int i = y * PLANET_MASK_SIZE + x;
+            pixels[i] = (planet->mask[y] >> x) & 1 ? source[i] : 0;
+        }
+        view->shown[y] = planet->mask[y];
+    }
+
+    SDL_Rect dirty = {x0, y0, x1 - x0 + 1, y1 - y0 + 1};
+    update_texture(game, view->texture, &dirty, &pixels[y0 * PLANET_MASK_SIZE + x0], PLANET_MASK_SIZE * sizeof(Uint32));
+
+    return view->texture;
+}
+
+void planet_close_views(Game* game)
+{
+    for (int i = 0; i < MAX_PLANETS; i++)
+    {
+        destroy_texture(game, game->planet_views[i].texture);
+        game->planet_views[i].texture = NULL;
+    }
+}
@@ -21,106 +21,113 @@ void init_powerups(Game* game) {
         
 
     // Create texture from surface
-    game->powerup_texture = SDL_CreateTextureFromSurface(game->renderer, surface);
+    game->powerup_texture = create_texture(game, surface);
     SDL_FreeSurface(surface);
 
     // Initialize powerups
     for (int i = 0; i < MAX_POWERUPS; i++) {
-        game->powerups[i].active = false;
+        game->sim.powerups[i].active = false;
     }
 
-    // Initialize powerup end times
-    for (int i = 0; i < 4; i++) {
-        game->powerup_end_times[i] = 0;
-    }
 }
 
 void update_powerups(Game* game, float delta_time) {
     for (int i = 0; i < MAX_POWERUPS; i++) {
-        if (game->powerups[i].active) {
-            game->powerups[i].position.y += game->powerups[i].velocity_y * delta_time;
+        if (game->sim.powerups[i].active) {
+            game->sim.powerups[i].position.y += game->sim.powerups[i].velocity_y * delta_time;
 
             // Check if powerup is off-screen
-            if (game->powerups[i].position.y > SCREEN_HEIGHT) {
-                game->powerups[i].active = false;
+            if (game->sim.powerups[i].position.y > SCREEN_HEIGHT) {
+                game->sim.powerups[i].active = false;
             }
 
-            // Check collision with player
-            if (check_collision(game->powerups[i].position, game->player.position)) {
-                apply_powerup(game, game->powerups[i].type);
-                game->powerups[i].active = false;
+            // Check collision with players, first one there gets it
+            for (int p = 0; p < game->sim.num_players && game->sim.powerups[i].active; p++) {
+                if (check_collision(game->sim.powerups[i].position, game->sim.players[p].position)) {
+                    apply_powerup(game, &game->sim.players[p], game->sim.powerups[i].type);
+                    emit_pickup(game, (PickupEvent){p, game->sim.powerups[i].type,
+                                game->sim.powerups[i].position.x + game->sim.powerups[i].position.w / 2.0f,
+                                game->sim.powerups[i].position.y + game->sim.powerups[i].position.h / 2.0f});
+                    game->sim.powerups[i].active = false;
+                }
             }
         }
     }
-
-    // Spawn new powerup
-    if ((float)rand() / RAND_MAX < POWERUP_SPAWN_CHANCE) {
-        spawn_powerup(game);
-    }
-
-    update_powerup_effects(game);
 }
 
 void render_powerups(Game* game) {
     for (int i = 0; i < MAX_POWERUPS; i++) {
-        if (game->powerups[i].active) {
-            SDL_SetTextureColorMod(game->powerup_texture, 
-                POWERUP_COLORS[game->powerups[i].type].r,
-                POWERUP_COLORS[game->powerups[i].type].g,
-                POWERUP_COLORS[game->powerups[i].type].b);
-            SDL_RenderCopy(game->renderer, game->powerup_texture, NULL, &game->powerups[i].position);
+        if (game->sim.powerups[i].active) {
+            set_texture_color_mod(game, game->powerup_texture, 
+                POWERUP_COLORS[game->sim.powerups[i].type].r,
+                POWERUP_COLORS[game->sim.powerups[i].type].g,
+                POWERUP_COLORS[game->sim.powerups[i].type].b);
+            draw_copy(game, game->powerup_texture, NULL, &game->sim.powerups[i].position);
         }
     }
 }
 
-void spawn_powerup(Game* game) {
+PowerUp* spawn_powerup(Game* game) {
     for (int i = 0; i < MAX_POWERUPS; i++) {
-        if (!game->powerups[i].active) {
-            game->powerups[i].active = true;
-            game->powerups[i].type = rand() % 4;
-            game->powerups[i].position.w = POWERUP_SIZE;
-            game->powerups[i].position.h = POWERUP_SIZE;
-            game->powerups[i].position.x = rand() % (SCREEN_WIDTH - POWERUP_SIZE);
-            game->powerups[i].position.y = -POWERUP_SIZE;
-            game->powerups[i].velocity_y = POWERUP_SPEED;
-            break;
+        if (!game->sim.powerups[i].active) {
+            game->sim.powerups[i].active = true;
+            game->sim.powerups[i].type = sim_rand(game) % 4;
+            game->sim.powerups[i].position.w = POWERUP_SIZE;
+            game->sim.powerups[i].position.h = POWERUP_SIZE;
+            game->sim.powerups[i].position.x = sim_rand(game) % (SCREEN_WIDTH - POWERUP_SIZE);
+            game->sim.powerups[i].position.y = -POWERUP_SIZE;
+            game->sim.powerups[i].velocity_y = POWERUP_SPEED;
+            return &game->sim.powerups[i];
         }
     }
+    return NULL;
 }
 
-void apply_powerup(Game* game, PowerUpType type) {
-    game->powerup_end_times[type] = SDL_GetTicks() + POWERUP_DURATION;
+void apply_powerup(Game* game, Player* player, PowerUpType type) {
+    bool running = player->powerup_end_times[type] > game->sim.time;
+
+    player->powerup_end_times[type] = game->sim.time + POWERUP_DURATION;
+
+    // Only speed has anything to undo when it runs out, see powerup_expire().
+    // If it was still running, its timer already chases the new end.
+    if (type == POWERUP_SPEED && !running)
+        timer_add(game, TIMER_POWERUP_END, (int)(player - game->sim.players) * POWERUP_COUNT + type, POWERUP_DURATION * FPS / 1000);
 
     switch (type) {
         case POWERUP_SPEED:
-            game->player.bonus_velocity = PLAYER_SPEED * 0.5f;
+            player->bonus_velocity = PLAYER_SPEED * 0.5f;
             break;
         case POWERUP_FIRE_RATE:
             // The effect will be applied in the shooting logic
             break;
         case POWERUP_SHIELD:
-            game->player.hit_points += 50;  // Add shield points
-            if (game->player.hit_points > game->player.max_hp) {
-                game->player.hit_points = game->player.max_hp;
+            player->hit_points += 50;  // Add shield points
+            if (player->hit_points > player->max_hp) {
+                player->hit_points = player->max_hp;
             }
             break;
         case POWERUP_AMMO:
             for (int i = 0; i < MAX_WEAPONS; i++) {
-                game->player.weapons[i].ammo = game->player.weapons[i].type.max_ammo;
+                player->weapons[i].ammo = player->weapons[i].type.max_ammo;
             }
             break;
     }
 }
 
-void update_powerup_effects(Game* game) {
-    Uint32 current_time = SDL_GetTicks();
+//Timer from apply_powerup(). Picking the same powerup up again pushes the end
+//back, so the timer can go off early; it then waits out the rest.
+void powerup_expire(Game* game, int player, int type) {
+    Player* p = &game->sim.players[player];
+    Uint32 end = p->powerup_end_times[type];
 
-    // Speed powerup
-    if (current_time > game->powerup_end_times[POWERUP_SPEED]) {
-        game->player.bonus_velocity = 0;
+    if (end > game->sim.time) {
+        timer_add(game, TIMER_POWERUP_END, player * POWERUP_COUNT + type, ((end - game->sim.time) * FPS + 999) / 1000);
+        return;
     }
 
-    // Other powerups don't need to be updated here as they are checked in their respective systems
+    if (type == POWERUP_SPEED) {
+        p->bonus_velocity = 0;
+    }
 }
 
 
@@ -131,5 +138,8 @@ void draw_shield(Game* game, int x, int y, int radius,/* int thickness,*/ Uint32
     
     // Draw the shield circle
     //thickCircleColor(game->renderer, x, y, radius, thickness, 0, 255, 255, alpha);
-    aacircleRGBA(game->renderer, x, y, radius, 0, 255, 255, alpha);
+    if (quality_tier(game)->aa)
+        draw_aa_circle(game, x, y, radius, 0, 255, 255, alpha);
+    else
+        draw_circle(game, x, y, radius, 0, 255, 255, alpha);
 }
\ No newline at end of file
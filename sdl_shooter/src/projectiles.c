@@ -0,0 +1,166 @@
+#include "main.h"
+
+//Shots in flight. Each weapon has its own bucket of projectiles, packed from
+//index 0, and its own update and draw kernel stamped out from WEAPON_LIST
+//(main.h) with that weapon's stats as compile time constants: a laser's
+//loop has no homing or splash code in it at all, and a projectile only
+//carries what differs between two shots of the same weapon.
+//
+//A shot that hits is only marked inactive; its bucket's next update packs
+//the survivors down over it, so nothing else has to care about holes.
+
+#define WEAPON_ROW(id, name, ammo, damage, fire_rate, speed, cooldown, offx, offy, width, height, homing, splash) \
+    {ammo, damage, fire_rate, speed, cooldown, name, offx, offy, width, height, homing, splash},
+
+const WeaponType WEAPON_TYPES[] =
+{
+    WEAPON_LIST(WEAPON_ROW)
+};
+
+//Drawn at twice the image size.
+#define SHOT_W(type)        (WEAPON_TYPES[type].width * 2)
+#define SHOT_H(type)        (WEAPON_TYPES[type].height * 2)
+
+//Appends a shot of weapon type at x, y heading angle degrees (0 is up,
+//clockwise), fired by player owner or, with owner -1, by enemy shooter.
+//NULL if that weapon's bucket is full.
+Projectile* projectile_spawn(Game* game, int type, float x, float y, float angle, int owner, int shooter)
+{
+    ProjectileBucket* bucket = &game->sim.projectiles[type];
+    float rad_angle = angle * (float)M_PI / 180.0f;
+
+    if (bucket->count == PROJECTILES_PER_WEAPON)
+        return NULL;
+
+    Projectile* shot = &bucket->items[bucket->count++];
+    shot->x = x;
+    shot->y = y;
+    shot->vx = sinf(rad_angle) * WEAPON_TYPES[type].bullet_speed;
+    shot->vy = -cosf(rad_angle) * WEAPON_TYPES[type].bullet_speed;
+    shot->angle = angle;
+    shot->dest_rect = (SDL_Rect){(int)x - SHOT_W(type) / 2, (int)y - SHOT_H(type) / 2, SHOT_W(type), SHOT_H(type)};
+    shot->owner = (Sint8)owner;
+    shot->shooter = (Sint8)shooter;
+    shot->is_enemy_projectile = owner < 0;
+    shot->active = true;
+    return shot;
+}
+
+//One tick of every shot in a bucket: steer, move, collide, then pack the
+//ones still flying. Always inlined into the per weapon kernels below, so
+//the weapon's numbers are constants and the branches on them fold away.
+static inline __attribute__((always_inline))
+void projectile_kernel(Game* game, int type, int w, int h, int damage, float speed, float homing, int splash)
+{
+    ProjectileBucket* bucket = &game->sim.projectiles[type];
+    int kept = 0;
+
+    for (int i = 0; i < bucket->count; i++)
+    {
+        Projectile* shot = &bucket->items[i];
+
+        //Already spent on an enemy this tick, see update_enemies().
+        if (!shot->active)
+            continue;
+
+        if (homing > 0 && !shot->is_enemy_projectile)
+            projectile_home(game, shot, homing, speed);
+
+        shot->x += shot->vx;
+        shot->y += shot->vy;
+        shot->dest_rect.x = (int)shot->x - w / 2;
+        shot->dest_rect.y = (int)shot->y - h / 2;
+
+        if (shot->y < 0 || shot->y > SCREEN_HEIGHT || shot->x < 0 || shot->x > SCREEN_WIDTH)
+            continue;
+
+        SDL_Rect point = {(int)shot->x - 2, (int)shot->y - 2, 4, 4};
+
+        //Anything hits enemies, enemy fire included, except the enemy that
+        //fired it: most patterns fire some of their bullets back up through
+        //the muzzle at its bottom edge.
+        for (int j = 0; j < MAX_ENEMIES && shot->active; j++)
+        {
+            if (game->sim.enemies[j].active && j != shot->shooter && hitbox_hit_rect(&game->enemy_hitbox, &game->sim.enemies[j].position, &point))
+            {
+                damage_enemy(game, j, damage, shot->owner);
+                if (splash > 0)
+                    projectile_splash(game, shot, damage, splash, j);
+                shot->active = false;
+            }
+        }
+
+        if (shot->is_enemy_projectile)
+        {
+            for (int p = 0; p < game->sim.num_players && shot->active; p++)
+            {
+                if (hitbox_hit_rect(player_hitbox(game, &game->sim.players[p]), &game->sim.players[p].position, &point))
+                {
+                    damage_player(game, p, damage, TARGET_ENEMY, -1);
+                    shot->active = false;
+                }
+            }
+        }
+        else
+        {
+            //Player shots crater planets, and pass over the holes.
+            for (int j = 0; j < MAX_PLANETS && shot->active; j++)
+            {
+                if (planet_hit(game, j, &point, damage, shot->owner))
+                {
+                    if (splash > 0)
+                        projectile_splash(game, shot, damage, splash, -1);
+                    shot->active = false;
+                }
+            }
+        }
+
+        if (shot->active)
+            bucket->items[kept++] = *shot;
+    }
+    bucket->count = kept;
+}
+
+static inline __attribute__((always_inline))
+void projectile_draw_kernel(Game* game, int type, int w, int h)
+{
+    const ProjectileBucket* bucket = &game->sim.projectiles[type];
+    SDL_Texture* texture = texture_pick(&game->weapon_textures[type], w, h);
+    SDL_Point center = {w / 4, h / 4};
+
+    for (int i = 0; i < bucket->count; i++)
+        if (bucket->items[i].active)
+            draw_copy_ex(game, texture, NULL, &bucket->items[i].dest_rect, bucket->items[i].angle, &center);
+}
+
+#define WEAPON_KERNELS(id, name, ammo, damage, fire_rate, speed, cooldown, offx, offy, width, height, homing, splash) \
+    static void update_##id(Game* game)                                                                             \
+    {                                                                                                               \
+        projectile_kernel(game, id, (width) * 2, (height) * 2, damage, (float)(speed), homing, splash);            \
+    }                                                                                                               \
+    static void draw_##id(Game* game)                                                                               \
+    {                                                                                                               \
+        projectile_draw_kernel(game, id, (width) * 2, (height) * 2);                                                \
+    }
+
+WEAPON_LIST(WEAPON_KERNELS)
+
+#define UPDATE_KERNEL(id, ...)  update_##id,
+#define DRAW_KERNEL(id, ...)    draw_##id,
+
+static void (*const UPDATE_KERNELS[MAX_WEAPONS])(Game* game) = {WEAPON_LIST(UPDATE_KERNEL)};
+static void (*const DRAW_KERNELS[MAX_WEAPONS])(Game* game) = {WEAPON_LIST(DRAW_KERNEL)};
+
+void update_projectiles(Game* game)
+{
+    spatial_update(game);
+
+    for (int type = 0; type < MAX_WEAPONS; type++)
+        UPDATE_KERNELS[type](game);
+}
+
+void render_projectiles(Game* game)
+{
+    for (int type = 0; type < MAX_WEAPONS; type++)
+        DRAW_KERNELS[type](game);
+}
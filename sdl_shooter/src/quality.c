@@ -0,0 +1,175 @@
+#include "main.h"
+
+//Adaptive quality. Each frame's cost, from its start up to the moment it is
+//handed to present (so neither the pacing wait nor a vsync block counts),
+//is smoothed and compared to the frame budget. Staying above
+//QUALITY_DOWN_LOAD of the budget for QUALITY_DOWN_FRAMES drops a tier;
+//staying below QUALITY_UP_LOAD for the much longer QUALITY_UP_FRAMES raises
+//one, and after any change the load is left to settle before it counts
+//again. The gap between the two thresholds keeps it from flip-flopping.
+//
+//A tier draws the frame at a reduced resolution and stretches it over the
+//window, thins out the particles and drops the antialiased shield. All of
+//it is render side: the sim still runs every particle, so replays, rewind
+//and netplay are unaffected.
+
+static const QualityTier QUALITY_TABLE[QUALITY_TIERS] =
+{
+    //name      scale   particles   aa
+    {"high",    1.0f,   1,          true},
+    {"medium",  0.85f,  1,          true},
+    {"low",     0.7f,   2,          false},
+    {"lowest",  0.5f,   4,          false}
+};
+
+static void quality_set(Game* game, int tier)
+{
+    QualityGovernor* q = &game->quality;
+    char buf[MSL];
+
+    tier = SDL_max(0, SDL_min(tier, QUALITY_TIERS - 1));
+    if (tier == q->tier)
+        return;
+
+    snprintf(buf, sizeof(buf), "Quality %s -> %s (%.1f ms per frame)\n",
+             QUALITY_TABLE[q->tier].name, QUALITY_TABLE[tier].name, q->load_ms);
+    LOG(buf);
+
+    q->tier = tier;
+    q->changes++;
+    q->over = 0;
+    q->under = 0;
+    q->settle = QUALITY_SETTLE_FRAMES;
+}
+
+//Capture and the replay test read back full size frames, so both stay at
+//full quality whatever was asked for.
+void quality_init(Game* game)
+{
+    QualityGovernor* q = &game->quality;
+    char buf[MSL];
+
+    q->tier = 0;
+    q->locked = game->opts.quality_fixed || game->opts.capture_sequence || game->opts.test_dir[0];
+    if (game->opts.quality_fixed && !game->opts.capture_sequence && !game->opts.test_dir[0])
+        q->tier = SDL_max(0, SDL_min(game->opts.quality, QUALITY_TIERS - 1));
+
+    snprintf(buf, sizeof(buf), "Quality: %s, %s\n", QUALITY_TABLE[q->tier].name, q->locked ? "fixed" : "adaptive");
+    LOG(buf);
+}
+
+const QualityTier* quality_tier(Game* game)
+{
+    return &QUALITY_TABLE[game->quality.tier];
+}
+
+//Sets up this frame's resolution. The rasterizer scales its own draw calls;
+//SDL_Renderer draws into an offscreen target with a render scale instead.
+void quality_begin_frame(Game* game)
+{
+    QualityGovernor* q = &game->quality;
+    float scale = QUALITY_TABLE[q->tier].render_scale;
+
+    q->scaled = false;
+
+    if (game->soft)
+    {
+        soft_set_scale(game->soft, scale);
+        return;
+    }
+
+    if (scale >= 1.0f)
+        return;
+
+    if (q->target == NULL)
+    {
+        q->target = SDL_CreateTexture(game->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, SCREEN_WIDTH, SCREEN_HEIGHT);
+        if (q->target == NULL)
+        {
+            //Keep the other knobs, just draw at full size.
+            SDL_Log("Unable to create the reduced resolution target, SDL_Error: %s\n", SDL_GetError());
+            q->locked = true;
+            q->tier = 0;
+            return;
+        }
+        SDL_SetTextureScaleMode(q->target, SDL_ScaleModeLinear);
+    }
+
+    SDL_SetRenderTarget(game->renderer, q->target);
+    SDL_RenderSetScale(game->renderer, scale, scale);
+    q->scaled = true;
+}
+
+//Called from draw_present once the frame is finished: puts a reduced frame
+//on screen and notes when the work ended.
+void quality_resolve(Game* game)
+{
+    QualityGovernor* q = &game->quality;
+
+    if (q->scaled)
+    {
+        float scale = QUALITY_TABLE[q->tier].render_scale;
+        SDL_Rect view = {0, 0, (int)(SCREEN_WIDTH * scale + 0.5f), (int)(SCREEN_HEIGHT * scale + 0.5f)};
+
+        SDL_SetRenderTarget(game->renderer, NULL);
+        SDL_RenderCopy(game->renderer, q->target, &view, NULL);
+    }
+
+    q->drawn = SDL_GetPerformanceCounter();
+}
+
+//Called from pacer_end_frame with the counter the frame started at.
+void quality_end_frame(Game* game, Uint64 frame_start)
+{
+    QualityGovernor* q = &game->quality;
+    int fps = game->opts.target_fps > 0 ? game->opts.target_fps : FPS;
+    float budget = 1000.0f / fps;
+
+    q->frames[q->tier]++;
+
+    //A frame that never reached present (or a suspend) tells us nothing.
+    if (q->drawn < frame_start)
+        return;
+
+    float ms = (float)((q->drawn - frame_start) * 1000.0 / game->pacer.freq);
+    q->load_ms = q->load_ms ? q->load_ms * 0.9f + ms * 0.1f : ms;
+
+    if (q->locked)
+        return;
+
+    if (q->settle > 0)
+    {
+        q->settle--;
+        return;
+    }
+
+    q->over = q->load_ms > budget * QUALITY_DOWN_LOAD ? q->over + 1 : 0;
+    q->under = q->load_ms < budget * QUALITY_UP_LOAD ? q->under + 1 : 0;
+
+    if (q->over >= QUALITY_DOWN_FRAMES && q->tier < QUALITY_TIERS - 1)
+        quality_set(game, q->tier + 1);
+    else if (q->under >= QUALITY_UP_FRAMES && q->tier > 0)
+        quality_set(game, q->tier - 1);
+}
+
+void quality_close(Game* game)
+{
+    QualityGovernor* q = &game->quality;
+    Uint32 total = 0;
+    char buf[MSL];
+
+    for (int i = 0; i < QUALITY_TIERS; i++)
+        total += q->frames[i];
+
+    if (total)
+    {
+        snprintf(buf, sizeof(buf), "Quality: %u changes, frames high %.1f%%, medium %.1f%%, low %.1f%%, lowest %.1f%%\n",
+                 q->changes, 100.0 * q->frames[0] / total, 100.0 * q->frames[1] / total,
+                 100.0 * q->frames[2] / total, 100.0 * q->frames[3] / total);
+        LOG(buf);
+    }
+
+    if (q->target)
+        SDL_DestroyTexture(q->target);
+    q->target = NULL;
+}
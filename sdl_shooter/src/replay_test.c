@@ -0,0 +1,226 @@
+#include "main.h"
+
+//Headless replay test (--test DIR). Plays a fixed-seed session with fixed
+//time steps under the software rasterizer, compares every Nth frame with the
+//golden PNGs in DIR and records update/render time for every frame, so a
+//render change can be checked for both correctness and speed.
+//
+//The render benchmark (--bench N) plays the same session with the effects
+//kept as full as they go, to compare the rasterizer (--soft) with SDL's
+//software renderer on the same load.
+
+//Deterministic stand-in for the player: sweep left and right, always firing.
+static void replay_script_input(Game* game)
+{
+    TickInput* input = &game->tick_input;
+    int phase = (game->sim.tick / 60) % 4;
+
+    input->held = ACT_FIRE;
+    if (phase == 0)
+        input->held |= ACT_LEFT;
+    else if (phase == 2)
+        input->held |= ACT_RIGHT | ACT_AFTERBURNER;
+
+    input->pressed = 0;
+    input->wheel = 0;
+    input->event_time = 0;
+}
+
+//Returns the number of pixels where any channel differs by more than the
+//tolerance, or -1 if the golden image is missing or the wrong size.
+static int golden_compare(Game* game, const Uint32* frame, const char* path)
+{
+    SDL_Surface* loaded = IMG_Load(path);
+    if (loaded == NULL)
+        return -1;
+
+    SDL_Surface* golden = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0);
+    SDL_FreeSurface(loaded);
+
+    if (golden == NULL || golden->w != SCREEN_WIDTH || golden->h != SCREEN_HEIGHT)
+    {
+        SDL_FreeSurface(golden);
+        return -1;
+    }
+
+    int bad = 0;
+    int tolerance = game->opts.golden_tolerance;
+
+    for (int y = 0; y < SCREEN_HEIGHT; y++)
+    {
+        const Uint32* row = (const Uint32*)((const Uint8*)golden->pixels + y * golden->pitch);
+        for (int x = 0; x < SCREEN_WIDTH; x++)
+        {
+            Uint32 a = row[x], b = frame[y * SCREEN_WIDTH + x];
+            for (int shift = 0; shift < 24; shift += 8)
+            {
+                if (abs((int)((a >> shift) & 0xFF) - (int)((b >> shift) & 0xFF)) > tolerance)
+                {
+                    bad++;
+                    break;
+                }
+            }
+        }
+    }
+
+    SDL_FreeSurface(golden);
+    return bad;
+}
+
+static int compare_float(const void* a, const void* b)
+{
+    float fa = *(const float*)a, fb = *(const float*)b;
+    return (fa > fb) - (fa < fb);
+}
+
+int run_replay_test(Game* game)
+{
+    char path[MSL];
+    char buf[MSL_LONG];
+    int frames = game->opts.test_frames;
+    int max_bad = (int)(SCREEN_WIDTH * SCREEN_HEIGHT * GOLDEN_MAX_BAD_FRACTION);
+    int compared = 0, failed = 0, blessed = 0;
+    double render_total = 0;
+    float render_max = 0;
+    Uint64 freq = SDL_GetPerformanceFrequency();
+
+    Uint32* frame = mem_alloc(MEM_GAME, sizeof(Uint32) * SCREEN_WIDTH * SCREEN_HEIGHT);
+    float* render_ms = mem_alloc(MEM_GAME, sizeof(float) * frames);
+
+    FILE* times = NULL;
+    if (snprintf(path, sizeof(path), "%s/render_times.csv", game->opts.test_dir) < (int)sizeof(path))
+        times = fopen(path, "w");
+
+    if (frame == NULL || render_ms == NULL || times == NULL)
+    {
+        snprintf(buf, sizeof(buf), "Unable to start replay test in %s\n", game->opts.test_dir);
+        LOG(buf);
+        mem_free(frame);
+        mem_free(render_ms);
+        if (times)
+            fclose(times);
+        return 1;
+    }
+
+    fprintf(times, "frame,update_ms,render_ms\n");
+
+    for (int f = 0; f < frames; f++)
+    {
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        replay_script_input(game);
+        update(game);
+        Uint64 t1 = SDL_GetPerformanceCounter();
+        render(game);
+        Uint64 t2 = SDL_GetPerformanceCounter();
+
+        float update_time = (float)((t1 - t0) * 1000.0 / freq);
+        render_ms[f] = (float)((t2 - t1) * 1000.0 / freq);
+        render_total += render_ms[f];
+        render_max = fmaxf(render_max, render_ms[f]);
+        fprintf(times, "%d,%.3f,%.3f\n", f + 1, update_time, render_ms[f]);
+
+        if ((f + 1) % game->opts.golden_every != 0)
+            continue;
+
+        if (snprintf(path, sizeof(path), "%s/golden_%05d.png", game->opts.test_dir, f + 1) >= (int)sizeof(path))
+        {
+            failed++;
+            snprintf(buf, sizeof(buf), "Golden image name for frame %d is too long\n", f + 1);
+            LOG(buf);
+            continue;
+        }
+
+        if (!game->opts.bless)
+        {
+            capture_read_pixels(game, frame);
+            int bad = golden_compare(game, frame, path);
+
+            if (bad >= 0)
+            {
+                compared++;
+                if (bad > max_bad)
+                {
+                    failed++;
+                    snprintf(buf, sizeof(buf), "Frame %d differs from %s in %d pixels\n", f + 1, path, bad);
+                    LOG(buf);
+                }
+                continue;
+            }
+
+            snprintf(buf, sizeof(buf), "No usable golden image %s, writing one\n", path);
+            LOG(buf);
+        }
+
+        capture_frame(game, path, true);
+        blessed++;
+    }
+
+    fclose(times);
+
+    qsort(render_ms, frames, sizeof(float), compare_float);
+    snprintf(buf, sizeof(buf), "Replay test: %d frames, %d compared, %d failed, %d written. Render avg %.3f ms, p99 %.3f ms, max %.3f ms\n",
+             frames, compared, failed, blessed, frames ? render_total / frames : 0.0,
+             frames ? render_ms[(frames - 1) * 99 / 100] : 0.0f, render_max);
+    LOG(buf);
+
+    mem_free(frame);
+    mem_free(render_ms);
+    return failed ? 1 : 0;
+}
+
+//Starts explosions and sparkles scattered over the screen until the effects
+//are full, and keeps every particle alive with an explosion a frame.
+static void bench_spawn_effects(Game* game)
+{
+    create_explosion(game, (float)(rand() % SCREEN_WIDTH), (float)(rand() % SCREEN_HEIGHT));
+
+    for (int i = 0; i < BENCH_SPAWNS_PER_FRAME && anim_count(game) < MAX_ANIMS; i++)
+    {
+        float vx = (rand() % 5 - 2) * 0.5f, vy = (rand() % 5 - 2) * 0.5f;
+
+        anim_spawn(game, i % 2 ? ANIM_SPARKLE : ANIM_EXPLOSION,
+                   (float)(rand() % SCREEN_WIDTH), (float)(rand() % SCREEN_HEIGHT), vx, vy, 0);
+    }
+}
+
+int run_render_bench(Game* game)
+{
+    char buf[MSL];
+    int frames = game->opts.bench_frames;
+    double render_total = 0;
+    float render_max = 0;
+    Uint64 effects = 0;
+    Uint64 freq = SDL_GetPerformanceFrequency();
+
+    float* render_ms = mem_alloc(MEM_GAME, sizeof(float) * frames);
+    if (render_ms == NULL)
+    {
+        LOG("Unable to start the render benchmark\n");
+        return 1;
+    }
+
+    for (int f = 0; f < frames; f++)
+    {
+        replay_script_input(game);
+        update(game);
+        bench_spawn_effects(game);
+        effects += anim_count(game);
+
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        render(game);
+        Uint64 t1 = SDL_GetPerformanceCounter();
+
+        render_ms[f] = (float)((t1 - t0) * 1000.0 / freq);
+        render_total += render_ms[f];
+        render_max = fmaxf(render_max, render_ms[f]);
+    }
+
+    qsort(render_ms, frames, sizeof(float), compare_float);
+    snprintf(buf, sizeof(buf), "Render benchmark (%s): %d frames, %llu effects on average. Render avg %.3f ms, p99 %.3f ms, max %.3f ms\n",
+             game->soft ? "software rasterizer" : "SDL software renderer", frames, (unsigned long long)(effects / frames),
+             render_total / frames, render_ms[(frames - 1) * 99 / 100], render_max);
+    LOG(buf);
+
+    mem_free(render_ms);
+    return 0;
+}
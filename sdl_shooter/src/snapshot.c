@@ -0,0 +1,417 @@
+#include "main.h"
+
+//Rewind and quick resume. After every tick the sim state goes into a ring:
+//every SNAP_KEYFRAME_EVERY ticks as a full keyframe, in between as the bytes
+//that differ from the last keyframe (XOR), run-length encoded. Most of the
+//state is inactive slots and fields that haven't moved, so a delta is a few
+//hundred bytes where the raw state is over ten KB.
+//
+//Holding R steps back one tick per frame, dropping the ticks it passes.
+//With --resume FILE the state is also written to FILE every few seconds and
+//on exit, and read back on the next start.
+
+#define SNAP_RESUME_MAGIC   0x53485253      //"SHRS"
+#define SNAP_RESUME_VERSION 1
+#define SNAP_MIN_GAP        4       //Unchanged bytes worth ending a literal run for
+#define SNAP_MAX_ENTRIES    (SNAP_KEYFRAMES * SNAP_KEYFRAME_EVERY)
+#define SNAP_ARENA_BYTES    (SNAP_ARENA_KB * 1024)
+
+typedef struct
+{
+    Uint32 tick;
+    int key;                //Slot in keys[]
+    int offset, len;        //Encoded delta in the arena, len 0 when equal to the keyframe
+} SnapEntry;
+
+struct SnapshotRing
+{
+    SimState keys[SNAP_KEYFRAMES];
+    int first_key, num_keys;
+
+    SnapEntry entries[SNAP_MAX_ENTRIES];
+    int first, count;
+
+    Uint8 arena[SNAP_ARENA_BYTES];
+    int head;
+    Uint8 scratch[2 * sizeof(SimState)];   //Enough for any delta, see delta_encode()
+
+    Uint32 last_resume_save;
+
+    //Reported on exit
+    Uint64 capture_time, max_capture_time, captures;
+    Uint64 restore_time, restores;
+    Uint64 delta_bytes, deltas;
+};
+
+static const SimState ZERO_STATE;
+
+static Uint64 load64(const Uint8* p)
+{
+    Uint64 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static int put_varint(Uint8* out, Uint32 v)
+{
+    int len = 0;
+
+    while (v >= 0x80)
+    {
+        out[len++] = (Uint8)(v | 0x80);
+        v >>= 7;
+    }
+    out[len++] = (Uint8)v;
+    return len;
+}
+
+static bool get_varint(const Uint8* in, int len, int* at, Uint32* v)
+{
+    *v = 0;
+    for (int shift = 0; *at < len && shift < 32; shift += 7)
+    {
+        Uint8 byte = in[(*at)++];
+        *v |= (Uint32)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+//Writes the changes from key to cur as (unchanged bytes, changed bytes,
+//XOR of those) records. Returns the length, or -1 if it didn't fit in cap.
+//Every record but the last covers at least SNAP_MIN_GAP unchanged bytes, so
+//the output never reaches twice the input.
+static int delta_encode(const Uint8* cur, const Uint8* key, int size, Uint8* out, int cap)
+{
+    Uint8 header[10];
+    int len = 0, i = 0;
+
+    while (i < size)
+    {
+        int start = i;
+
+        //Unchanged run, a word at a time while it lasts.
+        while (i + 8 <= size && load64(cur + i) == load64(key + i))
+            i += 8;
+        while (i < size && cur[i] == key[i])
+            i++;
+        if (i == size)
+            break;
+
+        //Changed run, carrying on through gaps too short to be worth a record.
+        int changed = i;
+        while (i < size && !(i + SNAP_MIN_GAP <= size && !memcmp(cur + i, key + i, SNAP_MIN_GAP)))
+            i++;
+
+        int header_len = put_varint(header, changed - start);
+        header_len += put_varint(header + header_len, i - changed);
+        if (len + header_len + (i - changed) > cap)
+            return -1;
+
+        memcpy(out + len, header, header_len);
+        len += header_len;
+        for (int k = changed; k < i; k++)
+            out[len++] = cur[k] ^ key[k];
+    }
+    return len;
+}
+
+//XORs a delta onto state, which holds its keyframe. False if the delta is
+//malformed (only possible for one read from a file).
+static bool delta_apply(Uint8* state, int size, const Uint8* in, int len)
+{
+    int at = 0, pos = 0;
+
+    while (at < len)
+    {
+        Uint32 skip, count;
+
+        if (!get_varint(in, len, &at, &skip) || !get_varint(in, len, &at, &count))
+            return false;
+        if (skip > (Uint32)(size - pos) || count > (Uint32)(size - pos - (int)skip) || count > (Uint32)(len - at))
+            return false;
+
+        pos += skip;
+        for (Uint32 k = 0; k < count; k++)
+            state[pos++] ^= in[at++];
+    }
+    return true;
+}
+
+static SnapEntry* entry_at(SnapshotRing* ring, int i)
+{
+    return &ring->entries[(ring->first + i) % SNAP_MAX_ENTRIES];
+}
+
+//A keyframe goes with the last entry that uses it.
+static void drop_oldest(SnapshotRing* ring)
+{
+    int key = entry_at(ring, 0)->key;
+
+    ring->first = (ring->first + 1) % SNAP_MAX_ENTRIES;
+    ring->count--;
+
+    if (ring->count == 0 || entry_at(ring, 0)->key != key)
+    {
+        ring->first_key = (ring->first_key + 1) % SNAP_KEYFRAMES;
+        ring->num_keys--;
+    }
+}
+
+static void drop_newest(SnapshotRing* ring)
+{
+    SnapEntry* entry = entry_at(ring, ring->count - 1);
+
+    ring->count--;
+    ring->head = entry->offset;
+
+    if (ring->count == 0 || entry_at(ring, ring->count - 1)->key != entry->key)
+        ring->num_keys--;
+}
+
+//Deltas are allocated in order, so only the oldest one can be in the way.
+static bool arena_overlaps(SnapshotRing* ring, int at, int len)
+{
+    for (int i = 0; i < ring->count; i++)
+    {
+        SnapEntry* entry = entry_at(ring, i);
+        if (entry->len > 0)
+            return entry->offset < at + len && at < entry->offset + entry->len;
+    }
+    return false;
+}
+
+//Room for len bytes at the write position, wrapping to the start when it
+//doesn't fit before the end. Anything in the way is old and goes.
+static int arena_alloc(SnapshotRing* ring, int len)
+{
+    int at = ring->head;
+
+    if (at + len > SNAP_ARENA_BYTES)
+    {
+        while (ring->count && entry_at(ring, 0)->offset >= at)
+            drop_oldest(ring);
+        at = 0;
+    }
+
+    while (ring->count && arena_overlaps(ring, at, len))
+        drop_oldest(ring);
+
+    ring->head = at + len;
+    return at;
+}
+
+static SnapEntry* push_entry(SnapshotRing* ring)
+{
+    if (ring->count == SNAP_MAX_ENTRIES)
+        drop_oldest(ring);
+
+    return entry_at(ring, ring->count++);
+}
+
+//Stores the current tick. Called after every single player sim step.
+void snapshot_capture(Game* game)
+{
+    SnapshotRing* ring = game->snapshots;
+    const SimState* sim = &game->sim;
+
+    if (ring == NULL)
+        return;
+
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    int newest_key = (ring->first_key + ring->num_keys - 1) % SNAP_KEYFRAMES;
+    int len = -1;
+
+    if (ring->num_keys > 0 && sim->tick - ring->keys[newest_key].tick < SNAP_KEYFRAME_EVERY)
+        len = delta_encode((const Uint8*)sim, (const Uint8*)&ring->keys[newest_key], sizeof(SimState), ring->scratch, sizeof(SimState));
+
+    //Time for a keyframe, or so much changed that the delta would be bigger.
+    //An empty delta (nothing moved) is fine and takes no arena space.
+    if (len < 0)
+    {
+        while (ring->num_keys == SNAP_KEYFRAMES)
+            drop_oldest(ring);
+
+        newest_key = (ring->first_key + ring->num_keys++) % SNAP_KEYFRAMES;
+        ring->keys[newest_key] = *sim;
+
+        SnapEntry* entry = push_entry(ring);
+        *entry = (SnapEntry){sim->tick, newest_key, ring->head, 0};
+    }
+    else
+    {
+        int offset = len ? arena_alloc(ring, len) : ring->head;
+
+        //Making room can take the whole history, keyframe included.
+        if (ring->num_keys == 0)
+        {
+            ring->head = 0;
+            snapshot_capture(game);
+            return;
+        }
+
+        memcpy(ring->arena + offset, ring->scratch, len);
+        SnapEntry* entry = push_entry(ring);
+        *entry = (SnapEntry){sim->tick, newest_key, offset, len};
+
+        ring->delta_bytes += len;
+        ring->deltas++;
+    }
+
+    Uint64 elapsed = SDL_GetPerformanceCounter() - t0;
+    ring->capture_time += elapsed;
+    ring->max_capture_time = SDL_max(ring->max_capture_time, elapsed);
+    ring->captures++;
+
+    if (game->opts.resume_file[0] && sim->tick - ring->last_resume_save >= SNAP_RESUME_EVERY)
+    {
+        snapshot_save_resume(game);
+        ring->last_resume_save = sim->tick;
+    }
+}
+
+//Goes back one tick. Returns false when there is nothing older left.
+bool snapshot_rewind(Game* game)
+{
+    SnapshotRing* ring = game->snapshots;
+
+    //The newest entry is the state we are in now.
+    if (ring == NULL || ring->count < 2)
+        return false;
+
+    Uint64 t0 = SDL_GetPerformanceCounter();
+
+    drop_newest(ring);
+    SnapEntry* entry = entry_at(ring, ring->count - 1);
+
+    game->sim = ring->keys[entry->key];
+    delta_apply((Uint8*)&game->sim, sizeof(SimState), ring->arena + entry->offset, entry->len);
+
+    ring->restore_time += SDL_GetPerformanceCounter() - t0;
+    ring->restores++;
+    return true;
+}
+
+//Writes the current state to --resume FILE. Goes through a temporary file
+//so a crash mid-write leaves the previous save intact.
+bool snapshot_save_resume(Game* game)
+{
+    char buf[MSL_LONG], tmp[MSL + 8];
+    SnapshotRing* ring = game->snapshots;
+
+    if (ring == NULL || !game->opts.resume_file[0])
+        return false;
+
+    //Against an all-zero state, so the inactive slots cost next to nothing.
+    int len = delta_encode((const Uint8*)&game->sim, (const Uint8*)&ZERO_STATE, sizeof(SimState), ring->scratch, sizeof(ring->scratch));
+    if (len < 0)
+        return false;
+
+    Uint32 header[5] = {SNAP_RESUME_MAGIC, SNAP_RESUME_VERSION, sizeof(SimState), (Uint32)len, 2166136261u};
+    for (int i = 0; i < len; i++)
+        header[4] = (header[4] ^ ring->scratch[i]) * 16777619u;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", game->opts.resume_file);
+    FILE* fp = fopen(tmp, "wb");
+    if (fp == NULL)
+    {
+        snprintf(buf, sizeof(buf), "Unable to write %s\n", tmp);
+        LOG(buf);
+        return false;
+    }
+
+    bool ok = fwrite(header, sizeof(header), 1, fp) == 1 && fwrite(ring->scratch, 1, len, fp) == (size_t)len;
+    ok = fclose(fp) == 0 && ok;
+
+    if (!ok || rename(tmp, game->opts.resume_file) != 0)
+    {
+        snprintf(buf, sizeof(buf), "Unable to save %s\n", game->opts.resume_file);
+        LOG(buf);
+        remove(tmp);
+        return false;
+    }
+    return true;
+}
+
+//Loads --resume FILE if there is one from this build. Anything else is
+//ignored and the game starts fresh.
+bool snapshot_load_resume(Game* game)
+{
+    char buf[MSL_LONG];
+    SnapshotRing* ring = game->snapshots;
+    Uint32 header[5];
+    SimState state = ZERO_STATE;
+
+    if (ring == NULL || !game->opts.resume_file[0])
+        return false;
+
+    FILE* fp = fopen(game->opts.resume_file, "rb");
+    if (fp == NULL)
+        return false;
+
+    bool ok = fread(header, sizeof(header), 1, fp) == 1 && header[0] == SNAP_RESUME_MAGIC && header[1] == SNAP_RESUME_VERSION &&
+              header[2] == sizeof(SimState) && header[3] <= sizeof(ring->scratch) &&
+              fread(ring->scratch, 1, header[3], fp) == header[3];
+    fclose(fp);
+
+    if (ok)
+    {
+        Uint32 hash = 2166136261u;
+        for (Uint32 i = 0; i < header[3]; i++)
+            hash = (hash ^ ring->scratch[i]) * 16777619u;
+
+        ok = hash == header[4] && delta_apply((Uint8*)&state, sizeof(SimState), ring->scratch, header[3]) &&
+             state.num_players == 1;
+    }
+
+    if (!ok)
+    {
+        snprintf(buf, sizeof(buf), "Ignoring %s: not a save from this version\n", game->opts.resume_file);
+        LOG(buf);
+        return false;
+    }
+
+    game->sim = state;
+    game->local_player = 0;
+    ring->last_resume_save = state.tick;
+
+    snprintf(buf, sizeof(buf), "Resumed from %s at tick %u\n", game->opts.resume_file, state.tick);
+    LOG(buf);
+    return true;
+}
+
+SnapshotRing* snapshot_open(Game* game)
+{
+    SnapshotRing* ring = mem_calloc(MEM_GAME, 1, sizeof(SnapshotRing));
+
+    if (ring == NULL)
+        SDL_Log("Unable to allocate the snapshot ring, rewind is off\n");
+    (void)game;
+    return ring;
+}
+
+void snapshot_close(Game* game, SnapshotRing* ring)
+{
+    char buf[MSL];
+
+    if (ring == NULL)
+        return;
+
+    double us = 1e6 / (double)SDL_GetPerformanceFrequency();
+    int stored = 0;
+
+    for (int i = 0; i < ring->count; i++)
+        stored += entry_at(ring, i)->len;
+
+    snprintf(buf, sizeof(buf), "Snapshots: %d ticks (%.1f s) in %d keyframes of %zu bytes + %d KB of deltas, avg delta %.0f bytes. "
+             "Capture avg %.1f us, max %.1f us; rewind avg %.1f us\n",
+             ring->count, ring->count / (float)FPS, ring->num_keys, sizeof(SimState), stored / 1024,
+             ring->deltas ? (double)ring->delta_bytes / ring->deltas : 0.0,
+             ring->captures ? ring->capture_time * us / ring->captures : 0.0, ring->max_capture_time * us,
+             ring->restores ? ring->restore_time * us / ring->restores : 0.0);
+    LOG(buf);
+
+    mem_free(ring);
+    (void)game;
+}
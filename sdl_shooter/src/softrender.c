@@ -0,0 +1,916 @@
+#include "main.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+    #define SOFT_USE_SSE2
+#endif
+
+//Software rasterizer backend. Draw calls are recorded into a command list,
+//binned into screen tiles and rasterized in parallel into an ARGB8888
+//framebuffer that gets uploaded to a single streaming texture per frame.
+//All colours and sprite pixels are kept premultiplied so a blend is
+//always dst = src + dst * (255 - src.a) / 255.
+
+#define SOFT_MAX_COMMANDS       16384
+#define SOFT_TILE_ITEMS         (4 * SOFT_MAX_COMMANDS)     //Reserved command-in-tile entries
+#define SOFT_TEXTURE_SLOTS      512         //Must be a power of two
+
+typedef enum
+{
+    SOFT_CMD_CLEAR,
+    SOFT_CMD_FILL,
+    SOFT_CMD_POINT,
+    SOFT_CMD_LINE,
+    SOFT_CMD_COPY,
+    SOFT_CMD_COPY_EX,
+    SOFT_CMD_CIRCLE
+} SoftCommandType;
+
+typedef struct
+{
+    SoftCommandType type;
+    bool blend;
+    SDL_Rect bounds;            //Screen space, already clipped to the framebuffer
+    Uint32 color;               //Premultiplied draw colour, or the colour/alpha mod for copies
+    const Uint32* pixels;       //Premultiplied source pixels for copies
+    int pitch;                  //In pixels
+    SDL_Rect src;
+    SDL_Rect dst;
+    float sin_a, cos_a;         //Rotation for SOFT_CMD_COPY_EX
+    float cx, cy;               //Rotation centre / circle centre in screen space
+    float radius;
+    int x1, y1, x2, y2;         //Line end points
+} SoftCommand;
+
+typedef struct
+{
+    SDL_Texture* texture;
+    Uint32* pixels;
+    int w, h;
+    Uint8 mod_r, mod_g, mod_b, mod_a;
+} SoftSprite;
+
+struct SoftRenderer
+{
+    SDL_Renderer* renderer;
+    SDL_Texture* target;
+    Uint32* framebuffer;
+    int width;
+    int height;
+    float scale;                //Draw calls land in the top left view_w x view_h
+    int view_w;
+    int view_h;
+
+    SoftCommand* commands;
+    int num_commands;
+    SDL_Color draw_color;
+    SDL_BlendMode draw_blend;
+
+    SoftSprite sprites[SOFT_TEXTURE_SLOTS];
+
+    int tiles_x;
+    int tiles_y;
+    int num_tiles;
+    int* tile_start;            //num_tiles + 1 prefix sums into tile_items
+    int* tile_cursor;
+    int* tile_items;
+    int tile_items_cap;
+
+    SDL_Thread* threads[SOFT_MAX_THREADS];
+    int num_threads;
+    SDL_sem* work_start;
+    SDL_sem* work_done;
+    SDL_atomic_t next_tile;
+    bool quit;
+};
+
+static inline Uint32 soft_premultiply(Uint8 r, Uint8 g, Uint8 b, Uint8 a)
+{
+    return ((Uint32)a << 24) |
+           ((Uint32)((r * a + 127) / 255) << 16) |
+           ((Uint32)((g * a + 127) / 255) << 8) |
+            (Uint32)((b * a + 127) / 255);
+}
+
+//Scalar premultiplied "over", two channels at a time.
+static inline Uint32 soft_blend_pixel(Uint32 src, Uint32 dst)
+{
+    Uint32 inv = 255 - (src >> 24);
+    Uint32 rb = (dst & 0x00FF00FF) * inv + 0x00800080;
+    Uint32 ag = ((dst >> 8) & 0x00FF00FF) * inv + 0x00800080;
+
+    rb = ((rb + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+    ag = (ag + ((ag >> 8) & 0x00FF00FF)) & 0xFF00FF00;
+
+    return src + (rb | ag);
+}
+
+//Scales every channel of a premultiplied pixel by the packed modulation.
+static inline Uint32 soft_modulate(Uint32 pixel, Uint32 mod)
+{
+    Uint32 out = 0;
+
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        Uint32 c = ((pixel >> shift) & 0xFF) * ((mod >> shift) & 0xFF) + 128;
+        out |= (((c + (c >> 8)) >> 8) & 0xFF) << shift;
+    }
+    return out;
+}
+
+#ifdef SOFT_USE_SSE2
+static inline __m128i soft_div255_epi16(__m128i x)
+{
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+//Blends two pixels held as 16-bit lanes (b,g,r,a,b,g,r,a).
+static inline __m128i soft_blend2_epi16(__m128i src, __m128i dst)
+{
+    __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(src, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i inv = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+
+    return _mm_add_epi16(soft_div255_epi16(_mm_mullo_epi16(dst, inv)), src);
+}
+
+//Four premultiplied source pixels over four destination pixels, with an
+//optional per-channel modulation (mod16 holds b,g,r,a twice, 0..255).
+static inline __m128i soft_blend4(__m128i src, __m128i dst, __m128i mod16, bool modulate)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i s_lo = _mm_unpacklo_epi8(src, zero);
+    __m128i s_hi = _mm_unpackhi_epi8(src, zero);
+
+    if (modulate)
+    {
+        s_lo = soft_div255_epi16(_mm_mullo_epi16(s_lo, mod16));
+        s_hi = soft_div255_epi16(_mm_mullo_epi16(s_hi, mod16));
+    }
+
+    __m128i d_lo = soft_blend2_epi16(s_lo, _mm_unpacklo_epi8(dst, zero));
+    __m128i d_hi = soft_blend2_epi16(s_hi, _mm_unpackhi_epi8(dst, zero));
+
+    return _mm_packus_epi16(d_lo, d_hi);
+}
+#endif
+
+static void soft_blend_span(Uint32* dst, int count, Uint32 color)
+{
+    int i = 0;
+
+    if ((color >> 24) == 255)
+    {
+        for (; i < count; i++)
+            dst[i] = color;
+        return;
+    }
+
+    if ((color >> 24) == 0)
+        return;
+
+#ifdef SOFT_USE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    __m128i src = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)color), zero);
+    src = _mm_unpacklo_epi64(src, src);
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i lo = soft_blend2_epi16(src, _mm_unpacklo_epi8(d, zero));
+        __m128i hi = soft_blend2_epi16(src, _mm_unpackhi_epi8(d, zero));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for (; i < count; i++)
+        dst[i] = soft_blend_pixel(color, dst[i]);
+}
+
+static inline bool soft_intersect(const SDL_Rect* a, const SDL_Rect* b, SDL_Rect* out)
+{
+    int x0 = SDL_max(a->x, b->x);
+    int y0 = SDL_max(a->y, b->y);
+    int x1 = SDL_min(a->x + a->w, b->x + b->w);
+    int y1 = SDL_min(a->y + a->h, b->y + b->h);
+
+    if (x1 <= x0 || y1 <= y0)
+        return false;
+
+    *out = (SDL_Rect){x0, y0, x1 - x0, y1 - y0};
+    return true;
+}
+
+static void soft_raster_fill(SoftRenderer* soft, const SoftCommand* cmd, const SDL_Rect* area)
+{
+    for (int y = area->y; y < area->y + area->h; y++)
+    {
+        Uint32* row = soft->framebuffer + y * soft->width + area->x;
+
+        if (cmd->blend)
+            soft_blend_span(row, area->w, cmd->color);
+        else
+            for (int x = 0; x < area->w; x++)
+                row[x] = cmd->color;
+    }
+}
+
+static void soft_raster_line(SoftRenderer* soft, const SoftCommand* cmd, const SDL_Rect* area)
+{
+    int x = cmd->x1, y = cmd->y1;
+    int dx = abs(cmd->x2 - cmd->x1), sx = cmd->x1 < cmd->x2 ? 1 : -1;
+    int dy = -abs(cmd->y2 - cmd->y1), sy = cmd->y1 < cmd->y2 ? 1 : -1;
+    int err = dx + dy;
+
+    for (;;)
+    {
+        if (x >= area->x && x < area->x + area->w && y >= area->y && y < area->y + area->h)
+        {
+            Uint32* p = soft->framebuffer + y * soft->width + x;
+            *p = cmd->blend ? soft_blend_pixel(cmd->color, *p) : cmd->color;
+        }
+
+        if (x == cmd->x2 && y == cmd->y2)
+            break;
+
+        int e2 = 2 * err;
+        if (e2 >= dy) { err += dy; x += sx; }
+        if (e2 <= dx) { err += dx; y += sy; }
+    }
+}
+
+static void soft_raster_copy(SoftRenderer* soft, const SoftCommand* cmd, const SDL_Rect* area)
+{
+    bool modulate = cmd->color != 0xFFFFFFFF;
+    Uint32 step_x = (Uint32)(((Uint64)cmd->src.w << 16) / cmd->dst.w);
+    Uint32 fx0 = (Uint32)((((Uint64)(area->x - cmd->dst.x) << 1) + 1) * cmd->src.w * 65536 / (2 * (Uint64)cmd->dst.w));
+
+#ifdef SOFT_USE_SSE2
+    __m128i mod16 = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)cmd->color), _mm_setzero_si128());
+    mod16 = _mm_unpacklo_epi64(mod16, mod16);
+#endif
+
+    for (int y = area->y; y < area->y + area->h; y++)
+    {
+        int sy = cmd->src.y + (int)(((Sint64)(2 * (y - cmd->dst.y) + 1) * cmd->src.h) / (2 * cmd->dst.h));
+        const Uint32* srow = cmd->pixels + sy * cmd->pitch + cmd->src.x;
+        Uint32* drow = soft->framebuffer + y * soft->width + area->x;
+        Uint32 fx = fx0;
+        int x = 0;
+
+#ifdef SOFT_USE_SSE2
+        for (; x + 4 <= area->w; x += 4)
+        {
+            Uint32 s[4];
+            for (int k = 0; k < 4; k++, fx += step_x)
+                s[k] = srow[fx >> 16];
+
+            __m128i src = _mm_loadu_si128((const __m128i*)s);
+            __m128i dst = _mm_loadu_si128((const __m128i*)(drow + x));
+            _mm_storeu_si128((__m128i*)(drow + x), soft_blend4(src, dst, mod16, modulate));
+        }
+#endif
+
+        for (; x < area->w; x++, fx += step_x)
+        {
+            Uint32 s = srow[fx >> 16];
+            if (modulate)
+                s = soft_modulate(s, cmd->color);
+            drow[x] = soft_blend_pixel(s, drow[x]);
+        }
+    }
+}
+
+//Rotated copy: inverse-map each destination pixel back into the sprite.
+static void soft_raster_copy_ex(SoftRenderer* soft, const SoftCommand* cmd, const SDL_Rect* area)
+{
+    bool modulate = cmd->color != 0xFFFFFFFF;
+    float scale_x = (float)cmd->src.w / cmd->dst.w;
+    float scale_y = (float)cmd->src.h / cmd->dst.h;
+
+    for (int y = area->y; y < area->y + area->h; y++)
+    {
+        Uint32* drow = soft->framebuffer + y * soft->width;
+        float dy = y + 0.5f - cmd->cy;
+
+        for (int x = area->x; x < area->x + area->w; x++)
+        {
+            float dx = x + 0.5f - cmd->cx;
+            float u = cmd->cos_a * dx + cmd->sin_a * dy + cmd->cx - cmd->dst.x;
+            float v = -cmd->sin_a * dx + cmd->cos_a * dy + cmd->cy - cmd->dst.y;
+
+            if (u < 0 || v < 0 || u >= cmd->dst.w || v >= cmd->dst.h)
+                continue;
+
+            int sx = SDL_min((int)(u * scale_x), cmd->src.w - 1);
+            int sy = SDL_min((int)(v * scale_y), cmd->src.h - 1);
+            Uint32 s = cmd->pixels[(cmd->src.y + sy) * cmd->pitch + cmd->src.x + sx];
+            if (modulate)
+                s = soft_modulate(s, cmd->color);
+            drow[x] = soft_blend_pixel(s, drow[x]);
+        }
+    }
+}
+
+//One pixel wide anti-aliased ring, coverage from the distance to the radius.
+static void soft_raster_circle(SoftRenderer* soft, const SoftCommand* cmd, const SDL_Rect* area)
+{
+    for (int y = area->y; y < area->y + area->h; y++)
+    {
+        Uint32* drow = soft->framebuffer + y * soft->width;
+        float dy = y + 0.5f - cmd->cy;
+
+        for (int x = area->x; x < area->x + area->w; x++)
+        {
+            float dx = x + 0.5f - cmd->cx;
+            float coverage = 1.0f - fabsf(sqrtf(dx * dx + dy * dy) - cmd->radius);
+
+            if (coverage <= 0.0f)
+                continue;
+
+            Uint8 c = (Uint8)(coverage * 255.0f);
+            drow[x] = soft_blend_pixel(soft_modulate(cmd->color, (Uint32)c * 0x01010101u), drow[x]);
+        }
+    }
+}
+
+static void soft_raster_tile(SoftRenderer* soft, int tile)
+{
+    int tx = tile % soft->tiles_x;
+    int ty = tile / soft->tiles_x;
+    SDL_Rect clip = {tx * SOFT_TILE_SIZE, ty * SOFT_TILE_SIZE, SOFT_TILE_SIZE, SOFT_TILE_SIZE};
+
+    for (int i = soft->tile_start[tile]; i < soft->tile_start[tile + 1]; i++)
+    {
+        const SoftCommand* cmd = &soft->commands[soft->tile_items[i]];
+        SDL_Rect area;
+
+        if (!soft_intersect(&cmd->bounds, &clip, &area))
+            continue;
+
+        switch (cmd->type)
+        {
+            case SOFT_CMD_CLEAR:
+            case SOFT_CMD_FILL:
+            case SOFT_CMD_POINT:
+                soft_raster_fill(soft, cmd, &area);
+                break;
+            case SOFT_CMD_LINE:
+                soft_raster_line(soft, cmd, &area);
+                break;
+            case SOFT_CMD_COPY:
+                soft_raster_copy(soft, cmd, &area);
+                break;
+            case SOFT_CMD_COPY_EX:
+                soft_raster_copy_ex(soft, cmd, &area);
+                break;
+            case SOFT_CMD_CIRCLE:
+                soft_raster_circle(soft, cmd, &area);
+                break;
+        }
+    }
+}
+
+static void soft_run_tiles(SoftRenderer* soft)
+{
+    int tile;
+
+    while ((tile = SDL_AtomicAdd(&soft->next_tile, 1)) < soft->num_tiles)
+        soft_raster_tile(soft, tile);
+}
+
+static int soft_worker(void* data)
+{
+    SoftRenderer* soft = data;
+
+    for (;;)
+    {
+        SDL_SemWait(soft->work_start);
+        if (soft->quit)
+            break;
+
+        soft_run_tiles(soft);
+        SDL_SemPost(soft->work_done);
+    }
+    return 0;
+}
+
+//Bins the pending commands into tiles (count, prefix sum, fill) so every
+//tile only walks the commands that touch it, then rasterizes all tiles.
+void soft_flush(SoftRenderer* soft)
+{
+    if (soft->num_commands == 0)
+        return;
+
+    memset(soft->tile_start, 0, sizeof(int) * (soft->num_tiles + 1));
+
+    for (int i = 0; i < soft->num_commands; i++)
+    {
+        const SDL_Rect* b = &soft->commands[i].bounds;
+        for (int ty = b->y / SOFT_TILE_SIZE; ty <= (b->y + b->h - 1) / SOFT_TILE_SIZE; ty++)
+            for (int tx = b->x / SOFT_TILE_SIZE; tx <= (b->x + b->w - 1) / SOFT_TILE_SIZE; tx++)
+                soft->tile_start[ty * soft->tiles_x + tx + 1]++;
+    }
+
+    for (int t = 0; t < soft->num_tiles; t++)
+    {
+        soft->tile_start[t + 1] += soft->tile_start[t];
+        soft->tile_cursor[t] = soft->tile_start[t];
+    }
+
+    int total = soft->tile_start[soft->num_tiles];
+    //Doubles, so a frame slightly busier than any before doesn't allocate
+    //again; soft_create() reserves enough for ordinary frames.
+    if (total > soft->tile_items_cap)
+    {
+        int cap = SDL_max(total, 2 * soft->tile_items_cap);
+        int* items = mem_realloc(MEM_RENDERER, soft->tile_items, sizeof(int) * cap);
+        if (items == NULL)
+        {
+            LOG("Out of memory binning software renderer tiles\n");
+            soft->num_commands = 0;
+            return;
+        }
+        soft->tile_items = items;
+        soft->tile_items_cap = cap;
+    }
+
+    for (int i = 0; i < soft->num_commands; i++)
+    {
+        const SDL_Rect* b = &soft->commands[i].bounds;
+        for (int ty = b->y / SOFT_TILE_SIZE; ty <= (b->y + b->h - 1) / SOFT_TILE_SIZE; ty++)
+            for (int tx = b->x / SOFT_TILE_SIZE; tx <= (b->x + b->w - 1) / SOFT_TILE_SIZE; tx++)
+                soft->tile_items[soft->tile_cursor[ty * soft->tiles_x + tx]++] = i;
+    }
+
+    SDL_AtomicSet(&soft->next_tile, 0);
+    for (int i = 0; i < soft->num_threads; i++)
+        SDL_SemPost(soft->work_start);
+
+    soft_run_tiles(soft);
+
+    for (int i = 0; i < soft->num_threads; i++)
+        SDL_SemWait(soft->work_done);
+
+    soft->num_commands = 0;
+}
+
+//Returns a new command with its bounds clipped to the view, or NULL if it
+//is entirely off screen.
+static SoftCommand* soft_push(SoftRenderer* soft, SoftCommandType type, SDL_Rect bounds)
+{
+    SDL_Rect screen = {0, 0, soft->view_w, soft->view_h};
+    SDL_Rect clipped;
+
+    if (!soft_intersect(&bounds, &screen, &clipped))
+        return NULL;
+
+    //Commands are rasterized strictly in order, so a full list can simply be
+    //drawn early and the frame carries on.
+    if (soft->num_commands == SOFT_MAX_COMMANDS)
+        soft_flush(soft);
+
+    SoftCommand* cmd = &soft->commands[soft->num_commands++];
+    cmd->type = type;
+    cmd->bounds = clipped;
+    cmd->blend = soft->draw_blend != SDL_BLENDMODE_NONE;
+
+    //Without blending SDL writes the draw colour as-is, so only premultiply when blending.
+    SDL_Color c = soft->draw_color;
+    if (cmd->blend)
+        cmd->color = soft_premultiply(c.r, c.g, c.b, c.a);
+    else
+        cmd->color = ((Uint32)c.a << 24) | ((Uint32)c.r << 16) | ((Uint32)c.g << 8) | c.b;
+    return cmd;
+}
+
+//Game coordinates to view coordinates. Rects grow outwards so nothing
+//thinner than a pixel disappears.
+static SDL_Rect soft_scale_rect(const SoftRenderer* soft, SDL_Rect r)
+{
+    if (soft->scale == 1.0f || r.w <= 0 || r.h <= 0)
+        return r;
+
+    int x0 = (int)floorf(r.x * soft->scale), y0 = (int)floorf(r.y * soft->scale);
+    int x1 = (int)ceilf((r.x + r.w) * soft->scale), y1 = (int)ceilf((r.y + r.h) * soft->scale);
+    return (SDL_Rect){x0, y0, x1 - x0, y1 - y0};
+}
+
+static inline int soft_scale(const SoftRenderer* soft, int value)
+{
+    return soft->scale == 1.0f ? value : (int)floorf(value * soft->scale + 0.5f);
+}
+
+static SoftSprite* soft_find_sprite(SoftRenderer* soft, SDL_Texture* texture, bool insert)
+{
+    if (texture == NULL)
+        return NULL;
+
+    Uint32 slot = (Uint32)(((uintptr_t)texture >> 4) * 2654435761u) & (SOFT_TEXTURE_SLOTS - 1);
+
+    for (int probe = 0; probe < SOFT_TEXTURE_SLOTS; probe++)
+    {
+        SoftSprite* sprite = &soft->sprites[(slot + probe) & (SOFT_TEXTURE_SLOTS - 1)];
+
+        if (sprite->texture == texture)
+            return sprite;
+        if (sprite->texture == NULL)
+            return insert ? sprite : NULL;
+    }
+    return NULL;
+}
+
+SoftRenderer* soft_create(SDL_Renderer* renderer, int width, int height)
+{
+    SoftRenderer* soft = mem_calloc(MEM_RENDERER, 1, sizeof(SoftRenderer));
+    if (soft == NULL)
+        return NULL;
+
+    soft->renderer = renderer;
+    soft->width = width;
+    soft->height = height;
+    soft->scale = 1.0f;
+    soft->view_w = width;
+    soft->view_h = height;
+    soft->draw_color = (SDL_Color){0, 0, 0, 255};
+    soft->draw_blend = SDL_BLENDMODE_NONE;
+    soft->tiles_x = (width + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    soft->tiles_y = (height + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    soft->num_tiles = soft->tiles_x * soft->tiles_y;
+
+    soft->framebuffer = mem_calloc(MEM_RENDERER, (size_t)width * height, sizeof(Uint32));
+    soft->commands = mem_alloc(MEM_RENDERER, sizeof(SoftCommand) * SOFT_MAX_COMMANDS);
+    soft->tile_start = mem_calloc(MEM_RENDERER, soft->num_tiles + 1, sizeof(int));
+    soft->tile_cursor = mem_calloc(MEM_RENDERER, soft->num_tiles, sizeof(int));
+    soft->tile_items_cap = SOFT_TILE_ITEMS;
+    soft->tile_items = mem_alloc(MEM_RENDERER, sizeof(int) * soft->tile_items_cap);
+    soft->target = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+
+    if (!soft->framebuffer || !soft->commands || !soft->tile_start || !soft->tile_cursor || !soft->tile_items || !soft->target)
+    {
+        SDL_Log("Unable to create software renderer! SDL_Error: %s\n", SDL_GetError());
+        soft_destroy(soft);
+        return NULL;
+    }
+    SDL_SetTextureBlendMode(soft->target, SDL_BLENDMODE_NONE);
+    SDL_SetTextureScaleMode(soft->target, SDL_ScaleModeLinear);
+
+    //The main thread rasterizes too, so only spawn helpers for the other cores.
+    soft->work_start = SDL_CreateSemaphore(0);
+    soft->work_done = SDL_CreateSemaphore(0);
+    int helpers = SDL_min(SDL_GetCPUCount() - 1, SOFT_MAX_THREADS);
+
+    for (int i = 0; i < helpers && soft->work_start && soft->work_done; i++)
+    {
+        soft->threads[i] = SDL_CreateThread(soft_worker, "soft_raster", soft);
+        if (soft->threads[i] == NULL)
+            break;
+        soft->num_threads++;
+    }
+
+    SDL_Log("Software renderer: %dx%d, %d tiles, %d threads\n", width, height, soft->num_tiles, soft->num_threads + 1);
+    return soft;
+}
+
+void soft_destroy(SoftRenderer* soft)
+{
+    if (soft == NULL)
+        return;
+
+    soft->quit = true;
+    for (int i = 0; i < soft->num_threads; i++)
+        SDL_SemPost(soft->work_start);
+    for (int i = 0; i < soft->num_threads; i++)
+        SDL_WaitThread(soft->threads[i], NULL);
+
+    for (int i = 0; i < SOFT_TEXTURE_SLOTS; i++)
+        mem_free(soft->sprites[i].pixels);
+
+    if (soft->work_start)
+        SDL_DestroySemaphore(soft->work_start);
+    if (soft->work_done)
+        SDL_DestroySemaphore(soft->work_done);
+    if (soft->target)
+        SDL_DestroyTexture(soft->target);
+
+    mem_free(soft->framebuffer);
+    mem_free(soft->commands);
+    mem_free(soft->tile_start);
+    mem_free(soft->tile_cursor);
+    mem_free(soft->tile_items);
+    mem_free(soft);
+}
+
+//Converts a surface to premultiplied ARGB8888. Returns false on failure.
+static bool soft_convert_surface(SDL_Surface* surface, Uint32* out)
+{
+    SDL_Surface* argb = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
+    if (argb == NULL)
+        return false;
+
+    for (int y = 0; y < argb->h; y++)
+    {
+        const Uint32* row = (const Uint32*)((const Uint8*)argb->pixels + y * argb->pitch);
+        for (int x = 0; x < argb->w; x++)
+        {
+            Uint32 p = row[x];
+            out[y * argb->w + x] = soft_premultiply((p >> 16) & 0xFF, (p >> 8) & 0xFF, p & 0xFF, p >> 24);
+        }
+    }
+
+    SDL_FreeSurface(argb);
+    return true;
+}
+
+void soft_register_texture(SoftRenderer* soft, SDL_Texture* texture, SDL_Surface* surface)
+{
+    SoftSprite* sprite = soft_find_sprite(soft, texture, true);
+    if (sprite == NULL)
+    {
+        LOG("Software renderer texture table is full\n");
+        return;
+    }
+
+    Uint32* pixels = mem_alloc(MEM_RENDERER, sizeof(Uint32) * surface->w * surface->h);
+    if (pixels == NULL || !soft_convert_surface(surface, pixels))
+    {
+        mem_free(pixels);
+        return;
+    }
+
+    mem_free(sprite->pixels);
+    sprite->texture = texture;
+    sprite->pixels = pixels;
+    sprite->w = surface->w;
+    sprite->h = surface->h;
+    sprite->mod_r = sprite->mod_g = sprite->mod_b = sprite->mod_a = 255;
+}
+
+void soft_unregister_texture(SoftRenderer* soft, SDL_Texture* texture)
+{
+    SoftSprite* sprite = soft_find_sprite(soft, texture, false);
+    if (sprite == NULL)
+        return;
+
+    //Textures can die mid-frame, so draw anything that might reference it.
+    soft_flush(soft);
+    mem_free(sprite->pixels);
+
+    //Re-insert the rest of the probe chain so lookups past this slot still work.
+    int slot = (int)(sprite - soft->sprites);
+    sprite->texture = NULL;
+    sprite->pixels = NULL;
+
+    for (int i = (slot + 1) & (SOFT_TEXTURE_SLOTS - 1); soft->sprites[i].texture; i = (i + 1) & (SOFT_TEXTURE_SLOTS - 1))
+    {
+        SoftSprite moved = soft->sprites[i];
+        soft->sprites[i] = (SoftSprite){0};
+        *soft_find_sprite(soft, moved.texture, true) = moved;
+    }
+}
+
+void soft_update_texture(SoftRenderer* soft, SDL_Texture* texture, const SDL_Rect* rect, const Uint32* pixels, int pitch)
+{
+    SoftSprite* sprite = soft_find_sprite(soft, texture, false);
+    if (sprite == NULL)
+        return;
+
+    SDL_Rect full = {0, 0, sprite->w, sprite->h};
+    SDL_Rect area = full;
+    if (rect == NULL)
+        rect = &full;
+    else if (!soft_intersect(rect, &full, &area))
+        return;
+
+    pixels += (area.y - rect->y) * (pitch / 4) + (area.x - rect->x);
+
+    //Queued copies read the sprite when they are rasterized, not when queued.
+    soft_flush(soft);
+
+    for (int y = 0; y < area.h; y++)
+    {
+        const Uint32* src = (const Uint32*)((const Uint8*)pixels + y * pitch);
+        Uint32* dst = sprite->pixels + (area.y + y) * sprite->w + area.x;
+
+        for (int x = 0; x < area.w; x++)
+            dst[x] = soft_premultiply((src[x] >> 16) & 0xFF, (src[x] >> 8) & 0xFF, src[x] & 0xFF, src[x] >> 24);
+    }
+}
+
+void soft_set_texture_mod(SoftRenderer* soft, SDL_Texture* texture, Uint8 r, Uint8 g, Uint8 b, Uint8 a)
+{
+    SoftSprite* sprite = soft_find_sprite(soft, texture, false);
+    if (sprite == NULL)
+        return;
+
+    sprite->mod_r = r;
+    sprite->mod_g = g;
+    sprite->mod_b = b;
+    sprite->mod_a = a;
+}
+
+void soft_set_draw_color(SoftRenderer* soft, Uint8 r, Uint8 g, Uint8 b, Uint8 a)
+{
+    soft->draw_color = (SDL_Color){r, g, b, a};
+}
+
+void soft_set_draw_blend_mode(SoftRenderer* soft, SDL_BlendMode mode)
+{
+    soft->draw_blend = mode;
+}
+
+//Draws the frame smaller by scale (0..1] and stretches it over the window
+//at present, so the rasterizers only fill scale squared of the pixels.
+//Takes effect for everything drawn after it, so call it between frames.
+void soft_set_scale(SoftRenderer* soft, float scale)
+{
+    soft->scale = SDL_max(0.25f, SDL_min(scale, 1.0f));
+    soft->view_w = SDL_max(1, (int)(soft->width * soft->scale + 0.5f));
+    soft->view_h = SDL_max(1, (int)(soft->height * soft->scale + 0.5f));
+}
+
+void soft_clear(SoftRenderer* soft)
+{
+    //A clear hides everything queued before it.
+    soft->num_commands = 0;
+
+    SoftCommand* cmd = soft_push(soft, SOFT_CMD_CLEAR, (SDL_Rect){0, 0, soft->width, soft->height});
+    if (cmd)
+        cmd->blend = false;
+}
+
+void soft_fill_rect(SoftRenderer* soft, const SDL_Rect* rect)
+{
+    SDL_Rect bounds = rect ? soft_scale_rect(soft, *rect) : (SDL_Rect){0, 0, soft->view_w, soft->view_h};
+    soft_push(soft, SOFT_CMD_FILL, bounds);
+}
+
+void soft_draw_point(SoftRenderer* soft, int x, int y)
+{
+    soft_push(soft, SOFT_CMD_POINT, soft_scale_rect(soft, (SDL_Rect){x, y, 1, 1}));
+}
+
+void soft_draw_line(SoftRenderer* soft, int x1, int y1, int x2, int y2)
+{
+    x1 = soft_scale(soft, x1);
+    y1 = soft_scale(soft, y1);
+    x2 = soft_scale(soft, x2);
+    y2 = soft_scale(soft, y2);
+
+    //Axis aligned lines are just thin rects and take the span path.
+    if (x1 == x2 || y1 == y2)
+    {
+        SDL_Rect r = {SDL_min(x1, x2), SDL_min(y1, y2), abs(x2 - x1) + 1, abs(y2 - y1) + 1};
+        soft_push(soft, SOFT_CMD_FILL, r);
+        return;
+    }
+
+    SDL_Rect bounds = {SDL_min(x1, x2), SDL_min(y1, y2), abs(x2 - x1) + 1, abs(y2 - y1) + 1};
+    SoftCommand* cmd = soft_push(soft, SOFT_CMD_LINE, bounds);
+    if (cmd)
+    {
+        cmd->x1 = x1;
+        cmd->y1 = y1;
+        cmd->x2 = x2;
+        cmd->y2 = y2;
+    }
+}
+
+void soft_draw_circle(SoftRenderer* soft, int x, int y, int radius, Uint8 r, Uint8 g, Uint8 b, Uint8 a)
+{
+    x = soft_scale(soft, x);
+    y = soft_scale(soft, y);
+    radius = SDL_max(1, soft_scale(soft, radius));
+
+    SDL_Rect bounds = {x - radius - 1, y - radius - 1, 2 * radius + 3, 2 * radius + 3};
+    SoftCommand* cmd = soft_push(soft, SOFT_CMD_CIRCLE, bounds);
+    if (cmd)
+    {
+        cmd->color = soft_premultiply(r, g, b, a);
+        cmd->cx = x + 0.5f;
+        cmd->cy = y + 0.5f;
+        cmd->radius = (float)radius;
+    }
+}
+
+void soft_copy(SoftRenderer* soft, SDL_Texture* texture, const SDL_Rect* src, const SDL_Rect* dst, double angle, const SDL_Point* center)
+{
+    SoftSprite* sprite = soft_find_sprite(soft, texture, false);
+    if (sprite == NULL || sprite->pixels == NULL)
+        return;
+
+    SDL_Rect s = src ? *src : (SDL_Rect){0, 0, sprite->w, sprite->h};
+    SDL_Rect d = dst ? soft_scale_rect(soft, *dst) : (SDL_Rect){0, 0, soft->view_w, soft->view_h};
+    SDL_Rect sprite_rect = {0, 0, sprite->w, sprite->h};
+
+    if (!soft_intersect(&s, &sprite_rect, &s) || d.w <= 0 || d.h <= 0)
+        return;
+
+    SoftCommand* cmd;
+    if (angle == 0.0)
+    {
+        cmd = soft_push(soft, SOFT_CMD_COPY, d);
+    }
+    else
+    {
+        float cx = d.x + (center ? center->x * soft->scale : d.w / 2.0f);
+        float cy = d.y + (center ? center->y * soft->scale : d.h / 2.0f);
+        float rad = (float)(angle * M_PI / 180.0);
+        float sin_a = sinf(rad), cos_a = cosf(rad);
+        float min_x = 1e9f, min_y = 1e9f, max_x = -1e9f, max_y = -1e9f;
+
+        for (int i = 0; i < 4; i++)
+        {
+            float px = (i & 1 ? d.x + d.w : d.x) - cx;
+            float py = (i & 2 ? d.y + d.h : d.y) - cy;
+            float rx = cos_a * px - sin_a * py + cx;
+            float ry = sin_a * px + cos_a * py + cy;
+            min_x = fminf(min_x, rx);
+            max_x = fmaxf(max_x, rx);
+            min_y = fminf(min_y, ry);
+            max_y = fmaxf(max_y, ry);
+        }
+
+        cmd = soft_push(soft, SOFT_CMD_COPY_EX, (SDL_Rect){(int)floorf(min_x), (int)floorf(min_y),
+                        (int)ceilf(max_x) - (int)floorf(min_x) + 1, (int)ceilf(max_y) - (int)floorf(min_y) + 1});
+        if (cmd)
+        {
+            cmd->sin_a = sin_a;
+            cmd->cos_a = cos_a;
+            cmd->cx = cx;
+            cmd->cy = cy;
+        }
+    }
+
+    if (cmd == NULL)
+        return;
+
+    //Modulation in premultiplied space: the colour channels also take the alpha mod.
+    cmd->color = ((Uint32)sprite->mod_a << 24) |
+                 ((Uint32)(sprite->mod_r * sprite->mod_a / 255) << 16) |
+                 ((Uint32)(sprite->mod_g * sprite->mod_a / 255) << 8) |
+                  (Uint32)(sprite->mod_b * sprite->mod_a / 255);
+    cmd->blend = true;
+    cmd->pixels = sprite->pixels;
+    cmd->pitch = sprite->w;
+    cmd->src = s;
+    cmd->dst = d;
+}
+
+//Batched sprites from draw_quads(): each quad becomes a plain copy of the
+//texture rect its corners map to, modulated by its first vertex's colour.
+void soft_draw_quads(SoftRenderer* soft, SDL_Texture* texture, const SDL_Vertex* vertices, int num_quads)
+{
+    SoftSprite* sprite = soft_find_sprite(soft, texture, false);
+    SDL_Rect sprite_rect;
+
+    if (sprite == NULL || sprite->pixels == NULL)
+        return;
+    sprite_rect = (SDL_Rect){0, 0, sprite->w, sprite->h};
+
+    for (int q = 0; q < num_quads; q++)
+    {
+        const SDL_Vertex* v = &vertices[q * 4];
+        SDL_Rect s = {(int)(v[0].tex_coord.x * sprite->w + 0.5f), (int)(v[0].tex_coord.y * sprite->h + 0.5f),
+                      (int)((v[2].tex_coord.x - v[0].tex_coord.x) * sprite->w + 0.5f),
+                      (int)((v[2].tex_coord.y - v[0].tex_coord.y) * sprite->h + 0.5f)};
+        SDL_Rect d = soft_scale_rect(soft, (SDL_Rect){(int)floorf(v[0].position.x), (int)floorf(v[0].position.y),
+                                     (int)(v[2].position.x - v[0].position.x + 0.5f),
+                                     (int)(v[2].position.y - v[0].position.y + 0.5f)});
+        SDL_Color c = v[0].color;
+
+        if (!soft_intersect(&s, &sprite_rect, &s) || d.w <= 0 || d.h <= 0)
+            continue;
+
+        SoftCommand* cmd = soft_push(soft, SOFT_CMD_COPY, d);
+        if (cmd == NULL)
+            continue;
+
+        cmd->color = soft_premultiply(c.r, c.g, c.b, c.a);
+        cmd->blend = true;
+        cmd->pixels = sprite->pixels;
+        cmd->pitch = sprite->w;
+        cmd->src = s;
+        cmd->dst = d;
+    }
+}
+
+//The last presented frame, width * height ARGB8888. Only the top left
+//view is drawn while the scale is below 1.
+const Uint32* soft_get_framebuffer(SoftRenderer* soft)
+{
+    return soft->framebuffer;
+}
+
+//Rasterizes everything queued for the frame, then one upload and one copy
+//that stretches the view over the window.
+void soft_present(SoftRenderer* soft)
+{
+    SDL_Rect view = {0, 0, soft->view_w, soft->view_h};
+
+    soft_flush(soft);
+
+    SDL_UpdateTexture(soft->target, &view, soft->framebuffer, soft->width * (int)sizeof(Uint32));
+    SDL_RenderCopy(soft->renderer, soft->target, &view, NULL);
+    SDL_RenderPresent(soft->renderer);
+}
@@ -0,0 +1,309 @@
+#include "main.h"
+#include "space.h"
+
+//The embedding API from space.h. An env is a headless Game like the batch
+//runner's, stepped with fixed ticks. Observations are packed from the sim
+//arrays into the caller's buffers once per call, after the last tick, so
+//the cost of a step is the sim itself.
+
+_Static_assert(SPACE_MAX_PLAYERS == MAX_PLAYERS && SPACE_MAX_ENEMIES == MAX_ENEMIES &&
+               SPACE_MAX_PROJECTILES == MAX_PROJECTILES && SPACE_MAX_PLANETS == MAX_PLANETS &&
+               SPACE_MAX_POWERUPS == MAX_POWERUPS && SPACE_WEAPONS == MAX_WEAPONS, "space.h capacities are out of date");
+_Static_assert(SPACE_LEFT == ACT_LEFT && SPACE_RIGHT == ACT_RIGHT && SPACE_FIRE == ACT_FIRE &&
+               SPACE_AFTERBURNER == ACT_AFTERBURNER && SPACE_PREV_WEAPON == ACT_PREV_WEAPON &&
+               SPACE_NEXT_WEAPON == ACT_NEXT_WEAPON, "space.h actions are out of date");
+
+#define SPACE_ACTIONS (ACT_LEFT | ACT_RIGHT | ACT_FIRE | ACT_AFTERBURNER | ACT_PREV_WEAPON | ACT_NEXT_WEAPON)
+
+struct SpaceEnv
+{
+    Game* game;
+    SpaceConfig config;
+    SpaceObs* obs;
+    Uint8* frame;
+};
+
+//Fills rect (game pixels) in the downscaled frame.
+static void frame_fill(const SpaceEnv* env, const SDL_Rect* rect, Uint8 kind)
+{
+    int fw = env->config.frame_width, fh = env->config.frame_height;
+    int x0 = SDL_max(0, rect->x * fw / SCREEN_WIDTH);
+    int y0 = SDL_max(0, rect->y * fh / SCREEN_HEIGHT);
+    int x1 = SDL_min(fw - 1, (rect->x + rect->w - 1) * fw / SCREEN_WIDTH);
+    int y1 = SDL_min(fh - 1, (rect->y + rect->h - 1) * fh / SCREEN_HEIGHT);
+
+    for (int y = y0; y <= y1; y++)
+        if (x1 >= x0)
+            memset(env->frame + y * fw + x0, kind, x1 - x0 + 1);
+}
+
+//Planets go through their mask, so craters show.
+static void frame_planet(const SpaceEnv* env, const Planet* planet)
+{
+    const SDL_Rect* pos = &planet->position;
+    int fw = env->config.frame_width, fh = env->config.frame_height;
+    int x0 = SDL_max(0, pos->x * fw / SCREEN_WIDTH);
+    int y0 = SDL_max(0, pos->y * fh / SCREEN_HEIGHT);
+    int x1 = SDL_min(fw - 1, (pos->x + pos->w - 1) * fw / SCREEN_WIDTH);
+    int y1 = SDL_min(fh - 1, (pos->y + pos->h - 1) * fh / SCREEN_HEIGHT);
+
+    for (int y = y0; y <= y1; y++)
+    {
+        //Frame pixel centre back onto the mask.
+        int gy = (int)(((y + 0.5f) * SCREEN_HEIGHT / fh - pos->y) * PLANET_MASK_SIZE / pos->h);
+        if (gy < 0 || gy >= PLANET_MASK_SIZE)
+            continue;
+
+        for (int x = x0; x <= x1; x++)
+        {
+            int gx = (int)(((x + 0.5f) * SCREEN_WIDTH / fw - pos->x) * PLANET_MASK_SIZE / pos->w);
+            if (gx >= 0 && gx < PLANET_MASK_SIZE && ((planet->mask[gy] >> gx) & 1))
+                env->frame[y * fw + x] = SPACE_PIXEL_PLANET;
+        }
+    }
+}
+
+static void write_frame(const SpaceEnv* env)
+{
+    const SimState* sim = &env->game->sim;
+
+    memset(env->frame, SPACE_PIXEL_EMPTY, (size_t)env->config.frame_width * env->config.frame_height);
+
+    for (int i = 0; i < MAX_PLANETS; i++)
+        if (sim->planets[i].active && sim->planets[i].position.w > 0 && sim->planets[i].position.h > 0)
+            frame_planet(env, &sim->planets[i]);
+    for (int i = 0; i < MAX_POWERUPS; i++)
+        if (sim->powerups[i].active)
+            frame_fill(env, &sim->powerups[i].position, SPACE_PIXEL_POWERUP);
+    for (int i = 0; i < MAX_ENEMIES; i++)
+        if (sim->enemies[i].active)
+            frame_fill(env, &sim->enemies[i].position, SPACE_PIXEL_ENEMY);
+    for (int i = 0; i < sim->num_players; i++)
+        frame_fill(env, &sim->players[i].position, SPACE_PIXEL_PLAYER);
+    for (int t = 0; t < MAX_WEAPONS; t++)
+        for (int i = 0; i < sim->projectiles[t].count; i++)
+            if (sim->projectiles[t].items[i].active)
+                frame_fill(env, &sim->projectiles[t].items[i].dest_rect,
+                           sim->projectiles[t].items[i].is_enemy_projectile ? SPACE_PIXEL_ENEMY_SHOT : SPACE_PIXEL_PLAYER_SHOT);
+}
+
+static bool space_done(const SpaceEnv* env)
+{
+    const SimState* sim = &env->game->sim;
+
+    if (env->config.max_ticks > 0 && sim->tick >= (Uint32)env->config.max_ticks)
+        return true;
+
+    for (int i = 0; i < sim->num_players; i++)
+        if (sim->players[i].hit_points > 0)
+            return false;
+    return true;
+}
+
+static void write_obs(const SpaceEnv* env)
+{
+    const SimState* sim = &env->game->sim;
+    SpaceObs* obs = env->obs;
+    int n;
+
+    obs->tick = sim->tick;
+    obs->done = space_done(env);
+
+    obs->num_players = sim->num_players;
+    for (int i = 0; i < sim->num_players; i++)
+    {
+        const Player* player = &sim->players[i];
+
+        obs->players[i].x = (float)player->position.x;
+        obs->players[i].y = (float)player->position.y;
+        obs->players[i].w = (float)player->position.w;
+        obs->players[i].h = (float)player->position.h;
+        obs->players[i].hit_points = player->hit_points;
+        obs->players[i].max_hp = player->max_hp;
+        obs->players[i].score = player->score;
+        obs->players[i].weapon = player->current_weapon;
+        for (int w = 0; w < MAX_WEAPONS; w++)
+            obs->players[i].ammo[w] = player->weapons[w].ammo;
+        obs->players[i].afterburner = player->afterburner;
+    }
+
+    n = 0;
+    for (int i = 0; i < MAX_ENEMIES; i++)
+    {
+        const Enemy* enemy = &sim->enemies[i];
+        if (!enemy->active)
+            continue;
+
+        obs->enemies[n].x = (float)enemy->position.x;
+        obs->enemies[n].y = (float)enemy->position.y;
+        obs->enemies[n].w = (float)enemy->position.w;
+        obs->enemies[n].h = (float)enemy->position.h;
+        obs->enemies[n].vx = enemy->velocity_x;
+        obs->enemies[n].vy = enemy->velocity_y;
+        obs->enemies[n].hit_points = enemy->hit_points;
+        n++;
+    }
+    obs->num_enemies = n;
+
+    //Projectiles move a fixed amount per tick, see projectile_spawn().
+    n = 0;
+    for (int t = 0; t < MAX_WEAPONS; t++)
+    {
+        for (int i = 0; i < sim->projectiles[t].count; i++)
+        {
+            const Projectile* proj = &sim->projectiles[t].items[i];
+            if (!proj->active)
+                continue;
+
+            obs->projectiles[n].x = proj->x;
+            obs->projectiles[n].y = proj->y;
+            obs->projectiles[n].vx = proj->vx * FPS;
+            obs->projectiles[n].vy = proj->vy * FPS;
+            obs->projectiles[n].weapon = t;
+            obs->projectiles[n].hostile = proj->is_enemy_projectile;
+            n++;
+        }
+    }
+    obs->num_projectiles = n;
+
+    n = 0;
+    for (int i = 0; i < MAX_PLANETS; i++)
+    {
+        const Planet* planet = &sim->planets[i];
+        if (!planet->active)
+            continue;
+
+        obs->planets[n].x = (float)planet->position.x;
+        obs->planets[n].y = (float)planet->position.y;
+        obs->planets[n].w = (float)planet->position.w;
+        obs->planets[n].h = (float)planet->position.h;
+        obs->planets[n].vy = planet->speed;
+        n++;
+    }
+    obs->num_planets = n;
+
+    n = 0;
+    for (int i = 0; i < MAX_POWERUPS; i++)
+    {
+        const PowerUp* powerup = &sim->powerups[i];
+        if (!powerup->active)
+            continue;
+
+        obs->powerups[n].x = (float)powerup->position.x;
+        obs->powerups[n].y = (float)powerup->position.y;
+        obs->powerups[n].type = powerup->type;
+        n++;
+    }
+    obs->num_powerups = n;
+}
+
+static void space_observe(const SpaceEnv* env)
+{
+    if (env->obs)
+        write_obs(env);
+    if (env->frame)
+        write_frame(env);
+}
+
+SpaceEnv* space_create(const SpaceConfig* config)
+{
+    SpaceEnv* env;
+    Game* game;
+
+    if (config == NULL || config->num_players < 0 || config->num_players > MAX_PLAYERS ||
+        config->frame_width < 0 || config->frame_height < 0 || (config->frame_width == 0) != (config->frame_height == 0))
+        return NULL;
+
+    env = mem_calloc(MEM_GAME, 1, sizeof(SpaceEnv));
+    game = env ? mem_calloc(MEM_GAME, 1, sizeof(Game)) : NULL;
+    if (game == NULL)
+    {
+        mem_free(env);
+        return NULL;
+    }
+
+    env->game = game;
+    env->config = *config;
+    if (env->config.num_players == 0)
+        env->config.num_players = 1;
+
+    //Quiet unless something goes wrong: the env's LOG() output is dropped.
+    game->headless = true;
+    game->opts.seed = 1;
+    for (int i = 0; i < MAX_PLANETS; i++)
+        game->planet_textures[i] = -1;
+    log_set_context(&game->log);
+
+    //Solid boxes when the images aren't there.
+    if (!hitbox_load(game))
+    {
+        for (int i = 0; i < HITBOX_ROLL_STEPS; i++)
+            hitbox_build(&game->player_hitboxes[i], NULL, NULL, PLAYER_WIDTH, PLAYER_HEIGHT, 0);
+        hitbox_build(&game->enemy_hitbox, NULL, NULL, ENEMY_SIZE, ENEMY_SIZE, 0);
+    }
+
+    game->events = events_open();
+    game->patterns = patterns_load();
+    if (config->level_file)
+        game->level = level_open(config->level_file);
+    log_set_context(NULL);
+
+    if (game->events == NULL || game->patterns == NULL || (config->level_file && game->level == NULL))
+    {
+        space_destroy(env);
+        return NULL;
+    }
+
+    spatial_init(&game->enemy_index);
+    reset_sim(game, 1, env->config.num_players);
+    return env;
+}
+
+void space_destroy(SpaceEnv* env)
+{
+    if (env == NULL)
+        return;
+
+    log_set_context(&env->game->log);
+    events_close(env->game->events);
+    patterns_close(env->game->patterns);
+    level_close(env->game->level);
+    log_set_context(NULL);
+
+    mem_free(env->game);
+    mem_free(env);
+}
+
+void space_bind(SpaceEnv* env, SpaceObs* obs, uint8_t* frame)
+{
+    env->obs = obs;
+    env->frame = env->config.frame_width > 0 ? frame : NULL;
+}
+
+void space_reset(SpaceEnv* env, uint32_t seed)
+{
+    reset_sim(env->game, seed, env->config.num_players);
+    space_observe(env);
+}
+
+int space_step(SpaceEnv* env, const uint16_t* actions, int n_ticks)
+{
+    Game* game = env->game;
+    TickInput inputs[MAX_PLAYERS];
+    int ticks = 0;
+
+    memset(inputs, 0, sizeof(inputs));
+    for (int i = 0; i < env->config.num_players; i++)
+        inputs[i].held = actions ? (actions[i] & SPACE_ACTIONS) : 0;
+
+    log_set_context(&game->log);
+    while (ticks < n_ticks && !space_done(env))
+    {
+        sim_step(game, inputs, 0);
+        ticks++;
+    }
+    log_set_context(NULL);
+
+    space_observe(env);
+    return ticks;
+}
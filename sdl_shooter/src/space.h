@@ -0,0 +1,133 @@
+#ifndef SPACE_H
+#define SPACE_H
+
+//Embedding API (space.c, built as libspace by "make lib"). Runs the game's
+//simulation headless for tuning and bot training: no window, renderer,
+//textures or audio, and nothing is allocated after space_create().
+//
+//Observations are written straight into buffers the caller binds with
+//space_bind(), e.g. a region of shared memory another process reads, after
+//every space_reset() and space_step(). Assets (bullet patterns, the images
+//hitboxes are built from) are read relative to the working directory like
+//the game does; missing ones fall back to built in defaults.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//Actions, one bit each, same as the game's input.
+#define SPACE_LEFT              (1 << 0)
+#define SPACE_RIGHT             (1 << 1)
+#define SPACE_FIRE              (1 << 2)
+#define SPACE_AFTERBURNER       (1 << 3)
+#define SPACE_PREV_WEAPON       (1 << 4)
+#define SPACE_NEXT_WEAPON       (1 << 5)
+
+//Capacities of the observation arrays, same as the sim's.
+#define SPACE_MAX_PLAYERS       2
+#define SPACE_MAX_ENEMIES       10
+#define SPACE_MAX_PROJECTILES   320
+#define SPACE_MAX_PLANETS       24
+#define SPACE_MAX_POWERUPS      10
+#define SPACE_WEAPONS           5
+
+//What the downscaled frame holds per pixel: the kind of the topmost thing
+//covering it, drawn in this order.
+enum
+{
+    SPACE_PIXEL_EMPTY,
+    SPACE_PIXEL_PLANET,
+    SPACE_PIXEL_POWERUP,
+    SPACE_PIXEL_ENEMY,
+    SPACE_PIXEL_PLAYER,
+    SPACE_PIXEL_PLAYER_SHOT,
+    SPACE_PIXEL_ENEMY_SHOT
+};
+
+typedef struct SpaceEnv SpaceEnv;
+
+typedef struct
+{
+    int num_players;            //1 or 2, 0 means 1
+    int max_ticks;              //Episode length, 0 for no limit
+    int frame_width;            //Downscaled frame size, 0 for none
+    int frame_height;
+    const char* level_file;     //Scripted spawns, NULL for random ones
+} SpaceConfig;
+
+//Positions are in game pixels (800 x 600, y grows downwards), velocities in
+//pixels per second. Only live entities are listed, packed from index 0.
+typedef struct
+{
+    uint32_t tick;
+    int32_t done;               //Every player is dead or max_ticks was reached
+
+    int32_t num_players;
+    struct
+    {
+        float x, y, w, h;
+        int32_t hit_points;
+        int32_t max_hp;
+        int32_t score;
+        int32_t weapon;
+        int32_t ammo[SPACE_WEAPONS];
+        float afterburner;      //0..100
+    } players[SPACE_MAX_PLAYERS];
+
+    int32_t num_enemies;
+    struct
+    {
+        float x, y, w, h;
+        float vx, vy;
+        int32_t hit_points;
+    } enemies[SPACE_MAX_ENEMIES];
+
+    int32_t num_projectiles;
+    struct
+    {
+        float x, y;
+        float vx, vy;
+        int32_t weapon;
+        int32_t hostile;        //Fired by an enemy
+    } projectiles[SPACE_MAX_PROJECTILES];
+
+    int32_t num_planets;
+    struct
+    {
+        float x, y, w, h;
+        float vy;
+    } planets[SPACE_MAX_PLANETS];
+
+    int32_t num_powerups;
+    struct
+    {
+        float x, y;
+        int32_t type;
+    } powerups[SPACE_MAX_POWERUPS];
+} SpaceObs;
+
+//NULL if config is invalid or memory runs out.
+SpaceEnv* space_create(const SpaceConfig* config);
+void space_destroy(SpaceEnv* env);
+
+//Where observations go, either may be NULL to skip it. frame needs
+//frame_width * frame_height bytes, row major. Both must stay valid until
+//rebound or the env is destroyed.
+void space_bind(SpaceEnv* env, SpaceObs* obs, uint8_t* frame);
+
+//Starts a new episode. The same seed and actions always play out the same.
+void space_reset(SpaceEnv* env, uint32_t seed);
+
+//Runs n_ticks ticks (1/60 s each) holding actions[p] for player p, then
+//writes the observations. Stops early when the episode ends. Returns the
+//ticks actually run.
+int space_step(SpaceEnv* env, const uint16_t* actions, int n_ticks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,220 @@
+#include "main.h"
+
+//Spatial queries over enemies: k nearest and everything within a radius.
+//
+//Enemy centres are bucketed into a uniform grid of SPATIAL_CELL squares with
+//an intrusive linked list per cell. spatial_update() runs once per tick and
+//only relinks enemies whose cell changed (or that spawned or died), so the
+//index never needs clearing, and it also catches up by itself after a rewind
+//or rollback replaces the enemies wholesale. Queries only look at the cells
+//that can still hold a closer or in-range enemy.
+//
+//Positions off the screen are clamped onto the border cells. Queries from
+//on-screen points still get correct bounds, since a clamped cell is never
+//farther away than the enemy really is.
+//
+//Homing shots and splash damage are built on top.
+
+static inline int cell_x(float x)
+{
+    return SDL_max(0, SDL_min((int)floorf(x / SPATIAL_CELL), SPATIAL_COLS - 1));
+}
+
+static inline int cell_y(float y)
+{
+    return SDL_max(0, SDL_min((int)floorf(y / SPATIAL_CELL), SPATIAL_ROWS - 1));
+}
+
+void spatial_init(SpatialIndex* index)
+{
+    memset(index->head, 0xFF, sizeof(index->head));
+    memset(index->cell, 0xFF, sizeof(index->cell));
+}
+
+static void spatial_unlink(SpatialIndex* index, int i)
+{
+    if (index->prev[i] >= 0)
+        index->next[index->prev[i]] = index->next[i];
+    else
+        index->head[index->cell[i]] = index->next[i];
+
+    if (index->next[i] >= 0)
+        index->prev[index->next[i]] = index->prev[i];
+
+    index->cell[i] = -1;
+}
+
+static void spatial_link(SpatialIndex* index, int i, int cell)
+{
+    index->cell[i] = (Sint16)cell;
+    index->prev[i] = -1;
+    index->next[i] = index->head[cell];
+    if (index->head[cell] >= 0)
+        index->prev[index->head[cell]] = (Sint16)i;
+    index->head[cell] = (Sint16)i;
+}
+
+//Brings the index up to date with the enemies' positions this tick.
+void spatial_update(Game* game)
+{
+    SpatialIndex* index = &game->enemy_index;
+
+    for (int i = 0; i < MAX_ENEMIES; i++)
+    {
+        const Enemy* enemy = &game->sim.enemies[i];
+        int cell = -1;
+
+        if (enemy->active)
+        {
+            index->x[i] = enemy->position.x + enemy->position.w / 2.0f;
+            index->y[i] = enemy->position.y + enemy->position.h / 2.0f;
+            cell = cell_y(index->y[i]) * SPATIAL_COLS + cell_x(index->x[i]);
+        }
+
+        if (cell == index->cell[i])
+            continue;
+
+        if (index->cell[i] >= 0)
+            spatial_unlink(index, i);
+        if (cell >= 0)
+            spatial_link(index, i, cell);
+    }
+}
+
+//Up to k (at most SPATIAL_MAX_K) live enemies no farther than max_dist from
+//x, y, nearest first, equal distances by enemy index so the answer doesn't
+//depend on the order of the cell lists. Returns how many were written to out.
+int spatial_nearest(Game* game, float x, float y, int k, float max_dist, int* out)
+{
+    const SpatialIndex* index = &game->enemy_index;
+    float best[SPATIAL_MAX_K];
+    int count = 0;
+    int cx = cell_x(x), cy = cell_y(y);
+
+    k = SDL_min(k, SPATIAL_MAX_K);
+    if (k <= 0)
+        return 0;
+
+    //Ring r holds the cells r steps from the query's cell, which are at
+    //least (r - 1) cells away, so stop once that beats the kth best.
+    for (int r = 0; r < SDL_max(SPATIAL_COLS, SPATIAL_ROWS); r++)
+    {
+        float ring_dist = (r - 1) * (float)SPATIAL_CELL;
+        if (r > 0 && (ring_dist > max_dist || (count == k && ring_dist * ring_dist > best[k - 1])))
+            break;
+
+        for (int gy = cy - r; gy <= cy + r; gy++)
+        {
+            if (gy < 0 || gy >= SPATIAL_ROWS)
+                continue;
+
+            //Only the ring's edge, the inside was covered by smaller rings.
+            int step = (gy == cy - r || gy == cy + r) ? 1 : SDL_max(1, 2 * r);
+            for (int gx = cx - r; gx <= cx + r; gx += step)
+            {
+                if (gx < 0 || gx >= SPATIAL_COLS)
+                    continue;
+
+                for (int i = index->head[gy * SPATIAL_COLS + gx]; i >= 0; i = index->next[i])
+                {
+                    if (!game->sim.enemies[i].active)
+                        continue;
+
+                    float dx = index->x[i] - x, dy = index->y[i] - y;
+                    float d = dx * dx + dy * dy;
+                    if (d > max_dist * max_dist)
+                        continue;
+                    if (count == k && (d > best[k - 1] || (d == best[k - 1] && i > out[k - 1])))
+                        continue;
+
+                    //Insertion into the sorted best list, dropping the farthest when full.
+                    int at = count < k ? count++ : k - 1;
+                    while (at > 0 && (best[at - 1] > d || (best[at - 1] == d && out[at - 1] > i)))
+                    {
+                        best[at] = best[at - 1];
+                        out[at] = out[at - 1];
+                        at--;
+                    }
+                    best[at] = d;
+                    out[at] = i;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+//Live enemies with their centre within radius of x, y, by enemy index.
+//Writes at most max to out (the lowest indices) and returns how many.
+int spatial_radius(Game* game, float x, float y, float radius, int* out, int max)
+{
+    const SpatialIndex* index = &game->enemy_index;
+    int count = 0;
+
+    for (int gy = cell_y(y - radius); gy <= cell_y(y + radius); gy++)
+    for (int gx = cell_x(x - radius); gx <= cell_x(x + radius); gx++)
+    {
+        for (int i = index->head[gy * SPATIAL_COLS + gx]; i >= 0; i = index->next[i])
+        {
+            float dx = index->x[i] - x, dy = index->y[i] - y;
+
+            if (!game->sim.enemies[i].active || dx * dx + dy * dy > radius * radius)
+                continue;
+            if (count == max && (max == 0 || i > out[max - 1]))
+                continue;
+
+            //Same insertion as spatial_nearest(), keyed on the index.
+            int at = count < max ? count++ : max - 1;
+            while (at > 0 && out[at - 1] > i)
+            {
+                out[at] = out[at - 1];
+                at--;
+            }
+            out[at] = i;
+        }
+    }
+    return count;
+}
+
+//Turns a homing shot toward the nearest enemy, by at most rate degrees per
+//tick, keeping its speed. Re-picks the target every tick.
+void projectile_home(Game* game, Projectile* projectile, float rate, float speed)
+{
+    int target;
+
+    if (spatial_nearest(game, projectile->x, projectile->y, 1, SCREEN_HEIGHT, &target) == 0)
+        return;
+
+    //Same convention as projectile_spawn(): 0 is straight up, clockwise.
+    float dx = game->enemy_index.x[target] - projectile->x;
+    float dy = game->enemy_index.y[target] - projectile->y;
+    float turn = atan2f(dx, -dy) * 180.0f / (float)M_PI - projectile->angle;
+
+    turn = fmodf(turn + 540.0f, 360.0f) - 180.0f;
+    projectile->angle += SDL_max(-rate, SDL_min(turn, rate));
+
+    float rad_angle = projectile->angle * (float)M_PI / 180.0f;
+    projectile->vx = sinf(rad_angle) * speed;
+    projectile->vy = -cosf(rad_angle) * speed;
+}
+
+//Damages every enemy within radius of an impact except direct (the one
+//already hit, or -1) and the one that fired it, falling off from full damage
+//at the centre to none at the edge.
+void projectile_splash(Game* game, const Projectile* projectile, int damage, int radius, int direct)
+{
+    int hits[MAX_ENEMIES];
+    int count = spatial_radius(game, projectile->x, projectile->y, radius, hits, MAX_ENEMIES);
+
+    for (int i = 0; i < count; i++)
+    {
+        if (hits[i] == direct || hits[i] == projectile->shooter)
+            continue;
+
+        float dx = game->enemy_index.x[hits[i]] - projectile->x;
+        float dy = game->enemy_index.y[hits[i]] - projectile->y;
+        float falloff = 1.0f - sqrtf(dx * dx + dy * dy) / radius;
+
+        damage_enemy(game, hits[i], (int)(damage * falloff), projectile->owner);
+    }
+}
@@ -0,0 +1,919 @@
+#define _POSIX_C_SOURCE 200809L     //getaddrinfo() and MSG_NOSIGNAL under -std=c11
+
+#include "main.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+//Spectators. --spectate ADDR publishes what is on screen once a frame to
+//any number of viewers; --watch ADDR is such a viewer, which rebuilds the
+//scene from the stream into its own sim and draws it with the game's usual
+//render(), simulating nothing. ADDR is a port on localhost, HOST:PORT, or
+//the path of a Unix socket.
+//
+//The scene is quantised to whole pixels, 256ths of a turn and whole HUD
+//numbers. A frame only carries what changed since the one before: for each
+//changed entity or HUD, a bitmask of the fields that differ, then each
+//difference as a zigzag varint, mostly a single byte. A cratered planet's
+//mask goes as the rows that changed. Every SPECTATE_KEY_FRAMES frames the
+//whole scene is sent again as a keyframe, diffed against an empty one;
+//that is where new viewers join.
+//
+//All the game loop does is encode the frame and copy it into a ring. A
+//broadcast thread accepts viewers and feeds them without ever blocking; a
+//viewer that falls a whole ring behind is dropped.
+
+#define SPEC_MAGIC          0x53485350      //"SHSP", sent first on every connection
+#define SPEC_VERSION        1
+#define SPEC_FRAME_MAX      32768           //A keyframe with every slot and crater in use is ~26 KB
+#define SPEC_RING           (SPECTATE_RING_KB * 1024)
+
+//Wire format, all integers little endian or varints:
+//  frame:  length (16 bits, of what follows) | SPEC_FRAME_KEY or _DELTA | records
+//  record: SPEC_REC_WORLD fields
+//          SPEC_REC_ENTITY slot fields     changes slot, or spawns into it
+//                                          with fields diffed against zero
+//          SPEC_REC_REMOVE slot
+//          SPEC_REC_HUD player fields
+//          SPEC_REC_MASK planet row bits   row's new 64 bits
+//  fields: varint bitmask of the fields present, then one zigzag varint
+//          difference per field present, lowest bit first
+enum
+{
+    SPEC_FRAME_KEY,
+    SPEC_FRAME_DELTA
+};
+
+enum
+{
+    SPEC_REC_WORLD,
+    SPEC_REC_ENTITY,
+    SPEC_REC_REMOVE,
+    SPEC_REC_HUD,
+    SPEC_REC_MASK
+};
+
+enum { SW_TICK, SW_TIME, SW_SCROLL, SW_PLAYERS, SPEC_WORLD_FIELDS };
+enum { SE_X, SE_Y, SE_W, SE_H, SE_KIND, SE_ANGLE, SE_FLAGS, SPEC_ENTITY_FIELDS };
+enum { SH_HP, SH_MAX_HP, SH_SCORE, SH_WEAPON, SH_AFTERBURNER, SH_SHIELD, SH_AMMO, SPEC_HUD_FIELDS = SH_AMMO + MAX_WEAPONS };
+
+//SE_FLAGS bits
+#define SPEC_AFTERBURNER    (1 << 0)
+#define SPEC_DAMAGED        (1 << 1)
+#define SPEC_HOSTILE        (1 << 2)
+
+//Entity slots, one block per kind.
+#define SLOT_PLAYERS        0
+#define SLOT_ENEMIES        (SLOT_PLAYERS + MAX_PLAYERS)
+#define SLOT_PLANETS        (SLOT_ENEMIES + MAX_ENEMIES)
+#define SLOT_POWERUPS       (SLOT_PLANETS + MAX_PLANETS)
+#define SLOT_SHOTS          (SLOT_POWERUPS + MAX_POWERUPS)
+#define SPEC_SLOTS          (SLOT_SHOTS + MAX_PROJECTILES)
+
+typedef struct
+{
+    Sint32 v[SPEC_ENTITY_FIELDS];
+    bool active;
+} SpecEntity;
+
+//Everything a viewer sees, quantised.
+typedef struct
+{
+    Sint32 world[SPEC_WORLD_FIELDS];
+    SpecEntity entities[SPEC_SLOTS];
+    Sint32 hud[MAX_PLAYERS][SPEC_HUD_FIELDS];
+    Uint64 masks[MAX_PLANETS][PLANET_MASK_SIZE];    //Zero unless the planet is damaged
+} SpecScene;
+
+typedef struct
+{
+    int sock;               //-1 for a free slot
+    Uint64 sent;            //Stream offset sent up to
+} Viewer;
+
+struct Spectate
+{
+    //Game thread only
+    SpecScene sent;         //As of the last frame published
+    SpecScene now;
+    Uint8 frame[SPEC_FRAME_MAX];
+    int frames;
+    Uint64 frame_bytes;
+    Uint64 key_bytes;
+    Uint64 publish_time;    //Performance counter ticks spent in spectate_publish()
+
+    //Shared, under lock
+    SDL_mutex* lock;
+    SDL_cond* wake;
+    bool quit;
+    Uint8 ring[SPEC_RING];
+    Uint64 head;            //Stream bytes written so far
+    Uint64 key;             //Offset of the latest keyframe
+
+    //Broadcast thread only
+    SDL_Thread* thread;
+    int listener;
+    char unix_path[MSL];    //Unlinked on close
+    Uint8 mirror[SPEC_RING];
+    Uint64 copied;          //Stream bytes copied into mirror
+    Viewer viewers[SPECTATE_MAX_VIEWERS];
+    int joined;
+    int dropped;
+    int peak;
+};
+
+struct Watch
+{
+    int sock;
+    SpecScene scene;
+    Uint8 buffer[SPEC_FRAME_MAX * 2];
+    int buffered;
+    bool synced;            //A keyframe has arrived
+    Uint64 frames;
+    Uint64 bytes;
+};
+
+static Uint8* put_varint(Uint8* p, Uint32 v)
+{
+    while (v >= 0x80)
+    {
+        *p++ = (Uint8)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (Uint8)v;
+    return p;
+}
+
+//NULL if it runs past end.
+static const Uint8* get_varint(const Uint8* p, const Uint8* end, Uint32* v)
+{
+    *v = 0;
+    for (int shift = 0; shift < 35 && p < end; shift += 7)
+    {
+        Uint8 byte = *p++;
+        *v |= (Uint32)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return p;
+    }
+    return NULL;
+}
+
+static Uint32 zigzag(Sint32 v) { return ((Uint32)v << 1) ^ (Uint32)(v >> 31); }
+static Sint32 unzigzag(Uint32 v) { return (Sint32)(v >> 1) ^ -(Sint32)(v & 1); }
+
+//Writes the fields of now that differ from prev, or nothing (returning p)
+//if none do. Differences wrap, so any Sint32 goes.
+static Uint8* put_fields(Uint8* p, int record, int index, const Sint32* prev, const Sint32* now, int count)
+{
+    Uint32 changed = 0;
+
+    for (int i = 0; i < count; i++)
+        if (now[i] != prev[i])
+            changed |= 1u << i;
+
+    if (changed == 0 && record != SPEC_REC_ENTITY)
+        return p;
+
+    *p++ = (Uint8)record;
+    if (index >= 0)
+        p = put_varint(p, (Uint32)index);
+    p = put_varint(p, changed);
+    for (int i = 0; i < count; i++)
+        if (changed & (1u << i))
+            p = put_varint(p, zigzag((Sint32)((Uint32)now[i] - (Uint32)prev[i])));
+    return p;
+}
+
+static const Uint8* get_fields(const Uint8* p, const Uint8* end, Sint32* fields, int count)
+{
+    Uint32 changed, diff;
+
+    if ((p = get_varint(p, end, &changed)) == NULL)
+        return NULL;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (!(changed & (1u << i)))
+            continue;
+        if ((p = get_varint(p, end, &diff)) == NULL)
+            return NULL;
+        fields[i] = (Sint32)((Uint32)fields[i] + (Uint32)unzigzag(diff));
+    }
+    return p;
+}
+
+static Sint32 quantise_angle(float degrees)
+{
+    return (Sint32)lroundf(degrees * 256.0f / 360.0f) & 0xFF;
+}
+
+static void capture_rect(SpecEntity* entity, const SDL_Rect* rect)
+{
+    entity->active = true;
+    entity->v[SE_X] = rect->x;
+    entity->v[SE_Y] = rect->y;
+    entity->v[SE_W] = rect->w;
+    entity->v[SE_H] = rect->h;
+    entity->v[SE_KIND] = 0;
+    entity->v[SE_ANGLE] = 0;
+    entity->v[SE_FLAGS] = 0;
+}
+
+//Quantises what render() would draw into scene.
+static void capture_scene(const Game* game, SpecScene* scene)
+{
+    const SimState* sim = &game->sim;
+
+    memset(scene->entities, 0, sizeof(scene->entities));
+
+    scene->world[SW_TICK] = (Sint32)sim->tick;
+    scene->world[SW_TIME] = (Sint32)sim->time;
+    scene->world[SW_SCROLL] = sim->scroll_y;
+    scene->world[SW_PLAYERS] = sim->num_players;
+
+    for (int i = 0; i < sim->num_players; i++)
+    {
+        const Player* player = &sim->players[i];
+        SpecEntity* entity = &scene->entities[SLOT_PLAYERS + i];
+        Sint32* hud = scene->hud[i];
+
+        capture_rect(entity, &player->position);
+        entity->v[SE_ANGLE] = quantise_angle(player->roll_angle);
+        entity->v[SE_FLAGS] = player->is_afterburner_active ? SPEC_AFTERBURNER : 0;
+
+        hud[SH_HP] = player->hit_points;
+        hud[SH_MAX_HP] = player->max_hp;
+        hud[SH_SCORE] = player->score;
+        hud[SH_WEAPON] = player->current_weapon;
+        hud[SH_AFTERBURNER] = (Sint32)player->afterburner;
+        hud[SH_SHIELD] = player->powerup_end_times[POWERUP_SHIELD] > sim->time ? (Sint32)(player->powerup_end_times[POWERUP_SHIELD] - sim->time) / 100 : 0;
+        for (int w = 0; w < MAX_WEAPONS; w++)
+            hud[SH_AMMO + w] = player->weapons[w].ammo;
+    }
+
+    for (int i = 0; i < MAX_ENEMIES; i++)
+        if (sim->enemies[i].active)
+            capture_rect(&scene->entities[SLOT_ENEMIES + i], &sim->enemies[i].position);
+
+    for (int i = 0; i < MAX_PLANETS; i++)
+    {
+        const Planet* planet = &sim->planets[i];
+
+        if (planet->active)
+        {
+            capture_rect(&scene->entities[SLOT_PLANETS + i], &planet->position);
+            scene->entities[SLOT_PLANETS + i].v[SE_FLAGS] = planet->damaged ? SPEC_DAMAGED : 0;
+        }
+
+        if (planet->active && planet->damaged)
+            memcpy(scene->masks[i], planet->mask, sizeof(planet->mask));
+        else
+            memset(scene->masks[i], 0, sizeof(scene->masks[i]));
+    }
+
+    for (int i = 0; i < MAX_POWERUPS; i++)
+    {
+        if (sim->powerups[i].active)
+        {
+            capture_rect(&scene->entities[SLOT_POWERUPS + i], &sim->powerups[i].position);
+            scene->entities[SLOT_POWERUPS + i].v[SE_KIND] = sim->powerups[i].type;
+        }
+    }
+
+    for (int t = 0; t < MAX_WEAPONS; t++)
+    {
+        for (int i = 0; i < sim->projectiles[t].count; i++)
+        {
+            const Projectile* shot = &sim->projectiles[t].items[i];
+            SpecEntity* entity = &scene->entities[SLOT_SHOTS + t * PROJECTILES_PER_WEAPON + i];
+
+            if (!shot->active)
+                continue;
+
+            capture_rect(entity, &shot->dest_rect);
+            entity->v[SE_KIND] = t;
+            entity->v[SE_ANGLE] = quantise_angle(shot->angle);
+            entity->v[SE_FLAGS] = shot->is_enemy_projectile ? SPEC_HOSTILE : 0;
+        }
+    }
+}
+
+//Encodes the changes from prev to now as one frame, returning its size.
+static int encode_frame(Uint8* out, const SpecScene* prev, const SpecScene* now, bool key)
+{
+    static const Sint32 spawned[SPEC_ENTITY_FIELDS];
+    Uint8* p = out + 2;
+
+    *p++ = key ? SPEC_FRAME_KEY : SPEC_FRAME_DELTA;
+    p = put_fields(p, SPEC_REC_WORLD, -1, prev->world, now->world, SPEC_WORLD_FIELDS);
+
+    for (int i = 0; i < SPEC_SLOTS; i++)
+    {
+        const SpecEntity* was = &prev->entities[i];
+        const SpecEntity* is = &now->entities[i];
+
+        if (is->active && !was->active)
+            p = put_fields(p, SPEC_REC_ENTITY, i, spawned, is->v, SPEC_ENTITY_FIELDS);
+        else if (is->active && memcmp(was->v, is->v, sizeof(is->v)))
+            p = put_fields(p, SPEC_REC_ENTITY, i, was->v, is->v, SPEC_ENTITY_FIELDS);
+        else if (!is->active && was->active)
+        {
+            *p++ = SPEC_REC_REMOVE;
+            p = put_varint(p, (Uint32)i);
+        }
+    }
+
+    for (int i = 0; i < now->world[SW_PLAYERS]; i++)
+        p = put_fields(p, SPEC_REC_HUD, i, prev->hud[i], now->hud[i], SPEC_HUD_FIELDS);
+
+    for (int i = 0; i < MAX_PLANETS; i++)
+    {
+        for (int row = 0; row < PLANET_MASK_SIZE; row++)
+        {
+            Uint64 bits = SDL_SwapLE64(now->masks[i][row]);
+
+            if (now->masks[i][row] == prev->masks[i][row])
+                continue;
+
+            *p++ = SPEC_REC_MASK;
+            *p++ = (Uint8)i;
+            *p++ = (Uint8)row;
+            memcpy(p, &bits, 8);
+            p += 8;
+        }
+    }
+
+    Uint16 length = SDL_SwapLE16((Uint16)(p - out - 2));
+    memcpy(out, &length, 2);
+    return (int)(p - out);
+}
+
+//Applies one frame's payload (after the length) to scene. False if it is
+//malformed.
+static bool decode_frame(SpecScene* scene, const Uint8* p, const Uint8* end)
+{
+    static const SpecScene empty;
+    Uint32 index;
+
+    if (p == end)
+        return false;
+
+    if (*p++ == SPEC_FRAME_KEY)
+        *scene = empty;
+
+    while (p && p < end)
+    {
+        switch (*p++)
+        {
+            case SPEC_REC_WORLD:
+                p = get_fields(p, end, scene->world, SPEC_WORLD_FIELDS);
+                break;
+
+            case SPEC_REC_ENTITY:
+                if ((p = get_varint(p, end, &index)) == NULL || index >= SPEC_SLOTS)
+                    return false;
+                if (!scene->entities[index].active)
+                    memset(scene->entities[index].v, 0, sizeof(scene->entities[index].v));
+                scene->entities[index].active = true;
+                p = get_fields(p, end, scene->entities[index].v, SPEC_ENTITY_FIELDS);
+                break;
+
+            case SPEC_REC_REMOVE:
+                if ((p = get_varint(p, end, &index)) == NULL || index >= SPEC_SLOTS)
+                    return false;
+                scene->entities[index].active = false;
+                break;
+
+            case SPEC_REC_HUD:
+                if ((p = get_varint(p, end, &index)) == NULL || index >= MAX_PLAYERS)
+                    return false;
+                p = get_fields(p, end, scene->hud[index], SPEC_HUD_FIELDS);
+                break;
+
+            case SPEC_REC_MASK:
+            {
+                Uint64 bits;
+
+                if (end - p < 10 || p[0] >= MAX_PLANETS || p[1] >= PLANET_MASK_SIZE)
+                    return false;
+                memcpy(&bits, p + 2, 8);
+                scene->masks[p[0]][p[1]] = SDL_SwapLE64(bits);
+                p += 10;
+                break;
+            }
+
+            default:
+                return false;
+        }
+    }
+    return p != NULL;
+}
+
+static void apply_rect(SDL_Rect* rect, const SpecEntity* entity)
+{
+    *rect = (SDL_Rect){entity->v[SE_X], entity->v[SE_Y], entity->v[SE_W], entity->v[SE_H]};
+}
+
+//Writes scene over the viewer's sim, for render() to draw.
+static void apply_scene(Game* game, const SpecScene* scene)
+{
+    SimState* sim = &game->sim;
+
+    sim->tick = (Uint32)scene->world[SW_TICK];
+    sim->time = (Uint32)scene->world[SW_TIME];
+    sim->scroll_y = scene->world[SW_SCROLL];
+    sim->num_players = SDL_max(1, SDL_min(scene->world[SW_PLAYERS], MAX_PLAYERS));
+    game->local_player = 0;
+
+    for (int i = 0; i < sim->num_players; i++)
+    {
+        Player* player = &sim->players[i];
+        const SpecEntity* entity = &scene->entities[SLOT_PLAYERS + i];
+        const Sint32* hud = scene->hud[i];
+
+        apply_rect(&player->position, entity);
+        player->roll_angle = (Sint8)entity->v[SE_ANGLE] * 360.0f / 256.0f;
+        player->is_afterburner_active = entity->v[SE_FLAGS] & SPEC_AFTERBURNER;
+
+        player->hit_points = hud[SH_HP];
+        player->max_hp = SDL_max(1, hud[SH_MAX_HP]);
+        player->score = hud[SH_SCORE];
+        player->current_weapon = SDL_max(0, SDL_min(hud[SH_WEAPON], MAX_WEAPONS - 1));
+        player->afterburner = (float)hud[SH_AFTERBURNER];
+        player->powerup_end_times[POWERUP_SHIELD] = sim->time + (Uint32)hud[SH_SHIELD] * 100;
+        for (int w = 0; w < MAX_WEAPONS; w++)
+            player->weapons[w].ammo = hud[SH_AMMO + w];
+    }
+
+    for (int i = 0; i < MAX_ENEMIES; i++)
+    {
+        sim->enemies[i].active = scene->entities[SLOT_ENEMIES + i].active;
+        apply_rect(&sim->enemies[i].position, &scene->entities[SLOT_ENEMIES + i]);
+    }
+
+    for (int i = 0; i < MAX_PLANETS; i++)
+    {
+        Planet* planet = &sim->planets[i];
+        const SpecEntity* entity = &scene->entities[SLOT_PLANETS + i];
+
+        planet->active = entity->active;
+        apply_rect(&planet->position, entity);
+        planet->damaged = entity->v[SE_FLAGS] & SPEC_DAMAGED;
+        memcpy(planet->mask, scene->masks[i], sizeof(planet->mask));
+    }
+
+    for (int i = 0; i < MAX_POWERUPS; i++)
+    {
+        const SpecEntity* entity = &scene->entities[SLOT_POWERUPS + i];
+
+        sim->powerups[i].active = entity->active;
+        apply_rect(&sim->powerups[i].position, entity);
+        sim->powerups[i].type = SDL_max(0, SDL_min(entity->v[SE_KIND], POWERUP_COUNT - 1));
+    }
+
+    //Slots keep their place, so buckets may have holes; render skips them.
+    for (int t = 0; t < MAX_WEAPONS; t++)
+    {
+        ProjectileBucket* bucket = &sim->projectiles[t];
+
+        bucket->count = PROJECTILES_PER_WEAPON;
+        for (int i = 0; i < PROJECTILES_PER_WEAPON; i++)
+        {
+            Projectile* shot = &bucket->items[i];
+            const SpecEntity* entity = &scene->entities[SLOT_SHOTS + t * PROJECTILES_PER_WEAPON + i];
+
+            shot->active = entity->active;
+            apply_rect(&shot->dest_rect, entity);
+            shot->x = shot->dest_rect.x + shot->dest_rect.w / 2.0f;
+            shot->y = shot->dest_rect.y + shot->dest_rect.h / 2.0f;
+            shot->angle = entity->v[SE_ANGLE] * 360.0f / 256.0f;
+            shot->is_enemy_projectile = entity->v[SE_FLAGS] & SPEC_HOSTILE;
+        }
+    }
+}
+
+//Resolves ADDR for --spectate or --watch. A path (anything with a '/')
+//is a Unix socket, a bare number a port on localhost. Returns the socket
+//family, or -1.
+static int resolve_address(const char* text, struct sockaddr_storage* addr, socklen_t* len)
+{
+    char host[MSL];
+    char port[16];
+    const char* colon = strrchr(text, ':');
+
+    memset(addr, 0, sizeof(*addr));
+
+    if (strchr(text, '/'))
+    {
+        struct sockaddr_un* un = (struct sockaddr_un*)addr;
+
+        if (strlen(text) >= sizeof(un->sun_path))
+            return -1;
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, text);
+        *len = sizeof(struct sockaddr_un);
+        return AF_UNIX;
+    }
+
+    if (colon)
+    {
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - text), text);
+        snprintf(port, sizeof(port), "%s", colon + 1);
+    }
+    else
+    {
+        snprintf(host, sizeof(host), "127.0.0.1");
+        snprintf(port, sizeof(port), "%s", text[0] ? text : "0");
+    }
+    if (atoi(port) <= 0)
+        snprintf(port, sizeof(port), "%d", SPECTATE_DEFAULT_PORT);
+
+    struct addrinfo hints = {0};
+    struct addrinfo* result = NULL;
+
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &result) != 0 || result == NULL)
+        return -1;
+
+    memcpy(addr, result->ai_addr, result->ai_addrlen);
+    *len = result->ai_addrlen;
+    freeaddrinfo(result);
+    return AF_INET;
+}
+
+static void set_nonblocking(int sock)
+{
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+}
+
+static void drop_viewer(Viewer* viewer)
+{
+    close(viewer->sock);
+    viewer->sock = -1;
+}
+
+static void accept_viewers(Spectate* spectate, Uint64 key)
+{
+    int sock;
+
+    while ((sock = accept(spectate->listener, NULL, NULL)) >= 0)
+    {
+        Uint8 hello[5];
+        Uint32 magic = SDL_SwapLE32(SPEC_MAGIC);
+        Viewer* viewer = NULL;
+
+        for (int i = 0; i < SPECTATE_MAX_VIEWERS && viewer == NULL; i++)
+            if (spectate->viewers[i].sock < 0)
+                viewer = &spectate->viewers[i];
+
+        memcpy(hello, &magic, 4);
+        hello[4] = SPEC_VERSION;
+        set_nonblocking(sock);
+
+        //A fresh socket always has room for the hello.
+        if (viewer == NULL || send(sock, hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello))
+        {
+            close(sock);
+            continue;
+        }
+
+        viewer->sock = sock;
+        viewer->sent = key;
+        spectate->joined++;
+    }
+}
+
+//Sends each viewer as much of what it hasn't had as its socket takes.
+static void feed_viewers(Spectate* spectate)
+{
+    int live = 0;
+
+    for (int i = 0; i < SPECTATE_MAX_VIEWERS; i++)
+    {
+        Viewer* viewer = &spectate->viewers[i];
+
+        if (viewer->sock < 0)
+            continue;
+
+        if (spectate->copied - viewer->sent > SPEC_RING)
+        {
+            drop_viewer(viewer);
+            spectate->dropped++;
+            continue;
+        }
+
+        while (viewer->sent < spectate->copied)
+        {
+            size_t at = viewer->sent % SPEC_RING;
+            size_t size = SDL_min(spectate->copied - viewer->sent, SPEC_RING - at);
+            ssize_t sent = send(viewer->sock, spectate->mirror + at, size, MSG_NOSIGNAL);
+
+            if (sent > 0)
+                viewer->sent += (Uint64)sent;
+            else
+            {
+                if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                    drop_viewer(viewer);
+                break;
+            }
+        }
+
+        if (viewer->sock >= 0)
+            live++;
+    }
+    spectate->peak = SDL_max(spectate->peak, live);
+}
+
+static int broadcast_thread(void* data)
+{
+    Spectate* spectate = data;
+
+    SDL_LockMutex(spectate->lock);
+    while (!spectate->quit)
+    {
+        //Woken by each frame, or every 50 ms to let new viewers in.
+        SDL_CondWaitTimeout(spectate->wake, spectate->lock, 50);
+
+        Uint64 head = spectate->head;
+        Uint64 key = spectate->key;
+
+        //Starved for a whole ring: what was missed is gone for everyone.
+        if (head - spectate->copied > SPEC_RING)
+            spectate->copied = head - SPEC_RING;
+        while (spectate->copied < head)
+        {
+            size_t at = spectate->copied % SPEC_RING;
+            size_t size = SDL_min(head - spectate->copied, SPEC_RING - at);
+
+            memcpy(spectate->mirror + at, spectate->ring + at, size);
+            spectate->copied += size;
+        }
+        SDL_UnlockMutex(spectate->lock);
+
+        accept_viewers(spectate, key);
+        feed_viewers(spectate);
+
+        SDL_LockMutex(spectate->lock);
+    }
+    SDL_UnlockMutex(spectate->lock);
+    return 0;
+}
+
+Spectate* spectate_open(Game* game)
+{
+    char buf[MSL_LONG];
+    struct sockaddr_storage addr;
+    socklen_t len;
+    int family = resolve_address(game->opts.spectate_address, &addr, &len);
+    Spectate* spectate = mem_calloc(MEM_NET, 1, sizeof(Spectate));
+
+    if (spectate == NULL)
+        return NULL;
+
+    spectate->listener = -1;
+    for (int i = 0; i < SPECTATE_MAX_VIEWERS; i++)
+        spectate->viewers[i].sock = -1;
+
+    if (family < 0 || (spectate->listener = socket(family, SOCK_STREAM, 0)) < 0)
+    {
+        snprintf(buf, sizeof(buf), "Unable to open spectator socket %s\n", game->opts.spectate_address);
+        LOG(buf);
+        spectate_close(game, spectate);
+        return NULL;
+    }
+
+    if (family == AF_UNIX)
+    {
+        snprintf(spectate->unix_path, sizeof(spectate->unix_path), "%s", ((struct sockaddr_un*)&addr)->sun_path);
+        unlink(spectate->unix_path);
+    }
+    else
+        setsockopt(spectate->listener, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int));
+
+    if (bind(spectate->listener, (struct sockaddr*)&addr, len) < 0 || listen(spectate->listener, 16) < 0)
+    {
+        snprintf(buf, sizeof(buf), "Unable to listen for spectators on %s: %s\n", game->opts.spectate_address, strerror(errno));
+        LOG(buf);
+        spectate->unix_path[0] = '\0';
+        spectate_close(game, spectate);
+        return NULL;
+    }
+    set_nonblocking(spectate->listener);
+
+    spectate->lock = SDL_CreateMutex();
+    spectate->wake = SDL_CreateCond();
+    spectate->thread = spectate->lock && spectate->wake ? SDL_CreateThread(broadcast_thread, "spectate", spectate) : NULL;
+    if (spectate->thread == NULL)
+    {
+        snprintf(buf, sizeof(buf), "Unable to start the spectator thread: %s\n", SDL_GetError());
+        LOG(buf);
+        spectate_close(game, spectate);
+        return NULL;
+    }
+
+    snprintf(buf, sizeof(buf), "Spectators can watch on %s\n", game->opts.spectate_address);
+    LOG(buf);
+    return spectate;
+}
+
+void spectate_close(Game* game, Spectate* spectate)
+{
+    char buf[MSL];
+
+    if (spectate == NULL)
+        return;
+
+    if (spectate->thread)
+    {
+        SDL_LockMutex(spectate->lock);
+        spectate->quit = true;
+        SDL_CondSignal(spectate->wake);
+        SDL_UnlockMutex(spectate->lock);
+        SDL_WaitThread(spectate->thread, NULL);
+
+        double freq = (double)SDL_GetPerformanceFrequency();
+        snprintf(buf, sizeof(buf), "Spectators: %d frames, avg %.1f bytes (keyframes %.1f), %.2f us each to publish. "
+                 "%d viewers joined, at most %d at once, %d dropped for falling behind\n",
+                 spectate->frames, spectate->frames ? (double)spectate->frame_bytes / spectate->frames : 0.0,
+                 spectate->frames ? (double)spectate->key_bytes * SPECTATE_KEY_FRAMES / spectate->frames : 0.0,
+                 spectate->frames ? spectate->publish_time * 1e6 / freq / spectate->frames : 0.0,
+                 spectate->joined, spectate->peak, spectate->dropped);
+        LOG(buf);
+    }
+
+    for (int i = 0; i < SPECTATE_MAX_VIEWERS; i++)
+        if (spectate->viewers[i].sock >= 0)
+            close(spectate->viewers[i].sock);
+    if (spectate->listener >= 0)
+        close(spectate->listener);
+    if (spectate->unix_path[0])
+        unlink(spectate->unix_path);
+    if (spectate->wake)
+        SDL_DestroyCond(spectate->wake);
+    if (spectate->lock)
+        SDL_DestroyMutex(spectate->lock);
+    mem_free(spectate);
+    (void)game;
+}
+
+//Once a frame, after the sim has run: sends viewers what changed on screen.
+void spectate_publish(Game* game)
+{
+    static const SpecScene empty;
+    Spectate* spectate = game->spectate;
+
+    if (spectate == NULL)
+        return;
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    bool key = spectate->frames % SPECTATE_KEY_FRAMES == 0;
+
+    capture_scene(game, &spectate->now);
+    int size = encode_frame(spectate->frame, key ? &empty : &spectate->sent, &spectate->now, key);
+    spectate->sent = spectate->now;
+
+    SDL_LockMutex(spectate->lock);
+    if (key)
+        spectate->key = spectate->head;
+    for (int done = 0; done < size; )
+    {
+        size_t at = spectate->head % SPEC_RING;
+        int chunk = (int)SDL_min((size_t)(size - done), SPEC_RING - at);
+
+        memcpy(spectate->ring + at, spectate->frame + done, chunk);
+        spectate->head += chunk;
+        done += chunk;
+    }
+    SDL_CondSignal(spectate->wake);
+    SDL_UnlockMutex(spectate->lock);
+
+    spectate->frames++;
+    spectate->frame_bytes += size;
+    if (key)
+        spectate->key_bytes += size;
+    spectate->publish_time += SDL_GetPerformanceCounter() - start;
+}
+
+//Connects to a game broadcasting with --spectate. Blocks until connected.
+Watch* watch_open(Game* game)
+{
+    char buf[MSL_LONG];
+    struct sockaddr_storage addr;
+    socklen_t len;
+    int family = resolve_address(game->opts.watch_address, &addr, &len);
+    Watch* watch = mem_calloc(MEM_NET, 1, sizeof(Watch));
+    Uint8 hello[5];
+    Uint32 magic;
+
+    if (watch == NULL)
+        return NULL;
+
+    watch->sock = family < 0 ? -1 : socket(family, SOCK_STREAM, 0);
+    if (watch->sock < 0 || connect(watch->sock, (struct sockaddr*)&addr, len) < 0 ||
+        recv(watch->sock, hello, sizeof(hello), MSG_WAITALL) != sizeof(hello))
+    {
+        snprintf(buf, sizeof(buf), "Unable to watch %s: %s\n", game->opts.watch_address, strerror(errno));
+        LOG(buf);
+        watch_close(game, watch);
+        return NULL;
+    }
+
+    memcpy(&magic, hello, 4);
+    if (SDL_SwapLE32(magic) != SPEC_MAGIC || hello[4] != SPEC_VERSION)
+    {
+        snprintf(buf, sizeof(buf), "%s is not a spectator stream this version can show\n", game->opts.watch_address);
+        LOG(buf);
+        watch_close(game, watch);
+        return NULL;
+    }
+
+    set_nonblocking(watch->sock);
+    snprintf(buf, sizeof(buf), "Watching %s\n", game->opts.watch_address);
+    LOG(buf);
+    return watch;
+}
+
+void watch_close(Game* game, Watch* watch)
+{
+    char buf[MSL];
+
+    if (watch == NULL)
+        return;
+
+    if (watch->frames)
+    {
+        snprintf(buf, sizeof(buf), "Watched %llu frames, %llu bytes\n", (unsigned long long)watch->frames, (unsigned long long)watch->bytes);
+        LOG(buf);
+    }
+
+    if (watch->sock >= 0)
+        close(watch->sock);
+    mem_free(watch);
+    (void)game;
+}
+
+//Replaces update() when watching: applies every frame that has arrived and
+//shows the result. The game ends when the broadcast does.
+void watch_update(Game* game)
+{
+    Watch* watch = game->watch;
+    bool changed = false;
+
+    for (;;)
+    {
+        ssize_t got = recv(watch->sock, watch->buffer + watch->buffered, sizeof(watch->buffer) - watch->buffered, 0);
+
+        if (got > 0)
+        {
+            watch->buffered += (int)got;
+            watch->bytes += (Uint64)got;
+        }
+        else if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        {
+            LOG("The spectated game has ended\n");
+            game->is_running = false;
+            break;
+        }
+
+        int at = 0;
+        while (watch->buffered - at >= 2)
+        {
+            Uint16 length;
+
+            memcpy(&length, watch->buffer + at, 2);
+            length = SDL_SwapLE16(length);
+            if (watch->buffered - at - 2 < length)
+                break;
+
+            const Uint8* frame = watch->buffer + at + 2;
+
+            //Joined or dropped frames before the first keyframe mean nothing yet.
+            watch->synced |= length > 0 && frame[0] == SPEC_FRAME_KEY;
+            if (watch->synced && !decode_frame(&watch->scene, frame, frame + length))
+            {
+                LOG("Spectator stream is corrupt\n");
+                game->is_running = false;
+                return;
+            }
+
+            changed |= watch->synced;
+            watch->frames++;
+            at += 2 + length;
+        }
+
+        memmove(watch->buffer, watch->buffer + at, watch->buffered - at);
+        watch->buffered -= at;
+
+        if (got <= 0)
+            break;
+    }
+
+    if (changed)
+        apply_scene(game, &watch->scene);
+}
@@ -0,0 +1,195 @@
+#include "main.h"
+
+//Frame time instrumentation. Every frame goes into two histograms: the full
+//frame (including the pacing wait) and the work alone. A frame that is long
+//while its work is short means the stutter came from pacing; long work means
+//it came from the game. F3 toggles an overlay of the last window of frames
+//and a session summary is logged on exit (--stats FILE also dumps the buckets).
+//Input latency, from an input event to the present that first shows its
+//effect, is kept the same way.
+
+void histogram_reset(FrameHistogram* hist)
+{
+    memset(hist, 0, sizeof(FrameHistogram));
+}
+
+void histogram_add(FrameHistogram* hist, float ms)
+{
+    int bucket = (int)(ms / HIST_BUCKET_MS);
+
+    if (bucket < 0)
+        bucket = 0;
+    else if (bucket >= HIST_BUCKETS)
+        bucket = HIST_BUCKETS - 1;
+
+    hist->counts[bucket]++;
+    hist->total++;
+    hist->sum_ms += ms;
+    if (ms > hist->max_ms)
+        hist->max_ms = ms;
+}
+
+//Upper edge of the bucket holding the given percentile (0..100).
+float histogram_percentile(const FrameHistogram* hist, float percentile)
+{
+    if (hist->total == 0)
+        return 0;
+
+    Uint32 target = (Uint32)ceilf(hist->total * percentile / 100.0f);
+    Uint32 seen = 0;
+
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += hist->counts[i];
+        if (seen >= target && seen > 0)
+            return (i + 1) * HIST_BUCKET_MS;
+    }
+    return hist->max_ms;
+}
+
+float histogram_mean(const FrameHistogram* hist)
+{
+    return hist->total ? (float)(hist->sum_ms / hist->total) : 0;
+}
+
+void stats_record_frame(Game* game, float frame_ms, float work_ms)
+{
+    FrameStats* stats = &game->stats;
+
+    histogram_add(&stats->frame, frame_ms);
+    histogram_add(&stats->work, work_ms);
+    histogram_add(&stats->window_frame, frame_ms);
+    histogram_add(&stats->window_work, work_ms);
+
+    //The overlay shows the last finished window so the numbers hold still long enough to read.
+    if (stats->window_frame.total >= STATS_WINDOW_FRAMES)
+    {
+        stats->shown_frame = stats->window_frame;
+        stats->shown_work = stats->window_work;
+        histogram_reset(&stats->window_frame);
+        histogram_reset(&stats->window_work);
+    }
+}
+
+void stats_record_latency(Game* game, float ms)
+{
+    FrameStats* stats = &game->stats;
+
+    histogram_add(&stats->latency, ms);
+    histogram_add(&stats->window_latency, ms);
+
+    //Latency only shows up when there was input, so it gets its own window.
+    if (stats->window_latency.total >= STATS_WINDOW_FRAMES / 10)
+    {
+        stats->shown_latency = stats->window_latency;
+        histogram_reset(&stats->window_latency);
+    }
+}
+
+//FPS you'd see if every frame were as slow as the given percentile.
+static float low_fps(const FrameHistogram* hist, float percentile)
+{
+    float ms = histogram_percentile(hist, percentile);
+    return ms > 0 ? 1000.0f / ms : 0;
+}
+
+static const char* pacing_mode(Game* game)
+{
+    if (game->opts.uncapped)
+        return "uncapped";
+    if (game->opts.vsync)
+        return "vsync";
+    return "timer";
+}
+
+void render_stats_overlay(Game* game)
+{
+    char line[MSL];
+    const FrameHistogram* frame = &game->stats.shown_frame;
+    const FrameHistogram* work = &game->stats.shown_work;
+    const FrameHistogram* latency = &game->stats.shown_latency;
+    int y = 10;
+
+    if (!game->show_stats)
+        return;
+
+    float mean = histogram_mean(frame);
+    snprintf(line, sizeof(line), "FPS %.1f  1%% low %.1f  0.1%% low %.1f (%s)",
+             mean > 0 ? 1000.0f / mean : 0.0f, low_fps(frame, 99.0f), low_fps(frame, 99.9f), pacing_mode(game));
+    render_text(game, line, 10, y, CLR_LIME_GREEN);
+    y += 16;
+
+    snprintf(line, sizeof(line), "frame ms p50 %.1f  p99 %.1f  max %.1f",
+             histogram_percentile(frame, 50.0f), histogram_percentile(frame, 99.0f), frame->max_ms);
+    render_text(game, line, 10, y, CLR_LIME_GREEN);
+    y += 16;
+
+    snprintf(line, sizeof(line), "work ms p50 %.1f  p99 %.1f  max %.1f",
+             histogram_percentile(work, 50.0f), histogram_percentile(work, 99.0f), work->max_ms);
+    render_text(game, line, 10, y, CLR_LIME_GREEN);
+    y += 16;
+
+    snprintf(line, sizeof(line), "input ms p50 %.1f  p99 %.1f  max %.1f",
+             histogram_percentile(latency, 50.0f), histogram_percentile(latency, 99.0f), latency->max_ms);
+    render_text(game, line, 10, y, CLR_LIME_GREEN);
+    y += 16;
+
+    const QualityTier* tier = quality_tier(game);
+    snprintf(line, sizeof(line), "quality %s (%s)  %d%% res  load %.1f ms",
+             tier->name, game->quality.locked ? "fixed" : "auto", (int)(tier->render_scale * 100 + 0.5f), game->quality.load_ms);
+    render_text(game, line, 10, y, CLR_LIME_GREEN);
+    y += 16;
+
+    MemTotals mem;
+    mem_totals(&mem);
+    snprintf(line, sizeof(line), "alloc %u (%.1f KB)/frame  mem %.1f MB  peak %.1f MB",
+             mem.frame_allocs, mem.frame_bytes / 1024.0, mem.live / (1024.0 * 1024.0), mem.peak / (1024.0 * 1024.0));
+    render_text(game, line, 10, y, CLR_LIME_GREEN);
+}
+
+void stats_report(Game* game)
+{
+    char buf[MSL_LONG];
+    const FrameHistogram* frame = &game->stats.frame;
+    const FrameHistogram* work = &game->stats.work;
+    const FrameHistogram* latency = &game->stats.latency;
+
+    if (frame->total == 0)
+        return;
+
+    snprintf(buf, sizeof(buf), "Frames: %u, avg %.2f ms, p50 %.2f, p99 %.2f, p99.9 %.2f, max %.2f ms. 1%% low %.1f FPS, 0.1%% low %.1f FPS\n",
+             frame->total, histogram_mean(frame), histogram_percentile(frame, 50.0f), histogram_percentile(frame, 99.0f),
+             histogram_percentile(frame, 99.9f), frame->max_ms, low_fps(frame, 99.0f), low_fps(frame, 99.9f));
+    LOG(buf);
+
+    snprintf(buf, sizeof(buf), "Work: avg %.2f ms, p50 %.2f, p99 %.2f, p99.9 %.2f, max %.2f ms\n",
+             histogram_mean(work), histogram_percentile(work, 50.0f), histogram_percentile(work, 99.0f),
+             histogram_percentile(work, 99.9f), work->max_ms);
+    LOG(buf);
+
+    if (latency->total)
+    {
+        snprintf(buf, sizeof(buf), "Input to present: %u events, avg %.2f ms, p50 %.2f, p99 %.2f, max %.2f ms\n",
+                 latency->total, histogram_mean(latency), histogram_percentile(latency, 50.0f),
+                 histogram_percentile(latency, 99.0f), latency->max_ms);
+        LOG(buf);
+    }
+
+    if (game->opts.stats_file[0] == '\0')
+        return;
+
+    FILE* fp = fopen(game->opts.stats_file, "w");
+    if (fp == NULL)
+    {
+        snprintf(buf, sizeof(buf), "Unable to write %s\n", game->opts.stats_file);
+        LOG(buf);
+        return;
+    }
+
+    fprintf(fp, "bucket_ms,frame_count,work_count,input_latency_count\n");
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        if (frame->counts[i] || work->counts[i] || latency->counts[i])
+            fprintf(fp, "%.1f,%u,%u,%u\n", i * HIST_BUCKET_MS, frame->counts[i], work->counts[i], latency->counts[i]);
+
+    fclose(fp);
+}
@@ -0,0 +1,361 @@
+#include "main.h"
+
+//On-demand texture streaming for decorative sprites (planets so far). Assets
+//are registered by path at startup, which only checks the file is there, and
+//nothing is read until the first stream_request(). A worker thread decodes the image and builds its variants
+//(texture_set_build() only touches surfaces); the main thread uploads a few
+//finished sets per frame in stream_update(). Until then stream_pick() returns
+//NULL and the caller draws a placeholder.
+//
+//Resident assets are kept within --stream-budget KB by evicting the least
+//recently drawn ones. Anything drawn this frame is never evicted, so the
+//budget can be exceeded briefly when a lot is on screen at once.
+//
+//Streaming is for drawing only. What the simulation asks (whether an asset
+//exists, its collision mask) never depends on how far the worker has got:
+//presence is fixed at registration and masks are decoded on the calling
+//thread, so netplay, replays and rewind see the same answers every run.
+
+enum
+{
+    ASSET_UNLOADED,
+    ASSET_QUEUED,               //Waiting for or being decoded by the worker
+    ASSET_DECODED,              //Surfaces ready, waiting for upload
+    ASSET_RESIDENT,
+    ASSET_FAILED                //Missing or unreadable, never retried
+};
+
+typedef struct
+{
+    char path[MSL];
+    SDL_Point sizes[TEX_MAX_VARIANTS];
+    int num_sizes;
+
+    TextureSet set;             //Owned by the worker while QUEUED
+    SDL_atomic_t state;
+    size_t bytes;
+    Uint32 last_used;           //Streamer frame it was last drawn
+
+    bool present;               //File was there at registration, fixed for the game
+
+    //Built by the first stream_mask() and kept through evictions
+    Uint64 mask[PLANET_MASK_SIZE];
+    Uint32 pixels[PLANET_MASK_SIZE * PLANET_MASK_SIZE];
+    int mask_state;             //0 not tried, 1 built, -1 won't decode
+} StreamAsset;
+
+struct TextureStreamer
+{
+    StreamAsset assets[STREAM_MAX_ASSETS];
+    int num_assets;
+
+    size_t budget;
+    size_t resident_bytes;
+    Uint32 frame;
+    int loads, evictions;
+    bool async;
+
+    int queue[STREAM_MAX_ASSETS];   //Each asset is queued at most once at a time
+    int head, tail;
+    SDL_mutex* lock;
+    SDL_sem* queued;
+    SDL_Thread* thread;
+    bool quit;
+};
+
+//On the worker thread, or inline; either way what it allocates is streamed.
+static void stream_decode(StreamAsset* asset)
+{
+    MemTag tag = mem_set_tag(MEM_STREAM);
+
+    if (!texture_set_build(&asset->set, asset->path, asset->sizes, asset->num_sizes))
+        SDL_AtomicSet(&asset->state, ASSET_FAILED);
+    else
+        SDL_AtomicSet(&asset->state, ASSET_DECODED);
+    mem_set_tag(tag);
+}
+
+static int stream_worker(void* data)
+{
+    TextureStreamer* stream = data;
+
+    for (;;)
+    {
+        SDL_SemWait(stream->queued);
+
+        SDL_LockMutex(stream->lock);
+        if (stream->quit)
+        {
+            SDL_UnlockMutex(stream->lock);
+            return 0;
+        }
+        int id = stream->queue[stream->tail];
+        stream->tail = (stream->tail + 1) % STREAM_MAX_ASSETS;
+        SDL_UnlockMutex(stream->lock);
+
+        stream_decode(&stream->assets[id]);
+    }
+}
+
+//Without async the replay test would see a different number of placeholder
+//frames on every run, so it loads inline instead.
+TextureStreamer* stream_open(Game* game, bool async)
+{
+    TextureStreamer* stream = mem_calloc(MEM_ASSETS, 1, sizeof(TextureStreamer));
+    if (stream == NULL)
+        return NULL;
+
+    stream->budget = (size_t)game->opts.stream_budget_kb * 1024;
+    stream->async = async;
+
+    if (async)
+    {
+        stream->lock = SDL_CreateMutex();
+        stream->queued = SDL_CreateSemaphore(0);
+        if (stream->lock)
+            stream->thread = SDL_CreateThread(stream_worker, "texture_stream", stream);
+
+        //No thread is no reason not to play; fall back to loading inline.
+        if (stream->thread == NULL)
+        {
+            SDL_Log("Unable to start texture streaming thread, loading inline: %s\n", SDL_GetError());
+            stream->async = false;
+        }
+    }
+    return stream;
+}
+
+void stream_close(Game* game, TextureStreamer* stream)
+{
+    char buf[MSL];
+
+    if (stream == NULL)
+        return;
+
+    if (stream->thread)
+    {
+        SDL_LockMutex(stream->lock);
+        stream->quit = true;
+        SDL_UnlockMutex(stream->lock);
+        SDL_SemPost(stream->queued);
+        SDL_WaitThread(stream->thread, NULL);
+    }
+
+    //The worker is gone, so every set is ours; undecoded ones are still empty.
+    for (int i = 0; i < stream->num_assets; i++)
+        texture_set_destroy(game, &stream->assets[i].set);
+
+    snprintf(buf, sizeof(buf), "Texture streaming: %d loads, %d evictions, %zu KB resident at exit\n",
+             stream->loads, stream->evictions, stream->resident_bytes / 1024);
+    LOG(buf);
+
+    if (stream->queued)
+        SDL_DestroySemaphore(stream->queued);
+    if (stream->lock)
+        SDL_DestroyMutex(stream->lock);
+    mem_free(stream);
+}
+
+//Registers an asset and returns its id, or -1 if the table is full.
+int stream_add(TextureStreamer* stream, const char* path, const SDL_Point* sizes, int num_sizes)
+{
+    if (stream->num_assets == STREAM_MAX_ASSETS)
+    {
+        SDL_Log("Too many streamed textures, can't add %s\n", path);
+        return -1;
+    }
+
+    StreamAsset* asset = &stream->assets[stream->num_assets];
+    snprintf(asset->path, sizeof(asset->path), "%s", path);
+    asset->num_sizes = SDL_min(num_sizes, TEX_MAX_VARIANTS);
+    memcpy(asset->sizes, sizes, sizeof(SDL_Point) * asset->num_sizes);
+
+    //Whether the file is there at all is known up front, so stream_request()
+    //can turn a missing one down before anything is queued.
+    FILE* fp = fopen(path, "rb");
+    if (fp)
+        fclose(fp);
+    else
+        SDL_Log("Streamed texture %s is missing, it won't be loaded\n", path);
+    asset->present = fp != NULL;
+    asset->mask_state = 0;
+    SDL_AtomicSet(&asset->state, fp ? ASSET_UNLOADED : ASSET_FAILED);
+
+    return stream->num_assets++;
+}
+
+static void stream_upload(Game* game, TextureStreamer* stream, StreamAsset* asset)
+{
+    MemTag tag = mem_set_tag(MEM_STREAM);
+
+    asset->bytes = texture_set_upload(game, &asset->set);
+    asset->last_used = stream->frame;
+    stream->resident_bytes += asset->bytes;
+    stream->loads++;
+    SDL_AtomicSet(&asset->state, ASSET_RESIDENT);
+    mem_set_tag(tag);
+}
+
+//Starts loading an asset if it isn't already. Returns false once it is known
+//to be missing, so the caller can stop asking.
+bool stream_request(Game* game, int id)
+{
+    TextureStreamer* stream = game->streamer;
+
+    if (stream == NULL || id < 0 || id >= stream->num_assets)
+        return false;
+
+    StreamAsset* asset = &stream->assets[id];
+    int state = SDL_AtomicGet(&asset->state);
+
+    if (state == ASSET_FAILED)
+        return false;
+    if (state != ASSET_UNLOADED)
+        return true;
+
+    SDL_AtomicSet(&asset->state, ASSET_QUEUED);
+
+    if (!stream->async)
+    {
+        stream_decode(asset);
+        if (SDL_AtomicGet(&asset->state) == ASSET_FAILED)
+            return false;
+        stream_upload(game, stream, asset);
+        return true;
+    }
+
+    SDL_LockMutex(stream->lock);
+    stream->queue[stream->head] = id;
+    stream->head = (stream->head + 1) % STREAM_MAX_ASSETS;
+    SDL_UnlockMutex(stream->lock);
+    SDL_SemPost(stream->queued);
+    return true;
+}
+
+//Best variant for w x h, or NULL if the asset isn't resident yet.
+SDL_Texture* stream_pick(Game* game, int id, int w, int h)
+{
+    TextureStreamer* stream = game->streamer;
+
+    if (stream == NULL || id < 0 || id >= stream->num_assets)
+        return NULL;
+
+    StreamAsset* asset = &stream->assets[id];
+    if (SDL_AtomicGet(&asset->state) != ASSET_RESIDENT)
+        return NULL;
+
+    asset->last_used = stream->frame;
+    return texture_pick(&asset->set, w, h);
+}
+
+//Whether the asset's file was there when it was registered. Unlike
+//stream_request() this never changes, so the simulation can go by it.
+bool stream_present(Game* game, int id)
+{
+    TextureStreamer* stream = game->streamer;
+
+    return stream && id >= 0 && id < stream->num_assets && stream->assets[id].present;
+}
+
+//Decodes the asset's mask and mask pixels the first time either is asked
+//for, here rather than on the worker, so the answer doesn't depend on
+//timing. Only the mask size is built, and tagged as streamed like the rest.
+static bool stream_build_mask(Game* game, int id)
+{
+    TextureStreamer* stream = game->streamer;
+
+    if (stream == NULL || id < 0 || id >= stream->num_assets)
+        return false;
+
+    StreamAsset* asset = &stream->assets[id];
+    if (asset->mask_state == 0)
+    {
+        const SDL_Point size = {PLANET_MASK_SIZE, PLANET_MASK_SIZE};
+        MemTag tag = mem_set_tag(MEM_STREAM);
+        TextureSet set;
+
+        asset->mask_state = -1;
+        if (asset->present && texture_set_build(&set, asset->path, &size, 1))
+        {
+            if (texture_set_mask(&set, PLANET_MASK_SIZE, asset->mask, asset->pixels))
+                asset->mask_state = 1;
+            texture_set_destroy(game, &set);
+        }
+        mem_set_tag(tag);
+    }
+    return asset->mask_state == 1;
+}
+
+//Copies out the asset's collision mask. False if its image won't decode.
+bool stream_mask(Game* game, int id, Uint64* mask)
+{
+    if (!stream_build_mask(game, id))
+        return false;
+
+    memcpy(mask, game->streamer->assets[id].mask, sizeof(game->streamer->assets[id].mask));
+    return true;
+}
+
+//Unmasked PLANET_MASK_SIZE square ARGB pixels of the asset, or NULL if its
+//image won't decode.
+const Uint32* stream_mask_pixels(Game* game, int id)
+{
+    if (!stream_build_mask(game, id))
+        return NULL;
+
+    return game->streamer->assets[id].pixels;
+}
+
+static void stream_evict(Game* game, TextureStreamer* stream)
+{
+    while (stream->resident_bytes > stream->budget)
+    {
+        StreamAsset* oldest = NULL;
+
+        for (int i = 0; i < stream->num_assets; i++)
+        {
+            StreamAsset* asset = &stream->assets[i];
+
+            //Drawn last frame or just uploaded: still in use.
+            if (SDL_AtomicGet(&asset->state) != ASSET_RESIDENT || asset->last_used + 1 >= stream->frame)
+                continue;
+            if (oldest == NULL || asset->last_used < oldest->last_used)
+                oldest = asset;
+        }
+
+        if (oldest == NULL)
+            return;
+
+        texture_set_destroy(game, &oldest->set);
+        stream->resident_bytes -= oldest->bytes;
+        oldest->bytes = 0;
+        stream->evictions++;
+        SDL_AtomicSet(&oldest->state, ASSET_UNLOADED);
+    }
+}
+
+//Once per frame, before rendering: uploads decoded assets and trims the cache.
+void stream_update(Game* game)
+{
+    TextureStreamer* stream = game->streamer;
+    int uploads = 0;
+
+    if (stream == NULL)
+        return;
+
+    stream->frame++;
+
+    //Uploads stall the renderer, so spread a burst of them over a few frames.
+    for (int i = 0; i < stream->num_assets && uploads < STREAM_UPLOADS_PER_FRAME; i++)
+    {
+        StreamAsset* asset = &stream->assets[i];
+
+        if (SDL_AtomicGet(&asset->state) == ASSET_DECODED)
+        {
+            stream_upload(game, stream, asset);
+            uploads++;
+        }
+    }
+
+    stream_evict(game, stream);
+}
@@ -0,0 +1,117 @@
+#include "main.h"
+
+//HUD text. Every printable ASCII glyph of the font is rendered once at
+//startup into one atlas texture, and a string is drawn as a copy per
+//character. Score, ammo and the F3 overlay change all the time; rendering
+//them through SDL_ttf allocated a surface and a texture per string per frame.
+//
+//Glyphs are drawn side by side at their advance, without kerning, which at
+//HUD sizes doesn't show. Anything outside the atlas is skipped.
+
+//Renders the glyphs white, so set_texture_color_mod() gives any colour.
+//Call once the font is open; without an atlas render_text() draws nothing.
+bool text_open(Game* game)
+{
+    TextAtlas* atlas = &game->text;
+    SDL_Surface* glyphs[TEXT_GLYPHS] = {0};
+    SDL_Color white = {255, 255, 255, 255};
+    int x = 0, y = 0;
+    bool ok = false;
+
+    memset(atlas, 0, sizeof(TextAtlas));
+    atlas->height = TTF_FontHeight(game->font);
+
+    //Lay the glyphs out in rows first, the atlas is sized to fit.
+    for (int i = 0; i < TEXT_GLYPHS; i++)
+    {
+        int minx, maxx, miny, maxy, advance;
+        Uint16 ch = (Uint16)(TEXT_FIRST_GLYPH + i);
+
+        if (TTF_GlyphMetrics(game->font, ch, &minx, &maxx, &miny, &maxy, &advance) < 0)
+            continue;
+        atlas->advance[i] = (Sint16)advance;
+
+        glyphs[i] = TTF_RenderGlyph_Solid(game->font, ch, white);
+        if (glyphs[i] == NULL)
+            continue;
+
+        if (x + glyphs[i]->w > TEXT_ATLAS_WIDTH)
+        {
+            x = 0;
+            y += atlas->height;
+        }
+        atlas->glyphs[i] = (SDL_Rect){x, y, glyphs[i]->w, glyphs[i]->h};
+        x += glyphs[i]->w;
+    }
+
+    SDL_Surface* sheet = SDL_CreateRGBSurfaceWithFormat(0, TEXT_ATLAS_WIDTH, y + atlas->height, 32, SDL_PIXELFORMAT_ARGB8888);
+    if (sheet)
+    {
+        //Solid glyphs are colour keyed, so only the glyph itself lands on the
+        //transparent sheet.
+        for (int i = 0; i < TEXT_GLYPHS; i++)
+        {
+            SDL_Rect dest = atlas->glyphs[i];   //Blits write the clipped rect back
+
+            if (glyphs[i])
+                SDL_BlitSurface(glyphs[i], NULL, sheet, &dest);
+        }
+
+        atlas->texture = create_texture(game, sheet);
+        ok = atlas->texture != NULL;
+        SDL_FreeSurface(sheet);
+    }
+
+    for (int i = 0; i < TEXT_GLYPHS; i++)
+        SDL_FreeSurface(glyphs[i]);
+
+    if (!ok)
+        SDL_Log("Unable to build the text atlas: %s\n", SDL_GetError());
+    return ok;
+}
+
+void text_close(Game* game)
+{
+    destroy_texture(game, game->text.texture);
+    game->text.texture = NULL;
+}
+
+//Width and height text takes up when drawn with render_text().
+void text_size(Game* game, const char* text, int* w, int* h)
+{
+    const TextAtlas* atlas = &game->text;
+
+    *w = 0;
+    *h = atlas->height;
+    for (const char* c = text; *c; c++)
+    {
+        int i = (unsigned char)*c - TEXT_FIRST_GLYPH;
+
+        if (i >= 0 && i < TEXT_GLYPHS)
+            *w += atlas->advance[i];
+    }
+}
+
+void render_text(Game* game, const char* text, int x, int y, SDL_Color color)
+{
+    const TextAtlas* atlas = &game->text;
+
+    if (atlas->texture == NULL)
+        return;
+
+    set_texture_color_mod(game, atlas->texture, color.r, color.g, color.b);
+    for (const char* c = text; *c; c++)
+    {
+        int i = (unsigned char)*c - TEXT_FIRST_GLYPH;
+
+        if (i < 0 || i >= TEXT_GLYPHS)
+            continue;
+
+        if (atlas->glyphs[i].w > 0)
+        {
+            SDL_Rect dest = {x, y, atlas->glyphs[i].w, atlas->glyphs[i].h};
+            draw_copy(game, atlas->texture, &atlas->glyphs[i], &dest);
+        }
+        x += atlas->advance[i];
+    }
+}
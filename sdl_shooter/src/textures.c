@@ -0,0 +1,354 @@
+#include "main.h"
+
+//Downscaled texture variants. Most sprites are drawn well below their source
+//resolution, and letting the GPU (or the software rasterizer) minify them on
+//every draw both aliases and wastes bandwidth. At load time each image gets
+//area-filtered variants at the sizes the game actually draws it, and the
+//draw code picks the closest one with texture_pick().
+//
+//Variants are kept as surfaces until texture_budget_commit(), which uploads
+//them smallest first until --tex-budget runs out. Every set keeps at least
+//its smallest variant; the source resolution is only uploaded when something
+//is drawn at (or above) that size. Streamed sets (streaming.c) skip the
+//budget and are uploaded whole with texture_set_upload().
+
+#define BYTES_PER_PIXEL 4
+
+static int variant_bytes(const TextureVariant* variant)
+{
+    return variant->w * variant->h * BYTES_PER_PIXEL;
+}
+
+//Averages the premultiplied samples covering each output pixel along one axis.
+//Output pixel i covers input [i * scale, (i + 1) * scale), partial pixels weighted.
+static void area_filter(const float* in, float* out, int in_len, int out_len, int in_step, int out_step, int lines, int in_line, int out_line)
+{
+    float scale = (float)in_len / out_len;
+
+    for (int line = 0; line < lines; line++)
+    {
+        const float* src = in + line * in_line;
+        float* dst = out + line * out_line;
+
+        for (int i = 0; i < out_len; i++)
+        {
+            float start = i * scale, end = (i + 1) * scale;
+            float sum[4] = {0, 0, 0, 0};
+
+            for (int k = (int)start; k < in_len && k < end; k++)
+            {
+                float weight = fminf(end, k + 1.0f) - fmaxf(start, (float)k);
+                for (int c = 0; c < 4; c++)
+                    sum[c] += src[k * in_step + c] * weight;
+            }
+
+            for (int c = 0; c < 4; c++)
+                dst[i * out_step + c] = sum[c] / scale;
+        }
+    }
+}
+
+//Box filtered copy of an ARGB8888 surface. Works in premultiplied alpha so
+//transparent pixels don't bleed dark fringes into the edges.
+static SDL_Surface* downscale_surface(SDL_Surface* src, int w, int h)
+{
+    SDL_Surface* dst = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_ARGB8888);
+    float* pixels = mem_alloc(MEM_ASSETS, sizeof(float) * 4 * src->w * src->h);
+    float* rows = mem_alloc(MEM_ASSETS, sizeof(float) * 4 * w * src->h);
+    float* out = mem_alloc(MEM_ASSETS, sizeof(float) * 4 * w * h);
+
+    if (dst == NULL || pixels == NULL || rows == NULL || out == NULL)
+    {
+        SDL_FreeSurface(dst);
+        mem_free(pixels);
+        mem_free(rows);
+        mem_free(out);
+        return NULL;
+    }
+
+    SDL_LockSurface(src);
+    for (int y = 0; y < src->h; y++)
+    {
+        const Uint32* row = (const Uint32*)((const Uint8*)src->pixels + y * src->pitch);
+        for (int x = 0; x < src->w; x++)
+        {
+            float* p = &pixels[(y * src->w + x) * 4];
+            float a = (row[x] >> 24) / 255.0f;
+
+            p[0] = ((row[x] >> 16) & 0xFF) * a;
+            p[1] = ((row[x] >> 8) & 0xFF) * a;
+            p[2] = (row[x] & 0xFF) * a;
+            p[3] = a;
+        }
+    }
+    SDL_UnlockSurface(src);
+
+    //Rows first, then columns.
+    area_filter(pixels, rows, src->w, w, 4, 4, src->h, src->w * 4, w * 4);
+    area_filter(rows, out, src->h, h, w * 4, w * 4, w, 4, 4);
+
+    SDL_LockSurface(dst);
+    for (int y = 0; y < h; y++)
+    {
+        Uint32* row = (Uint32*)((Uint8*)dst->pixels + y * dst->pitch);
+        for (int x = 0; x < w; x++)
+        {
+            const float* p = &out[(y * w + x) * 4];
+            float a = p[3];
+            Uint32 r = 0, g = 0, b = 0;
+
+            if (a > 0)
+            {
+                r = (Uint32)SDL_min(255.0f, p[0] / a + 0.5f);
+                g = (Uint32)SDL_min(255.0f, p[1] / a + 0.5f);
+                b = (Uint32)SDL_min(255.0f, p[2] / a + 0.5f);
+            }
+            row[x] = ((Uint32)(a * 255.0f + 0.5f) << 24) | (r << 16) | (g << 8) | b;
+        }
+    }
+    SDL_UnlockSurface(dst);
+
+    SDL_SetSurfaceBlendMode(dst, SDL_BLENDMODE_BLEND);
+    mem_free(pixels);
+    mem_free(rows);
+    mem_free(out);
+    return dst;
+}
+
+static void add_variant(TextureSet* set, SDL_Surface* source, int w, int h)
+{
+    int at = 0;
+
+    //Never upscale: the source itself covers anything drawn larger.
+    w = SDL_max(1, SDL_min(w, source->w));
+    h = SDL_max(1, SDL_min(h, source->h));
+
+    while (at < set->num_variants && set->variants[at].w * set->variants[at].h < w * h)
+        at++;
+
+    for (int i = 0; i < set->num_variants; i++)
+        if (set->variants[i].w == w && set->variants[i].h == h)
+            return;
+
+    if (set->num_variants == TEX_MAX_VARIANTS)
+        return;
+
+    SDL_Surface* surface = (w == source->w && h == source->h) ?
+                           SDL_ConvertSurfaceFormat(source, SDL_PIXELFORMAT_ARGB8888, 0) :
+                           downscale_surface(source, w, h);
+    if (surface == NULL)
+        return;
+
+    memmove(&set->variants[at + 1], &set->variants[at], sizeof(TextureVariant) * (set->num_variants - at));
+    set->variants[at] = (TextureVariant){surface, NULL, w, h};
+    set->num_variants++;
+}
+
+//Loads an image and builds a surface for each size it is drawn at. Only
+//touches surfaces, so it is safe on a worker thread (see streaming.c).
+bool texture_set_build(TextureSet* set, const char* path, const SDL_Point* sizes, int num_sizes)
+{
+    memset(set, 0, sizeof(TextureSet));
+
+    SDL_Surface* loaded = IMG_Load(path);
+    if (loaded == NULL)
+    {
+        SDL_Log("Unable to load image %s! SDL_Error: %s\n", path, SDL_GetError());
+        return false;
+    }
+
+    SDL_Surface* source = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0);
+    SDL_FreeSurface(loaded);
+    if (source == NULL)
+    {
+        SDL_Log("Unable to convert image %s! SDL_Error: %s\n", path, SDL_GetError());
+        return false;
+    }
+
+    set->source_w = source->w;
+    set->source_h = source->h;
+
+    for (int i = 0; i < num_sizes; i++)
+        add_variant(set, source, sizes[i].x, sizes[i].y);
+
+    SDL_FreeSurface(source);
+
+    if (set->num_variants == 0)
+    {
+        SDL_Log("Unable to build texture variants for %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+//Boils a built set down to a size x size collision mask, one bit per pixel
+//that is at least half opaque (bit x of mask[y]), plus the matching ARGB
+//pixels for drawing damaged copies. Needs the staging surfaces, so call it
+//before the set is uploaded. size is at most 64.
+bool texture_set_mask(const TextureSet* set, int size, Uint64* mask, Uint32* pixels)
+{
+    if (set->num_variants == 0 || set->variants[set->num_variants - 1].surface == NULL)
+        return false;
+
+    SDL_Surface* scaled = downscale_surface(set->variants[set->num_variants - 1].surface, size, size);
+    if (scaled == NULL)
+        return false;
+
+    SDL_LockSurface(scaled);
+    for (int y = 0; y < size; y++)
+    {
+        const Uint32* row = (const Uint32*)((const Uint8*)scaled->pixels + y * scaled->pitch);
+
+        mask[y] = 0;
+        for (int x = 0; x < size; x++)
+        {
+            pixels[y * size + x] = row[x];
+            if ((row[x] >> 24) >= 128)
+                mask[y] |= (Uint64)1 << x;
+        }
+    }
+    SDL_UnlockSurface(scaled);
+
+    SDL_FreeSurface(scaled);
+    return true;
+}
+
+//Builds a set that is uploaded by texture_budget_commit().
+bool texture_set_load(Game* game, TextureSet* set, const char* path, const SDL_Point* sizes, int num_sizes)
+{
+    TexturePool* pool = &game->textures;
+
+    if (pool->num_sets == TEX_MAX_SETS)
+    {
+        SDL_Log("Too many texture sets, can't load %s\n", path);
+        return false;
+    }
+
+    if (!texture_set_build(set, path, sizes, num_sizes))
+        return false;
+
+    pool->sets[pool->num_sets++] = set;
+    return true;
+}
+
+static bool upload_variant(Game* game, TextureVariant* variant)
+{
+    variant->texture = create_texture(game, variant->surface);
+    if (variant->texture == NULL)
+        return false;
+
+    //The variants are already close to the drawn size, so linear filtering is cheap and looks right.
+    SDL_SetTextureScaleMode(variant->texture, SDL_ScaleModeLinear);
+    return true;
+}
+
+//Uploads every variant of a built set regardless of the budget. Returns the
+//bytes now resident.
+size_t texture_set_upload(Game* game, TextureSet* set)
+{
+    size_t bytes = 0;
+
+    for (int i = 0; i < set->num_variants; i++)
+    {
+        TextureVariant* variant = &set->variants[i];
+
+        if (variant->surface && upload_variant(game, variant))
+            bytes += variant_bytes(variant);
+
+        SDL_FreeSurface(variant->surface);
+        variant->surface = NULL;
+    }
+    return bytes;
+}
+
+//Uploads what fits in the budget and frees the staging surfaces.
+void texture_budget_commit(Game* game)
+{
+    char buf[MSL];
+    TexturePool* pool = &game->textures;
+    size_t budget = (size_t)game->opts.texture_budget_kb * 1024;
+    size_t source_bytes = 0, dropped_bytes = 0;
+    int resident = 0, dropped = 0;
+
+    //Every set needs something to draw with, whatever the budget says.
+    for (int s = 0; s < pool->num_sets; s++)
+    {
+        TextureSet* set = pool->sets[s];
+
+        source_bytes += (size_t)set->source_w * set->source_h * BYTES_PER_PIXEL;
+        if (upload_variant(game, &set->variants[0]))
+        {
+            resident++;
+            pool->resident_bytes += variant_bytes(&set->variants[0]);
+        }
+    }
+
+    //Then the rest, cheapest first, so as many sets as possible get every size.
+    for (;;)
+    {
+        TextureVariant* next = NULL;
+
+        for (int s = 0; s < pool->num_sets; s++)
+            for (int v = 1; v < pool->sets[s]->num_variants; v++)
+            {
+                TextureVariant* variant = &pool->sets[s]->variants[v];
+                if (variant->surface && variant->texture == NULL && (next == NULL || variant_bytes(variant) < variant_bytes(next)))
+                    next = variant;
+            }
+
+        if (next == NULL)
+            break;
+
+        if (pool->resident_bytes + variant_bytes(next) <= budget && upload_variant(game, next))
+        {
+            resident++;
+            pool->resident_bytes += variant_bytes(next);
+        }
+        else
+        {
+            dropped++;
+            dropped_bytes += variant_bytes(next);
+        }
+
+        SDL_FreeSurface(next->surface);
+        next->surface = NULL;
+    }
+
+    for (int s = 0; s < pool->num_sets; s++)
+    {
+        SDL_FreeSurface(pool->sets[s]->variants[0].surface);
+        pool->sets[s]->variants[0].surface = NULL;
+    }
+
+    snprintf(buf, sizeof(buf), "Textures: %d variants resident in %zu KB (budget %d KB, sources %zu KB), %d dropped (%zu KB)\n",
+             resident, pool->resident_bytes / 1024, game->opts.texture_budget_kb, source_bytes / 1024, dropped, dropped_bytes / 1024);
+    LOG(buf);
+}
+
+//Smallest resident variant at least w x h, or the largest one if none is big enough.
+SDL_Texture* texture_pick(const TextureSet* set, int w, int h)
+{
+    SDL_Texture* largest = NULL;
+
+    for (int i = 0; i < set->num_variants; i++)
+    {
+        const TextureVariant* variant = &set->variants[i];
+
+        if (variant->texture == NULL)
+            continue;
+        if ((variant->w >= w || variant->w == set->source_w) && (variant->h >= h || variant->h == set->source_h))
+            return variant->texture;
+        largest = variant->texture;
+    }
+    return largest;
+}
+
+void texture_set_destroy(Game* game, TextureSet* set)
+{
+    for (int i = 0; i < set->num_variants; i++)
+    {
+        destroy_texture(game, set->variants[i].texture);
+        SDL_FreeSurface(set->variants[i].surface);
+    }
+    memset(set, 0, sizeof(TextureSet));
+}
@@ -0,0 +1,241 @@
+#include "main.h"
+
+//Hierarchical timer wheel on simulation ticks. Things that happen after a
+//delay (an enemy's bullet pattern or behaviour resuming after a wait, a
+//powerup running out, the next random spawn) schedule a timer instead of
+//being checked every tick, so a tick costs one slot's worth of timers, not
+//one check per entity.
+//
+//Level 0 has a slot per tick for the next TIMER_SLOTS ticks; each level
+//above covers TIMER_SLOTS times as much per slot. When level 0 wraps, the
+//next level 1 slot is emptied back into the levels below, and likewise up
+//the levels. Everything is indices in SimState, so timers roll back,
+//rewind and replay with the rest of the sim.
+//
+//Every owner has a timer of its own: one per spawn chain, per player and
+//powerup, and an emitter and a behaviour per enemy slot. Arming one that is
+//still pending moves it, so the wheel never runs out. A timer whose enemy
+//died in the meantime fires anyway and its handler ignores it.
+
+#define TIMER_SPAN(level)       (1u << (TIMER_BITS * ((level) + 1)))
+
+_Static_assert(TIMER_SPAWN_POWERUP - TIMER_SPAWN_ENEMY + 1 == TIMER_SPAWNS, "a spawn chain without a timer");
+_Static_assert(MAX_TIMERS <= INT16_MAX, "timer ids are Sint16");
+
+//The one timer kind uses for target.
+static int timer_id(TimerKind kind, int target)
+{
+    switch (kind)
+    {
+        case TIMER_EMITTER:
+            return TIMER_SPAWNS + MAX_PLAYERS * POWERUP_COUNT + target;
+        case TIMER_BEHAVIOUR:
+            return TIMER_SPAWNS + MAX_PLAYERS * POWERUP_COUNT + MAX_ENEMIES + target;
+        case TIMER_POWERUP_END:
+            return TIMER_SPAWNS + target;
+        default:
+            return kind - TIMER_SPAWN_ENEMY;
+    }
+}
+
+//Links timer id into the slot that its due tick falls in, seen from now.
+static void timer_link(TimerWheel* wheel, int id)
+{
+    Timer* timer = &wheel->timers[id];
+    Uint32 delta = timer->due - wheel->now;
+    Sint16* head;
+
+    if (delta < TIMER_SPAN(0))
+        head = &wheel->head[0][timer->due & (TIMER_SLOTS - 1)];
+    else if (delta < TIMER_SPAN(1))
+        head = &wheel->head[1][(timer->due >> TIMER_BITS) & (TIMER_SLOTS - 1)];
+    else if (delta < TIMER_SPAN(2))
+        head = &wheel->head[2][(timer->due >> (2 * TIMER_BITS)) & (TIMER_SLOTS - 1)];
+    else
+        //Further than the wheel reaches: park it in the top slot that comes
+        //round last and it is linked again from there.
+        head = &wheel->head[2][((wheel->now >> (2 * TIMER_BITS)) - 1) & (TIMER_SLOTS - 1)];
+
+    timer->next = *head;
+    timer->slot = (Sint16)(head - &wheel->head[0][0]);
+    *head = (Sint16)id;
+}
+
+//Takes timer id out of its slot if it is pending. Slots hold a handful of
+//timers, so walking to it is cheap.
+static void timer_unlink(TimerWheel* wheel, int id)
+{
+    Timer* timer = &wheel->timers[id];
+
+    if (timer->slot < 0)
+        return;
+
+    Sint16* link = &wheel->head[0][0] + timer->slot;
+    while (*link != id)
+        link = &wheel->timers[*link].next;
+    *link = timer->next;
+    timer->slot = -1;
+}
+
+//Relinks every timer in a higher level slot, they all land further down.
+static void timer_cascade(TimerWheel* wheel, int level, int slot)
+{
+    int id = wheel->head[level][slot];
+
+    wheel->head[level][slot] = -1;
+    while (id >= 0)
+    {
+        int next = wheel->timers[id].next;
+        timer_link(wheel, id);
+        id = next;
+    }
+}
+
+//Schedules kind for target delay ticks from the current one; 0 fires later
+//in this same tick if the wheel hasn't run yet, otherwise on the next one.
+//Replaces the one already pending for the same kind and target, if any.
+//Returns the timer's id.
+int timer_add(Game* game, TimerKind kind, int target, Uint32 delay)
+{
+    TimerWheel* wheel = &game->sim.timers;
+    int id = timer_id(kind, target);
+    Timer* timer = &wheel->timers[id];
+
+    timer_unlink(wheel, id);
+    timer->due = game->sim.tick + delay;
+    if ((Sint32)(timer->due - wheel->now) < 0)
+        timer->due = wheel->now;
+    timer->kind = (Uint8)kind;
+    timer->target = (Sint16)target;
+    timer_link(wheel, id);
+    return id;
+}
+
+//The next random spawn, gap ticks away on average.
+static void timer_add_spawn(Game* game, TimerKind kind, int gap)
+{
+    timer_add(game, kind, -1, 1 + sim_rand(game) % (Uint32)(2 * gap - 1));
+}
+
+//Empties the wheel and schedules the first random spawns. Called by
+//reset_sim() after it zeroed the sim.
+void timers_reset(Game* game)
+{
+    TimerWheel* wheel = &game->sim.timers;
+
+    memset(wheel->head, 0xFF, sizeof(wheel->head));
+    for (int i = 0; i < MAX_TIMERS; i++)
+        wheel->timers[i].slot = -1;
+    wheel->now = game->sim.tick + 1;
+
+    timer_add_spawn(game, TIMER_SPAWN_ENEMY, ENEMY_SPAWN_GAP);
+    timer_add_spawn(game, TIMER_SPAWN_PLANET, PLANET_SPAWN_GAP);
+    timer_add_spawn(game, TIMER_SPAWN_POWERUP, POWERUP_SPAWN_GAP);
+}
+
+//Random spawning, unless a level decides when.
+static void timer_spawn(Game* game, TimerKind kind)
+{
+    switch (kind)
+    {
+        case TIMER_SPAWN_ENEMY:
+            if (game->level == NULL)
+                spawn_enemy(game);
+            timer_add_spawn(game, kind, ENEMY_SPAWN_GAP);
+            break;
+
+        case TIMER_SPAWN_PLANET:
+            if (game->level == NULL)
+                spawn_planet(game, -1);
+            timer_add_spawn(game, kind, PLANET_SPAWN_GAP);
+            break;
+
+        case TIMER_SPAWN_POWERUP:
+            if (game->level == NULL)
+                spawn_powerup(game);
+            timer_add_spawn(game, kind, POWERUP_SPAWN_GAP);
+            break;
+
+        default:
+            break;
+    }
+}
+
+//Runs everything due up to the current tick, once per sim_step().
+void timers_update(Game* game)
+{
+    TimerWheel* wheel = &game->sim.timers;
+    int emitters[MAX_TIMERS];
+    int num_emitters = 0;
+    int behaviours[MAX_TIMERS];
+    int num_behaviours = 0;
+
+    while ((Sint32)(game->sim.tick - wheel->now) >= 0)
+    {
+        Uint32 tick = wheel->now;
+        int slot = tick & (TIMER_SLOTS - 1);
+
+        if (slot == 0)
+        {
+            if (((tick >> TIMER_BITS) & (TIMER_SLOTS - 1)) == 0)
+                timer_cascade(wheel, 2, (tick >> (2 * TIMER_BITS)) & (TIMER_SLOTS - 1));
+            timer_cascade(wheel, 1, (tick >> TIMER_BITS) & (TIMER_SLOTS - 1));
+        }
+
+        //Detach the slot first: handlers add timers, and those belong to
+        //later ticks.
+        int fired[MAX_TIMERS];
+        int num_fired = 0;
+        for (int id = wheel->head[0][slot]; id >= 0; id = wheel->timers[id].next)
+        {
+            fired[num_fired++] = id;
+            wheel->timers[id].slot = -1;
+        }
+        wheel->head[0][slot] = -1;
+        wheel->now++;
+
+        for (int i = 0; i < num_fired; i++)
+        {
+            int id = fired[i];
+            Timer* timer = &wheel->timers[id];
+
+            //Armed again by a handler before its turn, e.g. a spawned enemy
+            //taking over the slot of one whose timer was due.
+            if (timer->slot >= 0)
+                continue;
+
+            switch (timer->kind)
+            {
+                case TIMER_EMITTER:
+                    //Stale if the enemy died or its slot went to another one.
+                    if (game->sim.enemies[timer->target].active && game->sim.enemies[timer->target].emitter.timer == id)
+                    {
+                        game->sim.enemies[timer->target].emitter.timer = -1;
+                        emitters[num_emitters++] = timer->target;
+                    }
+                    break;
+
+                case TIMER_BEHAVIOUR:
+                    if (game->sim.enemies[timer->target].active && game->sim.enemies[timer->target].behaviour.timer == id)
+                    {
+                        game->sim.enemies[timer->target].behaviour.timer = -1;
+                        behaviours[num_behaviours++] = timer->target;
+                    }
+                    break;
+
+                case TIMER_POWERUP_END:
+                    powerup_expire(game, timer->target / POWERUP_COUNT, timer->target % POWERUP_COUNT);
+                    break;
+
+                default:
+                    timer_spawn(game, timer->kind);
+                    break;
+            }
+        }
+    }
+
+    //Behaviours and patterns run as one pass each, moves before shots so a
+    //gunner that switches its pattern off does it before the pattern fires.
+    behaviours_update(game, behaviours, num_behaviours);
+    patterns_update(game, emitters, num_emitters);
+}